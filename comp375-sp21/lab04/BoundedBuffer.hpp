@@ -1,5 +1,10 @@
+#ifndef BOUNDEDBUFFER_HPP
+#define BOUNDEDBUFFER_HPP
+
 #include <queue>
 
+#include "WorkQueue.hpp"
+
 /**
  * Class representing a buffer with a fixed capacity.
  *
@@ -7,15 +12,15 @@
  * class while the implementation of the constructors, destructors, and methods,
  * and given in an implementation (i.e. cpp) file.
  */
-class BoundedBuffer {
+class BoundedBuffer : public virtual WorkQueue {
   // begin section containing publicly accessible parts of the class
   public:
 	  // public constructor
 	  BoundedBuffer(int max_size);
 	  
 	  // public member functions (a.k.a. methods)
-	  int getItem();
-	  void putItem(int new_item);
+	  virtual int getItem();
+	  virtual void putItem(int new_item);
 
   // begin section containing private (i.e. hidden) parts of the class
   private:
@@ -26,3 +31,5 @@ class BoundedBuffer {
 	  // This class doesn't have any, but we could also have private
 	  // constructors and/or member functions here.
 };
+
+#endif // BOUNDEDBUFFER_HPP
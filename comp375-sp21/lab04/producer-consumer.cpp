@@ -1,11 +1,13 @@
 #include <cstdio>
 #include <cstdlib>
 #include <pthread.h>
+#include <unistd.h>
 
 #include <thread>
 #include <chrono>	// for times (e.g. seconds)
 
 #include "BoundedBuffer.hpp"
+#include "WorkStealingPool.hpp"
 
 const size_t BUFFER_CAPACITY = 10;
 const size_t NUM_CONSUMERS = 5;
@@ -13,9 +15,9 @@ const size_t NUM_CONSUMERS = 5;
 /**
  * Function run by a consumer.
  *
- * @param buffer A bounded buffered, shared amongst several threads.
+ * @param buffer A work queue, shared amongst several threads.
  */
-void consume(BoundedBuffer &buffer) {
+void consume(WorkQueue &buffer) {
 	printf("Starting a consumer\n");
 
 	// Consume a value from the buffer every 0 to 9 seconds.
@@ -31,9 +33,9 @@ void consume(BoundedBuffer &buffer) {
 /**
  * Function run by a producer.
  *
- * @param buffer A bounded buffered, shared amongst several threads.
+ * @param buffer A work queue, shared amongst several threads.
  */
-void produce(BoundedBuffer &buffer) {
+void produce(WorkQueue &buffer) {
 	printf("Starting a producer\n");
 
 	// Produce a random value between 1 and 100 every 0 to 2 seconds, adding
@@ -49,8 +51,22 @@ void produce(BoundedBuffer &buffer) {
 	}
 }
 
-int main() {
-	BoundedBuffer buff(BUFFER_CAPACITY);
+int main(int argc, char **argv) {
+	// Passing -w uses a work-stealing pool rather than a single shared buffer.
+	bool use_work_stealing = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "w")) != -1) {
+		if (opt == 'w')
+			use_work_stealing = true;
+	}
+
+	WorkQueue *queue;
+	if (use_work_stealing)
+		queue = new WorkStealingPool(BUFFER_CAPACITY, NUM_CONSUMERS);
+	else
+		queue = new BoundedBuffer(BUFFER_CAPACITY);
+
+	WorkQueue &buff = *queue;
 
 	// create only a single producer thread
 	std::thread producer(produce, std::ref(buff));
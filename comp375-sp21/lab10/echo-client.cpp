@@ -0,0 +1,722 @@
+/*
+ * File: echo-client.cpp
+ *
+ * Benchmark client for the echo server: keeps a number of connections busy
+ * sending fixed size messages and reports how many messages per second came
+ * back, and how long they took to come back (round-trip latency).
+ *
+ * Each connection keeps a set number of messages in flight (1 measures pure
+ * round-trip latency, more measures pipelined throughput). The echoed bytes
+ * are checked against what was sent, so a broken server doesn't look fast.
+ *
+ * With -u it sends UDP datagrams instead (to a server run with -u), from a
+ * connected socket per "connection", and reports packets per second. Each
+ * datagram carries its sequence number and send time. Sends and receives
+ * are batched with sendmmsg and recvmmsg, or with GSO and GRO if -g is
+ * given. Datagrams that don't come back within UDP_LOSS_TIMEOUT are counted
+ * as lost and replaced, so a drop doesn't stall the pipeline.
+ *
+ * Usage: ./echo-client [-c connections] [-s msg_bytes] [-p pipeline]
+ *                      [-d seconds] [-t threads] [-u [-g]] <host> <port>
+ */
+
+// C++ standard libraries
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// C standard libraries
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+// POSIX / OS-specific libraries
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+using std::cout;
+using std::cerr;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+const int MAX_EVENTS = 64;
+
+// The bytes we send repeat with this period, so any byte's value follows
+// from its position in the stream.
+const size_t PATTERN_PERIOD = 251;
+
+// Most bytes we send or receive in one call.
+const size_t IO_SIZE = 64 * 1024;
+
+// Most datagrams moved by one sendmmsg or recvmmsg (or one GSO send).
+const int UDP_BATCH = 64;
+
+// Biggest UDP payload (what's left of 65535 bytes after the IP and UDP
+// headers). A GSO send counts as one datagram, so it can't be any bigger.
+const size_t MAX_UDP_PAYLOAD = 65507;
+
+// A datagram that hasn't come back after this long is counted as lost.
+const std::chrono::milliseconds UDP_LOSS_TIMEOUT(200);
+
+// Older headers don't know about UDP GSO/GRO.
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/**
+ * Gets the byte at the given position of the stream we send.
+ */
+static inline char pattern_byte(uint64_t position) {
+	return (char)(position % PATTERN_PERIOD);
+}
+
+/**
+ * Class that counts latencies in buckets that are about 3% wide, so that
+ * percentiles can be read off without keeping every sample.
+ */
+class LatencyHistogram {
+  private:
+	// Values below 64 ns get a bucket each; above that, each power of two
+	// is split into 32 buckets.
+	static const int SUB_BUCKETS = 32;
+	vector<uint64_t> counts;
+	uint64_t total;
+	uint64_t max_value;
+
+	static size_t bucket(uint64_t value) {
+		if (value < 2 * SUB_BUCKETS)
+			return value;
+
+		int msb = 63 - __builtin_clzll(value);
+		int shift = msb - 5;
+		return 2 * SUB_BUCKETS + (msb - 6) * SUB_BUCKETS
+			+ ((value >> shift) - SUB_BUCKETS);
+	}
+
+	static uint64_t bucket_value(size_t index) {
+		if (index < 2 * SUB_BUCKETS)
+			return index;
+
+		int msb = (index - 2 * SUB_BUCKETS) / SUB_BUCKETS + 6;
+		uint64_t mantissa = (index - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+		return mantissa << (msb - 5);
+	}
+
+  public:
+	LatencyHistogram() : counts(bucket(UINT64_MAX) + 1), total(0), max_value(0) {}
+
+	void record(uint64_t nanoseconds) {
+		counts[bucket(nanoseconds)]++;
+		total++;
+		max_value = std::max(max_value, nanoseconds);
+	}
+
+	void merge(const LatencyHistogram &other) {
+		for (size_t i = 0; i < counts.size(); i++)
+			counts[i] += other.counts[i];
+		total += other.total;
+		max_value = std::max(max_value, other.max_value);
+	}
+
+	uint64_t count() const { return total; }
+	uint64_t max() const { return max_value; }
+
+	/**
+	 * Gets (the bottom of the bucket of) the given percentile.
+	 *
+	 * @param percent Between 0 and 100.
+	 */
+	uint64_t percentile(double percent) const {
+		uint64_t wanted = std::max<uint64_t>(1, total * percent / 100.0);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < counts.size(); i++) {
+			seen += counts[i];
+			if (seen >= wanted)
+				return bucket_value(i);
+		}
+		return max_value;
+	}
+};
+
+/**
+ * One connection to the server.
+ */
+struct EchoConnection {
+	int fd;
+	uint64_t sent;            // bytes sent so far
+	uint64_t queued;          // bytes we want to have sent
+	uint64_t received;        // bytes echoed back so far
+	vector<time_point> times; // when each message in flight was queued
+	uint64_t next_message;    // number of the next message to queue
+};
+
+/**
+ * Settings and results of one benchmark thread.
+ */
+struct Worker {
+	const struct addrinfo *server;
+	int num_connections;
+	size_t msg_size;
+	int pipeline;
+	bool use_gso;           // UDP only: batch with GSO and GRO
+	time_point deadline;
+
+	uint64_t messages;
+	LatencyHistogram latencies;
+	bool failed;
+	uint64_t sent;          // UDP only: datagrams sent
+	uint64_t lost;          // UDP only: datagrams that never came back
+};
+
+/**
+ * One UDP "connection" (a connected socket) and the datagrams it has in
+ * flight.
+ */
+struct UdpFlow {
+	int fd;
+	uint64_t next_seq;     // sequence number of the next datagram
+	uint64_t first_live;   // datagrams before this one were given up on
+	int in_flight;         // sent, and not yet back (or given up on)
+	time_point last_heard; // when a datagram last came back (or was given up)
+};
+
+/**
+ * What each UDP datagram starts with.
+ */
+struct UdpHeader {
+	uint64_t seq;
+	int64_t sent_ns; // steady clock time it was sent
+};
+
+/**
+ * Connects to the server (blocking, so that every connection is up before
+ * we start timing), then makes the socket non-blocking.
+ */
+int connect_to_server(const struct addrinfo *server) {
+	int sock = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
+	if (sock < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	if (connect(sock, server->ai_addr, server->ai_addrlen) < 0) {
+		perror("connect");
+		exit(EXIT_FAILURE);
+	}
+
+	int one = 1;
+	if (server->ai_socktype == SOCK_STREAM)
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	int flags = fcntl(sock, F_GETFL);
+	if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		perror("fcntl");
+		exit(EXIT_FAILURE);
+	}
+
+	return sock;
+}
+
+/**
+ * Queues the next message on a connection.
+ */
+void queue_message(EchoConnection &conn, Worker &worker, time_point now) {
+	conn.times[conn.next_message % worker.pipeline] = now;
+	conn.next_message++;
+	conn.queued += worker.msg_size;
+}
+
+/**
+ * Sends as much of what's queued as the socket takes.
+ *
+ * @return false if the connection failed.
+ */
+bool send_queued(EchoConnection &conn, const vector<char> &pattern) {
+	while (conn.sent < conn.queued) {
+		size_t offset = conn.sent % PATTERN_PERIOD;
+		size_t len = std::min<uint64_t>(conn.queued - conn.sent,
+										pattern.size() - offset);
+		ssize_t n = send(conn.fd, &pattern[offset], len, MSG_NOSIGNAL);
+		if (n > 0)
+			conn.sent += n;
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true; // we'll hear about it when there's room
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Reads everything that has been echoed back, checks it, and queues a new
+ * message for each one that is complete.
+ *
+ * @return false if the connection failed (or echoed the wrong bytes).
+ */
+bool receive_echoes(EchoConnection &conn, Worker &worker, char *buffer) {
+	while (true) {
+		ssize_t n = recv(conn.fd, buffer, IO_SIZE, 0);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0 || conn.received + n > conn.sent) {
+			cerr << "ERROR: connection closed (or sent too much)\n";
+			return false;
+		}
+
+		for (ssize_t i = 0; i < n; i++) {
+			if (buffer[i] != pattern_byte(conn.received + i)) {
+				cerr << "ERROR: echo doesn't match what we sent\n";
+				return false;
+			}
+		}
+
+		time_point now = std::chrono::steady_clock::now();
+		uint64_t done_before = conn.received / worker.msg_size;
+		conn.received += n;
+		uint64_t done_after = conn.received / worker.msg_size;
+		for (uint64_t m = done_before; m < done_after; m++) {
+			std::chrono::nanoseconds rtt = now - conn.times[m % worker.pipeline];
+			worker.latencies.record(rtt.count());
+			worker.messages++;
+			queue_message(conn, worker, now);
+		}
+	}
+}
+
+/**
+ * Runs one thread's share of the connections until the deadline.
+ */
+void run_worker(Worker *worker) {
+	vector<char> pattern(IO_SIZE + PATTERN_PERIOD);
+	for (size_t i = 0; i < pattern.size(); i++)
+		pattern[i] = pattern_byte(i);
+	vector<char> buffer(IO_SIZE);
+
+	int epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+
+	vector<EchoConnection> connections(worker->num_connections);
+	for (EchoConnection &conn : connections) {
+		conn = EchoConnection{connect_to_server(worker->server), 0, 0, 0,
+								vector<time_point>(worker->pipeline), 0};
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		ev.data.ptr = &conn;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn.fd, &ev) < 0) {
+			perror("epoll_ctl");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Fill every connection's pipeline.
+	time_point now = std::chrono::steady_clock::now();
+	for (EchoConnection &conn : connections) {
+		for (int i = 0; i < worker->pipeline; i++)
+			queue_message(conn, *worker, now);
+		send_queued(conn, pattern);
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	while ((now = std::chrono::steady_clock::now()) < worker->deadline) {
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+						worker->deadline - now);
+		int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS,
+									left.count() + 1);
+		if (num_events < 0 && errno == EINTR)
+			continue;
+		if (num_events < 0) {
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+
+		for (int i = 0; i < num_events; i++) {
+			EchoConnection &conn = *(EchoConnection*)events[i].data.ptr;
+			if (!receive_echoes(conn, *worker, buffer.data())
+					|| !send_queued(conn, pattern)) {
+				worker->failed = true;
+				break;
+			}
+		}
+
+		if (worker->failed)
+			break;
+	}
+
+	for (EchoConnection &conn : connections)
+		close(conn.fd);
+	close(epoll_fd);
+}
+
+/**
+ * Gets the time on the steady clock, in nanoseconds.
+ */
+static int64_t now_ns(time_point now) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				now.time_since_epoch()).count();
+}
+
+/**
+ * Sends datagrams on a flow until it has a full pipeline in flight. If a
+ * send fails for any reason other than a full buffer, the worker is marked
+ * as failed.
+ *
+ * @param buffer Room for UDP_BATCH datagrams.
+ */
+void fill_udp_flow(UdpFlow &flow, Worker &worker, time_point now,
+					char *buffer) {
+	// A GSO batch goes out as one (big) datagram, so it has to fit in one.
+	int max_batch = UDP_BATCH;
+	if (worker.use_gso)
+		max_batch = std::max(std::min<int>(MAX_UDP_PAYLOAD / worker.msg_size,
+											UDP_BATCH), 1);
+
+	while (flow.in_flight < worker.pipeline) {
+		int count = std::min(worker.pipeline - flow.in_flight, max_batch);
+		int64_t sent_ns = now_ns(now);
+		for (int i = 0; i < count; i++) {
+			UdpHeader header = { flow.next_seq + i, sent_ns };
+			memcpy(buffer + i * worker.msg_size, &header, sizeof(header));
+		}
+
+		int num_sent;
+		if (worker.use_gso && count > 1) {
+			// One send of the whole batch, which the kernel (or the NIC)
+			// splits into msg_size datagrams.
+			char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+			struct iovec iov = { buffer, count * worker.msg_size };
+			struct msghdr msg = {};
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = IPPROTO_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t segment_size = worker.msg_size;
+			memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+
+			num_sent = (sendmsg(flow.fd, &msg, 0) < 0) ? -1 : count;
+		}
+		else {
+			struct mmsghdr msgs[UDP_BATCH];
+			struct iovec iovs[UDP_BATCH];
+			memset(msgs, 0, sizeof(msgs));
+			for (int i = 0; i < count; i++) {
+				iovs[i].iov_base = buffer + i * worker.msg_size;
+				iovs[i].iov_len = worker.msg_size;
+				msgs[i].msg_hdr.msg_iov = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+			num_sent = sendmmsg(flow.fd, msgs, count, 0);
+		}
+
+		if (num_sent < 0 && errno != EAGAIN && errno != ENOBUFS) {
+			// e.g. EMSGSIZE, or ECONNREFUSED if the server isn't there.
+			perror(worker.use_gso && count > 1 ? "sendmsg" : "sendmmsg");
+			worker.failed = true;
+			return;
+		}
+		else if (num_sent <= 0) {
+			// The socket buffer is full: whatever we couldn't send counts
+			// as sent and lost, so we try again after the loss timeout.
+			num_sent = count;
+		}
+
+		flow.next_seq += num_sent;
+		flow.in_flight += num_sent;
+		worker.sent += num_sent;
+	}
+}
+
+/**
+ * Handles one echoed datagram (or one segment of a GRO batch).
+ */
+void handle_udp_echo(UdpFlow &flow, Worker &worker, const char *data,
+						size_t len, int64_t received_ns) {
+	UdpHeader header;
+	if (len < sizeof(header))
+		return;
+	memcpy(&header, data, sizeof(header));
+
+	// Ignore anything we already gave up on (or never sent).
+	if (header.seq < flow.first_live || header.seq >= flow.next_seq)
+		return;
+
+	worker.latencies.record(received_ns - header.sent_ns);
+	worker.messages++;
+	flow.in_flight--;
+}
+
+/**
+ * Reads everything that has come back on a flow.
+ *
+ * @param buffer Room for UDP_BATCH datagrams of IO_SIZE bytes.
+ */
+void receive_udp_echoes(UdpFlow &flow, Worker &worker, char *buffer) {
+	const size_t control_size = CMSG_SPACE(sizeof(int));
+	char controls[UDP_BATCH][CMSG_SPACE(sizeof(int))];
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iovs[UDP_BATCH];
+
+	while (true) {
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < UDP_BATCH; i++) {
+			iovs[i].iov_base = buffer + i * IO_SIZE;
+			iovs[i].iov_len = IO_SIZE;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = controls[i];
+			msgs[i].msg_hdr.msg_controllen = control_size;
+		}
+
+		int n = recvmmsg(flow.fd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+		if (n <= 0)
+			return; // EAGAIN (or a refused send we'll count as lost)
+
+		time_point now = std::chrono::steady_clock::now();
+		for (int i = 0; i < n; i++) {
+			// A GRO batch is several datagrams of the segment size.
+			size_t segment_size = msgs[i].msg_len;
+			struct msghdr *hdr = &msgs[i].msg_hdr;
+			for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL;
+					cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+				if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+					int gro_size;
+					memcpy(&gro_size, CMSG_DATA(cmsg), sizeof(gro_size));
+					segment_size = gro_size;
+				}
+			}
+
+			const char *data = (const char*)iovs[i].iov_base;
+			for (size_t pos = 0; pos < msgs[i].msg_len; pos += segment_size) {
+				handle_udp_echo(flow, worker, data + pos,
+								std::min(segment_size, msgs[i].msg_len - pos),
+								now_ns(now));
+			}
+		}
+		flow.last_heard = now;
+	}
+}
+
+/**
+ * Runs one thread's share of the UDP flows until the deadline.
+ */
+void run_udp_worker(Worker *worker) {
+	vector<char> send_buffer(UDP_BATCH * worker->msg_size);
+	vector<char> receive_buffer(UDP_BATCH * IO_SIZE);
+
+	int epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+
+	time_point now = std::chrono::steady_clock::now();
+	vector<UdpFlow> flows(worker->num_connections);
+	for (UdpFlow &flow : flows) {
+		flow = UdpFlow{connect_to_server(worker->server), 0, 0, 0, now};
+
+		int one = 1;
+		if (worker->use_gso
+				&& setsockopt(flow.fd, IPPROTO_UDP, UDP_GRO, &one, sizeof(one)) < 0)
+			perror("UDP_GRO (carrying on without it)");
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = &flow;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, flow.fd, &ev) < 0) {
+			perror("epoll_ctl");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (UdpFlow &flow : flows)
+		fill_udp_flow(flow, *worker, now, send_buffer.data());
+
+	struct epoll_event events[MAX_EVENTS];
+	time_point next_loss_check = now + UDP_LOSS_TIMEOUT / 4;
+	while (!worker->failed
+			&& (now = std::chrono::steady_clock::now()) < worker->deadline) {
+		auto until = std::min(worker->deadline, next_loss_check);
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(until - now);
+		int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS,
+									std::max<long>(left.count(), 0) + 1);
+		if (num_events < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+
+		now = std::chrono::steady_clock::now();
+		for (int i = 0; i < num_events; i++) {
+			UdpFlow &flow = *(UdpFlow*)events[i].data.ptr;
+			receive_udp_echoes(flow, *worker, receive_buffer.data());
+			fill_udp_flow(flow, *worker, now, send_buffer.data());
+		}
+
+		// Give up on datagrams that have been gone too long.
+		if (now >= next_loss_check) {
+			for (UdpFlow &flow : flows) {
+				if (flow.in_flight > 0 && now - flow.last_heard >= UDP_LOSS_TIMEOUT) {
+					worker->lost += flow.in_flight;
+					flow.in_flight = 0;
+					flow.first_live = flow.next_seq;
+					flow.last_heard = now;
+					fill_udp_flow(flow, *worker, now, send_buffer.data());
+				}
+			}
+			next_loss_check = now + UDP_LOSS_TIMEOUT / 4;
+		}
+	}
+
+	for (UdpFlow &flow : flows)
+		close(flow.fd);
+	close(epoll_fd);
+}
+
+int main(int argc, char **argv) {
+	// -c <connections> sets how many connections to keep busy (default: 1).
+	// -s <bytes> sets the size of each message (default: 64).
+	// -p <messages> sets how many messages each connection keeps in flight
+	// (default: 1, i.e. pure round trips).
+	// -d <seconds> sets how long to run for (default: 5).
+	// -t <threads> sets how many threads to spread the connections across
+	// (default: 1).
+	// -u sends UDP datagrams rather than using TCP, and -g batches them
+	// with GSO/GRO.
+	int num_connections = 1;
+	size_t msg_size = 64;
+	int pipeline = 1;
+	double seconds = 5;
+	int num_threads = 1;
+	bool use_udp = false;
+	bool use_gso = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:s:p:d:t:ug")) != -1) {
+		if (opt == 'c')
+			num_connections = std::max(std::stoi(optarg), 1);
+		else if (opt == 's')
+			msg_size = std::max(std::stoul(optarg), 1ul);
+		else if (opt == 'p')
+			pipeline = std::max(std::stoi(optarg), 1);
+		else if (opt == 'd')
+			seconds = std::stod(optarg);
+		else if (opt == 't')
+			num_threads = std::max(std::stoi(optarg), 1);
+		else if (opt == 'u')
+			use_udp = true;
+		else if (opt == 'g')
+			use_gso = true;
+		else
+			optind = argc + 1; // i.e. print the usage
+	}
+
+	if (argc - optind != 2) {
+		cerr << "Usage: " << argv[0] << " [-c connections] [-s msg_bytes]"
+			<< " [-p pipeline] [-d seconds] [-t threads] [-u [-g]] <host> <port>\n";
+		exit(EXIT_FAILURE);
+	}
+
+	if (use_udp && (msg_size < sizeof(UdpHeader) || msg_size > MAX_UDP_PAYLOAD)) {
+		cerr << "ERROR: UDP messages must be " << sizeof(UdpHeader) << " to "
+			<< MAX_UDP_PAYLOAD << " bytes\n";
+		exit(EXIT_FAILURE);
+	}
+
+	struct addrinfo hints, *server;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = use_udp ? SOCK_DGRAM : SOCK_STREAM;
+	int error = getaddrinfo(argv[optind], argv[optind + 1], &hints, &server);
+	if (error != 0) {
+		cerr << "ERROR: " << gai_strerror(error) << "\n";
+		exit(EXIT_FAILURE);
+	}
+
+	num_threads = std::min(num_threads, num_connections);
+	auto duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+						std::chrono::duration<double>(seconds));
+	time_point start = std::chrono::steady_clock::now();
+
+	vector<Worker> workers(num_threads);
+	vector<std::thread> threads;
+	for (int i = 0; i < num_threads; i++) {
+		workers[i].server = server;
+		workers[i].num_connections = num_connections * (i + 1) / num_threads
+										- num_connections * i / num_threads;
+		workers[i].msg_size = msg_size;
+		workers[i].pipeline = pipeline;
+		workers[i].use_gso = use_gso;
+		workers[i].deadline = start + duration;
+		workers[i].messages = 0;
+		workers[i].failed = false;
+		workers[i].sent = 0;
+		workers[i].lost = 0;
+		threads.emplace_back(use_udp ? run_udp_worker : run_worker, &workers[i]);
+	}
+
+	LatencyHistogram latencies;
+	uint64_t messages = 0;
+	uint64_t sent = 0;
+	uint64_t lost = 0;
+	bool failed = false;
+	for (int i = 0; i < num_threads; i++) {
+		threads[i].join();
+		latencies.merge(workers[i].latencies);
+		messages += workers[i].messages;
+		sent += workers[i].sent;
+		lost += workers[i].lost;
+		failed = failed || workers[i].failed;
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	freeaddrinfo(server);
+
+	printf("%d connections, %zu byte messages, %d in flight each, %.1f s\n",
+			num_connections, msg_size, pipeline, elapsed.count());
+	if (use_udp) {
+		printf("packets: %" PRIu64 " echoed (%.0f pps), %" PRIu64 " sent, %"
+				PRIu64 " lost (%.2f%%)\n", messages, messages / elapsed.count(),
+				sent, lost, sent > 0 ? 100.0 * lost / sent : 0.0);
+	}
+	else {
+		printf("messages: %" PRIu64 " (%.0f msgs/s, %.1f MB/s each way)\n",
+				messages, messages / elapsed.count(),
+				messages * msg_size / elapsed.count() / 1e6);
+	}
+	if (latencies.count() > 0) {
+		printf("rtt (us): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+				latencies.percentile(50) / 1e3, latencies.percentile(90) / 1e3,
+				latencies.percentile(99) / 1e3, latencies.percentile(99.9) / 1e3,
+				latencies.max() / 1e3);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
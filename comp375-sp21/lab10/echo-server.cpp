@@ -6,11 +6,30 @@
  * Implementation of an "echo server" that uses epoll to enable concurrent
  * client connections.
  *
+ * Each thread runs its own event loop, with its own listening socket on the
+ * same port (SO_REUSEPORT) so the kernel spreads connections across them.
+ * The loop and the connections come from the networking core (../netcore):
+ * sockets are watched edge-triggered, and each connection's ring buffers
+ * are filled with readv and drained with a single sendmsg, so a burst of
+ * data is echoed with as few system calls as possible. It is meant as a
+ * reference server for benchmarking (see echo-client.cpp).
+ *
+ * With -u it echoes UDP datagrams instead, moving up to UDP_BATCH of them
+ * per system call with recvmmsg and sendmmsg. Each thread has its own
+ * socket on the port (again SO_REUSEPORT), so -t 1 turns the sharding off.
+ * Adding -g turns on GRO, so that a burst of datagrams from one client can
+ * arrive as a single buffer, which is sent back in one go with GSO (where
+ * the kernel supports them).
+ *
+ * Usage: ./echo-server [-t threads] [-b buffer_kb] [-u [-g]] <port>
  */
 
 // C++ standard libraries
+#include <algorithm>
 #include <string>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 // C standard libraries
 #include <cstdio>
@@ -22,261 +41,271 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
-#include <sys/select.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/types.h>
-#include <dirent.h>
-#include <fcntl.h>
+#include <sys/uio.h>
+
+#include "Acceptor.h"
+#include "BufferedConnection.h"
+#include "EventLoop.h"
+#include "NetSocket.h"
 
 using std::cout;
 using std::cerr;
+using std::vector;
 
 
-const int BACKLOG = 10; // max number of pending connections
+const int MAX_EVENTS = 64; // max number of epoll events
 
-const int MAX_EVENTS = 10; // max number of epoll events
-const int MAX_DATA_LENGTH = 4096; // max bytes read by a recv
+// Size of each connection's ring buffers unless changed with -b (rounded up
+// to a power of two).
+const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
 
-/* 
- * Use fcntl (file control) to set the given socket to non-blocking mode.
- *
- * @info Setting your sockets to non-blocking mode is not required, but it
- * might help with your debugging. By setting each socket you get from
- * accept() to non-blocking, you can be sure that normally blocking calls like
- * send, recv, and accept will instead return an error condition and set errno
- * to EWOULDBLOCK/EAGAIN. I would recommend that you set your sockets for
- * non-blocking and then explicitly check each call to send, recv, and accept
- * for this errno. If you see it happening, you know that you're attempting
- * to call one of those functions when you shouldn't be.
- *
- * @param sock The file descriptor for the socket you want to make
- * 				non-blocking.
- */
-void setNonBlocking(int sock) {
-    // Get the current flags. We want to add O_NONBLOCK to this set.
-    int socket_flags = fcntl(sock, F_GETFD);
-    if (socket_flags < 0) {
-        perror("fcntl");
-        exit(1);
-    }
+// Most datagrams moved by one recvmmsg or sendmmsg.
+const int UDP_BATCH = 64;
 
-    // TODO: Add in the O_NONBLOCK flag by bitwise ORing it to the old flags.
-    socket_flags = socket_flags | /* FIXME */;
+// Room for each datagram we receive: the biggest a UDP datagram (or a GRO
+// batch of them) can be.
+const size_t UDP_BUFFER_SIZE = 65536;
 
-    /* Set the new flags, including O_NONBLOCK. */
-    int result = fcntl(sock, F_SETFD, socket_flags);
-    if (result < 0) {
-        perror("fcntl");
-        exit(1);
-    }
+// Older headers don't know about UDP GSO/GRO.
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
 
-    // YAY! The socket is now in non-blocking mode.
-}
+/**
+ * A connected client, which gets back whatever it sends.
+ */
+class EchoConnection : public BufferedConnection {
+  public:
+	EchoConnection(EventLoop *loop, int fd, size_t buffer_size) :
+		BufferedConnection(loop, fd, buffer_size) {}
+
+  protected:
+	void on_input(RingBuffer &input) override {
+		// Whatever doesn't fit waits until some of the output has gone.
+		this->send(input);
+	}
+
+	void on_closed() override {
+		delete this;
+	}
+};
 
 /**
- * Creates a socket, sets it to non-blocking, binds it to the given port, then
- * sets it to start listen for incoming connections.
+ * Runs one thread's event loop forever.
  *
- * @param port_num The port number we will listen on.
- * @return The file descriptor of the newly created/setup server socket.
+ * @param port The port number to listen on.
+ * @param buffer_size Size of each connection's buffers.
  */
-int setup_server_socket(uint16_t port_num) {
-    /* Create the socket that we'll listen on. */
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-
-    /* Set SO_REUSEADDR so that we don't waste time in TIME_WAIT. */
-    int val = setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, 
-							&val, sizeof(val));
-    if (val < 0) {
-        perror("Setting socket option failed");
-        exit(1);
-    }
+void run_event_loop(uint16_t port, size_t buffer_size) {
+	EventLoop loop(MAX_EVENTS);
 
-    /* 
-	 * Set our server socket to non-blocking mode.  This way, if we
-     * accidentally accept() when we shouldn't have, we won't block
-     * indefinitely.
-	 */
-    setNonBlocking(sock_fd);
-
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port_num);
-    addr.sin_addr.s_addr = INADDR_ANY;
-
-    /* Bind our socket and start listening for connections. */
-    if (bind(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("Error binding to port");
-        exit(1);
-    }
+	// Every thread has a socket of its own on the same port, and the kernel
+	// spreads new connections across them.
+	int server_socket = setup_server_socket(port, LISTEN_REUSEPORT);
 
-    if (listen(sock_fd, BACKLOG) < 0) {
-        perror("Error listening for connections");
-        exit(1);
-    }
+	Acceptor acceptor(&loop, server_socket, [&](int client_fd) {
+		// Echoes are small and we want them back right away.
+		set_no_delay(client_fd);
 
-	return sock_fd;
-}
+		EchoConnection *conn = new EchoConnection(&loop, client_fd, buffer_size);
+		conn->start();
+	});
 
+	loop.run();
+}
 
-/*
- * The main function for the server.
- * You should refactor this to be smaller and add additional functionality as
- * needed.
+/**
+ * Creates a UDP socket bound to the given port, shared with the other
+ * threads' sockets (SO_REUSEPORT).
+ *
+ * @param port_num The port number to listen on.
+ * @param use_gro True to have the kernel coalesce datagrams (if it can).
+ * @return The socket.
  */
-int main(int argc, char **argv) {
+int setup_udp_socket(uint16_t port_num, bool use_gro) {
+	int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock_fd < 0) {
+		perror("socket");
+		exit(1);
+	}
 
-    if (argc < 2) {
-        printf("Usage:\t%s <port>\n", argv[0]);
-        exit(0);
-    }
+	int val = 1;
+	if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) < 0) {
+		perror("Setting socket option failed");
+		exit(1);
+	}
 
-    /* Get the port number from the arguments. */
-    uint16_t port = (uint16_t) std::stoul(argv[1]);
+	if (use_gro && setsockopt(sock_fd, IPPROTO_UDP, UDP_GRO, &val, sizeof(val)) < 0)
+		perror("UDP_GRO (carrying on without it)");
 
-	int server_socket = setup_server_socket(port);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port_num);
+	addr.sin_addr.s_addr = INADDR_ANY;
 
-	// Create the epoll, which returns a file descriptor for us to use later.
-	int epoll_fd = epoll_create1(0);
-	if (epoll_fd < 0) {
-		perror("epoll_create1");
+	if (bind(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("Error binding to port");
 		exit(1);
 	}
 
-	/*
-	 * epoll uses a special struct named epoll_event to track I/O events.
-	 * This struct has two fields: events and data. The events field is used
-	 * to indicate what type of event it is (e.g. input/read or output/write).
-	 * The data field will contain a file descriptor for our associated
-	 * socket.
-	 */
-
-	 /*
-	  * We'll start by creating an epoll_event for our server socket to
-	  * indicate that we want epoll to watch for "input" events on this
-	  * socket, i.e. incoming requests to connect to this server.
-	  */
-	struct epoll_event server_ev;
-
-	server_ev.data.fd = server_socket; // set the file descriptor to watch
-
-	// TODO: Change this to the "read" event type that you identified while
-	// answering the lab questions.
-	server_ev.events = /* FIXME */;
-
-	// TODO: Fill in the first two parameters to the following function call
-	// so that it correctly sets up the epoll file descriptor you just created
-	// (epoll_fd) by ADDING the new epoll_event to the list of events.  Review
-	// the epoll_ctl manual if you need a refresher on what each of these
-	// parameters mean.
-	if (epoll_ctl(/* FIXME */, /* FIXME */, server_socket, &server_ev) == -1) {
-		perror("epoll_ctl");
-		exit(1);
+	return sock_fd;
+}
+
+/**
+ * Gets the segment size of a datagram that GRO made out of several.
+ *
+ * @return The size of each segment, or 0 if it's a single datagram.
+ */
+int gro_segment_size(struct msghdr *msg) {
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+			int segment_size;
+			memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+			return segment_size;
+		}
 	}
 
-    while (true) {
-		// The following array will be filled in by epoll_wait with all of the
-		// events that are ready to be handled.
-		struct epoll_event events_to_handle[MAX_EVENTS];
-
-        /* 
-		 * epoll_wait will block until at least one of the sockets we
-		 * registered (using epoll_ctl) has an actual I/O event for us to
-		 * handle.
-		 */
-		// TODO: Update the last parameters so that we wait indefinitely for
-		// an event to occur (just like you identified in your lab answers).
-		int num_events = epoll_wait(epoll_fd, events_to_handle, MAX_EVENTS, /* FIXME */);
-		if (num_events < 0) {
-			perror("epoll_wait");
+	return 0;
+}
+
+/**
+ * Runs one thread's UDP echo loop forever: receive a batch of datagrams,
+ * then send each one back where it came from.
+ *
+ * @param port The port number to listen on.
+ * @param use_gro True to use GRO (and GSO to send the batches back).
+ */
+void run_udp_loop(uint16_t port, bool use_gro) {
+	int sock = setup_udp_socket(port, use_gro);
+
+	// Each datagram in a batch has its own buffer, source address and
+	// control message (for GRO and GSO).
+	const size_t control_size = CMSG_SPACE(sizeof(int));
+	vector<char> buffers(UDP_BATCH * UDP_BUFFER_SIZE);
+	vector<char> controls(UDP_BATCH * control_size);
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iovs[UDP_BATCH];
+	struct sockaddr_storage addrs[UDP_BATCH];
+
+	while (true) {
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < UDP_BATCH; i++) {
+			iovs[i].iov_base = &buffers[i * UDP_BUFFER_SIZE];
+			iovs[i].iov_len = UDP_BUFFER_SIZE;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			if (use_gro) {
+				msgs[i].msg_hdr.msg_control = &controls[i * control_size];
+				msgs[i].msg_hdr.msg_controllen = control_size;
+			}
+		}
+
+		// Wait for one datagram, then take whatever else is already there.
+		int num_received = recvmmsg(sock, msgs, UDP_BATCH, MSG_WAITFORONE, NULL);
+		if (num_received < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("recvmmsg");
 			exit(1);
 		}
 
-		// Loop through all the I/O events that just happened.
-		for (int n = 0; n < num_events; n++) {
-
-			// Check if this event is an input event. We can figure out if
-			// this as an input event by anding together the events field of
-			// the current event with EPOLLIN, and making sure it doesn't
-			// equal 0.
-			if ((events_to_handle[n].events & EPOLLIN) != 0) {
-
-				// Check to see if this event was the server socket ready to
-				// accept a new connection.
-				if (events_to_handle[n].data.fd == server_socket) {
-					// The only event that will trigger our server_socket is when
-					// there is a new client wanting to connect to the server.
-					// In this case, we'll need to call the accept function to
-					// accept a connection, then add the new file descriptor
-					// to our set of all file descriptors.
-
-					struct sockaddr_storage client_addr;
-					socklen_t addr_size = sizeof(client_addr);
-
-					// TODO: Fill in the missing parameter so that the server
-					// socket accepts the connection.
-					int client_fd = accept(/* FIXME*/, 
-											(struct sockaddr *)&client_addr, 
-											&addr_size);
-					if (client_fd == -1) {
-						perror("accept");
-						exit(EXIT_FAILURE);
-					}
-
-					// TODO: Make the new client socket non-blocking... we have a
-					// function for that, right...?
-
-					// Create a new epoll_event for the new client, setting
-					// it so that we only check for "input" events (i.e. client
-					// sent us data that we can now read).
-					struct epoll_event new_client_ev;
-
-					// TODO: fill in both the events and the data.fd fields of
-					// new_client_ev so that we wait for read events from the
-					// new client. This should look very similar to what we
-					// did when setting up server_ev above.
-
-					// TODO: use epoll_ctl to add the new epoll_event to the list
-					// to watch for. Again, this should look very similar to
-					// the code for adding the server event from earlier.
-					if (epoll_ctl(/* FIXME */) == -1) {
-						perror("epoll_ctl: client_fd");
-						exit(1);
-					}
-				}
-				else {
-					// This is a normal client socket so we need to recv the data
-					// it has sent to us.
-
-					// For this example program we are just implementing an echo
-					// server so once we receive data, we'll send the same data
-					// back to the client (using the send function).
-
-					char received_data[MAX_DATA_LENGTH];
-					// TODO: Step 1: Receive data from the client, using the
-					// venerable recv system call to store it into the
-					// received_data array. Recall that the client's socket
-					// file descriptor will be stored in
-					// events_to_handle[n].data.fd
-
-					// TODO: Step 2: Send the same data back to the client
-					// using the send system call.
-				}
+		// Send each one back as it came: same length, same address, and a
+		// GRO batch goes back as a GSO batch with the same segment size.
+		for (int i = 0; i < num_received; i++) {
+			struct msghdr *hdr = &msgs[i].msg_hdr;
+			iovs[i].iov_len = msgs[i].msg_len;
+
+			int segment_size = use_gro ? gro_segment_size(hdr) : 0;
+			if (segment_size > 0 && msgs[i].msg_len > (unsigned)segment_size) {
+				hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+				struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+				cmsg->cmsg_level = IPPROTO_UDP;
+				cmsg->cmsg_type = UDP_SEGMENT;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				uint16_t gso_size = segment_size;
+				memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
 			}
-
-			// Check if this event is an output event, this time by anding
-			// with EPOLLOUT.
-			if (events_to_handle[n].events & EPOLLOUT) {
-				// Note: For this example program, we don't have any sockets
-				// set up for "output" events. For your next project, you will
-				// have clients who will want to be written to so you will
-				// need to do something interesting here.
-				cerr << "ERROR: socket " << events_to_handle[n].data.fd 
-					 << " should not have any output/write events.\n";
-				exit(1);
+			else {
+				hdr->msg_control = NULL;
+				hdr->msg_controllen = 0;
 			}
 		}
+
+		int num_sent = 0;
+		while (num_sent < num_received) {
+			int n = sendmmsg(sock, msgs + num_sent, num_received - num_sent, 0);
+			if (n > 0)
+				num_sent += n;
+			else if (n < 0 && errno == EINTR)
+				continue;
+			else
+				num_sent++; // e.g. the client went away: skip that one
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	// -t <threads> sets how many event loop threads to run (default: one
+	// per core).
+	// -b <kilobytes> sets the size of each connection's buffers.
+	// -u echoes UDP instead of TCP, and -g turns on GRO/GSO for it.
+	unsigned int num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	size_t buffer_size = DEFAULT_BUFFER_SIZE;
+	bool use_udp = false;
+	bool use_gro = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "t:b:ug")) != -1) {
+		if (opt == 't') {
+			num_threads = std::max(std::stoul(optarg), 1ul);
+		}
+		else if (opt == 'b') {
+			buffer_size = std::max(std::stoul(optarg), 1ul) * 1024;
+		}
+		else if (opt == 'u') {
+			use_udp = true;
+		}
+		else if (opt == 'g') {
+			use_gro = true;
+		}
+		else {
+			cerr << "Usage: " << argv[0] << " [-t threads] [-b buffer_kb]"
+				<< " [-u [-g]] <port>\n";
+			exit(1);
+		}
+	}
+
+    if (argc - optind != 1) {
+		cerr << "Usage: " << argv[0] << " [-t threads] [-b buffer_kb]"
+			<< " [-u [-g]] <port>\n";
+        exit(1);
     }
+
+    /* Get the port number from the arguments. */
+    uint16_t port = (uint16_t) std::stoul(argv[optind]);
+
+	vector<std::thread> threads;
+	for (unsigned int i = 0; i < num_threads; i++) {
+		if (use_udp)
+			threads.emplace_back(run_udp_loop, port, use_gro);
+		else
+			threads.emplace_back(run_event_loop, port, buffer_size);
+	}
+
+	cout << "Echoing " << (use_udp ? "UDP" : "TCP") << " on port " << port
+		<< " with " << num_threads << " threads\n";
+
+	for (std::thread &thread : threads)
+		thread.join();
 }
@@ -13,10 +13,11 @@
 using std::cout;
 using std::cerr;
 
-ConnectedClient::ConnectedClient(int fd, ClientState initial_state) :
-	client_fd(fd), sender(NULL), state(initial_state) {}
+ConnectedClient::ConnectedClient(EventLoop *loop, int fd,
+									ClientState initial_state) :
+	client_fd(fd), sender(NULL), state(initial_state), loop(loop) {}
 
-void ConnectedClient::send_dummy_response(int epoll_fd) {
+void ConnectedClient::send_dummy_response() {
 	// Create a large array, just to make sure we can send a lot of data in
 	// smaller chunks.
 	char *data_to_send = new char[CHUNK_SIZE*2000];
@@ -42,8 +43,8 @@ void ConnectedClient::send_dummy_response(int epoll_fd) {
 	 *
 	 * 1. update our state field to be sending
 	 * 2. set our sender field to be the ArraySender object we created
-	 * 3. update epoll so that it also watches for EPOLLOUT for this client
-	 *    socket (use epoll_ctl with EPOLL_CTL_MOD).
+	 * 3. update the event loop so that it also watches for EPOLLOUT for this
+	 *    client socket (use this->loop->modify).
 	 *
 	 * WARNING: These steps are to be done inside of the following if statement,
 	 * not before it.
@@ -60,7 +61,7 @@ void ConnectedClient::send_dummy_response(int epoll_fd) {
 	}
 }
 
-void ConnectedClient::handle_input(int epoll_fd) {
+void ConnectedClient::handle_input() {
 	cout << "Ready to read from client " << this->client_fd << "\n";
 	char data[1024];
 	ssize_t bytes_received = recv(this->client_fd, data, 1024, 0);
@@ -80,19 +81,52 @@ void ConnectedClient::handle_input(int epoll_fd) {
 	// list of songs or for you to send them a song?)
 	// For now, the following function call just demonstrates how you might
 	// send data.
-	this->send_dummy_response(epoll_fd);
+	this->send_dummy_response();
 }
 
 
 // You likely should not need to modify this function.
-void ConnectedClient::handle_close(int epoll_fd) {
+void ConnectedClient::handle_close() {
 	cout << "Closing connection to client " << this->client_fd << "\n";
 
-	if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, this->client_fd, NULL) == -1) {
-		perror("handle_close epoll_ctl");
-		exit(EXIT_FAILURE);
-	}
-
+	this->loop->remove(this->client_fd, this);
 	close(this->client_fd);
 }
 
+void ConnectedClient::handle_events(uint32_t events) {
+	// Check if this is a "hang up" event (i.e. client closed the
+	// connection).
+	if ((events & EPOLLRDHUP) != 0) {
+		// If we get here, the socket associated with this event was
+		// closed by the remote host so we should clean up.
+		this->handle_close();
+		delete this;
+		return;
+	}
+
+	// Check if this is an "input" event (i.e. ready to "read" from
+	// this socket)
+	else if ((events & EPOLLIN) != 0) {
+		/*
+		 * The client has sent us data so we can receive it now
+		 * without worrying about blocking.
+		 */
+		this->handle_input();
+	}
+
+	// Check if this is an "output" event.
+	// Note: You may want/need to make this an else if, depending on
+	// how you are handling clients.
+	if ((events & EPOLLOUT) != 0) {
+		/* 
+		 * If you set things up correctly, you should only reach this
+		 * point if you started sending a response, but had to stop.
+		 * You'll therefore need to continue sending whatever response
+		 * you had in progress.
+		 */
+
+		// TODO: Create a new function in this class and call that here,
+		// sort of like what was done for handle_input and handle_close
+		// earlier in this function.
+	}
+}
@@ -1,6 +1,8 @@
 #ifndef CONNECTEDCLIENT_H
 #define CONNECTEDCLIENT_H
 
+#include "EventLoop.h"
+
 /**
  * Represents the state of a connected client.
  */
@@ -10,26 +12,22 @@ enum ClientState { RECEIVING, SENDING };
  * Class that models a connected client.
  * 
  * One object of this class will be created for every client that you accept a
- * connection from.
+ * connection from. The event loop hands it the events for its socket.
  */
-class ConnectedClient {
+class ConnectedClient : public EventHandler {
   public:
 	// Member Variablesa (i.e. fields)
 	int client_fd;
 	ChunkedDataSender *sender;
 	ClientState state;
+	EventLoop *loop;
 
 	// Constructors
 	/**
-	 * Constructor that takes the client's socket file descriptor and the
-	 * initial state of the client.
+	 * Constructor that takes the event loop, the client's socket file
+	 * descriptor and the initial state of the client.
 	 */
-	ConnectedClient(int fd, ClientState initial_state);
-
-	/**
-	 * No argument constructor.
-	 */
-	ConnectedClient() : client_fd(-1), sender(NULL), state(RECEIVING) {}
+	ConnectedClient(EventLoop *loop, int fd, ClientState initial_state);
 
 
 	// Member Functions (i.e. Methods)
@@ -38,24 +36,28 @@ class ConnectedClient {
 	 * Sends a response to the client.
 	 * Note that this is just to demonstrate sending to the client: it doesn't
 	 * send anything intelligent.
-	 *
-	 * @param epoll_fd File descriptor for epoll.
 	 */
-	void send_dummy_response(int epoll_fd);
+	void send_dummy_response();
 
 	/**
 	 * Handles new input from the client.
-	 *
-	 * @param epoll_fd File descriptor for epoll.
 	 */
-	void handle_input(int epoll_fd);
+	void handle_input();
 
 	/**
 	 * Handles a close request from the client.
+	 */
+	void handle_close();
+
+	/**
+	 * Handles the events that happened on the client's socket.
+	 *
+	 * @note The client deletes itself once its connection is closed, so this
+	 * object can't be used after that.
 	 *
-	 * @param epoll_fd File descriptor for epoll.
+	 * @param events The EPOLL* events that happened.
 	 */
-	void handle_close(int epoll_fd);
+	void handle_events(uint32_t events) override;
 };
 
 #endif
@@ -0,0 +1,22 @@
+#include <sys/socket.h>
+
+#include "Acceptor.h"
+#include "NetSocket.h"
+
+Acceptor::Acceptor(EventLoop *loop, int server_socket,
+					std::function<void(int)> on_accept) :
+	loop(loop), server_socket(server_socket), on_accept(std::move(on_accept)) {
+	this->loop->add(this->server_socket, EPOLLIN | EPOLLET, this);
+}
+
+Acceptor::~Acceptor() {
+	this->loop->remove(this->server_socket, this);
+}
+
+void Acceptor::handle_events(uint32_t) {
+	// Being edge-triggered, we only hear about waiting connections once.
+	int client_fd;
+	while ((client_fd = accept_connection(this->server_socket,
+											SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+		this->on_accept(client_fd);
+}
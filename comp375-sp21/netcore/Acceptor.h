@@ -0,0 +1,47 @@
+#ifndef ACCEPTOR_H
+#define ACCEPTOR_H
+
+#include <cstdint>
+#include <functional>
+
+#include "EventLoop.h"
+
+/**
+ * Class that accepts connections on a listening socket as they come in and
+ * hands each new (non-blocking) socket to a callback.
+ *
+ * The listening socket is watched edge-triggered, so every waiting
+ * connection is accepted each time, with accept4 making the new sockets
+ * non-blocking as they are created. To share a port between threads, give
+ * each thread's EventLoop an Acceptor with its own listening socket (see
+ * LISTEN_REUSEPORT).
+ */
+class Acceptor : public EventHandler {
+  private:
+	EventLoop *loop;
+	int server_socket;
+	std::function<void(int)> on_accept;
+
+  public:
+	/**
+	 * Constructor for Acceptor class, which starts accepting right away.
+	 *
+	 * @param loop The event loop to accept on.
+	 * @param server_socket The (non-blocking) listening socket.
+	 * @param on_accept Called with each new socket, which it then owns.
+	 */
+	Acceptor(EventLoop *loop, int server_socket,
+				std::function<void(int)> on_accept);
+
+	/**
+	 * Destructor, which stops accepting (but leaves the socket open).
+	 */
+	~Acceptor();
+
+	Acceptor(const Acceptor&) = delete;
+	Acceptor &operator=(const Acceptor&) = delete;
+
+	void handle_events(uint32_t events) override;
+};
+
+#endif // ACCEPTOR_H
@@ -0,0 +1,210 @@
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "BufferedConnection.h"
+
+BufferedConnection::BufferedConnection(EventLoop *loop, int fd,
+										size_t buffer_size) :
+	loop(loop), fd(fd), input(buffer_size), output(buffer_size),
+	readable(true), writable(true), peer_closed(false),
+	told_peer_closed(false), closing(false),
+	dispatching(false), closed_pending(false) {}
+
+BufferedConnection::~BufferedConnection() {
+	if (this->fd >= 0) {
+		::close(this->fd); // also takes it out of the epoll
+		this->loop->forget(this);
+	}
+
+	if (this->closed_pending)
+		this->loop->cancel_timer(this->closed_timer);
+}
+
+void BufferedConnection::start() {
+	// Being edge-triggered, we only hear about changes, so there's no need
+	// to switch between watching for input and output.
+	this->loop->add(this->fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, this);
+}
+
+size_t BufferedConnection::send(const void *data, size_t len) {
+	if (this->fd < 0 || this->closing)
+		return 0;
+
+	size_t queued = this->output.put(data, len);
+
+	// Inside handle_events, it goes out before we return.
+	if (!this->dispatching)
+		this->flush();
+	return queued;
+}
+
+size_t BufferedConnection::send(RingBuffer &source) {
+	if (this->fd < 0 || this->closing)
+		return 0;
+
+	struct iovec iov[2];
+	int num_iov = source.data_iovecs(iov);
+	size_t queued = 0;
+	for (int i = 0; i < num_iov; i++) {
+		size_t n = this->output.put(iov[i].iov_base, iov[i].iov_len);
+		queued += n;
+		if (n < iov[i].iov_len)
+			break;
+	}
+	source.removed(queued);
+
+	if (!this->dispatching)
+		this->flush();
+	return queued;
+}
+
+void BufferedConnection::close() {
+	if (this->fd < 0)
+		return;
+
+	::close(this->fd); // also takes it out of the epoll
+	this->loop->forget(this);
+	this->fd = -1;
+
+	// on_closed may delete us, so it has to wait until whoever called us
+	// is done with us: the end of handle_events if that's where we are, or
+	// else the loop's next chance to run timers.
+	if (!this->dispatching) {
+		this->closed_pending = true;
+		this->closed_timer = this->loop->add_timer(
+			std::chrono::steady_clock::now(), [this]() {
+				this->closed_pending = false;
+				this->on_closed();
+			});
+	}
+}
+
+void BufferedConnection::close_after_sending() {
+	this->closing = true;
+	if (this->output.size() == 0)
+		this->close();
+}
+
+void BufferedConnection::handle_events(uint32_t events) {
+	if (events & EPOLLERR) {
+		this->dispatching = true;
+		this->close();
+		this->dispatching = false;
+		this->on_closed();
+		return;
+	}
+
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+		this->readable = true;
+	if (events & EPOLLOUT)
+		this->writable = true;
+
+	this->dispatching = true;
+	this->pump();
+	this->dispatching = false;
+
+	if (this->fd < 0)
+		this->on_closed(); // may delete us
+}
+
+bool BufferedConnection::pump() {
+	struct iovec iov[2];
+	bool progress = true;
+	while (progress) {
+		progress = false;
+
+		// Read everything that fits. A short read means there's nothing
+		// left until the next EPOLLIN.
+		if (this->readable && !this->peer_closed && !this->closing
+				&& this->input.space() > 0) {
+			int num_iov = this->input.free_iovecs(iov);
+			ssize_t n = readv(this->fd, iov, num_iov);
+			if (n > 0) {
+				this->readable = ((size_t)n == this->input.space());
+				this->input.added(n);
+				progress = true;
+			}
+			else if (n == 0) {
+				this->peer_closed = true;
+			}
+			else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				this->readable = false;
+			}
+			else if (errno != EINTR) {
+				this->close();
+				return false;
+			}
+		}
+
+		// Hand over the input. It may not all be taken (e.g. if there's no
+		// room for the reply), in which case we try again after sending.
+		if (this->input.size() > 0 && !this->closing) {
+			size_t before = this->input.size();
+			this->on_input(this->input);
+			if (this->fd < 0)
+				return false;
+			if (this->input.size() != before)
+				progress = true;
+		}
+
+		size_t before = this->output.size();
+		if (!this->flush())
+			return false;
+		if (this->output.size() != before) {
+			progress = true;
+			if (this->output.size() == 0 && !this->closing) {
+				this->on_drained();
+				if (this->fd < 0)
+					return false;
+			}
+		}
+	}
+
+	// on_input can't take any more once the output buffer is empty and no
+	// more input is coming.
+	if (this->peer_closed && !this->told_peer_closed && !this->closing
+			&& (this->input.size() == 0 || this->output.size() == 0)) {
+		this->told_peer_closed = true;
+		this->on_peer_closed();
+		if (this->fd < 0)
+			return false;
+	}
+
+	if (this->closing && this->output.size() == 0) {
+		this->close();
+		return false;
+	}
+
+	return true;
+}
+
+bool BufferedConnection::flush() {
+	// Send everything we have. A short write means the socket buffer is
+	// full until the next EPOLLOUT.
+	struct iovec iov[2];
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	while (this->writable && this->output.size() > 0) {
+		msg.msg_iovlen = this->output.data_iovecs(iov);
+		ssize_t n = sendmsg(this->fd, &msg, MSG_NOSIGNAL);
+		if (n > 0) {
+			this->writable = ((size_t)n == this->output.size());
+			this->output.removed(n);
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			this->writable = false;
+		}
+		else if (errno != EINTR) {
+			this->close();
+			return false;
+		}
+	}
+
+	if (this->closing && this->output.size() == 0 && !this->dispatching)
+		this->close();
+
+	return true;
+}
@@ -0,0 +1,167 @@
+#ifndef BUFFEREDCONNECTION_H
+#define BUFFEREDCONNECTION_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "EventLoop.h"
+#include "RingBuffer.h"
+
+// Size of each of a connection's buffers, unless told otherwise.
+const size_t DEFAULT_CONNECTION_BUFFER = 64 * 1024;
+
+/**
+ * Class for a non-blocking connection with an input and an output buffer.
+ *
+ * The socket is watched edge-triggered for both input and output from the
+ * start, so epoll never needs to be told when we want to write. Input is
+ * read with readv into the input buffer and handed to on_input; output
+ * queued with send goes out with one sendmsg (i.e. a writev that can't
+ * raise SIGPIPE), as much as the socket takes, and the rest waits for the
+ * next EPOLLOUT.
+ *
+ * Nothing more is read while the input buffer is full, so a peer that sends
+ * faster than on_input consumes (e.g. because the output buffer is full)
+ * gets slowed down by TCP instead of using up our memory.
+ *
+ * Subclasses decide what to do with the input, and what happens to the
+ * object once the connection is closed (see on_closed).
+ */
+class BufferedConnection : public EventHandler {
+  protected:
+	EventLoop *loop;
+	int fd;               // -1 once closed
+	RingBuffer input;     // received, but not yet consumed
+	RingBuffer output;    // queued, but not yet sent
+
+  private:
+	bool readable;        // true until a read comes up short
+	bool writable;        // true until a write comes up short
+	bool peer_closed;     // true once the peer has sent everything
+	bool told_peer_closed; // true once on_peer_closed has been called
+	bool closing;         // true to close once the output has gone out
+	bool dispatching;     // true while in handle_events
+
+	// Timer that calls on_closed after a close outside handle_events.
+	bool closed_pending;
+	EventLoop::TimerId closed_timer;
+
+  public:
+	/**
+	 * Constructor for BufferedConnection class. The connection doesn't get
+	 * any events until it is started.
+	 *
+	 * @param loop The event loop to handle the connection on.
+	 * @param fd The connection's socket (which must be non-blocking).
+	 * @param buffer_size Size of the input and output buffers (rounded up
+	 * 	to a power of two).
+	 */
+	BufferedConnection(EventLoop *loop, int fd,
+						size_t buffer_size = DEFAULT_CONNECTION_BUFFER);
+
+	/**
+	 * Destructor, which closes the connection if it is still open (without
+	 * calling on_closed).
+	 */
+	virtual ~BufferedConnection();
+
+	/**
+	 * Starts handling the connection's events.
+	 */
+	void start();
+
+	/**
+	 * Queues data to send, as much as fits in the output buffer, and sends
+	 * it right away if the socket has room.
+	 *
+	 * @param data The data to send.
+	 * @param len Number of bytes of data.
+	 * @return Number of bytes queued (less than len if the buffer filled).
+	 */
+	size_t send(const void *data, size_t len);
+
+	/**
+	 * Queues as much of another buffer's data as fits, taking it out of
+	 * that buffer.
+	 *
+	 * @return Number of bytes queued.
+	 */
+	size_t send(RingBuffer &source);
+
+	/**
+	 * Closes the connection, throwing away anything that hasn't been sent.
+	 * on_closed is called once the caller is done with the connection: at
+	 * the end of handle_events, or else on the event loop's next pass.
+	 */
+	void close();
+
+	/**
+	 * Closes the connection once everything queued has been sent (and stops
+	 * reading in the meantime).
+	 */
+	void close_after_sending();
+
+	/**
+	 * Checks if the connection is still open.
+	 */
+	bool is_open() const {
+		return fd >= 0;
+	}
+
+	/**
+	 * Gets the number of bytes waiting to be sent.
+	 */
+	size_t pending_output() const {
+		return output.size();
+	}
+
+	void handle_events(uint32_t events) override;
+
+  protected:
+	/**
+	 * Called when there is input. It should take out whatever it can use
+	 * (anything left stays for the next call, which comes when more input
+	 * arrives or some output has been sent).
+	 *
+	 * @param input The input buffer.
+	 */
+	virtual void on_input(RingBuffer &input) = 0;
+
+	/**
+	 * Called when everything queued has been sent, for a subclass that has
+	 * more to send than fits in the output buffer.
+	 */
+	virtual void on_drained() {}
+
+	/**
+	 * Called (once) when the peer has finished sending, after on_input has
+	 * had the last of its input. By default, the connection is closed once
+	 * everything queued has been sent.
+	 */
+	virtual void on_peer_closed() {
+		this->close_after_sending();
+	}
+
+	/**
+	 * Called once the connection has been closed, as the very last thing
+	 * the connection does, so it may delete the object.
+	 */
+	virtual void on_closed() {}
+
+  private:
+	/**
+	 * Reads, consumes and sends until none of them can make progress.
+	 *
+	 * @return false if the connection was closed.
+	 */
+	bool pump();
+
+	/**
+	 * Sends as much of the output buffer as the socket takes.
+	 *
+	 * @return false if the connection was closed.
+	 */
+	bool flush();
+};
+
+#endif // BUFFEREDCONNECTION_H
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "EventLoop.h"
+
+EventLoop::EventLoop(int max_events) :
+	events(max_events), num_events(0), next_event(0), next_timer_id(0),
+	stopped(false) {
+	this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (this->epoll_fd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+}
+
+EventLoop::~EventLoop() {
+	close(this->epoll_fd);
+}
+
+void EventLoop::add(int fd, uint32_t events, EventHandler *handler) {
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = handler;
+	if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		perror("epoll_ctl: add");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void EventLoop::modify(int fd, uint32_t events, EventHandler *handler) {
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = handler;
+	if (epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+		perror("epoll_ctl: modify");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void EventLoop::remove(int fd, EventHandler *handler) {
+	if (epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+		perror("epoll_ctl: remove");
+		exit(EXIT_FAILURE);
+	}
+
+	this->forget(handler);
+}
+
+void EventLoop::forget(EventHandler *handler) {
+	// A handler gets at most one event per batch, but that event may still
+	// be ahead of us.
+	for (int n = this->next_event; n < this->num_events; n++) {
+		if (this->events[n].data.ptr == handler)
+			this->events[n].data.ptr = NULL;
+	}
+}
+
+EventLoop::TimerId EventLoop::add_timer(time_point when,
+										std::function<void()> callback) {
+	TimerId id(when, this->next_timer_id++);
+	this->timers.emplace(id, std::move(callback));
+	return id;
+}
+
+bool EventLoop::cancel_timer(TimerId id) {
+	return this->timers.erase(id) > 0;
+}
+
+int EventLoop::wait_time(int max_wait_ms) const {
+	if (this->timers.empty())
+		return max_wait_ms;
+
+	// Round up, so we don't wake just before the timer is due and then
+	// spin until it is.
+	auto until_due = this->timers.begin()->first.first
+						- std::chrono::steady_clock::now();
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+					until_due + std::chrono::microseconds(999)).count();
+	int timer_wait = (int)std::max<long long>(ms, 0);
+
+	if (max_wait_ms < 0 || timer_wait < max_wait_ms)
+		return timer_wait;
+	return max_wait_ms;
+}
+
+void EventLoop::run_timers() {
+	time_point now = std::chrono::steady_clock::now();
+
+	// Timers added by a callback can be due straight away, but those wait
+	// for the next pass, so a timer that keeps re-adding itself can't starve
+	// everything else.
+	uint64_t last_id = this->next_timer_id;
+	for (auto it = this->timers.begin();
+			it != this->timers.end() && it->first.first <= now; ) {
+		if (it->first.second >= last_id) {
+			++it;
+			continue;
+		}
+
+		// Take it out before running it, so it can add (or cancel) timers.
+		std::function<void()> callback = std::move(it->second);
+		this->timers.erase(it);
+		callback();
+		it = this->timers.begin();
+	}
+}
+
+int EventLoop::run_once(int max_wait_ms) {
+	int ready = epoll_wait(this->epoll_fd, this->events.data(),
+							(int)this->events.size(),
+							this->wait_time(max_wait_ms));
+	if (ready < 0) {
+		if (errno != EINTR) {
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+		ready = 0;
+	}
+
+	this->woke_at = std::chrono::steady_clock::now();
+
+	this->num_events = ready;
+	for (this->next_event = 0; this->next_event < this->num_events; ) {
+		struct epoll_event &ev = this->events[this->next_event++];
+
+		// A handler that was removed earlier in the batch has no events left.
+		EventHandler *handler = (EventHandler*)ev.data.ptr;
+		if (handler != NULL)
+			handler->handle_events(ev.events);
+	}
+	this->num_events = 0;
+	this->next_event = 0;
+
+	if (!this->timers.empty())
+		this->run_timers();
+
+	return ready;
+}
+
+void EventLoop::run() {
+	this->stopped = false;
+	while (!this->stopped)
+		this->run_once();
+}
@@ -0,0 +1,192 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+
+// Most epoll events handled per pass of the loop, unless told otherwise.
+const int DEFAULT_MAX_EVENTS = 64;
+
+/**
+ * Interface for anything that gets events from an EventLoop (e.g. a
+ * connection, or a listening socket). The handler is what gets stored in the
+ * epoll_event, so it must stay put while it is registered.
+ */
+class EventHandler {
+  public:
+	virtual ~EventHandler() {}
+
+	/**
+	 * Handles the events epoll reported for the handler's file descriptor.
+	 *
+	 * @param events The EPOLL* event bits.
+	 */
+	virtual void handle_events(uint32_t events) = 0;
+};
+
+/**
+ * Class that runs an epoll event loop: it waits for events on the file
+ * descriptors registered with it, hands them to their handlers, and runs
+ * timers when they are due.
+ *
+ * An EventLoop belongs to a single thread. A server that wants more threads
+ * runs an EventLoop on each (e.g. each with its own SO_REUSEPORT listening
+ * socket), rather than sharing one.
+ */
+class EventLoop {
+  public:
+	typedef std::chrono::steady_clock::time_point time_point;
+
+	// A timer's due time, plus a number that makes it unique.
+	typedef std::pair<time_point, uint64_t> TimerId;
+
+  private:
+	int epoll_fd;
+
+	// The batch of events being handed out, and where we are in it.
+	std::vector<struct epoll_event> events;
+	int num_events;
+	int next_event;
+
+	// Pending timers, soonest first.
+	std::map<TimerId, std::function<void()>> timers;
+	uint64_t next_timer_id;
+
+	time_point woke_at; // when the last wait for events ended
+	bool stopped;
+
+  public:
+	/**
+	 * Constructor for EventLoop class.
+	 *
+	 * @param max_events Most events to handle per pass of the loop.
+	 */
+	EventLoop(int max_events = DEFAULT_MAX_EVENTS);
+
+	~EventLoop();
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop &operator=(const EventLoop&) = delete;
+
+	/**
+	 * Gets the loop's epoll file descriptor, for code that manages its own
+	 * registrations with epoll_ctl (which must store an EventHandler* in
+	 * data.ptr).
+	 */
+	int fd() const {
+		return epoll_fd;
+	}
+
+	/**
+	 * Starts watching a file descriptor.
+	 *
+	 * @param fd The file descriptor.
+	 * @param events The EPOLL* events to watch for.
+	 * @param handler What to hand the events to.
+	 */
+	void add(int fd, uint32_t events, EventHandler *handler);
+
+	/**
+	 * Changes which events are being watched for on a file descriptor.
+	 */
+	void modify(int fd, uint32_t events, EventHandler *handler);
+
+	/**
+	 * Stops watching a file descriptor, and drops any events for its handler
+	 * that are still waiting to be handed out, so the handler can be deleted
+	 * (or reused for another file descriptor) straight away.
+	 */
+	void remove(int fd, EventHandler *handler);
+
+	/**
+	 * Drops any events for a handler that are still waiting to be handed
+	 * out, without touching epoll (e.g. after closing its file descriptor,
+	 * which takes it out of the epoll anyway).
+	 */
+	void forget(EventHandler *handler);
+
+	/**
+	 * Runs a callback (once) at the given time, or soon after.
+	 *
+	 * @return The timer's ID, which can be used to cancel it.
+	 */
+	TimerId add_timer(time_point when, std::function<void()> callback);
+
+	/**
+	 * Runs a callback (once) after the given delay.
+	 */
+	template <typename Rep, typename Period>
+	TimerId add_timer(std::chrono::duration<Rep, Period> delay,
+						std::function<void()> callback) {
+		return this->add_timer(std::chrono::steady_clock::now()
+			+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay),
+			std::move(callback));
+	}
+
+	/**
+	 * Cancels a timer that hasn't run yet.
+	 *
+	 * @return true if the timer was cancelled, false if it had already run
+	 * 	(or been cancelled).
+	 */
+	bool cancel_timer(TimerId id);
+
+	/**
+	 * Gets the number of timers waiting to run.
+	 */
+	size_t num_timers() const {
+		return timers.size();
+	}
+
+	/**
+	 * Waits for events (but no later than the next timer), hands them to
+	 * their handlers, then runs any timers that are due.
+	 *
+	 * @param max_wait_ms Longest to wait for events, in milliseconds (-1 to
+	 * 	wait for as long as it takes).
+	 * @return The number of events that happened.
+	 */
+	int run_once(int max_wait_ms = -1);
+
+	/**
+	 * Runs the loop until stop is called.
+	 */
+	void run();
+
+	/**
+	 * Makes run return once it has finished its current pass.
+	 */
+	void stop() {
+		stopped = true;
+	}
+
+	/**
+	 * Gets when the last wait for events ended, i.e. when the current (or
+	 * last) pass of the loop started handling events.
+	 */
+	time_point last_wake() const {
+		return woke_at;
+	}
+
+  private:
+	/**
+	 * Gets how long to wait for events before the next timer is due.
+	 *
+	 * @param max_wait_ms Longest to wait anyway (-1 for no limit).
+	 * @return How long to wait, in milliseconds (-1 for no limit).
+	 */
+	int wait_time(int max_wait_ms) const;
+
+	/**
+	 * Runs every timer that is due.
+	 */
+	void run_timers();
+};
+
+#endif // EVENTLOOP_H
@@ -0,0 +1,99 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "NetSocket.h"
+
+int setup_server_socket(uint16_t port_num, int flags) {
+	int sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock_fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	int reuse_true = 1;
+	if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_true,
+					sizeof(reuse_true)) < 0) {
+		perror("Setting socket option failed");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((flags & LISTEN_REUSEPORT)
+			&& setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &reuse_true,
+							sizeof(reuse_true)) < 0) {
+		perror("Setting socket option failed");
+		exit(EXIT_FAILURE);
+	}
+
+	// A non-blocking server socket means that if we accept() when there's
+	// no one there, we find out instead of blocking indefinitely.
+	if (!(flags & LISTEN_BLOCKING))
+		set_non_blocking(sock_fd);
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port_num);
+	addr.sin_addr.s_addr = htonl((flags & LISTEN_LOOPBACK) ? INADDR_LOOPBACK
+															: INADDR_ANY);
+
+	/* Bind our socket and start listening for connections. */
+	if (bind(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("Error binding to port");
+		exit(EXIT_FAILURE);
+	}
+
+	if (listen(sock_fd, DEFAULT_BACKLOG) < 0) {
+		perror("Error listening for connections");
+		exit(EXIT_FAILURE);
+	}
+
+	return sock_fd;
+}
+
+int accept_connection(int server_socket, int flags) {
+	while (true) {
+		struct sockaddr_storage their_addr;
+		socklen_t addr_size = sizeof(their_addr);
+		int new_fd = accept4(server_socket, (struct sockaddr *)&their_addr,
+								&addr_size, flags);
+		if (new_fd >= 0)
+			return new_fd;
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return -1; // that's all of them
+		if (errno != EINTR && errno != ECONNABORTED) {
+			perror("accept");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+void set_non_blocking(int sock) {
+	// Get the current flags
+	int socket_flags = fcntl(sock, F_GETFL);
+	if (socket_flags < 0) {
+		perror("fcntl");
+		exit(EXIT_FAILURE);
+	}
+
+	// Set the new flags, including O_NONBLOCK.
+	if (fcntl(sock, F_SETFL, socket_flags | O_NONBLOCK) < 0) {
+		perror("fcntl");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void set_no_delay(int sock) {
+	// Only fails for sockets that aren't TCP, where there's nothing to do.
+	int one = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
@@ -0,0 +1,67 @@
+#ifndef NETSOCKET_H
+#define NETSOCKET_H
+
+#include <cstdint>
+
+// Most connections that can be waiting to be accepted.
+const int DEFAULT_BACKLOG = 128;
+
+/**
+ * Flags for setup_server_socket.
+ */
+enum ListenFlags {
+	LISTEN_REUSEPORT = 1, // share the port with other sockets (SO_REUSEPORT)
+	LISTEN_BLOCKING = 2,  // leave the socket blocking (for a thread that
+	                      // does nothing but accept)
+	LISTEN_LOOPBACK = 4   // only take connections from this machine
+};
+
+/**
+ * Creates a socket, sets it to non-blocking, binds it to the given port, then
+ * sets it to start listen for incoming connections.
+ *
+ * SO_REUSEADDR is always set, so a restarted server doesn't have to wait
+ * for the old one's connections to leave TIME_WAIT. With LISTEN_REUSEPORT,
+ * several sockets (e.g. one per event loop thread) can listen on the same
+ * port, and the kernel spreads new connections across them.
+ *
+ * @param port_num The port number we will listen on.
+ * @param flags ListenFlags, ORed together.
+ * @return The file descriptor of the newly created/setup server socket.
+ */
+int setup_server_socket(uint16_t port_num, int flags = 0);
+
+/**
+ * Accepts a connection and returns the socket descriptor of the new client
+ * that has connected to us.
+ *
+ * Connections that go away before we get to them are skipped, so this only
+ * gives up when there is nothing left to accept.
+ *
+ * @param server_socket Socket descriptor of the server (that is listening)
+ * @param flags Flags for the new socket (see accept4), e.g. SOCK_NONBLOCK.
+ * @return Socket descriptor for newly connected client, or -1 if there are
+ * 	none waiting (only for a non-blocking server socket).
+ */
+int accept_connection(int server_socket, int flags);
+
+/**
+ * Use fcntl (file control) to set the given socket to non-blocking mode.
+ * With non-blocking mode set, any time you try to call send or recv that
+ * would normally block, it will instead immediately return -1 and set errno
+ * to EAGAIN (or EWOULDBLOCK).
+ *
+ * @param sock The file descriptor for the socket you want to make
+ * 				non-blocking.
+ */
+void set_non_blocking(int sock);
+
+/**
+ * Turns off Nagle's algorithm for a TCP socket, so small writes go out
+ * straight away instead of waiting to be combined.
+ *
+ * @param sock The socket.
+ */
+void set_no_delay(int sock);
+
+#endif // NETSOCKET_H
@@ -0,0 +1,127 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <sys/uio.h>
+
+/**
+ * Class for a fixed size ring buffer of bytes. The free space and the data
+ * can each wrap around the end of the buffer, so they are handed out as (up
+ * to) two iovecs for readv and writev.
+ */
+class RingBuffer {
+  private:
+	std::vector<char> data;
+	size_t mask;  // capacity - 1 (the capacity is a power of two)
+	size_t head;  // total bytes taken out
+	size_t tail;  // total bytes put in
+
+  public:
+	/**
+	 * Constructor for RingBuffer class.
+	 *
+	 * @param capacity Most bytes the buffer holds (rounded up to a power of
+	 * 	two).
+	 */
+	RingBuffer(size_t capacity) : head(0), tail(0) {
+		size_t rounded = 1;
+		while (rounded < capacity)
+			rounded *= 2;
+		this->data.resize(rounded);
+		this->mask = rounded - 1;
+	}
+
+	size_t capacity() const { return data.size(); }
+	size_t size() const { return tail - head; }
+	size_t space() const { return data.size() - size(); }
+
+	/**
+	 * Fills in iovecs for the free space, in order.
+	 *
+	 * @return Number of iovecs filled in (0 if the buffer is full).
+	 */
+	int free_iovecs(struct iovec iov[2]) {
+		return make_iovecs(tail, space(), iov);
+	}
+
+	/**
+	 * Fills in iovecs for the data, oldest first.
+	 *
+	 * @return Number of iovecs filled in (0 if the buffer is empty).
+	 */
+	int data_iovecs(struct iovec iov[2]) {
+		return make_iovecs(head, size(), iov);
+	}
+
+	void added(size_t len) { tail += len; }
+	void removed(size_t len) { head += len; }
+
+	/**
+	 * Copies as much of src into the buffer as fits.
+	 *
+	 * @return Number of bytes copied.
+	 */
+	size_t put(const void *src, size_t len) {
+		struct iovec iov[2];
+		int num_iov = free_iovecs(iov);
+		size_t copied = 0;
+		for (int i = 0; i < num_iov && copied < len; i++) {
+			size_t n = std::min(iov[i].iov_len, len - copied);
+			memcpy(iov[i].iov_base, (const char*)src + copied, n);
+			copied += n;
+		}
+		added(copied);
+		return copied;
+	}
+
+	/**
+	 * Copies the oldest bytes out of the buffer without removing them.
+	 *
+	 * @return Number of bytes copied (less than len if that's all there is).
+	 */
+	size_t peek(void *dest, size_t len) {
+		struct iovec iov[2];
+		int num_iov = data_iovecs(iov);
+		size_t copied = 0;
+		for (int i = 0; i < num_iov && copied < len; i++) {
+			size_t n = std::min(iov[i].iov_len, len - copied);
+			memcpy((char*)dest + copied, iov[i].iov_base, n);
+			copied += n;
+		}
+		return copied;
+	}
+
+	/**
+	 * Copies the oldest bytes out of the buffer and removes them.
+	 *
+	 * @return Number of bytes taken (less than len if that's all there is).
+	 */
+	size_t take(void *dest, size_t len) {
+		size_t copied = peek(dest, len);
+		removed(copied);
+		return copied;
+	}
+
+  private:
+	int make_iovecs(size_t start, size_t len, struct iovec iov[2]) {
+		if (len == 0)
+			return 0;
+
+		size_t offset = start & mask;
+		size_t first = std::min(len, data.size() - offset);
+		iov[0].iov_base = &data[offset];
+		iov[0].iov_len = first;
+		if (first == len)
+			return 1;
+
+		iov[1].iov_base = &data[0];
+		iov[1].iov_len = len - first;
+		return 2;
+	}
+};
+
+#endif // RINGBUFFER_H
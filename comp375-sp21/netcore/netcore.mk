@@ -0,0 +1,8 @@
+# Networking core shared by the servers. A server's Makefile sets NETCORE to
+# the path of this directory, includes this file, and then adds
+# $(NETCORE_SRC) to its sources and $(NETCORE_HEADERS) to its dependencies.
+NETCORE_SRC = $(NETCORE)/EventLoop.cpp $(NETCORE)/BufferedConnection.cpp \
+			$(NETCORE)/NetSocket.cpp $(NETCORE)/Acceptor.cpp
+NETCORE_HEADERS = $(NETCORE)/EventLoop.h $(NETCORE)/BufferedConnection.h \
+			$(NETCORE)/NetSocket.h $(NETCORE)/RingBuffer.h $(NETCORE)/Acceptor.h
+CXXFLAGS += -I$(NETCORE)
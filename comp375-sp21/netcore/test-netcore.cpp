@@ -0,0 +1,263 @@
+/*
+ * File: test-netcore.cpp
+ *
+ * Test for the networking core (EventLoop, BufferedConnection, Acceptor and
+ * NetSocket).
+ *
+ * Checks that timers run in order and can be cancelled, that a handler
+ * removed partway through a batch gets no more events, and that a buffered
+ * echo connection over a socket pair sends back everything it is given
+ * (including more than fits in its buffers at once) and closes once the
+ * peer is done. Also echoes over TCP, through an Acceptor.
+ *
+ * Usage: ./test-netcore
+ */
+
+// C++ standard libraries
+#include <chrono>
+#include <string>
+#include <vector>
+
+// C standard libraries
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// POSIX and OS-specific libraries
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "Acceptor.h"
+#include "BufferedConnection.h"
+#include "EventLoop.h"
+#include "NetSocket.h"
+
+using std::string;
+using std::vector;
+
+static int num_failures = 0;
+
+/**
+ * Checks that something is true and prints the result.
+ */
+void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok)
+		num_failures++;
+}
+
+/**
+ * Connection that sends back whatever it gets (as much as fits).
+ */
+class EchoConnection : public BufferedConnection {
+  public:
+	bool closed;
+
+	EchoConnection(EventLoop *loop, int fd, size_t buffer_size) :
+		BufferedConnection(loop, fd, buffer_size), closed(false) {}
+
+  protected:
+	void on_input(RingBuffer &input) override {
+		this->send(input);
+	}
+
+	void on_closed() override {
+		this->closed = true;
+	}
+};
+
+/**
+ * Handler that counts its events, and removes another handler when it gets
+ * one.
+ */
+class CountingHandler : public EventHandler {
+  public:
+	EventLoop *loop;
+	int fd;
+	int num_events;
+	CountingHandler *victim; // handler to remove (or NULL)
+
+	CountingHandler(EventLoop *loop, int fd) :
+		loop(loop), fd(fd), num_events(0), victim(NULL) {}
+
+	void handle_events(uint32_t) override {
+		this->num_events++;
+		if (this->victim != NULL) {
+			this->loop->remove(this->victim->fd, this->victim);
+			this->victim = NULL;
+		}
+	}
+};
+
+void run_timer_checks() {
+	EventLoop loop;
+	vector<int> order;
+
+	auto start = std::chrono::steady_clock::now();
+	loop.add_timer(std::chrono::milliseconds(30), [&]() { order.push_back(3); });
+	loop.add_timer(std::chrono::milliseconds(10), [&]() { order.push_back(1); });
+	EventLoop::TimerId cancelled = loop.add_timer(std::chrono::milliseconds(20),
+									[&]() { order.push_back(2); });
+	loop.add_timer(std::chrono::milliseconds(20), [&]() {
+		order.push_back(20);
+		// Due straight away, but it waits for the next pass.
+		loop.add_timer(std::chrono::milliseconds(0), [&]() {
+			order.push_back(21);
+		});
+	});
+
+	check(loop.cancel_timer(cancelled), "timer can be cancelled");
+	check(!loop.cancel_timer(cancelled), "timer can only be cancelled once");
+
+	while (loop.num_timers() > 0)
+		loop.run_once();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	check(order == vector<int>({ 1, 20, 21, 3 }), "timers run in order");
+	check(elapsed >= std::chrono::milliseconds(30), "timers wait until due");
+	check(elapsed < std::chrono::milliseconds(500), "loop wakes for timers");
+}
+
+void run_remove_checks() {
+	EventLoop loop;
+	int pair_a[2], pair_b[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, pair_a);
+	socketpair(AF_UNIX, SOCK_STREAM, 0, pair_b);
+
+	// Both are readable, so they're in the same batch, and whichever goes
+	// first removes the other.
+	CountingHandler a(&loop, pair_a[0]);
+	CountingHandler b(&loop, pair_b[0]);
+	a.victim = &b;
+	b.victim = &a;
+	loop.add(a.fd, EPOLLIN, &a);
+	loop.add(b.fd, EPOLLIN, &b);
+	write(pair_a[1], "x", 1);
+	write(pair_b[1], "x", 1);
+
+	loop.run_once(1000);
+	check(a.num_events + b.num_events == 1,
+			"removed handler gets no more events from its batch");
+
+	for (int fd : { pair_a[0], pair_a[1], pair_b[0], pair_b[1] })
+		close(fd);
+}
+
+/**
+ * Sends data to an echo connection and checks it all comes back.
+ *
+ * @param loop The loop the connection is on.
+ * @param conn The connection.
+ * @param peer Our end of the connection (non-blocking).
+ * @param total How many bytes to send.
+ */
+bool echo_through(EventLoop &loop, EchoConnection &conn, int peer,
+					size_t total) {
+	string sent, received;
+	for (size_t i = 0; i < total; i++)
+		sent.push_back((char)(i % 251));
+
+	size_t offset = 0;
+	char buffer[65536];
+	for (int pass = 0; pass < 10000 && received.size() < total; pass++) {
+		if (offset < total) {
+			ssize_t n = write(peer, sent.data() + offset, total - offset);
+			if (n > 0)
+				offset += n;
+			if (offset == total)
+				shutdown(peer, SHUT_WR);
+		}
+
+		loop.run_once(10);
+
+		ssize_t n;
+		while ((n = read(peer, buffer, sizeof(buffer))) > 0)
+			received.append(buffer, n);
+	}
+
+	// Give the connection a chance to see we're done.
+	for (int pass = 0; pass < 100 && !conn.closed; pass++)
+		loop.run_once(10);
+
+	return received == sent;
+}
+
+void run_echo_checks() {
+	EventLoop loop;
+	int socks[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, socks);
+	set_non_blocking(socks[0]);
+	set_non_blocking(socks[1]);
+
+	// A small buffer, so the data has to go through it many times over.
+	EchoConnection conn(&loop, socks[0], 4096);
+	conn.start();
+
+	check(echo_through(loop, conn, socks[1], 1000000),
+			"echo sends back more than fits in its buffers");
+	check(conn.closed && !conn.is_open(), "echo closes once the peer is done");
+	close(socks[1]);
+
+	// Closing from outside the loop tells the connection on the next pass.
+	socketpair(AF_UNIX, SOCK_STREAM, 0, socks);
+	set_non_blocking(socks[0]);
+	EchoConnection closer(&loop, socks[0], 4096);
+	closer.start();
+	closer.close();
+	check(!closer.closed, "on_closed waits for the loop");
+	loop.run_once(0);
+	check(closer.closed, "on_closed runs on the next pass");
+	close(socks[1]);
+}
+
+void run_tcp_checks() {
+	// Port 0 picks any free port, which we then look up.
+	int server = setup_server_socket(0, LISTEN_REUSEPORT | LISTEN_LOOPBACK);
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	getsockname(server, (struct sockaddr*)&addr, &addr_len);
+
+	check(accept_connection(server, SOCK_NONBLOCK) == -1,
+			"accept with no one waiting gives -1");
+
+	int client = socket(AF_INET, SOCK_STREAM, 0);
+	connect(client, (struct sockaddr*)&addr, sizeof(addr));
+	set_non_blocking(client);
+
+	{
+		EventLoop loop;
+		EchoConnection *conn = NULL;
+		Acceptor acceptor(&loop, server, [&](int fd) {
+			set_no_delay(fd);
+			conn = new EchoConnection(&loop, fd, 16384);
+			conn->start();
+		});
+
+		loop.run_once(1000);
+		check(conn != NULL, "acceptor accepts the waiting connection");
+		if (conn != NULL) {
+			check(echo_through(loop, *conn, client, 300000), "echo over TCP");
+			delete conn;
+		}
+	}
+
+	close(client);
+	close(server);
+}
+
+int main() {
+	run_timer_checks();
+	run_remove_checks();
+	run_echo_checks();
+	run_tcp_checks();
+
+	if (num_failures != 0) {
+		printf("FAIL (%d checks failed)\n", num_failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
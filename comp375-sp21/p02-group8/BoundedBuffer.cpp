@@ -4,9 +4,30 @@
  * this class.
  */
 #include <cstdio>
+#include <cstring>
+#include <chrono>
 
 #include "BoundedBuffer.hpp"
 
+/*
+ * Instrumentation is only compiled in when BOUNDED_BUFFER_STATS is defined.
+ * Otherwise STATS(...) expands to nothing, so there is no overhead at all.
+ */
+#ifdef BOUNDED_BUFFER_STATS
+#define STATS(...) __VA_ARGS__
+
+/**
+ * Returns the current time in nanoseconds, from a clock that never goes
+ * backwards.
+ */
+static unsigned long long nowNs() {
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+#else
+#define STATS(...)
+#endif
+
 /**
  * Constructor that sets capacity to the given value. The buffer itself is
  * initialized to en empty queue.
@@ -18,6 +39,9 @@ BoundedBuffer::BoundedBuffer(int max_size) {
 
 	// buffer field implicitly has its default (no-arg) constructor called.
 	// This means we have a new buffer with no items in it.
+
+	memset(&this->stats, 0, sizeof(this->stats));
+	STATS(this->stats.enabled = true);
 }
 
 /**
@@ -26,19 +50,43 @@ BoundedBuffer::BoundedBuffer(int max_size) {
 int BoundedBuffer::getItem() {
 	// Create and acquire the lock
 	std::unique_lock<std::mutex> lk(this->mutex);
+	STATS(unsigned long long held_since = nowNs());
 	
 	// Wait for the producer to put something on the buffer
-	while (this->buffer.size() == 0)
+	STATS(bool woken = false);
+	while (this->buffer.size() == 0) {
+		STATS(
+			if (woken)
+				this->stats.spurious_wakeups++;
+			woken = true;
+
+			unsigned long long wait_start = nowNs();
+			this->recordLockHold(wait_start - held_since);
+		)
+
 		this->dataAvailable.wait(lk);
+
+		STATS(
+			held_since = nowNs();
+			this->stats.data_waits++;
+			this->stats.data_wait_ns += held_since - wait_start;
+		)
+	}
 	
 	// Remove the data from the buffer
 	int item = this->buffer.front(); // "this" refers to the calling object...
 	this->buffer.pop(); // ... but like Java it is optional (no this in front of buffer on this line)
 
+	STATS(
+		this->stats.num_gets++;
+		this->recordOccupancy();
+	)
+
 	// Send a signal to the waiting thread
 	this->spaceAvailable.notify_one();
 
 	// Release the ownership of the lock
+	STATS(this->recordLockHold(nowNs() - held_since));
 	lk.unlock();
 
 	return item;
@@ -52,17 +100,76 @@ int BoundedBuffer::getItem() {
 void BoundedBuffer::putItem(int new_item) {
 	// Create and acquire the lock
 	std::unique_lock<std::mutex> lk(this->mutex);
+	STATS(unsigned long long held_since = nowNs());
 
 	// Wait for space to become available
-	while (this->buffer.size() == this->capacity)
+	STATS(bool woken = false);
+	while (this->buffer.size() == this->capacity) {
+		STATS(
+			if (woken)
+				this->stats.spurious_wakeups++;
+			woken = true;
+
+			unsigned long long wait_start = nowNs();
+			this->recordLockHold(wait_start - held_since);
+		)
+
 		this->spaceAvailable.wait(lk);
+
+		STATS(
+			held_since = nowNs();
+			this->stats.space_waits++;
+			this->stats.space_wait_ns += held_since - wait_start;
+		)
+	}
 	
 	// Push the new item onto the buffer
 	buffer.push(new_item);
+
+	STATS(
+		this->stats.num_puts++;
+		this->recordOccupancy();
+	)
 	
 	// Let a consumer know that there is new data
 	this->dataAvailable.notify_one();
 
 	// Unlock the lock
+	STATS(this->recordLockHold(nowNs() - held_since));
 	lk.unlock();
 }
+
+/**
+ * Returns a copy of the counters collected so far. The copy is taken while
+ * holding the lock so that it is consistent.
+ */
+BoundedBufferStats BoundedBuffer::getStats() {
+	std::unique_lock<std::mutex> lk(this->mutex);
+	return this->stats;
+}
+
+/**
+ * Adds one hold of the lock to the counters. Must be called with the lock
+ * held.
+ *
+ * @param hold_ns How long the lock was held for (in nanoseconds).
+ */
+void BoundedBuffer::recordLockHold(unsigned long long hold_ns) {
+	this->stats.lock_hold_ns += hold_ns;
+	if (hold_ns > this->stats.max_lock_hold_ns)
+		this->stats.max_lock_hold_ns = hold_ns;
+}
+
+/**
+ * Adds the current occupancy of the buffer to the histogram. Must be called
+ * with the lock held.
+ */
+void BoundedBuffer::recordOccupancy() {
+	size_t bucket = 0;
+	if (this->capacity > 0)
+		bucket = this->buffer.size() * NUM_OCCUPANCY_BUCKETS / this->capacity;
+	if (bucket >= NUM_OCCUPANCY_BUCKETS)
+		bucket = NUM_OCCUPANCY_BUCKETS - 1;
+
+	this->stats.occupancy[bucket]++;
+}
@@ -1,7 +1,45 @@
+#ifndef BOUNDEDBUFFER_HPP
+#define BOUNDEDBUFFER_HPP
+
 #include <queue>
 #include <mutex>
 #include <condition_variable>
 
+#include "WorkQueue.hpp"
+
+// Number of buckets in the occupancy histogram. Bucket i counts operations
+// that left the buffer between i/N and (i+1)/N full (the last bucket also
+// counts a completely full buffer).
+const int NUM_OCCUPANCY_BUCKETS = 10;
+
+/**
+ * Snapshot of the contention and wait-time counters of a BoundedBuffer.
+ *
+ * The counters are only collected when the program is compiled with
+ * BOUNDED_BUFFER_STATS defined (e.g. "make STATS=1"). Otherwise the
+ * instrumentation compiles to nothing and every counter stays 0.
+ */
+struct BoundedBufferStats {
+	bool enabled; // true if the counters are actually being collected
+
+	unsigned long num_gets; // completed calls to getItem
+	unsigned long num_puts; // completed calls to putItem
+
+	unsigned long data_waits; // times getItem waited on dataAvailable
+	unsigned long space_waits; // times putItem waited on spaceAvailable
+	unsigned long long data_wait_ns; // total time blocked on dataAvailable
+	unsigned long long space_wait_ns; // total time blocked on spaceAvailable
+
+	// wakeups where the condition we waited for still wasn't true
+	unsigned long spurious_wakeups;
+
+	unsigned long long lock_hold_ns; // total time the mutex was held
+	unsigned long long max_lock_hold_ns; // longest single hold of the mutex
+
+	// occupancy of the buffer after each get/put
+	unsigned long occupancy[NUM_OCCUPANCY_BUCKETS];
+};
+
 /**
  * Class representing a buffer with a fixed capacity.
  *
@@ -9,15 +47,18 @@
  * class while the implementation of the constructors, destructors, and methods,
  * and given in an implementation (i.e. cpp) file.
  */
-class BoundedBuffer {
+class BoundedBuffer : public virtual WorkQueue {
   // begin section containing publicly accessible parts of the class
   public:
 	  // public constructor
 	  BoundedBuffer(int max_size);
 	  
 	  // public member functions (a.k.a. methods)
-	  int getItem();
-	  void putItem(int new_item);
+	  virtual int getItem();
+	  virtual void putItem(int new_item);
+
+	  // Returns a copy of the counters collected so far.
+	  BoundedBufferStats getStats();
 
   // begin section containing private (i.e. hidden) parts of the class
   private:
@@ -27,7 +68,11 @@ class BoundedBuffer {
 	  std::condition_variable dataAvailable;
 	  std::condition_variable spaceAvailable;
 	  std::mutex mutex;
+	  BoundedBufferStats stats; // protected by mutex
 
-	  // This class doesn't have any, but we could also have private
-	  // constructors and/or member functions here.
+	  // private member functions, used to update stats
+	  void recordLockHold(unsigned long long hold_ns);
+	  void recordOccupancy();
 };
+
+#endif // BOUNDEDBUFFER_HPP
@@ -0,0 +1,187 @@
+/**
+ * Benchmark comparing the BoundedBuffer and WorkStealingPool work queues.
+ *
+ * For each consumer thread count (1, 2, 4, ... 64), a fixed number of
+ * producer threads put items into the queue while the consumers take them
+ * out and do a small, fixed amount of "work" for each one. The output is one
+ * line per thread count with the throughput (items per second) of each
+ * queue, which can be plotted as a scaling curve.
+ *
+ * When built with "make STATS=1", the BoundedBuffer's contention counters are
+ * also printed after each of its rounds.
+ *
+ * Usage: ./bench-queue [num items] [work per item] [num producers]
+ */
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "BoundedBuffer.hpp"
+#include "WorkStealingPool.hpp"
+
+const int BUFFER_CAPACITY = 1024;
+const int MAX_THREADS = 64;
+
+// Item that tells a consumer there is no more work.
+const int DONE = -1;
+
+using std::thread;
+using std::vector;
+
+// Keeps the compiler from optimizing away the "work" we do for each item.
+static std::atomic<unsigned long> checksum(0);
+
+/**
+ * Puts one DONE item in the queue for each consumer.
+ */
+void stopConsumers(WorkQueue &queue, int num_consumers) {
+	for (int i = 0; i < num_consumers; ++i)
+		queue.putItem(DONE);
+}
+
+/**
+ * Function run by a consumer: takes items until it gets DONE.
+ *
+ * The DONE items only go in once every real item has been taken out (by
+ * whichever consumer takes the last one). If they went in any earlier, a
+ * WorkStealingPool worker could move some of them onto its deque along with
+ * real items, pop a DONE first (since it pops the newest) and stop, leaving
+ * the real items behind it for nobody.
+ *
+ * @param queue The shared work queue.
+ * @param work_per_item Number of loop iterations of busy work per item.
+ * @param items_left Number of real items not taken out yet.
+ * @param num_consumers Number of consumers to stop after the last item.
+ */
+void consume(WorkQueue &queue, int work_per_item,
+				std::atomic<int> &items_left, int num_consumers) {
+	unsigned long sum = 0;
+
+	while (true) {
+		int item = queue.getItem();
+		if (item == DONE)
+			break;
+
+		for (int i = 0; i < work_per_item; ++i)
+			sum = sum * 31 + item + i;
+
+		if (--items_left == 0)
+			stopConsumers(queue, num_consumers);
+	}
+
+	checksum += sum;
+}
+
+/**
+ * Function run by a producer: puts num_items items in the queue.
+ *
+ * @param queue The shared work queue.
+ * @param num_items How many items to produce.
+ */
+void produce(WorkQueue &queue, int num_items) {
+	for (int i = 0; i < num_items; ++i)
+		queue.putItem(i);
+}
+
+/**
+ * Prints a summary of a BoundedBuffer's contention counters.
+ *
+ * @param stats Snapshot of the counters.
+ */
+void printStats(const BoundedBufferStats &stats) {
+	unsigned long ops = stats.num_gets + stats.num_puts;
+	if (ops == 0)
+		return;
+
+	printf("#   waits: data %lu (%.1f ms), space %lu (%.1f ms), "
+			"spurious %lu\n",
+			stats.data_waits, stats.data_wait_ns / 1e6,
+			stats.space_waits, stats.space_wait_ns / 1e6,
+			stats.spurious_wakeups);
+	printf("#   lock hold: avg %.0f ns, max %llu ns\n",
+			(double)stats.lock_hold_ns / ops, stats.max_lock_hold_ns);
+	printf("#   occupancy:");
+	for (int i = 0; i < NUM_OCCUPANCY_BUCKETS; ++i)
+		printf(" %.0f%%", 100.0 * stats.occupancy[i] / ops);
+	printf("\n");
+}
+
+/**
+ * Runs one round of the benchmark.
+ *
+ * @return Throughput in items per second.
+ */
+double runRound(WorkQueue &queue, int num_consumers, int num_producers,
+				int num_items, int work_per_item) {
+	int items_produced = (num_items / num_producers) * num_producers;
+	std::atomic<int> items_left(items_produced);
+
+	auto start = std::chrono::steady_clock::now();
+
+	vector<thread> consumers;
+	for (int i = 0; i < num_consumers; ++i)
+		consumers.emplace_back(consume, std::ref(queue), work_per_item,
+								std::ref(items_left), num_consumers);
+
+	vector<thread> producers;
+	for (int i = 0; i < num_producers; ++i)
+		producers.emplace_back(produce, std::ref(queue),
+								num_items / num_producers);
+
+	for (auto &t : producers)
+		t.join();
+
+	// With no real items, there's no last one to stop the consumers.
+	if (items_produced == 0)
+		stopConsumers(queue, num_consumers);
+
+	for (auto &t : consumers)
+		t.join();
+
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+
+	return items_produced / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+	int num_items = (argc > 1) ? atoi(argv[1]) : 1000000;
+	int work_per_item = (argc > 2) ? atoi(argv[2]) : 100;
+	int num_producers = (argc > 3) ? atoi(argv[3]) : 4;
+
+	if (num_items <= 0 || work_per_item < 0 || num_producers <= 0) {
+		printf("usage: %s [num items] [work per item] [num producers]\n",
+				argv[0]);
+		exit(1);
+	}
+
+	printf("# %d items, %d work per item, %d producers\n",
+			num_items, work_per_item, num_producers);
+	printf("%-8s %18s %18s\n", "threads", "bounded (items/s)",
+			"stealing (items/s)");
+
+	for (int num_threads = 1; num_threads <= MAX_THREADS; num_threads *= 2) {
+		BoundedBuffer bounded(BUFFER_CAPACITY);
+		double bounded_rate = runRound(bounded, num_threads, num_producers,
+										num_items, work_per_item);
+
+		WorkStealingPool stealing(BUFFER_CAPACITY, num_threads);
+		double stealing_rate = runRound(stealing, num_threads, num_producers,
+										num_items, work_per_item);
+
+		printf("%-8d %18.0f %18.0f\n", num_threads, bounded_rate,
+				stealing_rate);
+
+		BoundedBufferStats stats = bounded.getStats();
+		if (stats.enabled)
+			printStats(stats);
+	}
+
+	printf("# checksum %lu\n", checksum.load());
+
+	return 0;
+}
@@ -6,6 +6,10 @@
  * 	1. The port number on which to bind and listen for connections
  * 	2. The directory out of which to serve files.
  *
+ * Passing the optional -w flag (before the arguments) hands clients out to
+ * the worker threads with a work-stealing pool instead of a single shared
+ * bounded buffer.
+ *
  * Author 1: Nico de la Fuente (ndelafuente@sandiego.edu)
  * Author 2: Christian Gideon (christiangideon@sandiego.edu)
  *
@@ -26,6 +30,7 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <getopt.h>
 
 // C++ standard libraries
 #include <vector>
@@ -40,6 +45,8 @@
 
 // Custom headers
 #include "BoundedBuffer.hpp"
+#include "NetSocket.h"
+#include "WorkStealingPool.hpp"
 
 #define BUFF_SIZE 256
 #define NUM_CLIENTS 12
@@ -57,13 +64,9 @@ using std::thread;
 using std::regex;
 using std::istringstream;
 
-// This will limit how many clients can be waiting for a connection.
-static const int BACKLOG = 10;
-
 /* Forward declarations */
-int createSocketAndListen(const int port_num);
-void acceptConnections(const int server_sock);
-void handleMultipleClients(BoundedBuffer &client_socks);
+void acceptConnections(const int server_sock, WorkQueue &client_sockets);
+void handleMultipleClients(WorkQueue &client_socks);
 void handleClient(const int client_sock);
 // General communication
 void sendData(int socked_fd, const char *data, size_t data_length);
@@ -79,165 +82,87 @@ string generateIndex(string uri, string full_path);
 
 int main(int argc, char** argv) {
 
+	/* Check whether the user asked for the work-stealing pool. */
+	bool use_work_stealing = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "w")) != -1) {
+		if (opt == 'w')
+			use_work_stealing = true;
+	}
+
 	/* Make sure the user called our program correctly. */
-	if (argc != 3) {
+	if (argc - optind != 2) {
 		// Print a proper error message informing user of proper usage
-		cout << "usage: " << argv[0] << " <port number> WWW\n";
+		cout << "usage: " << argv[0] << " [-w] <port number> WWW\n";
 		exit(1);
 	}
 
     /* Read the port number from the first command line argument. */
-    int port = std::stoi(argv[1]);
+    int port = std::stoi(argv[optind]);
 
 	/* Create a socket and start listening for new connections on the
-	 * specified port. */
-	int server_sock = createSocketAndListen(port);
+	 * specified port. Only the accepting thread uses it, so it can block. */
+	int server_sock = setup_server_socket(port, LISTEN_BLOCKING);
+
+	/* Create a shared queue to store client sockets, and a pool of threads
+	 * to handle the clients we put in it. */
+	WorkQueue *client_sockets;
+	if (use_work_stealing)
+		client_sockets = new WorkStealingPool(NUM_CLIENTS, NUM_THREADS);
+	else
+		client_sockets = new BoundedBuffer(NUM_CLIENTS);
+
+	for (size_t i = 0; i < NUM_THREADS; ++i) {
+		thread consumer(handleMultipleClients, std::ref(*client_sockets));
+
+		// Let the consumers run without waiting to be rejoined
+		consumer.detach();
+	}
 
 	/* Now let's start accepting connections. */
-	acceptConnections(server_sock);
+	acceptConnections(server_sock, *client_sockets);
 
     close(server_sock);
 
 	return 0;
 }
 
-/**
- * Creates a new socket and starts listening on that socket for new
- * connections.
- *
- * @param port_num The port number on which to listen for connections.
- * @returns The socket file descriptor
- */
-int createSocketAndListen(const int port_num) {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        perror("Creating socket failed");
-        exit(1);
-    }
-
-    /* 
-	 * A server socket is bound to a port, which it will listen on for incoming
-     * connections.  By default, when a bound socket is closed, the OS waits a
-     * couple of minutes before allowing the port to be re-used.  This is
-     * inconvenient when you're developing an application, since it means that
-     * you have to wait a minute or two after you run to try things again, so
-     * we can disable the wait time by setting a socket option called
-     * SO_REUSEADDR, which tells the OS that we want to be able to immediately
-     * re-bind to that same port. See the socket(7) man page ("man 7 socket")
-     * and setsockopt(2) pages for more details about socket options.
-	 */
-    int reuse_true = 1;
-
-	int retval; // for checking return values
-
-    retval = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse_true,
-                        sizeof(reuse_true));
-
-    if (retval < 0) {
-        perror("Setting socket option failed");
-        exit(1);
-    }
-
-    /*
-	 * Create an address structure.  This is very similar to what we saw on the
-     * client side, only this time, we're not telling the OS where to connect,
-     * we're telling it to bind to a particular address and port to receive
-     * incoming connections.  Like the client side, we must use htons() to put
-     * the port number in network byte order.  When specifying the IP address,
-     * we use a special constant, INADDR_ANY, which tells the OS to bind to all
-     * of the system's addresses.  If your machine has multiple network
-     * interfaces, and you only wanted to accept connections from one of them,
-     * you could supply the address of the interface you wanted to use here.
-	 */
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port_num);
-    addr.sin_addr.s_addr = INADDR_ANY;
-
-    /* 
-	 * As its name implies, this system call asks the OS to bind the socket to
-     * address and port specified above.
-	 */
-    retval = bind(sock, (struct sockaddr*)&addr, sizeof(addr));
-    if (retval < 0) {
-        perror("Error binding to port");
-        exit(1);
-    }
-
-    /* 
-	 * Now that we've bound to an address and port, we tell the OS that we're
-     * ready to start listening for client connections. This effectively
-	 * activates the server socket. BACKLOG (a global constant defined above)
-	 * tells the OS how much space to reserve for incoming connections that have
-	 * not yet been accepted.
-	 */
-    retval = listen(sock, BACKLOG);
-    if (retval < 0) {
-        perror("Error listening for connections");
-        exit(1);
-    }
-
-	return sock;
-}
-
 /**
  * Sit around forever accepting new connections from client.
  *
  * @param server_sock The socket used by the server.
+ * @param client_sockets Shared queue that the worker threads take clients from.
  */
-void acceptConnections(const int server_sock) {
+void acceptConnections(const int server_sock, WorkQueue &client_sockets) {
     while (true) {
-        // Declare a socket for the client connection.
-        int sock;
-
         /* 
-		 * Another address structure.  This time, the system will automatically
-         * fill it in, when we accept a connection, to tell us where the
-         * connection came from.
-		 */
-        struct sockaddr_in remote_addr;
-        unsigned int socklen = sizeof(remote_addr); 
-
-        /* 
-		 * Accept the first waiting connection from the server socket and
-         * populate the address information.  The result (sock) is a socket
-         * descriptor for the conversation with the newly connected client.  If
-         * there are no pending connections in the back log, this function will
-         * block indefinitely while waiting for a client connection to be made.
+		 * Accept the first waiting connection from the server socket.  The
+		 * result (sock) is a socket descriptor for the conversation with the
+		 * newly connected client.  If there are no pending connections in the
+		 * back log, this function will block indefinitely while waiting for a
+		 * client connection to be made.
          */
-        sock = accept(server_sock, (struct sockaddr*) &remote_addr, &socklen);
-        if (sock < 0) {
-            perror("Error accepting connection");
-            exit(1);
-        }
+        int sock = accept_connection(server_sock, SOCK_CLOEXEC);
+        if (sock < 0)
+            continue;
 
         /* 
 		 * At this point, you have a connected socket (named sock) that you can
          * use to send() and recv(). The handleClient function should handle all
 		 * of the sending and receiving to/from the client.
 		 */
-	
-		BoundedBuffer client_sockets(NUM_CLIENTS); // a shared buffer to store socks
 
-		// Put the socket in the buffer
+		// Put the socket in the queue for one of the workers to handle
 		client_sockets.putItem(sock);
-
-		// Create independent threads to handle multiple client requests
-		for (size_t i = 0; i < NUM_THREADS; ++i) {
-			thread consumer(handleMultipleClients, std::ref(client_sockets));
-
-			// Let the consumers run without waiting to be rejoined
-			consumer.detach();
-		}
     }
 }
 
 /**
  * A thread's sole purpose: to wait for someone to connect to the server.
  * 
- * @param client_socks The client's socket file descriptor.
+ * @param client_socks Shared queue of client socket file descriptors.
  */
-void handleMultipleClients(BoundedBuffer &client_socks) {
+void handleMultipleClients(WorkQueue &client_socks) {
 	while (true) {
 		// Wait for a socket to be put on the buffer
 		int sock = client_socks.getItem();
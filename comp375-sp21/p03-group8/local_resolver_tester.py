@@ -0,0 +1,210 @@
+"""
+Module: local_resolver_tester
+
+Test cases for the C resolver, run against the stand-in nameservers in
+test_nameserver (so they don't need the internet, and can check which
+queries the cache saves).
+
+Usage: python3 local_resolver_tester.py (after make resolver)
+"""
+
+import os
+import re
+import tempfile
+import subprocess
+import unittest
+
+from test_nameserver import TestNameserver, SERVERS
+
+
+class TestLocalResolver(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.server = TestNameserver()
+        cls.roots = tempfile.NamedTemporaryFile("w", suffix=".txt",
+                                                delete=False)
+        cls.roots.write(list(SERVERS)[0] + "\n")
+        cls.roots.close()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.server.stop()
+        os.unlink(cls.roots.name)
+
+    def resolve(self, *hostnames, is_mx=False):
+        """
+        Runs the resolver on some hostnames (in one process, so they share a
+        cache).
+
+        Returns:
+            tuple: The answers (None where it couldn't resolve one), and the
+                number of queries the servers got.
+        """
+        before = self.server.total_queries()
+        args = ["./resolver", "-r", self.roots.name, "-p",
+                str(self.server.port)]
+        if is_mx:
+            args.append("-m")
+        output = subprocess.run(args + list(hostnames), capture_output=True,
+                                text=True, timeout=30).stdout
+
+        answers = []
+        for line in output.splitlines():
+            match = re.match(r"Answer: (\S+)", line)
+            if match:
+                answers.append(match.group(1))
+            elif line.startswith("Could not resolve"):
+                answers.append(None)
+        self.assertEqual(len(answers), len(hostnames), output)
+        return answers, self.server.total_queries() - before
+
+    def test_a_record(self):
+        """
+        Tests following referrals from the root down, with glue.
+        """
+        answers, queries = self.resolve("www.example.com")
+        self.assertEqual(answers, ["10.0.0.1"])
+        self.assertEqual(queries, 3)  # root, com, example.com
+
+        answers, _ = self.resolve("WWW.Example.COM.", "example.com")
+        self.assertEqual(answers, ["10.0.0.1", "10.0.0.10"])
+
+    def test_cname_record(self):
+        """
+        Tests chasing CNAMEs, within a zone and into another one.
+        """
+        with self.subTest(msg="CNAME in the same zone"):
+            answers, _ = self.resolve("alias.example.com")
+            self.assertEqual(answers, ["10.0.0.1"])
+
+        with self.subTest(msg="CNAME to a zone whose server has no glue"):
+            answers, _ = self.resolve("far.example.com")
+            self.assertEqual(answers, ["10.0.0.2"])
+
+    def test_mx_record(self):
+        """
+        Tests that MX lookups give the most preferred mail server.
+        """
+        answers, _ = self.resolve("mail.example.com", is_mx=True)
+        self.assertEqual(answers, ["mx.example.com"])
+
+    def test_negative(self):
+        """
+        Tests names that don't exist, or don't have the type asked for.
+        """
+        with self.subTest(msg="NXDOMAIN"):
+            answers, _ = self.resolve("nope.example.com", "nope.nosuchtld")
+            self.assertEqual(answers, [None, None])
+
+        with self.subTest(msg="NODATA"):
+            answers, _ = self.resolve("www.example.com", is_mx=True)
+            self.assertEqual(answers, [None])
+
+    def test_cache(self):
+        """
+        Tests that repeated lookups are answered from the cache, and that
+        lookups in a known zone skip the root and TLD servers.
+        """
+        with self.subTest(msg="Repeated answer"):
+            answers, queries = self.resolve("www.example.com",
+                                            "www.example.com")
+            self.assertEqual(answers, ["10.0.0.1", "10.0.0.1"])
+            self.assertEqual(queries, 3)
+
+        with self.subTest(msg="Cached delegation"):
+            answers, queries = self.resolve("www.example.com",
+                                            "mx.example.com")
+            self.assertEqual(answers, ["10.0.0.1", "10.0.0.25"])
+            self.assertEqual(queries, 4)
+
+        with self.subTest(msg="Cached alias"):
+            answers, queries = self.resolve("alias.example.com",
+                                            "alias.example.com")
+            self.assertEqual(answers, ["10.0.0.1", "10.0.0.1"])
+            self.assertEqual(queries, 4)  # alias, then www
+
+        with self.subTest(msg="Cached negative answers"):
+            answers, queries = self.resolve("nope.example.com",
+                                            "nope.example.com")
+            self.assertEqual(answers, [None, None])
+            self.assertEqual(queries, 3)
+
+        with self.subTest(msg="Cached nameserver address"):
+            answers, queries = self.resolve("far.example.com",
+                                            "www.glueless.net")
+            self.assertEqual(answers, ["10.0.0.2", "10.0.0.2"])
+            self.assertEqual(queries, 7)
+
+    def test_ttl(self):
+        """
+        Tests that cached records expire after their TTL.
+        """
+        with self.subTest(msg="Within the TTL"):
+            answers, queries = self.resolve("short.example.com",
+                                            "short.example.com")
+            self.assertEqual(answers, ["10.0.0.3", "10.0.0.3"])
+            self.assertEqual(queries, 3)
+
+        # A query that's lost (and retried after a second) in between gives
+        # the 1 second TTL time to run out.
+        self.server.drops["lost.example.com"] = 1
+        with self.subTest(msg="After the TTL"):
+            answers, queries = self.resolve("short.example.com",
+                                            "lost.example.com",
+                                            "short.example.com")
+            self.assertEqual(answers, ["10.0.0.3", None, "10.0.0.3"])
+            self.assertEqual(queries, 6)
+
+    def resolve_batch(self, hostnames, concurrency):
+        """
+        Runs the resolver in batch mode on a file of hostnames.
+
+        Returns:
+            tuple: The answers by hostname (None where it couldn't resolve
+                one), and the summary it printed at the end.
+        """
+        with tempfile.NamedTemporaryFile("w", suffix=".txt") as names:
+            names.write("\n".join(hostnames) + "\n")
+            names.flush()
+            result = subprocess.run(
+                ["./resolver", "-r", self.roots.name, "-p",
+                 str(self.server.port), "-c", str(concurrency), "-b",
+                 names.name], capture_output=True, text=True, timeout=30)
+
+        answers = {}
+        for line in result.stdout.splitlines():
+            hostname, answer = line.split()
+            answers[hostname] = None if answer == "-" else answer
+        return answers, result.stderr
+
+    def test_batch(self):
+        """
+        Tests resolving a file of hostnames, many at once.
+        """
+        expected = {
+            "www.example.com": "10.0.0.1",
+            "alias.example.com": "10.0.0.1",
+            "far.example.com": "10.0.0.2",
+            "mx.example.com": "10.0.0.25",
+            "nope.example.com": None,
+            "bad..name": None,
+        }
+        for i in range(500):
+            expected["host%d.example.com" % i] = None
+
+        with self.subTest(msg="All the answers"):
+            answers, summary = self.resolve_batch(list(expected) * 2, 1000)
+            self.assertEqual(answers, expected)
+            self.assertIn("of %d names" % (2 * len(expected)), summary)
+            self.assertIn("names/sec", summary)
+
+        self.server.drops["www.glueless.net"] = 1
+        with self.subTest(msg="Retry after a lost query"):
+            answers, summary = self.resolve_batch(["www.glueless.net"], 10)
+            self.assertEqual(answers, {"www.glueless.net": "10.0.0.2"})
+            self.assertIn("1 timed out", summary)
+
+
+if __name__ == "__main__":
+    unittest.main()
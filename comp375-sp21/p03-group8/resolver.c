@@ -1,12 +1,45 @@
+/*
+ * File: resolver.c
+ *
+ * An iterative DNS resolver. Each lookup starts from one of the root servers
+ * (listed in root-servers.txt), follows referrals down to the servers that
+ * are authoritative for the name (using glue records where the referral
+ * includes them, and looking up the nameservers' addresses where it
+ * doesn't), and chases CNAMEs until it finds the A (or MX) record.
+ *
+ * Everything learned along the way goes into a cache that respects each
+ * record's TTL: answers, negative answers (names that don't exist, or don't
+ * have the type we asked for), and NS delegations with their addresses. A
+ * later lookup starts from the closest delegation the cache knows about,
+ * so names under the same zone skip the root and TLD round trips.
+ *
+ * Lookups don't wait on each other: each one is moved along by the responses
+ * to its queries, which all come in through an epoll loop over a handful of
+ * sockets. A query that gets no response is sent to the next server, waiting
+ * twice as long each time. In batch mode (-b), thousands of lookups are kept
+ * going at once.
+ *
+ * Usage: ./resolver [-m] [-v] [-r root_servers_file] [-p port] <hostname>...
+ *        ./resolver [-m] [-r root_servers_file] [-p port] [-c concurrency]
+ *                   -b hostnames_file
+ */
+
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
+#include <getopt.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
 #include <sys/socket.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdbool.h>
 
@@ -15,26 +48,556 @@
 #define MAX_QUERY_SIZE 1024
 #define MAX_RESPONSE_SIZE 4096
 
-// Note: uint8_t* is a pointer to 8 bits of data.
+// Longest name we handle, as a C string (RFC 1035 allows 255 bytes on the
+// wire, which is at most 253 characters written out).
+#define MAX_NAME_LEN 256
+
+// Records we keep from each section of a response (the rest are ignored).
+#define MAX_SECTION_RECORDS 32
+
+// Most servers we know about for a zone at once.
+#define MAX_SERVERS 16
+
+// Most queries one lookup may send (including looking up the addresses of
+// nameservers along the way), so a referral loop can't run forever.
+#define MAX_QUERIES_PER_LOOKUP 64
+
+// Most CNAMEs we follow for one lookup.
+#define MAX_CNAME_CHAIN 8
+
+// How deep lookups of nameserver addresses (for referrals without glue)
+// can go.
+#define MAX_NS_DEPTH 4
+
+// Milliseconds to wait for a server before trying the next one. Each try
+// waits twice as long as the one before, up to the maximum.
+#define FIRST_TIMEOUT_MS 1000
+#define MAX_TIMEOUT_MS 5000
+
+// Tries at asking a zone's servers before giving up on the lookup.
+#define MAX_TRIES 4
+
+// Sockets queries are spread over (each has its own 16-bit ID space).
+#define NUM_SOCKETS 8
+
+// Receive buffer for each socket, and responses read from one per call.
+#define SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+#define RECV_BATCH 32
+
+// Lookups going at once in batch mode: by default, and at most (few
+// enough that each socket always has IDs to spare).
+#define DEFAULT_CONCURRENCY 2000
+#define MAX_CONCURRENCY 50000
+
+// Buckets in a new cache (it grows as it fills).
+#define CACHE_INITIAL_BUCKETS 1024
+
+// Resource record types and classes (RFC 1035, Section 3.2).
+#define TYPE_A 1
+#define TYPE_NS 2
+#define TYPE_CNAME 5
+#define TYPE_SOA 6
+#define TYPE_MX 15
+#define TYPE_ANY 255 // used in the cache for names that don't exist
+#define CLASS_IN 1
+
+// Header flags and response codes (RFC 1035, Section 4.1.1).
+#define FLAG_RESPONSE 0x8000
+#define FLAG_TRUNCATED 0x0200
+#define RCODE_MASK 0x000f
+#define RCODE_NOERROR 0
+#define RCODE_NXDOMAIN 3
+
+/**
+ * A resource record from a response. Only what we use is kept.
+ */
+typedef struct {
+	char name[MAX_NAME_LEN];
+	uint16_t type;
+	uint32_t ttl;
+	uint16_t preference;   // MX only
+	uint32_t negative_ttl; // SOA only: its MINIMUM field (RFC 2308)
+	char data[MAX_NAME_LEN]; // address (A), or name (NS, CNAME, MX, SOA)
+} Record;
+
+enum { ANSWER, AUTHORITY, ADDITIONAL, NUM_SECTIONS };
+
+/**
+ * A parsed DNS response.
+ */
+typedef struct {
+	uint16_t id;
+	uint16_t flags;
+	char qname[MAX_NAME_LEN];
+	uint16_t qtype;
+	int num_records[NUM_SECTIONS];
+	Record records[NUM_SECTIONS][MAX_SECTION_RECORDS];
+} Message;
+
+/**
+ * A set of cached records with the same name and type (or a negative answer
+ * for that name and type).
+ */
+typedef struct CacheEntry {
+	struct CacheEntry *next; // next entry in the same bucket
+	char *name;
+	uint16_t type;
+	bool negative;  // true if the name (or type) is known not to exist
+	double expires; // when the entry stops being valid (see now_seconds)
+	int count;
+	char **values;  // addresses or names (MX are sorted by preference)
+} CacheEntry;
+
+/**
+ * Hash table of cache entries, keyed by name and type.
+ */
+typedef struct {
+	CacheEntry **buckets;
+	size_t num_buckets;
+	size_t size;
+} Cache;
+
+/**
+ * The servers for a zone, which we ask in turn until one answers.
+ */
+typedef struct {
+	char zone[MAX_NAME_LEN];
+	struct in_addr addrs[MAX_SERVERS];
+	int count;
+} ServerList;
+
+struct Resolver;
+struct Lookup;
+
+/**
+ * Called when a lookup is done, with its answer (if found is set) in answer.
+ */
+typedef void (*LookupDone)(struct Resolver *r, struct Lookup *l);
+
+/**
+ * A lookup of one name's record of one type. It sends one query at a time,
+ * and is moved on by the response (or the query timing out).
+ */
+typedef struct Lookup {
+	char hostname[MAX_NAME_LEN]; // name we were asked for
+	char name[MAX_NAME_LEN];     // name we're after now (after any CNAMEs)
+	uint16_t qtype;
+	int cnames;       // CNAMEs followed so far
+	int depth;        // how many nameserver lookups this one is nested in
+	int *budget;      // queries left, shared with any nameserver lookups
+	int own_budget;
+
+	// Who to tell when we're done: the lookup we're finding a nameserver's
+	// address for, or else the done function.
+	struct Lookup *parent;
+	LookupDone done;
+	void *context;
+
+	// The servers we're asking, and how many times we've asked.
+	ServerList servers;
+	int next_server;
+	int tries;
+
+	// The query we're waiting for a response to (if in_flight).
+	bool in_flight;
+	int sock_index;
+	uint16_t id;
+	struct in_addr server;
+	double deadline;
+	size_t heap_index; // place in the resolver's heap of timeouts
+
+	// Nameservers (for a referral without glue) we can still look up.
+	char ns_names[MAX_SERVERS][MAX_NAME_LEN];
+	int num_ns;
+	int next_ns;
+
+	bool found;
+	char answer[MAX_NAME_LEN];
+} Lookup;
+
+/**
+ * Everything a resolver needs between lookups.
+ */
+typedef struct Resolver {
+	uint16_t port;  // port that nameservers listen on
+	struct in_addr roots[MAX_SERVERS];
+	int num_roots;
+	Cache cache;
+	bool verbose;
+
+	int epoll_fd;
+	int socks[NUM_SOCKETS];
+	int next_socket;
+	Lookup **pending[NUM_SOCKETS]; // lookups waiting on each socket, by ID
+
+	// Lookups with a query out, as a heap ordered by deadline.
+	Lookup **timeouts;
+	size_t num_timeouts;
+	size_t timeouts_capacity;
+
+	uint8_t (*recv_buffers)[MAX_RESPONSE_SIZE];
+	Message *msg;   // the response being handled
+	int active;     // lookups started but not done (not counting nameservers)
+
+	unsigned long queries_sent;
+	unsigned long timeouts_seen;  // queries that got no response in time
+	unsigned long cached_lookups; // lookups answered without any queries
+} Resolver;
+
+/**
+ * How far a lookup got.
+ */
+typedef enum {
+	LOOKUP_FOUND,    // answer holds the answer
+	LOOKUP_NEGATIVE, // the name (or type) doesn't exist
+	LOOKUP_CNAME,    // the name is an alias for next_name
+	LOOKUP_MISS      // not in the cache
+} LookupStatus;
+
+static void continue_lookup(Resolver *r, Lookup *l);
+
+/**
+ * Gets the current time in seconds, from a clock that never jumps.
+ */
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Gets a random query ID, so that a response can't easily be forged.
+ */
+static uint16_t random_id(void) {
+	// Fetched a batch at a time, since there can be a lot of queries.
+	static uint16_t ids[256];
+	static size_t num_ids = 0;
+	if (num_ids == 0) {
+		if (getrandom(ids, sizeof(ids), 0) != sizeof(ids)) {
+			for (size_t i = 0; i < 256; i++)
+				ids[i] = (uint16_t)rand();
+		}
+		num_ids = 256;
+	}
+	return ids[--num_ids];
+}
+
+/**
+ * Checks if a name is in a zone, i.e. is the zone's name or ends with it.
+ * Every name is in the root zone ("").
+ */
+static bool in_zone(const char *name, const char *zone) {
+	size_t name_len = strlen(name);
+	size_t zone_len = strlen(zone);
+	if (zone_len == 0)
+		return true;
+	if (name_len < zone_len)
+		return false;
+	if (strcmp(name + name_len - zone_len, zone) != 0)
+		return false;
+	return name_len == zone_len || name[name_len - zone_len - 1] == '.';
+}
+
+/**
+ * Turns a hostname into the form we use everywhere: lower case, with no
+ * trailing dot.
+ *
+ * @return false if it isn't a valid hostname.
+ */
+static bool normalize_name(const char *hostname, char *name) {
+	size_t len = strlen(hostname);
+	if (len > 0 && hostname[len - 1] == '.')
+		len--;
+	if (len == 0 || len > MAX_NAME_LEN - 3)
+		return false;
+
+	size_t label_len = 0;
+	for (size_t i = 0; i < len; i++) {
+		char c = hostname[i];
+		if (c == '.') {
+			if (label_len == 0)
+				return false;
+			label_len = 0;
+		}
+		else if (++label_len > 63) {
+			return false;
+		}
+		name[i] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+	}
+	name[len] = '\0';
+	return label_len > 0;
+}
+
+/*
+ * Cache
+ */
+
+/**
+ * Hashes a name and type (FNV-1a).
+ */
+static size_t cache_hash(const char *name, uint16_t type) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char *c = name; *c; c++)
+		hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+	hash = (hash ^ type) * 1099511628211ULL;
+	return (size_t)hash;
+}
+
+static void cache_init(Cache *cache) {
+	cache->num_buckets = CACHE_INITIAL_BUCKETS;
+	cache->buckets = calloc(cache->num_buckets, sizeof(CacheEntry*));
+	cache->size = 0;
+	if (cache->buckets == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+}
+
+static void free_entry(CacheEntry *entry) {
+	for (int i = 0; i < entry->count; i++)
+		free(entry->values[i]);
+	free(entry->values);
+	free(entry->name);
+	free(entry);
+}
 
 /**
- * Constructs a DNS query for hostname's Type A record.
+ * Doubles the number of buckets, so chains stay short.
+ */
+static void cache_grow(Cache *cache) {
+	size_t num_buckets = cache->num_buckets * 2;
+	CacheEntry **buckets = calloc(num_buckets, sizeof(CacheEntry*));
+	if (buckets == NULL)
+		return; // carry on with longer chains
+
+	for (size_t b = 0; b < cache->num_buckets; b++) {
+		CacheEntry *entry = cache->buckets[b];
+		while (entry != NULL) {
+			CacheEntry *next = entry->next;
+			size_t i = cache_hash(entry->name, entry->type) & (num_buckets - 1);
+			entry->next = buckets[i];
+			buckets[i] = entry;
+			entry = next;
+		}
+	}
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->num_buckets = num_buckets;
+}
+
+/**
+ * Finds the entry for a name and type, if it hasn't expired (expired entries
+ * are removed as they are found).
+ *
+ * @return The entry, or NULL if there isn't a valid one.
+ */
+static CacheEntry *cache_lookup(Cache *cache, const char *name, uint16_t type,
+								double now) {
+	size_t i = cache_hash(name, type) & (cache->num_buckets - 1);
+	CacheEntry **link = &cache->buckets[i];
+	while (*link != NULL) {
+		CacheEntry *entry = *link;
+		if (entry->type == type && strcmp(entry->name, name) == 0) {
+			if (entry->expires > now)
+				return entry;
+
+			*link = entry->next;
+			free_entry(entry);
+			cache->size--;
+			return NULL;
+		}
+		link = &entry->next;
+	}
+	return NULL;
+}
+
+/**
+ * Stores an entry, replacing any entry with the same name and type.
+ *
+ * @param values The values (unused if negative).
+ * @param count Number of values.
+ * @param ttl Seconds the entry is valid for.
+ */
+static void cache_store(Cache *cache, const char *name, uint16_t type,
+						bool negative, char *const *values, int count,
+						uint32_t ttl, double now) {
+	if (ttl == 0)
+		return; // only good for the response it came in
+
+	size_t i = cache_hash(name, type) & (cache->num_buckets - 1);
+	for (CacheEntry **link = &cache->buckets[i]; *link != NULL;
+			link = &(*link)->next) {
+		if ((*link)->type == type && strcmp((*link)->name, name) == 0) {
+			CacheEntry *old = *link;
+			*link = old->next;
+			free_entry(old);
+			cache->size--;
+			break;
+		}
+	}
+
+	CacheEntry *entry = calloc(1, sizeof(CacheEntry));
+	entry->name = strdup(name);
+	entry->type = type;
+	entry->negative = negative;
+	entry->expires = now + ttl;
+	if (!negative && count > 0) {
+		entry->values = calloc(count, sizeof(char*));
+		for (int v = 0; v < count; v++)
+			entry->values[v] = strdup(values[v]);
+		entry->count = count;
+	}
+
+	entry->next = cache->buckets[i];
+	cache->buckets[i] = entry;
+	if (++cache->size > cache->num_buckets)
+		cache_grow(cache);
+}
+
+/**
+ * Caches every set of records in a section that is in the given zone (i.e.
+ * that the server that sent them is allowed to tell us about).
+ */
+static void cache_section(Cache *cache, const Record *records, int count,
+							const char *zone, double now) {
+	for (int i = 0; i < count; i++) {
+		const Record *rec = &records[i];
+		if (rec->type != TYPE_A && rec->type != TYPE_NS
+				&& rec->type != TYPE_CNAME && rec->type != TYPE_MX)
+			continue;
+		if (!in_zone(rec->name, zone))
+			continue;
+
+		// Only the first record of each set gathers the set.
+		bool seen = false;
+		for (int j = 0; j < i && !seen; j++)
+			seen = records[j].type == rec->type
+					&& strcmp(records[j].name, rec->name) == 0;
+		if (seen)
+			continue;
+
+		// Gather the set (MX lowest preference first), which lives as long
+		// as its shortest lived record.
+		char *values[MAX_SECTION_RECORDS];
+		uint16_t prefs[MAX_SECTION_RECORDS];
+		int num_values = 0;
+		uint32_t ttl = rec->ttl;
+		for (int j = i; j < count; j++) {
+			if (records[j].type != rec->type
+					|| strcmp(records[j].name, rec->name) != 0)
+				continue;
+
+			int k = num_values++;
+			while (k > 0 && prefs[k - 1] > records[j].preference) {
+				values[k] = values[k - 1];
+				prefs[k] = prefs[k - 1];
+				k--;
+			}
+			values[k] = (char*)records[j].data;
+			prefs[k] = records[j].preference;
+			if (records[j].ttl < ttl)
+				ttl = records[j].ttl;
+		}
+
+		cache_store(cache, rec->name, rec->type, false, values, num_values,
+					ttl, now);
+	}
+}
+
+/**
+ * Looks for an answer in the cache.
+ *
+ * @param answer Where to put the answer, if it's there.
+ * @param next_name Where to put the name it's an alias for, if it is one.
+ */
+static LookupStatus lookup_cached(Resolver *r, const char *name,
+									uint16_t qtype, char *answer,
+									char *next_name) {
+	double now = now_seconds();
+	CacheEntry *entry = cache_lookup(&r->cache, name, TYPE_ANY, now);
+	if (entry != NULL)
+		return LOOKUP_NEGATIVE; // no such name
+
+	entry = cache_lookup(&r->cache, name, qtype, now);
+	if (entry != NULL) {
+		if (entry->negative || entry->count == 0)
+			return LOOKUP_NEGATIVE;
+		strcpy(answer, entry->values[0]);
+		return LOOKUP_FOUND;
+	}
+
+	entry = cache_lookup(&r->cache, name, TYPE_CNAME, now);
+	if (entry != NULL && !entry->negative && entry->count > 0) {
+		strcpy(next_name, entry->values[0]);
+		return LOOKUP_CNAME;
+	}
+
+	return LOOKUP_MISS;
+}
+
+/**
+ * Finds the closest zone above name whose servers we know the addresses of,
+ * falling back to the root servers.
+ */
+static void closest_servers(Resolver *r, const char *name,
+							ServerList *servers) {
+	double now = now_seconds();
+	const char *zone = name;
+	while (*zone != '\0') {
+		CacheEntry *ns = cache_lookup(&r->cache, zone, TYPE_NS, now);
+		if (ns != NULL && !ns->negative) {
+			servers->count = 0;
+			for (int i = 0; i < ns->count && servers->count < MAX_SERVERS; i++) {
+				CacheEntry *a = cache_lookup(&r->cache, ns->values[i], TYPE_A,
+												now);
+				for (int j = 0; a != NULL && !a->negative && j < a->count
+						&& servers->count < MAX_SERVERS; j++) {
+					if (inet_pton(AF_INET, a->values[j],
+									&servers->addrs[servers->count]) == 1)
+						servers->count++;
+				}
+			}
+
+			if (servers->count > 0) {
+				strcpy(servers->zone, zone);
+				return;
+			}
+		}
+
+		// On to the parent zone.
+		const char *dot = strchr(zone, '.');
+		zone = (dot != NULL) ? dot + 1 : "";
+	}
+
+	strcpy(servers->zone, "");
+	memcpy(servers->addrs, r->roots, r->num_roots * sizeof(struct in_addr));
+	servers->count = r->num_roots;
+}
+
+/*
+ * Messages
+ */
+
+/**
+ * Constructs a DNS query for hostname's record of the given type.
  *
  * @param query Pointer to memory where query will stored.
- * @param hostname The host we are trying to resolve
+ * @param id The query's ID.
+ * @param hostname The host we are trying to resolve (normalized).
+ * @param qtype The type of record we want.
  * @return The number of bytes in the constructed query.
  */
-int construct_query(uint8_t* query, char* hostname) {
+int construct_query(uint8_t* query, uint16_t id, const char* hostname,
+					uint16_t qtype) {
 	memset(query, 0, MAX_QUERY_SIZE);
 
 	// first part of the query is a fixed size header
 	DNSHeader *hdr = (DNSHeader*)query;
-
-	// set ID to 5... you should randomize this!
-	hdr->id = htons(5);
+	hdr->id = htons(id);
 
 	// set header flags to request iterative query
-	hdr->flags = htons(0x0000);	
+	hdr->flags = htons(0x0000);
 
 	// 1 question, no answers or other records
 	hdr->q_count=htons(1);
@@ -42,41 +605,790 @@ int construct_query(uint8_t* query, char* hostname) {
 	hdr->auth_count=htons(0);
 	hdr->other_count=htons(0);
 
-	// We are going to have to wade into pointer arithmetic here since our
-	// struct is a fixed size but our queries will be variably sized.
-
 	// add the name
-	int query_len = sizeof(DNSHeader); 
-	int name_len = convertStringToDNS(hostname,query+query_len);
-	query_len += name_len; 
-	
-	// set the query type to A (i.e. 1)
-	uint16_t *type = (uint16_t*)(query+query_len);
-	*type = htons(1);
-	query_len+=2;
-
-	// finally the class: INET
-	uint16_t *class = (uint16_t*)(query+query_len);
-	*class = htons(1);
-	query_len += 2;
- 
+	int query_len = sizeof(DNSHeader);
+	int name_len = convertStringToDNS((char*)hostname, query+query_len);
+	query_len += name_len;
+
+	// then the query type and class (INET), which may not be aligned
+	uint16_t type_and_class[2] = { htons(qtype), htons(CLASS_IN) };
+	memcpy(query + query_len, type_and_class, sizeof(type_and_class));
+	query_len += sizeof(type_and_class);
+
 	return query_len;
 }
 
+/**
+ * Reads a (possibly compressed) name from a message, checking that it stays
+ * inside the message. Unlike getStringFromDNS, it can't be sent into a loop
+ * or off the end of the message by a bad response.
+ *
+ * @param msg The whole message.
+ * @param len Length of the message.
+ * @param pos Where the name starts; moved to just past it.
+ * @param name Where to put the name (lower case, no trailing dot).
+ * @return false if the name is malformed.
+ */
+static bool read_name(const uint8_t *msg, size_t len, size_t *pos,
+						char *name) {
+	size_t p = *pos;
+	size_t out = 0;
+	bool jumped = false;
+	int hops = 0;
+
+	while (true) {
+		if (p >= len)
+			return false;
+
+		uint8_t label_len = msg[p];
+		if (label_len == 0) {
+			if (!jumped)
+				*pos = p + 1;
+			break;
+		}
+
+		// A pointer to the rest of the name elsewhere (RFC 1035 4.1.4).
+		if ((label_len & 0xc0) == 0xc0) {
+			if (p + 1 >= len || ++hops > 64)
+				return false;
+			if (!jumped)
+				*pos = p + 2;
+			jumped = true;
+			p = ((label_len & 0x3f) << 8) | msg[p + 1];
+			continue;
+		}
+		if (label_len > 63 || p + 1 + label_len > len
+				|| out + label_len + 2 > MAX_NAME_LEN)
+			return false;
+
+		if (out > 0)
+			name[out++] = '.';
+		for (size_t i = 0; i < label_len; i++) {
+			char c = msg[p + 1 + i];
+			name[out++] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+		}
+		p += 1 + label_len;
+	}
+
+	name[out] = '\0';
+	return true;
+}
+
+static uint16_t read_u16(const uint8_t *p) {
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+		| ((uint32_t)p[2] << 8) | p[3];
+}
+
+/**
+ * Parses a DNS response.
+ *
+ * @return false if it is malformed.
+ */
+static bool parse_message(const uint8_t *buf, size_t len, Message *msg) {
+	if (len < sizeof(DNSHeader))
+		return false;
+
+	msg->id = read_u16(buf);
+	msg->flags = read_u16(buf + 2);
+	uint16_t q_count = read_u16(buf + 4);
+	uint16_t counts[NUM_SECTIONS] = { read_u16(buf + 6), read_u16(buf + 8),
+										read_u16(buf + 10) };
+
+	size_t pos = sizeof(DNSHeader);
+	msg->qname[0] = '\0';
+	msg->qtype = 0;
+	for (int q = 0; q < q_count; q++) {
+		char name[MAX_NAME_LEN];
+		if (!read_name(buf, len, &pos, name) || pos + 4 > len)
+			return false;
+		if (q == 0) {
+			strcpy(msg->qname, name);
+			msg->qtype = read_u16(buf + pos);
+		}
+		pos += 4;
+	}
+
+	for (int s = 0; s < NUM_SECTIONS; s++) {
+		msg->num_records[s] = 0;
+		for (int i = 0; i < counts[s]; i++) {
+			Record rec;
+			memset(&rec, 0, sizeof(rec));
+			if (!read_name(buf, len, &pos, rec.name) || pos + 10 > len)
+				return false;
+
+			rec.type = read_u16(buf + pos);
+			uint16_t class = read_u16(buf + pos + 2);
+			rec.ttl = read_u32(buf + pos + 4);
+			uint16_t data_len = read_u16(buf + pos + 8);
+			pos += 10;
+			if (pos + data_len > len)
+				return false;
+
+			size_t data_pos = pos;
+			bool ok = true;
+			if (rec.type == TYPE_A && data_len == 4) {
+				inet_ntop(AF_INET, buf + data_pos, rec.data, sizeof(rec.data));
+			}
+			else if (rec.type == TYPE_NS || rec.type == TYPE_CNAME) {
+				ok = read_name(buf, len, &data_pos, rec.data);
+			}
+			else if (rec.type == TYPE_MX && data_len > 2) {
+				rec.preference = read_u16(buf + data_pos);
+				data_pos += 2;
+				ok = read_name(buf, len, &data_pos, rec.data);
+			}
+			else if (rec.type == TYPE_SOA) {
+				char rname[MAX_NAME_LEN];
+				ok = read_name(buf, len, &data_pos, rec.data)
+					&& read_name(buf, len, &data_pos, rname)
+					&& data_pos + 20 <= len;
+				if (ok)
+					rec.negative_ttl = read_u32(buf + data_pos + 16);
+			}
+			else {
+				rec.type = 0; // not something we use
+			}
+			pos += data_len;
+
+			if (!ok)
+				return false;
+			if (class == CLASS_IN && rec.type != 0
+					&& msg->num_records[s] < MAX_SECTION_RECORDS)
+				msg->records[s][msg->num_records[s]++] = rec;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Finds a record in a section.
+ *
+ * @return The first record with the given name and type, or NULL.
+ */
+static const Record *find_record(const Message *msg, int section,
+									const char *name, uint16_t type) {
+	for (int i = 0; i < msg->num_records[section]; i++) {
+		const Record *rec = &msg->records[section][i];
+		if (rec->type == type && strcmp(rec->name, name) == 0)
+			return rec;
+	}
+	return NULL;
+}
+
+
+/*
+ * Talking to servers
+ *
+ * Every lookup has at most one query out at a time, and the responses (and
+ * timeouts) for all of them come through one epoll loop over a few sockets.
+ * That way any number of lookups can be going at once.
+ */
+
+/**
+ * How long to wait for the response to a lookup's latest try: twice as long
+ * as for the try before it, up to a limit.
+ */
+static double query_timeout(int tries) {
+	int timeout_ms = FIRST_TIMEOUT_MS;
+	for (int i = 1; i < tries && timeout_ms < MAX_TIMEOUT_MS; i++)
+		timeout_ms *= 2;
+	if (timeout_ms > MAX_TIMEOUT_MS)
+		timeout_ms = MAX_TIMEOUT_MS;
+	return timeout_ms / 1000.0;
+}
+
+static void heap_swap(Resolver *r, size_t a, size_t b) {
+	Lookup *tmp = r->timeouts[a];
+	r->timeouts[a] = r->timeouts[b];
+	r->timeouts[b] = tmp;
+	r->timeouts[a]->heap_index = a;
+	r->timeouts[b]->heap_index = b;
+}
+
+/**
+ * Moves the lookup at index i in the heap of timeouts to where it belongs.
+ */
+static void heap_fix(Resolver *r, size_t i) {
+	while (i > 0 && r->timeouts[i]->deadline
+			< r->timeouts[(i - 1) / 2]->deadline) {
+		heap_swap(r, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	while (true) {
+		size_t smallest = i;
+		size_t left = 2 * i + 1;
+		size_t right = left + 1;
+		if (left < r->num_timeouts && r->timeouts[left]->deadline
+				< r->timeouts[smallest]->deadline)
+			smallest = left;
+		if (right < r->num_timeouts && r->timeouts[right]->deadline
+				< r->timeouts[smallest]->deadline)
+			smallest = right;
+		if (smallest == i)
+			break;
+		heap_swap(r, i, smallest);
+		i = smallest;
+	}
+}
+
+static void heap_push(Resolver *r, Lookup *l) {
+	if (r->num_timeouts == r->timeouts_capacity) {
+		r->timeouts_capacity *= 2;
+		r->timeouts = realloc(r->timeouts,
+								r->timeouts_capacity * sizeof(Lookup*));
+		if (r->timeouts == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	l->heap_index = r->num_timeouts++;
+	r->timeouts[l->heap_index] = l;
+	heap_fix(r, l->heap_index);
+}
+
+static void heap_remove(Resolver *r, Lookup *l) {
+	size_t i = l->heap_index;
+	r->num_timeouts--;
+	if (i != r->num_timeouts) {
+		r->timeouts[i] = r->timeouts[r->num_timeouts];
+		r->timeouts[i]->heap_index = i;
+		heap_fix(r, i);
+	}
+}
+
+/**
+ * Stops waiting for the response to a lookup's query.
+ */
+static void forget_query(Resolver *r, Lookup *l) {
+	r->pending[l->sock_index][l->id] = NULL;
+	heap_remove(r, l);
+	l->in_flight = false;
+}
+
+/**
+ * Creates a lookup (which the caller then starts with continue_lookup).
+ */
+static Lookup *new_lookup(const char *name, uint16_t qtype) {
+	Lookup *l = calloc(1, sizeof(Lookup));
+	if (l == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+
+	strcpy(l->hostname, name);
+	strcpy(l->name, name);
+	l->qtype = qtype;
+	l->own_budget = MAX_QUERIES_PER_LOOKUP;
+	l->budget = &l->own_budget;
+	return l;
+}
+
+static void send_query(Resolver *r, Lookup *l);
+
+/**
+ * Looks up the address of the next nameserver (from a referral without
+ * glue) for a lookup, which carries on once it is known.
+ */
+static void lookup_next_nameserver(Resolver *r, Lookup *l);
+
+/**
+ * Ends a lookup (which mustn't be used afterwards), telling whoever was
+ * waiting for it.
+ */
+static void finish_lookup(Resolver *r, Lookup *l, bool found) {
+	l->found = found;
+
+	Lookup *parent = l->parent;
+	if (parent != NULL) {
+		// The parent can now ask the nameserver we found the address of.
+		bool usable = found && inet_pton(AF_INET, l->answer,
+											&parent->servers.addrs[0]) == 1;
+		free(l);
+		if (usable) {
+			parent->servers.count = 1;
+			parent->next_server = 0;
+			parent->tries = 0;
+			send_query(r, parent);
+		}
+		else {
+			lookup_next_nameserver(r, parent);
+		}
+		return;
+	}
+
+	if (l->own_budget == MAX_QUERIES_PER_LOOKUP)
+		r->cached_lookups++;
+	r->active--;
+	l->done(r, l);
+	free(l);
+}
+
+static void lookup_next_nameserver(Resolver *r, Lookup *l) {
+	if (l->next_ns >= l->num_ns) {
+		finish_lookup(r, l, false);
+		return;
+	}
+
+	const char *ns = l->ns_names[l->next_ns++];
+	if (r->verbose)
+		printf("  looking up nameserver %s\n", ns);
+
+	Lookup *child = new_lookup(ns, TYPE_A);
+	child->parent = l;
+	child->depth = l->depth + 1;
+	child->budget = l->budget;
+	continue_lookup(r, child);
+}
+
+/**
+ * Sends a lookup's query to the next of its servers, or gives up on the
+ * lookup if it has already had enough tries (or sent enough queries).
+ */
+static void send_query(Resolver *r, Lookup *l) {
+	if (l->tries >= MAX_TRIES || *l->budget <= 0 || l->servers.count == 0) {
+		finish_lookup(r, l, false);
+		return;
+	}
+
+	struct in_addr server = l->servers.addrs[l->next_server % l->servers.count];
+	l->next_server++;
+	l->tries++;
+	(*l->budget)--;
+
+	// Take turns with the sockets, and use an ID no other query on this
+	// socket is using, so the response can only be matched to this one.
+	int s = r->next_socket;
+	r->next_socket = (s + 1) % NUM_SOCKETS;
+	uint16_t id = random_id();
+	while (r->pending[s][id] != NULL)
+		id++;
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(r->port);
+	addr.sin_addr = server;
+
+	uint8_t query[MAX_QUERY_SIZE];
+	int query_len = construct_query(query, id, l->name, l->qtype);
+
+	if (r->verbose) {
+		char ip[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &server, ip, sizeof(ip));
+		printf("  asking %s about %s (type %d)\n", ip, l->name, l->qtype);
+	}
+
+	// If it can't be sent now (e.g. the socket's buffer is full), it is
+	// as good as lost, and is tried again when it times out.
+	r->queries_sent++;
+	if (sendto(r->socks[s], query, query_len, 0, (struct sockaddr*)&addr,
+				sizeof(addr)) < 0 && errno != EAGAIN && errno != ENOBUFS)
+		perror("Send failed");
+
+	l->in_flight = true;
+	l->sock_index = s;
+	l->id = id;
+	l->server = server;
+	l->deadline = now_seconds() + query_timeout(l->tries);
+	r->pending[s][id] = l;
+	heap_push(r, l);
+}
+
+/**
+ * Caches a negative answer, for as long as the zone's SOA record says.
+ * Without an SOA record there's no telling how long that is, so it isn't
+ * cached at all (RFC 2308, Section 5).
+ */
+static void cache_negative(Resolver *r, const Message *msg, const char *name,
+							uint16_t type, const char *zone) {
+	for (int i = 0; i < msg->num_records[AUTHORITY]; i++) {
+		const Record *rec = &msg->records[AUTHORITY][i];
+		if (rec->type == TYPE_SOA && in_zone(name, rec->name)
+				&& in_zone(rec->name, zone)) {
+			uint32_t ttl = rec->ttl < rec->negative_ttl ? rec->ttl
+														: rec->negative_ttl;
+			cache_store(&r->cache, name, type, true, NULL, 0, ttl,
+						now_seconds());
+			return;
+		}
+	}
+}
+
+/**
+ * Follows a referral: works out the (deeper) zone it delegates to and asks
+ * that zone's servers, using the glue records in the response for their
+ * addresses or else looking the nameservers up first.
+ *
+ * @return false if it isn't a referral (in which case nothing was done).
+ */
+static bool follow_referral(Resolver *r, Lookup *l, const Message *msg) {
+	// The delegation has to be below the zone we asked about (so we always
+	// make progress) and above the name.
+	const char *zone = NULL;
+	for (int i = 0; i < msg->num_records[AUTHORITY]; i++) {
+		const Record *rec = &msg->records[AUTHORITY][i];
+		if (rec->type == TYPE_NS && in_zone(l->name, rec->name)
+				&& in_zone(rec->name, l->servers.zone)
+				&& strcmp(rec->name, l->servers.zone) != 0) {
+			zone = rec->name;
+			break;
+		}
+	}
+	if (zone == NULL)
+		return false;
+
+	ServerList next;
+	strcpy(next.zone, zone);
+	next.count = 0;
+	l->num_ns = 0;
+	l->next_ns = 0;
+
+	for (int i = 0; i < msg->num_records[AUTHORITY]; i++) {
+		const Record *ns = &msg->records[AUTHORITY][i];
+		if (ns->type != TYPE_NS || strcmp(ns->name, zone) != 0)
+			continue;
+
+		// Glue: addresses for the nameservers that came with the referral.
+		bool glued = false;
+		for (int j = 0; j < msg->num_records[ADDITIONAL]
+				&& next.count < MAX_SERVERS; j++) {
+			const Record *glue = &msg->records[ADDITIONAL][j];
+			if (glue->type == TYPE_A && strcmp(glue->name, ns->data) == 0
+					&& in_zone(glue->name, l->servers.zone)
+					&& inet_pton(AF_INET, glue->data,
+									&next.addrs[next.count]) == 1) {
+				next.count++;
+				glued = true;
+			}
+		}
+
+		// Without glue we can look it up ourselves, unless it is inside
+		// the zone (which would need the zone's servers to find them).
+		if (!glued && !in_zone(ns->data, zone) && l->num_ns < MAX_SERVERS
+				&& l->depth < MAX_NS_DEPTH)
+			strcpy(l->ns_names[l->num_ns++], ns->data);
+	}
+
+	l->servers = next;
+	l->tries = 0;
+	if (next.count > 0) {
+		l->next_server = random_id() % next.count;
+		send_query(r, l);
+	}
+	else {
+		lookup_next_nameserver(r, l);
+	}
+	return true;
+}
+
+/**
+ * Moves a lookup on with the response to its query: an answer, an alias to
+ * chase, a referral to follow, or word that there's no such record.
+ */
+static void use_response(Resolver *r, Lookup *l, const Message *msg) {
+	// Keep everything the server may tell us about.
+	double now = now_seconds();
+	for (int s = 0; s < NUM_SECTIONS; s++)
+		cache_section(&r->cache, msg->records[s], msg->num_records[s],
+						l->servers.zone, now);
+
+	if ((msg->flags & RCODE_MASK) == RCODE_NXDOMAIN) {
+		cache_negative(r, msg, l->name, TYPE_ANY, l->servers.zone);
+		finish_lookup(r, l, false);
+		return;
+	}
+
+	// Follow any CNAMEs the answer has, as far as this server can vouch for
+	// them.
+	const char *current = l->name;
+	for (int i = 0; i < MAX_CNAME_CHAIN && in_zone(current, l->servers.zone);
+			i++) {
+		const Record *cname = find_record(msg, ANSWER, current, TYPE_CNAME);
+		if (cname == NULL)
+			break;
+		current = cname->data;
+	}
+
+	const Record *found = in_zone(current, l->servers.zone)
+		? find_record(msg, ANSWER, current, l->qtype) : NULL;
+	if (found != NULL && l->qtype == TYPE_MX) {
+		// The best mail server is the one with the lowest preference.
+		for (int i = 0; i < msg->num_records[ANSWER]; i++) {
+			const Record *rec = &msg->records[ANSWER][i];
+			if (rec->type == TYPE_MX && strcmp(rec->name, current) == 0
+					&& rec->preference < found->preference)
+				found = rec;
+		}
+	}
+
+	if (found != NULL) {
+		strcpy(l->answer, found->data);
+		finish_lookup(r, l, true);
+		return;
+	}
+	if (current != l->name) {
+		if (r->verbose)
+			printf("  %s is an alias for %s\n", l->name, current);
+		strcpy(l->name, current);
+		l->cnames++;
+		continue_lookup(r, l);
+		return;
+	}
+
+	if (!follow_referral(r, l, msg)) {
+		// Not an answer or a referral, so it has no records of this type
+		// (NODATA).
+		cache_negative(r, msg, l->name, l->qtype, l->servers.zone);
+		finish_lookup(r, l, false);
+	}
+}
+
+/**
+ * Moves a lookup on from the cache as far as it can go, then (if it isn't
+ * done) asks the closest servers we know of.
+ */
+static void continue_lookup(Resolver *r, Lookup *l) {
+	while (l->cnames <= MAX_CNAME_CHAIN) {
+		char next_name[MAX_NAME_LEN];
+		LookupStatus status = lookup_cached(r, l->name, l->qtype, l->answer,
+											next_name);
+		if (status == LOOKUP_MISS) {
+			closest_servers(r, l->name, &l->servers);
+			l->next_server = random_id() % l->servers.count;
+			l->tries = 0;
+			send_query(r, l);
+			return;
+		}
+
+		if (r->verbose)
+			printf("  %s is cached\n", l->name);
+		if (status != LOOKUP_CNAME) {
+			finish_lookup(r, l, status == LOOKUP_FOUND);
+			return;
+		}
+
+		if (r->verbose)
+			printf("  %s is an alias for %s\n", l->name, next_name);
+		strcpy(l->name, next_name);
+		l->cnames++;
+	}
+
+	finish_lookup(r, l, false);
+}
+
+/**
+ * Starts looking up a name's record of the given type, following CNAMEs.
+ *
+ * @param name The (normalized) name to look up.
+ * @param qtype The type of record we want (A or MX).
+ * @param done Called when the lookup is done (possibly before this returns).
+ * @param context Kept in the lookup, for done.
+ */
+static void start_lookup(Resolver *r, const char *name, uint16_t qtype,
+							LookupDone done, void *context) {
+	Lookup *l = new_lookup(name, qtype);
+	l->done = done;
+	l->context = context;
+	r->active++;
+	continue_lookup(r, l);
+}
+
+/**
+ * Handles a packet that arrived on one of the sockets.
+ *
+ * Anything that isn't the response to a query we're waiting for (wrong ID,
+ * question or sender) is ignored, so a stray or forged packet can't be
+ * mistaken for one.
+ */
+static void handle_response(Resolver *r, int s, const uint8_t *buf,
+							size_t len, const struct sockaddr_in *from) {
+	if (len < sizeof(DNSHeader))
+		return;
+
+	Lookup *l = r->pending[s][read_u16(buf)];
+	if (l == NULL || from->sin_addr.s_addr != l->server.s_addr
+			|| from->sin_port != htons(r->port))
+		return;
+
+	Message *msg = r->msg;
+	if (!parse_message(buf, len, msg) || !(msg->flags & FLAG_RESPONSE)
+			|| msg->qtype != l->qtype || strcmp(msg->qname, l->name) != 0)
+		return;
+
+	forget_query(r, l);
+
+	// A server that can't help (e.g. SERVFAIL or REFUSED), or whose answer
+	// didn't fit, is no good to us: try another one straight away.
+	int rcode = msg->flags & RCODE_MASK;
+	if ((rcode != RCODE_NOERROR && rcode != RCODE_NXDOMAIN)
+			|| (msg->flags & FLAG_TRUNCATED)) {
+		send_query(r, l);
+		return;
+	}
+
+	use_response(r, l, msg);
+}
+
+/**
+ * Reads everything waiting on one of the sockets, a batch at a time.
+ */
+static void receive_responses(Resolver *r, int s) {
+	struct mmsghdr msgs[RECV_BATCH];
+	struct iovec iovs[RECV_BATCH];
+	struct sockaddr_in froms[RECV_BATCH];
+
+	while (true) {
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < RECV_BATCH; i++) {
+			iovs[i].iov_base = r->recv_buffers[i];
+			iovs[i].iov_len = MAX_RESPONSE_SIZE;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &froms[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(froms[i]);
+		}
+
+		int n = recvmmsg(r->socks[s], msgs, RECV_BATCH, 0, NULL);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("recvmmsg");
+			return;
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (msgs[i].msg_hdr.msg_namelen == sizeof(struct sockaddr_in))
+				handle_response(r, s, r->recv_buffers[i], msgs[i].msg_len,
+								&froms[i]);
+		}
+
+		if (n < RECV_BATCH)
+			return;
+	}
+}
+
+/**
+ * Retries (or gives up on) every query whose time is up.
+ */
+static void expire_queries(Resolver *r) {
+	double now = now_seconds();
+	while (r->num_timeouts > 0 && r->timeouts[0]->deadline <= now) {
+		Lookup *l = r->timeouts[0];
+		forget_query(r, l);
+		r->timeouts_seen++;
+
+		if (r->verbose) {
+			char ip[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &l->server, ip, sizeof(ip));
+			printf("  timed out waiting for %s\n", ip);
+		}
+		send_query(r, l);
+	}
+}
+
+/**
+ * Waits for responses (or for the next query to time out), and handles
+ * them.
+ */
+static void run_events(Resolver *r) {
+	int timeout_ms = -1;
+	if (r->num_timeouts > 0) {
+		double wait = r->timeouts[0]->deadline - now_seconds();
+		timeout_ms = wait > 0 ? (int)(wait * 1000) + 1 : 0;
+	}
+
+	struct epoll_event events[NUM_SOCKETS];
+	int n = epoll_wait(r->epoll_fd, events, NUM_SOCKETS, timeout_ms);
+	if (n < 0 && errno != EINTR) {
+		perror("epoll_wait");
+		exit(1);
+	}
+
+	for (int i = 0; i < n; i++)
+		receive_responses(r, events[i].data.u32);
+	expire_queries(r);
+}
+
+/**
+ * Sets up a resolver's sockets (and everything else it needs).
+ */
+static void resolver_init(Resolver *r) {
+	r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->epoll_fd < 0) {
+		perror("epoll_create1");
+		exit(1);
+	}
+
+	for (int s = 0; s < NUM_SOCKETS; s++) {
+		// create a UDP (i.e. Datagram) socket
+		r->socks[s] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+		if (r->socks[s] < 0) {
+			perror("socket");
+			exit(1);
+		}
+
+		// Room for a burst of responses while we're busy with others.
+		int buffer_size = SOCKET_BUFFER_SIZE;
+		setsockopt(r->socks[s], SOL_SOCKET, SO_RCVBUF, &buffer_size,
+					sizeof(buffer_size));
+
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.u32 = s;
+		if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->socks[s], &event) < 0) {
+			perror("epoll_ctl");
+			exit(1);
+		}
+
+		r->pending[s] = calloc(65536, sizeof(Lookup*));
+		if (r->pending[s] == NULL) {
+			perror("calloc");
+			exit(1);
+		}
+	}
+
+	r->timeouts_capacity = 1024;
+	r->timeouts = malloc(r->timeouts_capacity * sizeof(Lookup*));
+	r->recv_buffers = malloc(RECV_BATCH * sizeof(*r->recv_buffers));
+	r->msg = malloc(sizeof(Message));
+	if (r->timeouts == NULL || r->recv_buffers == NULL || r->msg == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	cache_init(&r->cache);
+}
+
+/**
+ * Keeps the answer of a lookup from resolve.
+ */
+static void save_answer(Resolver *r, Lookup *l) {
+	(void)r;
+	char **answer = l->context;
+	*answer = l->found ? strdup(l->answer) : NULL;
+}
+
 /**
  * Returns a string with the IP address (for an A record) or name of mail
  * server associated with the given hostname.
  *
+ * @param r The resolver.
  * @param hostname The name of the host to resolve.
  * @param is_mx True (1) if requesting the MX record result, False (0) if
  *    requesting the A record.
  *
  * @return A string representation of an IP address (e.g. "192.168.0.1") or
- *   mail server (e.g. "mail.google.com"). If the request could not be
- *   resolved, NULL will be returned.
+ *   mail server (e.g. "mail.google.com"), which the caller must free. If the
+ *   request could not be resolved, NULL will be returned.
  */
-char* resolve(char *hostname, bool is_mx) {
-
+char* resolve(Resolver *r, char *hostname, bool is_mx) {
 	if (is_mx == false) {
 		printf("Requesting A record for %s\n", hostname);
 	}
@@ -84,91 +1396,209 @@ char* resolve(char *hostname, bool is_mx) {
 		printf("Requesting MX record for %s\n", hostname);
 	}
 
-	// create a UDP (i.e. Datagram) socket
-	int sock = socket(AF_INET, SOCK_DGRAM, 0);
-	if (sock < 0) {
-		perror("socket");
-		exit(0);
+	char name[MAX_NAME_LEN];
+	if (!normalize_name(hostname, name)) {
+		printf("Invalid hostname: %s\n", hostname);
+		return NULL;
 	}
-	// Create a time value structure and set it to five seconds.
-	struct timeval tv;
-	memset(&tv, 0, sizeof(struct timeval));
-	tv.tv_sec = 5;
 
-	/* Tell the OS to use that time value as a time out for operations on
-	 * our socket. */
-	int res = setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv,
-			sizeof(struct timeval));
+	char *answer = NULL;
+	start_lookup(r, name, is_mx ? TYPE_MX : TYPE_A, save_answer, &answer);
+	while (r->active > 0)
+		run_events(r);
+	return answer;
+}
 
-	if (res < 0) {
-		perror("setsockopt");
-		exit(0);
-	}
+/**
+ * Progress of a batch of lookups.
+ */
+typedef struct {
+	unsigned long names;
+	unsigned long resolved;
+} Batch;
 
-	// The following is the IP address of USD's local DNS server. It is a
-	// placeholder only (i.e. you shouldn't have this hardcoded into your final
-	// program).
-	in_addr_t nameserver_addr = inet_addr("172.16.7.15");
-	
-	struct sockaddr_in addr; 	// internet socket address data structure
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(53); // port 53 for DNS
-	addr.sin_addr.s_addr = nameserver_addr; // destination address (any local for now)
+/**
+ * Prints the answer of a lookup from resolve_batch.
+ */
+static void print_answer(Resolver *r, Lookup *l) {
+	(void)r;
+	Batch *batch = l->context;
+	if (l->found) {
+		batch->resolved++;
+		printf("%s %s\n", l->hostname, l->answer);
+	}
+	else {
+		printf("%s -\n", l->hostname);
+	}
+}
 
-	// uint8_t is a standard, unsigned 8-bit value.
-	// You should use that type for all buffers used for sending to and
-	// receiving from the DNS server.
-	uint8_t query[MAX_QUERY_SIZE]; 
-	int query_len=construct_query(query, hostname);
+/**
+ * Resolves every hostname in a file (one per line), with up to concurrency
+ * of them being looked up at once. Prints each hostname with its answer (or
+ * "-" if it couldn't be resolved), in the order the answers come in, and
+ * then how long it all took.
+ *
+ * @param r The resolver.
+ * @param input The file of hostnames.
+ * @param is_mx True if requesting MX records, false for A records.
+ * @param concurrency How many lookups to have going at once.
+ */
+void resolve_batch(Resolver *r, FILE *input, bool is_mx, int concurrency) {
+	Batch batch;
+	memset(&batch, 0, sizeof(batch));
+	double start = now_seconds();
 
-	int send_count = sendto(sock, query, query_len, 0,
-							(struct sockaddr*)&addr, sizeof(addr));
+	bool more = true;
+	while (more || r->active > 0) {
+		// Top up the lookups going. Ones answered from the cache are done
+		// straight away, which just makes room for the next.
+		while (more && r->active < concurrency) {
+			char line[1024];
+			if (fgets(line, sizeof(line), input) == NULL) {
+				more = false;
+				break;
+			}
 
-	if (send_count<0) { 
-		perror("Send failed");
-		exit(1);
-	}
+			line[strcspn(line, " \t\r\n")] = '\0';
+			if (line[0] == '\0' || line[0] == '#')
+				continue;
 
-	socklen_t len = sizeof(struct sockaddr_in);
+			batch.names++;
+			char name[MAX_NAME_LEN];
+			if (normalize_name(line, name))
+				start_lookup(r, name, is_mx ? TYPE_MX : TYPE_A, print_answer,
+								&batch);
+			else
+				printf("%s -\n", line);
+		}
 
-	uint8_t response[MAX_RESPONSE_SIZE];
+		if (r->active > 0)
+			run_events(r);
+	}
 
-	/* Blocking calls will now return error (-1) after the timeout period with
-	 * errno set to EAGAIN. */
-	res = recvfrom(sock, response, MAX_RESPONSE_SIZE, 0, 
-					(struct sockaddr *)&addr, &len);
+	double elapsed = now_seconds() - start;
+	fflush(stdout);
+	fprintf(stderr, "Resolved %lu of %lu names in %.2f s (%.0f names/sec)\n",
+			batch.resolved, batch.names, elapsed,
+			elapsed > 0 ? batch.names / elapsed : 0);
+	fprintf(stderr, "Sent %lu queries, %lu timed out, %lu names answered "
+			"from the cache\n", r->queries_sent, r->timeouts_seen,
+			r->cached_lookups);
+}
 
-	if (res < 1) {
-		if (errno == EAGAIN) {
-			printf("Timed out!\n");
-		} else {
-			perror("recv");
-		}
+/**
+ * Reads the root servers' addresses, one per line.
+ *
+ * @return The number of addresses read.
+ */
+static int read_root_servers(const char *filename, struct in_addr *roots) {
+	FILE *file = fopen(filename, "r");
+	if (file == NULL) {
+		perror(filename);
+		exit(1);
 	}
 
-	// TODO: The server's response will be located in the response array for you
-	// to further process and extract the needed information.
-	// Remember that DNS is a binary protocol: if you try printing out response
-	// as a string, it won't work correctly.
+	int count = 0;
+	char line[128];
+	while (count < MAX_SERVERS && fgets(line, sizeof(line), file) != NULL) {
+		line[strcspn(line, " \t\r\n")] = '\0';
+		if (line[0] != '\0' && inet_pton(AF_INET, line, &roots[count]) == 1)
+			count++;
+	}
 
-	return NULL;
+	fclose(file);
+	return count;
 }
 
+static void usage(const char *program) {
+	printf("Usage: %s [-m] [-v] [-r root_servers_file] [-p port] <hostname>...\n",
+			program);
+	printf("       %s [-m] [-r root_servers_file] [-p port] [-c concurrency] "
+			"-b hostnames_file\n", program);
+	printf("  -m  look up mail servers (MX records) instead of addresses\n");
+	printf("  -v  show every query sent\n");
+	printf("  -r  file of root server addresses (default: root-servers.txt)\n");
+	printf("  -p  port the nameservers listen on (default: 53)\n");
+	printf("  -b  resolve every hostname in a file (- for standard input)\n");
+	printf("  -c  lookups to have going at once with -b (default: %d)\n",
+			DEFAULT_CONCURRENCY);
+}
 
 int main(int argc, char **argv) {
-	if (argc < 2) {
-		// TODO: provide a more helpful message on how to use the program
-		printf("Invalid program usage for %s!\n", argv[0]);
+	bool is_mx = false;
+	const char *root_file = "root-servers.txt";
+	const char *batch_file = NULL;
+	int concurrency = DEFAULT_CONCURRENCY;
+	Resolver r;
+	memset(&r, 0, sizeof(r));
+	r.port = 53; // port 53 for DNS
+
+	int opt;
+	while ((opt = getopt(argc, argv, "mvr:p:b:c:")) != -1) {
+		if (opt == 'm') {
+			is_mx = true;
+		}
+		else if (opt == 'v') {
+			r.verbose = true;
+		}
+		else if (opt == 'r') {
+			root_file = optarg;
+		}
+		else if (opt == 'p') {
+			r.port = (uint16_t)atoi(optarg);
+		}
+		else if (opt == 'b') {
+			batch_file = optarg;
+		}
+		else if (opt == 'c') {
+			concurrency = atoi(optarg);
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
 	}
 
-	char *answer = resolve("www.sandiego.edu", false);
+	if ((batch_file == NULL) == (optind >= argc)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (concurrency < 1 || concurrency > MAX_CONCURRENCY) {
+		printf("Concurrency must be between 1 and %d\n", MAX_CONCURRENCY);
+		return 1;
+	}
 
-	if (answer != NULL) {
-		printf("Answer: %s\n", answer);
+	r.num_roots = read_root_servers(root_file, r.roots);
+	if (r.num_roots == 0) {
+		printf("No root servers in %s\n", root_file);
+		return 1;
 	}
-	else {
-		printf("Could not resolve request.\n");
+
+	resolver_init(&r);
+
+	if (batch_file != NULL) {
+		FILE *input = strcmp(batch_file, "-") == 0 ? stdin
+													: fopen(batch_file, "r");
+		if (input == NULL) {
+			perror(batch_file);
+			exit(1);
+		}
+		resolve_batch(&r, input, is_mx, concurrency);
+		return 0;
+	}
+
+	for (int i = optind; i < argc; i++) {
+		char *answer = resolve(&r, argv[i], is_mx);
+		if (answer != NULL) {
+			printf("Answer: %s\n", answer);
+			free(answer);
+		}
+		else {
+			printf("Could not resolve request.\n");
+		}
 	}
 
+	printf("Sent %lu queries for %d names (%lu answered from the cache)\n",
+			r.queries_sent, argc - optind, r.cached_lookups);
 	return 0;
 }
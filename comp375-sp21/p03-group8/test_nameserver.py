@@ -0,0 +1,251 @@
+"""
+Module: test_nameserver
+
+A stand-in for the DNS hierarchy, so the resolver can be tested without the
+internet. Each server in SERVERS listens on its own loopback address (they
+all share one port) and answers, authoritatively, for the zones it has:
+with the records it has for a name, a referral (with glue where it has it)
+for names in a zone it has delegated, or NXDOMAIN / NODATA with its zone's
+SOA record.
+
+It counts the queries each server gets, so tests can tell which ones the
+resolver's cache saved, and can be told to ignore the first few queries for
+a name (as if they had been lost).
+
+Usage: python3 test_nameserver.py <port>
+"""
+
+import sys
+import socket
+import selectors
+import threading
+from struct import pack, unpack_from
+
+(A, NS, CNAME, SOA, MX) = (1, 2, 5, 6, 15)
+(NOERROR, NXDOMAIN) = (0, 3)
+
+# Zones, by origin: a list of (name, type, ttl, data) records. MX data is
+# (preference, exchange), SOA data is its minimum (negative caching) TTL.
+ZONES = {
+    "": [
+        ("", SOA, 3600, 3600),
+        ("com", NS, 3600, "a.gtld.net"),
+        ("net", NS, 3600, "a.gtld.net"),
+        ("a.gtld.net", A, 3600, "127.0.0.2"),
+    ],
+    "com": [
+        ("com", SOA, 3600, 900),
+        ("example.com", NS, 3600, "ns1.example.com"),
+        ("ns1.example.com", A, 3600, "127.0.0.3"),
+    ],
+    "net": [
+        ("net", SOA, 3600, 900),
+        ("a.gtld.net", A, 3600, "127.0.0.2"),
+        # no glue, since its nameserver is in another zone
+        ("glueless.net", NS, 3600, "ns2.example.com"),
+    ],
+    "example.com": [
+        ("example.com", SOA, 3600, 60),
+        ("example.com", NS, 3600, "ns1.example.com"),
+        ("example.com", A, 300, "10.0.0.10"),
+        ("ns1.example.com", A, 3600, "127.0.0.3"),
+        ("ns2.example.com", A, 3600, "127.0.0.4"),
+        ("www.example.com", A, 300, "10.0.0.1"),
+        ("alias.example.com", CNAME, 300, "www.example.com"),
+        ("far.example.com", CNAME, 300, "www.glueless.net"),
+        ("short.example.com", A, 1, "10.0.0.3"),
+        ("mail.example.com", MX, 300, (20, "backup.example.com")),
+        ("mail.example.com", MX, 300, (10, "mx.example.com")),
+        ("mx.example.com", A, 300, "10.0.0.25"),
+    ],
+    "glueless.net": [
+        ("glueless.net", SOA, 3600, 60),
+        ("www.glueless.net", A, 300, "10.0.0.2"),
+    ],
+}
+
+# The zones each server is authoritative for, by address.
+SERVERS = {
+    "127.0.0.1": [""],
+    "127.0.0.2": ["com", "net"],
+    "127.0.0.3": ["example.com"],
+    "127.0.0.4": ["glueless.net"],
+}
+
+
+def in_zone(name, zone):
+    """
+    Checks if a name is in a zone (every name is in the root zone).
+    """
+    return zone == "" or name == zone or name.endswith("." + zone)
+
+
+def encode_name(name):
+    """
+    Converts a name to its (uncompressed) wire format.
+    """
+    labels = [label.encode() for label in name.split(".") if label]
+    return b"".join(bytes([len(l)]) + l for l in labels) + b"\0"
+
+
+def decode_name(message, pos):
+    """
+    Reads an uncompressed name (which is all a query has).
+
+    Returns:
+        tuple: The name and the position just past it.
+    """
+    labels = []
+    while message[pos] != 0:
+        length = message[pos]
+        labels.append(message[pos + 1:pos + 1 + length].decode().lower())
+        pos += 1 + length
+    return ".".join(labels), pos + 1
+
+
+def encode_record(record):
+    """
+    Converts a (name, type, ttl, data) record to its wire format.
+    """
+    (name, rtype, ttl, data) = record
+    if rtype == A:
+        rdata = socket.inet_aton(data)
+    elif rtype in (NS, CNAME):
+        rdata = encode_name(data)
+    elif rtype == MX:
+        rdata = pack("!H", data[0]) + encode_name(data[1])
+    else:
+        rdata = (encode_name("ns." + name) + encode_name("admin." + name)
+                 + pack("!IIIII", 1, 3600, 600, 86400, data))
+    return encode_name(name) + pack("!HHIH", rtype, 1, ttl, len(rdata)) + rdata
+
+
+def answer(zones, qname, qtype):
+    """
+    Works out a server's answer to a question.
+
+    Args:
+        zones (list): The origins of the zones the server has.
+        qname (string): The name asked about.
+        qtype (int): The type asked about.
+
+    Returns:
+        tuple: The rcode, and the answer, authority and additional records.
+    """
+    candidates = [z for z in zones if in_zone(qname, z)]
+    if not candidates:
+        return NXDOMAIN, [], [], []
+    origin = max(candidates, key=len)
+    records = ZONES[origin]
+
+    # A delegation to a zone between ours and the name is a referral.
+    cuts = [r[0] for r in records if r[1] == NS and r[0] != origin
+            and in_zone(qname, r[0])]
+    if cuts:
+        cut = max(cuts, key=len)
+        ns = [r for r in records if r[1] == NS and r[0] == cut]
+        glue = [r for r in records for n in ns if r[1] == A and r[0] == n[3]]
+        return NOERROR, [], ns, glue
+
+    matches = [r for r in records if r[0] == qname and r[1] == qtype]
+    if not matches:
+        matches = [r for r in records if r[0] == qname and r[1] == CNAME]
+    if matches:
+        return NOERROR, matches, [], []
+
+    soa = [r for r in records if r[1] == SOA]
+    if any(r[0] == qname for r in records):
+        return NOERROR, [], soa, []
+    return NXDOMAIN, [], soa, []
+
+
+class TestNameserver:
+    """
+    All the servers, answering queries in a background thread.
+    """
+
+    def __init__(self, port=0):
+        """
+        Starts the servers.
+
+        Args:
+            port (int): The port they listen on (0 for any free one, which
+                will then be in self.port).
+        """
+        self.queries = {address: 0 for address in SERVERS}
+        self.drops = {}  # queries to ignore, by name
+        self.selector = selectors.DefaultSelector()
+        self.sockets = []
+        self.port = port
+        for address in SERVERS:
+            sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+            # room for the bursts a resolver in batch mode sends
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 22)
+            sock.bind((address, self.port))
+            self.port = sock.getsockname()[1]
+            self.sockets.append(sock)
+            self.selector.register(sock, selectors.EVENT_READ, address)
+
+        self.running = True
+        self.thread = threading.Thread(target=self.serve, daemon=True)
+        self.thread.start()
+
+    def serve(self):
+        while self.running:
+            for key, _ in self.selector.select(timeout=0.1):
+                message, sender = key.fileobj.recvfrom(4096)
+                response = self.respond(key.data, message)
+                if response:
+                    key.fileobj.sendto(response, sender)
+
+    def respond(self, address, message):
+        """
+        Builds the response to a query sent to one of the servers.
+        """
+        if len(message) < 12:
+            return None
+        (query_id, _, q_count) = unpack_from("!HHH", message)
+        if q_count != 1:
+            return None
+        qname, pos = decode_name(message, 12)
+        (qtype,) = unpack_from("!H", message, pos)
+        self.queries[address] += 1
+        if self.drops.get(qname, 0) > 0:
+            self.drops[qname] -= 1
+            return None
+
+        rcode, answers, authority, additional = answer(SERVERS[address],
+                                                       qname, qtype)
+        flags = 0x8400 | rcode  # response, authoritative
+        header = pack("!HHHHHH", query_id, flags, 1, len(answers),
+                      len(authority), len(additional))
+        return (header + message[12:pos + 4]
+                + b"".join(encode_record(r)
+                           for r in answers + authority + additional))
+
+    def total_queries(self):
+        return sum(self.queries.values())
+
+    def stop(self):
+        self.running = False
+        self.thread.join()
+        for sock in self.sockets:
+            sock.close()
+
+
+def main(argv):
+    if len(argv) != 2:
+        print("Usage: python3 %s <port>" % argv[0])
+        sys.exit(1)
+
+    server = TestNameserver(int(argv[1]))
+    print("Serving on port %d; root server is %s" % (server.port,
+                                                    list(SERVERS)[0]))
+    try:
+        server.thread.join()
+    except KeyboardInterrupt:
+        server.stop()
+
+
+if __name__ == "__main__":
+    main(sys.argv)
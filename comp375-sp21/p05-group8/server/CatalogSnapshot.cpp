@@ -0,0 +1,308 @@
+/*
+ * File: CatalogSnapshot.cpp
+ *
+ * Saving a SongCatalog to a snapshot file, and loading it back (see
+ * SongCatalog::save_snapshot and SongCatalog::load_snapshot).
+ *
+ * A snapshot is a flat file in the machine's own byte order (it is only a
+ * cache, so it never moves between machines):
+ *
+ *   magic | u32 version | string dir | u32 number of songs | songs
+ *         | u32 number of terms | terms
+ *
+ * where each song is its entry followed by a u32 number of tiers and their
+ * entries, an entry is
+ *
+ *   string file name | stamp | stamp of info file | string info (songs only)
+ *     | i32 bitrate | u8 has frame index | frame index (if it has one)
+ *
+ * a stamp is u64 size | i64 mtime, a frame index is u64 file size | f64
+ * seconds per frame | u32 number of frames | u32 offset of each frame, each
+ * term is a string followed by a u32 count and that many u32 song numbers,
+ * and a string is a u32 length followed by its bytes.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "SongCatalog.h"
+#include "Log.h"
+
+namespace fs = std::filesystem;
+
+using std::string;
+using std::vector;
+
+const char SNAPSHOT_MAGIC[8] = { 'J', 'U', 'K', 'E', 'C', 'A', 'T', '\n' };
+
+// Bump this whenever the format changes, so old snapshots are ignored.
+const uint32_t SNAPSHOT_VERSION = 1;
+
+/**
+ * Class that builds up a snapshot in memory.
+ */
+class SnapshotWriter {
+  public:
+	string data;
+
+	template <typename T>
+	void put(T value) {
+		data.append((const char*)&value, sizeof(value));
+	}
+
+	void put_string(const string &str) {
+		put((uint32_t)str.length());
+		data += str;
+	}
+
+	void put_stamp(const FileStamp &stamp) {
+		put(stamp.size);
+		put(stamp.mtime);
+	}
+
+	void put_entry(const SongEntry &song, bool with_info) {
+		put_string(song.path.filename().string());
+		put_stamp(song.stamp);
+		put_stamp(song.info_stamp);
+		if (with_info)
+			put_string(string(song.info->begin(), song.info->end()));
+		put((int32_t)song.bitrate);
+
+		const Mp3FrameIndex *frames = song.frame_index->peek();
+		put((uint8_t)(frames != NULL));
+		if (frames != NULL) {
+			put((uint64_t)frames->total_size());
+			put(frames->seconds_per_frame());
+			put((uint32_t)frames->num_frames());
+			data.append((const char*)frames->starts().data(),
+						frames->num_frames() * sizeof(uint32_t));
+		}
+	}
+};
+
+/**
+ * Class that reads a snapshot back. Running off the end sets ok to false
+ * (and returns zeros) rather than reading past it.
+ */
+class SnapshotReader {
+  public:
+	const char *pos;
+	const char *end;
+	bool ok;
+
+	SnapshotReader(const char *data, size_t length) :
+		pos(data), end(data + length), ok(true) {}
+
+	bool has(size_t length) {
+		if ((size_t)(end - pos) < length)
+			ok = false;
+		return ok;
+	}
+
+	template <typename T>
+	T get() {
+		T value = T();
+		if (has(sizeof(value))) {
+			memcpy(&value, pos, sizeof(value));
+			pos += sizeof(value);
+		}
+		return value;
+	}
+
+	string get_string() {
+		uint32_t length = get<uint32_t>();
+		if (!has(length))
+			return string();
+
+		string str(pos, length);
+		pos += length;
+		return str;
+	}
+
+	FileStamp get_stamp() {
+		FileStamp stamp;
+		stamp.size = get<uint64_t>();
+		stamp.mtime = get<int64_t>();
+		return stamp;
+	}
+
+	/**
+	 * Reads an entry. Tiers share their song's info and stats, so those are
+	 * passed in; a song gets new stats.
+	 */
+	SongEntry get_entry(const fs::path &dir, const SongEntry *song) {
+		SongEntry entry;
+		entry.path = dir / get_string();
+		entry.stamp = get_stamp();
+		entry.info_stamp = get_stamp();
+		if (song == NULL) {
+			string info = get_string();
+			entry.info = std::make_shared<const vector<char>>(info.begin(),
+																info.end());
+			entry.stats = std::make_shared<SongStats>();
+		}
+		else {
+			entry.info = song->info;
+			entry.stats = song->stats;
+		}
+		entry.bitrate = get<int32_t>();
+
+		if (get<uint8_t>() == 0) {
+			entry.frame_index = std::make_shared<LazyFrameIndex>();
+			return entry;
+		}
+
+		uint64_t file_size = get<uint64_t>();
+		double frame_seconds = get<double>();
+		uint32_t num_frames = get<uint32_t>();
+		vector<uint32_t> starts;
+		if (has((size_t)num_frames * sizeof(uint32_t))) {
+			starts.resize(num_frames);
+			memcpy(starts.data(), pos, num_frames * sizeof(uint32_t));
+			pos += num_frames * sizeof(uint32_t);
+		}
+
+		entry.frame_index = std::make_shared<LazyFrameIndex>(
+			std::unique_ptr<const Mp3FrameIndex>(
+				new Mp3FrameIndex(std::move(starts), file_size, frame_seconds)));
+		return entry;
+	}
+};
+
+bool SongCatalog::save_snapshot(const fs::path &snapshot_file) const {
+	SnapshotWriter writer;
+	writer.data.append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	writer.put(SNAPSHOT_VERSION);
+	writer.put_string(this->dir.string());
+
+	writer.put((uint32_t)this->songs.size());
+	for (const SongEntry &song : this->songs) {
+		writer.put_entry(song, true);
+		writer.put((uint32_t)song.tiers.size());
+		for (const SongEntry &tier : song.tiers)
+			writer.put_entry(tier, false);
+	}
+
+	writer.put((uint32_t)this->index.num_terms());
+	for (size_t i = 0; i < this->index.num_terms(); i++) {
+		const vector<uint32_t> &songs_with = this->index.songs_with(i);
+		writer.put_string(this->index.term(i));
+		writer.put((uint32_t)songs_with.size());
+		writer.data.append((const char*)songs_with.data(),
+							songs_with.size() * sizeof(uint32_t));
+	}
+
+	// Write it next to the old one, then swap them over.
+	fs::path temp_file = snapshot_file.string() + ".tmp";
+	{
+		std::ofstream out(temp_file, std::ofstream::binary | std::ofstream::trunc);
+		out.write(writer.data.data(), writer.data.length());
+		if (!out.good()) {
+			LOG(LogLevel::WARN, "Couldn't write catalog snapshot " << temp_file);
+			return false;
+		}
+	}
+
+	std::error_code error;
+	fs::rename(temp_file, snapshot_file, error);
+	if (error) {
+		LOG(LogLevel::WARN, "Couldn't save catalog snapshot " << snapshot_file
+			<< ": " << error.message());
+		return false;
+	}
+
+	LOG(LogLevel::INFO, "Saved catalog snapshot (" << writer.data.length()
+		<< " bytes) to " << snapshot_file);
+	return true;
+}
+
+std::shared_ptr<const SongCatalog> SongCatalog::load_snapshot(
+											const fs::path &snapshot_file,
+											const fs::path &dir) {
+	int fd = open(snapshot_file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		LOG(LogLevel::INFO, "No catalog snapshot at " << snapshot_file);
+		return NULL;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) < 0 || info.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		LOG(LogLevel::WARN, "Mapping catalog snapshot: " << strerror(errno));
+		return NULL;
+	}
+
+	// We read it from start to finish, once.
+	madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+
+	SnapshotReader reader((const char*)mapped, info.st_size);
+	std::shared_ptr<SongCatalog> catalog(new SongCatalog());
+	catalog->dir = dir;
+
+	bool matches = reader.has(sizeof(SNAPSHOT_MAGIC))
+		&& memcmp(reader.pos, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0;
+	reader.pos += matches ? sizeof(SNAPSHOT_MAGIC) : 0;
+	matches = matches && reader.get<uint32_t>() == SNAPSHOT_VERSION
+		&& reader.get_string() == dir.string();
+
+	if (matches) {
+		uint32_t num_songs = reader.get<uint32_t>();
+		catalog->songs.reserve(std::min((size_t)num_songs,
+										(size_t)info.st_size / 32));
+		for (uint32_t i = 0; i < num_songs && reader.ok; i++) {
+			catalog->songs.push_back(reader.get_entry(dir, NULL));
+			SongEntry &song = catalog->songs.back();
+
+			uint32_t num_tiers = reader.get<uint32_t>();
+			for (uint32_t t = 0; t < num_tiers && reader.ok; t++)
+				song.tiers.push_back(reader.get_entry(dir, &song));
+		}
+
+		uint32_t num_terms = reader.get<uint32_t>();
+		vector<string> terms;
+		vector<vector<uint32_t>> postings;
+		for (uint32_t i = 0; i < num_terms && reader.ok; i++) {
+			terms.push_back(reader.get_string());
+			uint32_t count = reader.get<uint32_t>();
+			postings.emplace_back();
+			for (uint32_t j = 0; j < count && reader.ok; j++) {
+				uint32_t song_num = reader.get<uint32_t>();
+				if (song_num >= num_songs)
+					reader.ok = false;
+				postings.back().push_back(song_num);
+			}
+		}
+		catalog->index = SongIndex(std::move(terms), std::move(postings));
+	}
+
+	munmap(mapped, info.st_size);
+
+	if (!matches || !reader.ok || reader.pos != reader.end) {
+		LOG(LogLevel::WARN, "Ignoring catalog snapshot " << snapshot_file
+			<< " (it is " << (matches ? "damaged" : "of something else") << ")");
+		return NULL;
+	}
+
+	catalog->render_list();
+
+	LOG(LogLevel::INFO, "Loaded " << catalog->songs.size() << " songs from"
+		<< " catalog snapshot " << snapshot_file);
+
+	return catalog;
+}
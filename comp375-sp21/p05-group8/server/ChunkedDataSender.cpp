@@ -4,38 +4,45 @@
 #include <cerrno>
 #include <cstdio>
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 #include "ChunkedDataSender.h"
 
 namespace fs = std::filesystem;
 
 using fs::path;
-using std::ifstream;
 
 
-ArraySender::ArraySender(const char *array_to_send, size_t length) {
-	this->array = new char[length];
-	std::copy(array_to_send, array_to_send+length, this->array);
-	this->array_length = length;
-	this->curr_loc = 0;
+ArraySender::ArraySender() : curr_loc(0) {
+	this->array = SenderPool::local().take_buffer();
 }
 
-ssize_t ArraySender::send_next_chunk(int sock_fd) {
+ArraySender::ArraySender(const char *array_to_send, size_t length) :
+	ArraySender() {
+	this->append(array_to_send, length);
+}
+
+void ArraySender::append(const char *str) {
+	this->append(str, strlen(str));
+}
+
+ssize_t ArraySender::send_next_chunk(int sock_fd, size_t max_bytes) {
 	// Determine how many bytes we need to put in the next chunk.
-	// This will be either the CHUNK_SIZE constant or the number of bytes left
-	// to send in the array, whichever is smaller.
-	size_t num_bytes_remaining = array_length - curr_loc;
-	size_t bytes_in_chunk = std::min(num_bytes_remaining, CHUNK_SIZE);
+	// This will be the number of bytes left to send in the array, but never
+	// over max_bytes.
+	size_t num_bytes_remaining = array.size() - curr_loc;
+	size_t bytes_in_chunk = std::min(num_bytes_remaining, max_bytes);
 
 	if (bytes_in_chunk > 0) {
-		// Create the chunk and copy the data over from the appropriate
-		// location in the array
-		char chunk[CHUNK_SIZE];
-		memcpy(chunk, array+curr_loc, bytes_in_chunk);
-
-		ssize_t num_bytes_sent = send(sock_fd, chunk, bytes_in_chunk, 0);
+		// Send straight out of the array: nothing else can change it while
+		// we are sending, so there's no need to copy it into a chunk first.
+		ssize_t num_bytes_sent = send(sock_fd, array.data() + curr_loc,
+										bytes_in_chunk, MSG_NOSIGNAL);
 
 		if (num_bytes_sent > 0) {
 			// We successfully send some of the data so update our location in
@@ -49,9 +56,9 @@ ssize_t ArraySender::send_next_chunk(int sock_fd) {
 			return -1;
 		}
 		else {
-			// Send had an error which we didn't expect, so exit the program.
-			perror("send_next_chunk send");
-			exit(EXIT_FAILURE);
+			// The client is gone (e.g. EPIPE or ECONNRESET), so it should be
+			// closed.
+			return SEND_FAILED;
 		}
 	}
 	else {
@@ -61,52 +68,220 @@ ssize_t ArraySender::send_next_chunk(int sock_fd) {
 
 
 
-FileSender::FileSender(fs::path file_path) {
-	// Open the file in binary mode and get its size
-	this->file.open(file_path.string(), ifstream::binary); 
-	this->file_size = fs::file_size(file_path);
-	this->curr_pos = 0;
+FileSender *FileSender::open_file(const fs::path &file_path,
+									FileSendMode mode, size_t start) {
+	// Open the file and get its size
+	int file_fd = open(file_path.c_str(), O_RDONLY);
+	if (file_fd < 0) {
+		perror("FileSender open");
+		return NULL;
+	}
+
+	struct stat file_info;
+	if (fstat(file_fd, &file_info) < 0) {
+		perror("FileSender fstat");
+		close(file_fd);
+		return NULL;
+	}
+
+	return new FileSender(file_fd, file_info.st_size, mode, start);
+}
+
+FileSender::FileSender(int file_fd, size_t file_size, FileSendMode mode,
+						size_t start) :
+	file_fd(file_fd), file_size(file_size),
+	curr_pos(std::min(start, file_size)), mode(mode) {
+}
+
+FileSender::~FileSender() {
+	close(this->file_fd);
+}
+
+ssize_t FileSender::send_next_chunk(int sock_fd, size_t max_bytes) {
+	if (this->mode == SENDFILE)
+		return this->send_with_sendfile(sock_fd, max_bytes);
+	else
+		return this->send_with_buffer(sock_fd, max_bytes);
+}
+
+ssize_t FileSender::send_with_sendfile(int sock_fd, size_t max_bytes) {
+	size_t num_bytes_remaining = this->file_size - this->curr_pos;
+
+	if (num_bytes_remaining == 0)
+		return 0;
+
+	// Ask for everything that is left (up to max_bytes): the kernel will send
+	// as much as fits in the socket buffer and update curr_pos for us.
+	ssize_t num_bytes_sent = sendfile(sock_fd, this->file_fd, &this->curr_pos,
+										std::min(num_bytes_remaining, max_bytes));
+
+	if (num_bytes_sent > 0) {
+		return num_bytes_sent;
+	}
+	else if (num_bytes_sent < 0 && errno == EAGAIN) {
+		// We couldn't send anything because the buffer was full
+		return -1;
+	}
+	else if (num_bytes_sent < 0 && (errno == EINVAL || errno == ENOSYS)) {
+		// This file can't be used with sendfile, so read it ourselves.
+		this->mode = BUFFERED;
+		return this->send_with_buffer(sock_fd, max_bytes);
+	}
+	else if (num_bytes_sent == 0) {
+		// The file shrank out from under us, so there is nothing left.
+		this->file_size = this->curr_pos;
+		return 0;
+	}
+	else {
+		// The client is gone (e.g. EPIPE or ECONNRESET), so it should be
+		// closed. sendfile can't be told not to raise SIGPIPE, which is why
+		// jukebox-server ignores it.
+		return SEND_FAILED;
+	}
 }
 
-ssize_t FileSender::send_next_chunk(int sock_fd) {
+ssize_t FileSender::send_with_buffer(int sock_fd, size_t max_bytes) {
 	// Determine how many bytes we need to put in the next chunk.
 	size_t num_bytes_remaining = this->file_size - this->curr_pos;
-	ssize_t bytes_in_chunk = std::min(num_bytes_remaining, CHUNK_SIZE);
+	size_t bytes_in_chunk = std::min({num_bytes_remaining, MAX_CHUNK_SIZE,
+										max_bytes});
 
 	if (bytes_in_chunk > 0) {
-		// Create the chunk and read the data into it from the file
-		char chunk[CHUNK_SIZE];
-		this->file.read(chunk, bytes_in_chunk); // read up to bytes_in_chunk into file_data buffer
-		
-		if (this->file.gcount() != bytes_in_chunk) {
-			// There was an error reading the file? TODO
-			// Assign gcount value to bytes_read for later
+		// Read the chunk's data from the file into our thread's buffer
+		// (which is too big for the stack). Using pread means we never have
+		// to seek back after a partial send.
+		static thread_local char chunk[MAX_CHUNK_SIZE];
+		ssize_t bytes_read = pread(this->file_fd, chunk, bytes_in_chunk,
+									this->curr_pos);
+		if (bytes_read < 0) {
+			// We can't finish the song, so the client will have to go.
+			perror("send_next_chunk pread");
+			return SEND_FAILED;
+		}
+		else if (bytes_read == 0) {
+			// The file shrank out from under us, so there is nothing left.
+			this->file_size = this->curr_pos;
+			return 0;
 		}
 
-		ssize_t num_bytes_sent = send(sock_fd, chunk, bytes_in_chunk, 0);
+		ssize_t num_bytes_sent = send(sock_fd, chunk, bytes_read, MSG_NOSIGNAL);
 
 		if (num_bytes_sent > 0) {
 			// We successfully send some of the data so update our location in
-			// the array so we know where to start sending the next time we
+			// the file so we know where to start sending the next time we
 			// call this function.
 			this->curr_pos += num_bytes_sent;
-			this->file.seekg(curr_pos);
-
 			return num_bytes_sent;
 		}
 		else if (num_bytes_sent < 0 && errno == EAGAIN) {
 			// We couldn't send anything because the buffer was full
-			this->file.seekg(curr_pos); // reset the position in the file
-
 			return -1;
 		}
 		else {
-			// Send had an error which we didn't expect, so exit the program.
-			perror("send_next_chunk send");
-			exit(EXIT_FAILURE);
+			// The client is gone (e.g. EPIPE or ECONNRESET), so it should be
+			// closed.
+			return SEND_FAILED;
 		}
 	}
 	else {
 		return 0;
 	}
 }
+
+
+
+CachedSongSender::CachedSongSender(SharedBuffer song_data, size_t start) :
+	song(song_data), curr_loc(std::min(start, song_data->size())) {}
+
+ssize_t CachedSongSender::send_next_chunk(int sock_fd, size_t max_bytes) {
+	size_t num_bytes_remaining = this->song->size() - this->curr_loc;
+
+	if (num_bytes_remaining == 0)
+		return 0;
+
+	// Send straight out of the shared buffer; no need to copy into a chunk
+	// since the data can't change underneath us.
+	ssize_t num_bytes_sent = send(sock_fd, this->song->data() + this->curr_loc,
+									std::min(num_bytes_remaining, max_bytes),
+									MSG_NOSIGNAL);
+
+	if (num_bytes_sent > 0) {
+		this->curr_loc += num_bytes_sent;
+		return num_bytes_sent;
+	}
+	else if (num_bytes_sent < 0 && errno == EAGAIN) {
+		// We couldn't send anything because the buffer was full
+		return -1;
+	}
+	else {
+		// The client is gone (e.g. EPIPE or ECONNRESET), so it should be
+		// closed.
+		return SEND_FAILED;
+	}
+}
+
+
+
+PacedSender::PacedSender(ChunkedDataSender *inner, double bytes_per_sec,
+							size_t burst_bytes) :
+	inner(inner), bytes_per_sec(bytes_per_sec), burst_bytes(burst_bytes),
+	total_sent(0), started(false) {}
+
+/**
+ * Gets the total number of bytes we are allowed to have sent by the given
+ * time: the burst plus whatever has "played" since we started.
+ */
+double PacedSender::bytes_allowed(std::chrono::steady_clock::time_point now) const {
+	if (!this->started)
+		return this->burst_bytes;
+
+	std::chrono::duration<double> elapsed = now - this->start_time;
+	return this->burst_bytes + elapsed.count() * this->bytes_per_sec;
+}
+
+ssize_t PacedSender::send_next_chunk(int sock_fd, size_t max_bytes) {
+	auto now = std::chrono::steady_clock::now();
+	if (!this->started) {
+		this->started = true;
+		this->start_time = now;
+	}
+
+	double allowed = this->bytes_allowed(now);
+
+	// Not worth waking up for less than a chunk (or whatever is left, if we
+	// were asked for less than that), so wait until a whole chunk's worth of
+	// time has passed.
+	size_t worthwhile = std::min({CHUNK_SIZE, max_bytes, this->bytes_left()});
+	if (worthwhile > 0 && allowed < this->total_sent + worthwhile)
+		return SEND_PACED;
+
+	size_t budget = (size_t)allowed - this->total_sent;
+	ssize_t num_bytes_sent = this->inner->send_next_chunk(sock_fd,
+											std::min(budget, max_bytes));
+	if (num_bytes_sent > 0)
+		this->total_sent += num_bytes_sent;
+
+	return num_bytes_sent;
+}
+
+size_t PacedSender::bytes_ready() const {
+	size_t left = this->bytes_left();
+	double allowed = this->bytes_allowed(std::chrono::steady_clock::now());
+
+	if (allowed < this->total_sent + std::min(CHUNK_SIZE, left))
+		return 0;
+
+	return std::min(left, (size_t)allowed - this->total_sent);
+}
+
+std::chrono::steady_clock::time_point PacedSender::resume_time() const {
+	auto now = std::chrono::steady_clock::now();
+
+	double wanted = this->total_sent + std::min(CHUNK_SIZE, this->bytes_left());
+	double wait_secs = (wanted - this->bytes_allowed(now)) / this->bytes_per_sec;
+	if (wait_secs <= 0)
+		return now;
+
+	return now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+							std::chrono::duration<double>(wait_secs));
+}
@@ -1,36 +1,120 @@
 #ifndef CHUNKEDDATASENDER_H
 #define CHUNKEDDATASENDER_H
 
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
+#include <memory>
+#include <vector>
 
+#include <sys/types.h>
+
+#include "SenderPool.h"
+
+// Smallest chunk worth sending (e.g. when waking a paced sender).
 const size_t CHUNK_SIZE = 4096;
 
+// Biggest chunk a client asks a sender for at once. Clients pick a chunk
+// size in between, depending on how fast their socket drains.
+const size_t MAX_CHUNK_SIZE = 256 * 1024;
+
+/**
+ * Value returned by send_next_chunk when a (paced) sender has sent as much as
+ * it is allowed to for now. This is different from -1 (full socket buffer)
+ * since waiting for EPOLLOUT won't help: the sender's resume_time tells us
+ * when to try again.
+ */
+const ssize_t SEND_PACED = -2;
+
+/**
+ * Value returned by send_next_chunk when the response can't go on (e.g. the
+ * client reset the connection), so the client should be closed.
+ */
+const ssize_t SEND_FAILED = -3;
+
+/**
+ * How a FileSender moves file data onto the socket.
+ *
+ * SENDFILE has the kernel copy straight from the file to the socket (no
+ * userland buffer). BUFFERED reads each chunk into a buffer with pread and
+ * then sends it, which works for any kind of file.
+ */
+enum FileSendMode { SENDFILE, BUFFERED };
+
+/**
+ * Immutable, reference-counted block of bytes that many senders can share.
+ */
+typedef std::shared_ptr<const std::vector<char>> SharedBuffer;
+
 /**
  * An interface for sending data in fixed-sized chunks over a network socket.
- * This interface contains one function, send_next_chunk, which should send
- * the next chunk of data.
+ * The main function, send_next_chunk, should send the next chunk of data (but
+ * never more than max_bytes). The others say how much data is left, so that
+ * the data can be split into frames of a known size (see Protocol.h).
+ *
+ * Senders are created with new and deleted as usual, but their memory comes
+ * from (and goes back to) the thread's SenderPool rather than the heap.
  */
 class ChunkedDataSender {
   public:
 	virtual ~ChunkedDataSender() {}
 
-	virtual ssize_t send_next_chunk(int sock_fd) = 0;
+	static void *operator new(size_t size) {
+		return SenderPool::local().allocate(size);
+	}
+
+	static void operator delete(void *block, size_t size) {
+		SenderPool::local().deallocate(block, size);
+	}
+
+	virtual ssize_t send_next_chunk(int sock_fd, size_t max_bytes = SIZE_MAX) = 0;
+
+	/**
+	 * Gets the number of bytes left to send (0 once everything is sent).
+	 */
+	virtual size_t bytes_left() const = 0;
+
+	/**
+	 * Gets the number of bytes we could send right now if the socket had room
+	 * for them. This is the same as bytes_left, except for senders that hold
+	 * data back (see PacedSender).
+	 */
+	virtual size_t bytes_ready() const {
+		return bytes_left();
+	}
+
+	/**
+	 * After send_next_chunk returns SEND_PACED (or bytes_ready returns 0),
+	 * gets the time at which it is worth trying again. Senders that never
+	 * hold data back don't need to know.
+	 */
+	virtual std::chrono::steady_clock::time_point resume_time() const {
+		return std::chrono::steady_clock::time_point::max();
+	}
 };
 
 /**
  * Class that allows sending an array of over a network socket.
+ *
+ * The array is a buffer from the SenderPool, so text responses can be
+ * written straight into it (see append) rather than built somewhere else
+ * and then copied in.
  */
 class ArraySender : public virtual ChunkedDataSender {
   private:
-	char *array; // the array of data to send
-	size_t array_length; // length of the array to send (in bytes)
+	std::vector<char> array; // the array of data to send
 	size_t curr_loc; // index in array where next send will start
 
   public:
 	/**
-	 * Constructor for ArraySender class.
+	 * Constructor for ArraySender class that starts with nothing to send.
+	 * Use append to add the data.
+	 */
+	ArraySender();
+
+	/**
+	 * Constructor for ArraySender class that copies the array to send.
 	 */
 	ArraySender(const char *array_to_send, size_t length);
 
@@ -38,42 +122,203 @@ class ArraySender : public virtual ChunkedDataSender {
 	 * Destructor for ArraySender class.
 	 */
 	~ArraySender() {
-		delete[] array;
+		SenderPool::local().give_back_buffer(std::move(array));
 	}
 
+	/**
+	 * Adds data to the end of what we will send.
+	 *
+	 * @param data The data to add.
+	 * @param length Length of the data (in bytes).
+	 */
+	void append(const char *data, size_t length) {
+		array.insert(array.end(), data, data + length);
+	}
+
+	/**
+	 * Adds a (null terminated) string to the end of what we will send.
+	 */
+	void append(const char *str);
+
 	/**
 	 * Sends the next chunk of data, starting at the spot in the array right
 	 * after the last chunk we sent.
 	 *
 	 * @param sock_fd Socket which to send the data over.
+	 * @param max_bytes Most bytes to send.
 	 * @return -1 if we couldn't send because of a full socket buffer,
-	 * 	otherwise the number of bytes actually sent over the socket.
+	 * 	SEND_FAILED if the connection is broken, otherwise the number of
+	 * 	bytes actually sent over the socket.
 	 */
-	virtual ssize_t send_next_chunk(int sock_fd);
+	virtual ssize_t send_next_chunk(int sock_fd, size_t max_bytes = SIZE_MAX);
+
+	virtual size_t bytes_left() const {
+		return array.size() - curr_loc;
+	}
 };
 
 
+/**
+ * Class that allows sending a file over a network socket.
+ */
 class FileSender : public virtual ChunkedDataSender {
   private:
-	std::ifstream file; // the file stream containing the data to send
+	int file_fd;       // descriptor for the file containing the data to send
 	size_t file_size;  // size of the file to send (in bytes)
-	size_t curr_pos;   // position in file where next send will start
+	off_t curr_pos;    // position in file where next send will start
+	FileSendMode mode; // how we get data from the file to the socket
+
+	ssize_t send_with_sendfile(int sock_fd, size_t max_bytes);
+	ssize_t send_with_buffer(int sock_fd, size_t max_bytes);
+
+	/**
+	 * Constructor for FileSender class (see open_file).
+	 *
+	 * @param file_fd Descriptor for the (open) file, which we now own.
+	 * @param file_size Size of the file (in bytes).
+	 * @param mode How to send the file.
+	 * @param start Offset in the file to start sending from.
+	 */
+	FileSender(int file_fd, size_t file_size, FileSendMode mode, size_t start);
 
   public:
 	/**
-	 * Constructor for FileSender class.
+	 * Opens a file to send.
+	 *
+	 * @param file_path Path to the file to send.
+	 * @param mode How to send the file (falls back to BUFFERED if the file
+	 * 	doesn't support sendfile).
+	 * @param start Offset in the file to start sending from.
+	 * @return The new FileSender, or NULL if the file couldn't be opened
+	 * 	(e.g. it was deleted since the catalog was scanned).
 	 */
-	FileSender(std::filesystem::path file_path);
+	static FileSender *open_file(const std::filesystem::path &file_path,
+									FileSendMode mode = SENDFILE,
+									size_t start = 0);
+
+	/**
+	 * Destructor for FileSender class.
+	 */
+	~FileSender();
 
 	/**
 	 * Sends the next chunk of data, starting at the spot in the file right
 	 * after the last chunk we sent.
 	 *
 	 * @param sock_fd Socket which to send the data over.
+	 * @param max_bytes Most bytes to send.
 	 * @return -1 if we couldn't send because of a full socket buffer,
+	 * 	SEND_FAILED if the connection is broken (or the file can't be read),
 	 * 	otherwise the number of bytes actually sent over the socket.
 	 */
-	virtual ssize_t send_next_chunk(int sock_fd);
+	virtual ssize_t send_next_chunk(int sock_fd, size_t max_bytes = SIZE_MAX);
+
+	virtual size_t bytes_left() const {
+		return file_size - curr_pos;
+	}
+};
+
+/**
+ * Class that allows sending a song that is already in memory (e.g. from the
+ * SongCache) over a network socket. It also sends the other shared responses
+ * that are made ahead of time, like the song list.
+ *
+ * The song data is shared with every other client playing the same song, so
+ * each CachedSongSender only keeps its own offset into it.
+ */
+class CachedSongSender : public virtual ChunkedDataSender {
+  private:
+	SharedBuffer song; // the (shared) song data to send
+	size_t curr_loc;   // index in song where next send will start
+
+  public:
+	/**
+	 * Constructor for CachedSongSender class.
+	 *
+	 * @param song_data The song to send.
+	 * @param start Offset in the song to start sending from.
+	 */
+	CachedSongSender(SharedBuffer song_data, size_t start = 0);
+
+	/**
+	 * Sends as much of the rest of the song as the socket buffer will take.
+	 *
+	 * @param sock_fd Socket which to send the data over.
+	 * @param max_bytes Most bytes to send.
+	 * @return -1 if we couldn't send because of a full socket buffer,
+	 * 	SEND_FAILED if the connection is broken, otherwise the number of
+	 * 	bytes actually sent over the socket.
+	 */
+	virtual ssize_t send_next_chunk(int sock_fd, size_t max_bytes = SIZE_MAX);
+
+	virtual size_t bytes_left() const {
+		return song->size() - curr_loc;
+	}
+};
+
+/**
+ * Class that wraps another sender so that it sends no faster than a given
+ * rate (e.g. the bitrate of a song), after an initial burst.
+ *
+ * This keeps a fast client from pulling a whole song at line rate, which
+ * starves other clients and wastes bandwidth if the listener stops early.
+ */
+class PacedSender : public virtual ChunkedDataSender {
+  private:
+	ChunkedDataSender *inner; // the sender doing the actual sending
+	double bytes_per_sec;     // how fast we let data out after the burst
+	size_t burst_bytes;       // how much we send right away
+	size_t total_sent;        // bytes sent so far
+	bool started;             // whether we have sent anything yet
+	std::chrono::steady_clock::time_point start_time; // time of first send
+
+	double bytes_allowed(std::chrono::steady_clock::time_point now) const;
+
+  public:
+	/**
+	 * Constructor for PacedSender class. The PacedSender takes ownership of
+	 * (i.e. will delete) the inner sender.
+	 *
+	 * @param inner The sender to pace.
+	 * @param bytes_per_sec Rate to send at after the initial burst.
+	 * @param burst_bytes Bytes to send right away (e.g. for buffering).
+	 */
+	PacedSender(ChunkedDataSender *inner, double bytes_per_sec,
+				size_t burst_bytes);
+
+	/**
+	 * Destructor for PacedSender class.
+	 */
+	~PacedSender() {
+		delete inner;
+	}
+
+	/**
+	 * Sends the next chunk of data if we are allowed to by the pacing.
+	 *
+	 * @param sock_fd Socket which to send the data over.
+	 * @param max_bytes Most bytes to send.
+	 * @return SEND_PACED if we have already sent as much as we are allowed to
+	 * 	for now, otherwise the same as the inner sender.
+	 */
+	virtual ssize_t send_next_chunk(int sock_fd, size_t max_bytes = SIZE_MAX);
+
+	virtual size_t bytes_left() const {
+		return inner->bytes_left();
+	}
+
+	/**
+	 * Gets the number of bytes the pacing lets us send right now, which is 0
+	 * until we are allowed to send at least a whole chunk (or the rest of
+	 * the data, if that is smaller).
+	 */
+	virtual size_t bytes_ready() const;
+
+	/**
+	 * Gets the time at which we will be allowed to send a worthwhile amount
+	 * of data again.
+	 */
+	virtual std::chrono::steady_clock::time_point resume_time() const;
 };
 
 #endif // CHUNKEDDATASENDER_H
@@ -0,0 +1,58 @@
+#include <iostream>
+
+#include "ClientSlab.h"
+#include "ServerStats.h"
+
+
+ConnectedClient *ClientSlab::add(int fd, PacingScheduler *pacer,
+								ClientContext *context) {
+	if ((size_t)fd >= this->slots.size())
+		this->slots.resize(fd + 1);
+
+	std::unique_ptr<ConnectedClient> &slot = this->slots[fd];
+	uint32_t generation = 0;
+
+	if (slot == NULL) {
+		slot.reset(new ConnectedClient());
+	}
+	else if (slot->client_fd != -1) {
+		// The fd should have been closed (and its slot freed) before the OS
+		// could give it to us again.
+		std::cerr << "ERROR: File descriptor already mapped to an existing client.\n";
+		exit(EXIT_FAILURE);
+	}
+	else {
+		generation = slot->generation + 1;
+	}
+
+	*slot = ConnectedClient(fd, RECEIVING, pacer);
+	slot->generation = generation;
+	slot->context = context;
+	this->num_clients++;
+	ShardStats::add(ShardStats::local().clients, 1);
+
+	return slot.get();
+}
+
+ConnectedClient *ClientSlab::find(int fd, uint32_t generation) {
+	if (fd < 0 || (size_t)fd >= this->slots.size() || this->slots[fd] == NULL)
+		return NULL;
+
+	ConnectedClient *client = this->slots[fd].get();
+	if (client->client_fd != fd || client->generation != generation)
+		return NULL;
+
+	return client;
+}
+
+void ClientSlab::remove(ConnectedClient *client) {
+	// A slot is free as soon as handle_close marks it as closed (client_fd is
+	// -1), so all that's left is our own bookkeeping.
+	if (client->client_fd != -1) {
+		std::cerr << "ERROR: Removing a client that is still connected.\n";
+		exit(EXIT_FAILURE);
+	}
+
+	this->num_clients--;
+	ShardStats::subtract(ShardStats::local().clients, 1);
+}
@@ -0,0 +1,65 @@
+#ifndef CLIENTSLAB_H
+#define CLIENTSLAB_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ConnectedClient.h"
+
+/**
+ * Class that stores the connected clients of one event loop in a dense array
+ * indexed by file descriptor.
+ *
+ * Each slot is allocated once and then reused by whichever client gets that
+ * file descriptor next, so a slot's address never changes and can be stored
+ * directly in epoll_event.data.ptr (as the client's EventHandler). Every
+ * reuse bumps the slot's generation, which lets anything holding an (fd,
+ * generation) pair (e.g. a timer) notice that its client is gone.
+ */
+class ClientSlab {
+  private:
+	std::vector<std::unique_ptr<ConnectedClient>> slots; // indexed by fd
+	size_t num_clients; // slots currently in use
+
+  public:
+	/**
+	 * Constructor for ClientSlab class.
+	 */
+	ClientSlab() : num_clients(0) {}
+
+	/**
+	 * Puts a new client in the slot for fd.
+	 *
+	 * @param fd The new client's socket.
+	 * @param pacer Pacer for the new client's songs.
+	 * @param context The shard the new client belongs to.
+	 * @return The slot holding the new client.
+	 */
+	ConnectedClient *add(int fd, PacingScheduler *pacer,
+							ClientContext *context = NULL);
+
+	/**
+	 * Gets the client in the slot for fd, as long as the slot hasn't been
+	 * reused since it was given out with the given generation.
+	 *
+	 * @return The client, or NULL if there is no such client anymore.
+	 */
+	ConnectedClient *find(int fd, uint32_t generation);
+
+	/**
+	 * Updates the count of connected clients after a client's connection has
+	 * been closed (which is what actually frees its slot).
+	 */
+	void remove(ConnectedClient *client);
+
+	/**
+	 * Gets the number of clients currently connected.
+	 */
+	size_t size() const {
+		return num_clients;
+	}
+};
+
+#endif // CLIENTSLAB_H
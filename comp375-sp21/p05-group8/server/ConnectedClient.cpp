@@ -1,248 +1,1010 @@
-#include <iostream>
-
-#include <fstream>
+#include <algorithm>
 #include <sstream>
-#include <filesystem>
 
+#include <climits>
 #include <cstring>
+#include <cerrno>
 
 #include <unistd.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "ChunkedDataSender.h"
+#include "ClientSlab.h"
 #include "ConnectedClient.h"
+#include "SongCache.h"
+#include "PacingScheduler.h"
+#include "SongCatalog.h"
+#include "RadioChannel.h"
+#include "ServerStats.h"
+#include "Log.h"
 
-namespace fs = std::filesystem;
-
-using std::cout;
-using std::cerr;
 using std::string;
-using fs::path;
-
 
-ConnectedClient::ConnectedClient(int fd, ClientState initial_state) :
-	client_fd(fd), sender(NULL), state(initial_state) {}
+/**
+ * Finds where to start sending a copy of a song (i.e. one of its tiers) to
+ * start at a given point in the song.
+ *
+ * @param song The song.
+ * @param source The copy being sent.
+ * @param amount Offset in the song, in bytes or seconds.
+ * @param in_seconds True if amount is in seconds.
+ * @return The offset in source to start sending from.
+ */
+static size_t seek_in_tier(const SongEntry &song, const SongEntry &source,
+							double amount, bool in_seconds) {
+	if (in_seconds)
+		return source.seek_to_time(amount);
+
+	// Byte offsets are in the original, so go by the time they play at in
+	// any other copy.
+	if (&source == &song || song.bitrate == 0)
+		return source.seek_to_byte(amount);
+	return source.seek_to_time(amount * 8 / song.bitrate);
+}
 
-void ConnectedClient::send_txt_response(int epoll_fd, string str) {
-	char *data_to_send = strcpy(new char[str.length() + 1], str.c_str());
-	size_t data_size = strlen(data_to_send); 
 
-	ArraySender *array_sender = new ArraySender(data_to_send, data_size);
-	delete[] data_to_send;
+ConnectedClient::ConnectedClient(int fd, ClientState initial_state,
+									PacingScheduler *pacer) :
+	client_fd(fd), generation(0), sender(NULL), state(initial_state), pacer(pacer),
+	context(NULL), paced(false),
+	wakeup_at(PacingScheduler::time_point::max()), watching_output(false),
+	shut_down(false),
+	protocol(UNDECIDED), line_mode(false), streaming(false),
+	running_commands(false), input_len(0), num_responses(0), next_response(0),
+	current_response(0), frame_left(0), header_sent(FRAME_HEADER_SIZE),
+	chunk_size(CHUNK_SIZE), last_active(std::chrono::steady_clock::now()),
+	quality(QUALITY_AUTO), drain_rate(0) {
+	for (Response &response : this->responses)
+		response.sender = NULL;
+}
 
+void ConnectedClient::send_txt_response(int epoll_fd, const string &str) {
+	ArraySender *array_sender = new ArraySender(str.data(), str.length());
 	this->send_response(epoll_fd, array_sender);
 }
 
-void ConnectedClient::send_mp3_response(int epoll_fd, fs::path mp3_file) {
-	FileSender *file_sender = new FileSender(mp3_file);
+void ConnectedClient::send_mp3_response(int epoll_fd, const SongEntry &song,
+										SongCache *song_cache, size_t start) {
+	ChunkedDataSender *mp3_sender = this->make_song_sender(song, song_cache,
+															start);
+	if (mp3_sender == NULL) {
+		send_txt_response(epoll_fd, "n");
+		return;
+	}
 
-	this->send_response(epoll_fd, file_sender);
+	this->send_response(epoll_fd, mp3_sender, song.stats);
 }
 
-void ConnectedClient::send_response(int epoll_fd, ChunkedDataSender *sender) {
-	ssize_t num_bytes_sent;
-	ssize_t total_bytes_sent = 0;
-
-	// keep sending the next chunk until it says we either didn't send
-	// anything (0 return indicates nothing left to send) or until we can't
-	// send anymore because of a full socket buffer (-1 return value)
-	while((num_bytes_sent = sender->send_next_chunk(this->client_fd)) > 0) {
-		total_bytes_sent += num_bytes_sent;
+ChunkedDataSender *ConnectedClient::make_song_sender(const SongEntry &song,
+													SongCache *song_cache,
+													size_t start) {
+	// Popular songs are shared in memory if we have a cache and the song fits
+	// in it, otherwise we stream the song straight from the file.
+	SharedBuffer song_data;
+	if (song_cache != NULL)
+		song_data = song_cache->get(song.path);
+
+	ChunkedDataSender *mp3_sender;
+	if (song_data != NULL)
+		mp3_sender = new CachedSongSender(song_data, start);
+	else
+		mp3_sender = FileSender::open_file(song.path, SENDFILE, start);
+
+	if (mp3_sender == NULL)
+		return NULL;
+
+	// Stream at (a bit faster than) the song's bitrate, after an initial
+	// burst for the client to buffer, rather than as fast as we can.
+	if (this->pacer != NULL && this->pacer->pace_factor > 0
+			&& song.bitrate > 0) {
+		double bytes_per_sec = song.bitrate / 8.0;
+		mp3_sender = new PacedSender(mp3_sender,
+						bytes_per_sec * this->pacer->pace_factor,
+						bytes_per_sec * this->pacer->burst_seconds);
 	}
-	cout << "sent " << total_bytes_sent << " bytes to client\n";
 
-	/*
-	 * If the last call to send_next_chunk indicated we couldn't send
-	 * anything because of a full socket buffer, we should do the following:
-	 *
-	 * 1. update our state field to be sending
-	 * 2. set our sender field to be the ArraySender object we created
-	 * 3. update epoll so that it also watches for EPOLLOUT for this client
-	 *    socket (use epoll_ctl with EPOLL_CTL_MOD).
-	 */
+	return mp3_sender;
+}
 
-	if (num_bytes_sent < 0) {
-		this->state = SENDING;
-		this->sender = sender;
+void ConnectedClient::send_response(int epoll_fd, ChunkedDataSender *sender,
+									std::shared_ptr<SongStats> song_stats) {
+	// A new response replaces whatever we were still sending.
+	this->end_response();
 
-		struct epoll_event client_ev;
-		client_ev.events = EPOLLOUT | EPOLLIN;
-		client_ev.data.fd = this->client_fd;
-		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, this->client_fd, &client_ev);//epoll event struct in jukebox
-	}
-	else {
-		// Sent everything with no problem so we are done with our ArraySender
-		// object.
-		shutdown(client_fd, SHUT_RDWR);
-		delete sender;
-	}
+	this->set_state(SENDING);
+	this->sender = sender;
+	this->song_stats = std::move(song_stats);
+	if (this->song_stats != NULL)
+		this->song_stats->plays.fetch_add(1, std::memory_order_relaxed);
+
+	this->continue_response(epoll_fd);
 }
 
-void ConnectedClient::handle_input(int epoll_fd, path_list mp3_paths) {
-	char data[1024];
-	ssize_t bytes_received = recv(this->client_fd, data, 1024, 0);
-	if (bytes_received < 0) {
+void ConnectedClient::handle_input(int epoll_fd, const SongCatalog &catalog,
+									SongCache *song_cache,
+									const RadioChannelList *channels) {
+	// Leave room for a null terminator after text commands.
+	size_t space = INPUT_BUFFER_SIZE - this->input_len - 1;
+	if (space == 0) {
+		// A command longer than the buffer, or a client that keeps sending
+		// commands without reading the answers.
+		LOG(LogLevel::WARN, "Client (" << this->client_fd
+			<< ") sent more input than we can hold");
+		this->handle_close(epoll_fd);
+		return;
+	}
+
+	ssize_t bytes_received = recv(this->client_fd, this->input + this->input_len,
+									space, 0);
+	if (bytes_received < 0 && errno == EAGAIN) {
+		return; // nothing to read after all
+	}
+	else if (bytes_received < 0) {
 		perror("client_read recv");
 		exit(EXIT_FAILURE);
 	}
+	else if (bytes_received == 0) {
+		return; // hang up, which epoll tells us about separately
+	}
 
-	// Convert the input into a lowercase string and print it out
-	cout << "Received data: ";
-	for (int i = 0; i < bytes_received; i++) {
-		data[i] = std::tolower(data[i]);
-		cout << data[i];
+	this->input_len += bytes_received;
+	this->last_active = std::chrono::steady_clock::now();
+
+	// The first byte tells us which protocol the client speaks.
+	if (this->protocol == UNDECIDED && this->input[0] != PROTOCOL_MAGIC) {
+		this->protocol = TEXT;
+	}
+	else if (this->protocol == UNDECIDED) {
+		if (this->input_len < 2)
+			return; // wait for the version
+
+		if (this->input[1] != PROTOCOL_VERSION) {
+			LOG(LogLevel::WARN, "Client (" << this->client_fd
+				<< ") wants protocol version " << (int)this->input[1]
+				<< ", which we don't speak");
+			this->handle_close(epoll_fd);
+			return;
+		}
+
+		this->protocol = BINARY;
+		this->input_len -= 2;
+		memmove(this->input, this->input + 2, this->input_len);
 	}
-	data[bytes_received] = '\0'; // ensuring that the data ends properly
-	cout << " from client (" << this->client_fd << ")\n";
 
-	std::stringstream ss(data);	
+	if (this->protocol == TEXT)
+		this->handle_text_input(epoll_fd, catalog, song_cache, channels);
+	else
+		this->handle_binary_input(epoll_fd, catalog, song_cache, channels);
+}
+
+void ConnectedClient::handle_text_input(int epoll_fd, const SongCatalog &catalog,
+										SongCache *song_cache,
+										const RadioChannelList *channels) {
+	if (memchr(this->input, '\n', this->input_len) != NULL)
+		this->line_mode = true;
+
+	// Commands that come in while an answer is going out wait their turn
+	// (continue_response runs them once it's done). A song or the radio
+	// never finishes, so the next command stops it instead, as it always
+	// has.
+	if (this->state == SENDING && !this->streaming)
+		return;
+
+	this->run_text_commands(epoll_fd, catalog, song_cache, channels);
+}
+
+bool ConnectedClient::has_text_command() const {
+	if (this->protocol != TEXT || this->input_len == 0)
+		return false;
+
+	// The original client doesn't send newlines, so until we see one, what
+	// we have is taken to be a whole command.
+	return !this->line_mode
+		|| memchr(this->input, '\n', this->input_len) != NULL;
+}
+
+void ConnectedClient::run_text_commands(int epoll_fd,
+										const SongCatalog &catalog,
+										SongCache *song_cache,
+										const RadioChannelList *channels) {
+	this->running_commands = true;
+
+	while (this->client_fd != -1 && !this->shut_down
+			&& this->has_text_command()) {
+		// Take the command out of the buffer before running it, since
+		// finishing its answer looks for more (see continue_response).
+		uint8_t *newline = (uint8_t*)memchr(this->input, '\n', this->input_len);
+		size_t len = (newline != NULL) ? newline - this->input : this->input_len;
+		char command[INPUT_BUFFER_SIZE];
+		for (size_t i = 0; i < len; i++)
+			command[i] = std::tolower(this->input[i]);
+		command[len] = '\0';
+
+		size_t used = (newline != NULL) ? len + 1 : len;
+		this->input_len -= used;
+		memmove(this->input, this->input + used, this->input_len);
+
+		if (command[0] == '\0')
+			continue;
+
+		LOG(LogLevel::DEBUG, "Received data: " << command << " from client ("
+			<< this->client_fd << ")");
+
+		this->streaming = (strncmp(command, "play", 4) == 0
+							|| strncmp(command, "radio", 5) == 0);
+		this->run_text_command(epoll_fd, command, catalog, song_cache,
+								channels);
+
+		// The next command waits until this answer has all gone out.
+		if (this->state == SENDING && !this->streaming)
+			break;
+	}
+
+	this->running_commands = false;
+}
+
+void ConnectedClient::run_text_command(int epoll_fd, const char *command,
+										const SongCatalog &catalog,
+										SongCache *song_cache,
+										const RadioChannelList *channels) {
+	std::stringstream ss(command);
 	string input;
 	ss >> input;
 
 	//This section of the code parses the input and sends it to the
 	//appropriate command accordingly.
 	if (input == "list") {
-		this->list_songs(epoll_fd, mp3_paths);
+		// Optionally just part of the list: "list <offset> <count>".
+		size_t offset, count;
+		if (ss >> offset >> count)
+			this->send_txt_response(epoll_fd, catalog.list_page(offset, count));
+		else
+			this->list_songs(epoll_fd, catalog);
+	}
+	else if (input == "search") {
+		string query;
+		std::getline(ss, query);
+		this->send_txt_response(epoll_fd, catalog.search_results(query));
 	}
 	else if (input == "info") {
 		ss >> input; // extracting the song number
-		fs::path song_file = this->select_song(epoll_fd, mp3_paths, input);
+		const SongEntry *song = this->select_song(epoll_fd, catalog, input);
 
-		if (song_file != fs::path())
-			this->send_song_info(epoll_fd, song_file);
+		if (song != NULL)
+			this->send_song_info(epoll_fd, *song);
 	}
 	else if (input == "play") {
 		ss >> input; // extracting the song number
-		fs::path song_file = this->select_song(epoll_fd, mp3_paths, input);
-		
-		if (song_file != fs::path())
-			this->send_mp3_response(epoll_fd, song_file);
+		const SongEntry *song = this->select_song(epoll_fd, catalog, input);
+		if (song == NULL)
+			return;
+
+		// An optional offset to start from: a number of bytes, or of
+		// seconds if it ends in "s" (e.g. "play 2 90s").
+		const SongEntry &source = this->choose_tier(*song);
+		string offset;
+		size_t start = 0;
+		if (ss >> offset) {
+			char *end;
+			double amount = strtod(offset.c_str(), &end);
+			bool in_seconds = (*end == 's');
+			if (in_seconds)
+				end++;
+
+			if (*end != '\0' || !(amount >= 0)) {
+				LOG(LogLevel::DEBUG, "Invalid offset (" << offset << ")");
+				send_txt_response(epoll_fd, "n");
+				return;
+			}
+
+			start = seek_in_tier(*song, source, amount, in_seconds);
+			LOG(LogLevel::DEBUG, "Starting at byte " << start);
+		}
+
+		this->send_mp3_response(epoll_fd, source, song_cache, start);
+	}
+	else if (input == "radio") {
+		ss >> input; // extracting the channel number
+		char *end;
+		size_t channel_num = strtoul(input.c_str(), &end, 10);
+		RadioChannel *channel = NULL;
+		if (!input.empty() && *end == '\0')
+			channel = this->find_channel(channels, channel_num);
+
+		if (channel != NULL) {
+			this->send_response(epoll_fd, new RadioSender(channel));
+		}
+		else {
+			LOG(LogLevel::DEBUG, "User tried to tune in to a channel that doesn't exist.");
+			send_txt_response(epoll_fd, "n");
+		}
 	}
 	else if (input == "stop") {
 		this->stop_song(epoll_fd);
 	}
+	else if (input == "stats") {
+		this->send_txt_response(epoll_fd, render_stats(catalog));
+	}
+	else if (input == "quality") {
+		// "auto", "original", or the most kbps to send songs at
+		ss >> input;
+		char *end;
+		unsigned long kbps = strtoul(input.c_str(), &end, 10);
+		if (input == "auto")
+			this->quality = QUALITY_AUTO;
+		else if (input == "original")
+			this->quality = QUALITY_ORIGINAL;
+		else if (!input.empty() && *end == '\0' && kbps > 0 && kbps < QUALITY_ORIGINAL)
+			this->quality = kbps;
+		else
+			LOG(LogLevel::DEBUG, "Invalid quality (" << input << ")");
+	}
 	else if (input == "close") {
 		this->handle_close(epoll_fd);
 	}
 	else {
 		// Invalid command
-		cout << "Invalid command (" << input << ")\n";
+		LOG(LogLevel::DEBUG, "Invalid command (" << input << ")");
 	}
 }
 
-
-int ConnectedClient::list_songs(int epoll_fd, path_list mp3_paths) {
-	int song_num_int = 0;
-	
-	std::stringstream ss;
-	ss << "No.\tFilename\n";
-	
-	// Iterate over all available mp3 files, printing their info
-	for (fs::path entry : mp3_paths) {
-		ss  << "(" << song_num_int++ << ")\t" << entry.filename().string() << "\n";
+void ConnectedClient::handle_binary_input(int epoll_fd,
+											const SongCatalog &catalog,
+											SongCache *song_cache,
+											const RadioChannelList *channels) {
+	size_t pos = 0;
+
+	// Run every complete frame we have.
+	while (this->client_fd != -1 && this->input_len - pos >= 4) {
+		uint32_t length = read_u32(this->input + pos);
+		if (length < 5 || length > MAX_COMMAND_FRAME) {
+			LOG(LogLevel::WARN, "Bad command frame from client ("
+				<< this->client_fd << ")");
+			this->handle_close(epoll_fd);
+			return;
+		}
+
+		if (this->input_len - pos < 4 + length)
+			break; // wait for the rest of the frame
+
+		const uint8_t *frame = this->input + pos + 4;
+		this->run_binary_command(epoll_fd, read_u32(frame), frame[4],
+									frame + 5, length - 5, catalog, song_cache,
+									channels);
+		pos += 4 + length;
 	}
-	
-	send_txt_response(epoll_fd, ss.str());
 
-	return 0;
-}
+	if (this->client_fd == -1)
+		return; // closed by one of the commands
 
+	// Keep the start of the next frame for when the rest of it shows up.
+	this->input_len -= pos;
+	memmove(this->input, this->input + pos, this->input_len);
 
-int ConnectedClient::send_song_info(int epoll_fd, fs::path song_file) {
-	std::stringstream ss;
+	// Get any new responses going.
+	this->continue_response(epoll_fd);
+}
 
-	// Test whether the mp3 file has an info file
-	fs::path info_file_path = song_file.replace_extension(".mp3.info");
-	if (fs::is_regular_file(info_file_path)) {
-		std::ifstream t(info_file_path.string());
-		std::stringstream buffer;
-		buffer << t.rdbuf();
-		ss << buffer.str() << "\n";
+void ConnectedClient::run_binary_command(int epoll_fd, uint32_t request_id,
+											uint8_t command,
+											const uint8_t *args, size_t args_len,
+											const SongCatalog &catalog,
+											SongCache *song_cache,
+											const RadioChannelList *channels) {
+	LOG(LogLevel::DEBUG, "Received command " << (int)command << " (request "
+		<< request_id << ") from client (" << this->client_fd << ")");
+
+	const SongEntry *song = NULL;
+	if ((command == CMD_INFO || command == CMD_PLAY) && args_len >= 4)
+		song = catalog.song(read_u32(args));
+
+	if (command == CMD_LIST && args_len >= 8) {
+		string page = catalog.list_page(read_u32(args), read_u32(args + 4));
+		this->add_response(epoll_fd, request_id,
+							new ArraySender(page.data(), page.length()),
+							FRAME_DATA, false);
+	}
+	else if (command == CMD_LIST) {
+		this->add_response(epoll_fd, request_id,
+							new CachedSongSender(catalog.list()), FRAME_DATA,
+							false);
+	}
+	else if (command == CMD_SEARCH) {
+		string results = catalog.search_results(string((const char*)args,
+															args_len));
+		this->add_response(epoll_fd, request_id,
+							new ArraySender(results.data(), results.length()),
+							FRAME_DATA, false);
+	}
+	else if ((command == CMD_INFO || command == CMD_PLAY) && song == NULL) {
+		const char *error = "No such song";
+		this->add_response(epoll_fd, request_id,
+							new ArraySender(error, strlen(error)), FRAME_ERROR,
+							false);
+	}
+	else if (command == CMD_INFO) {
+		this->add_response(epoll_fd, request_id, new CachedSongSender(song->info),
+							FRAME_DATA, false);
+	}
+	else if (command == CMD_PLAY && args_len >= 9 && args[8] > SEEK_MILLISECONDS) {
+		const char *error = "Unknown offset unit";
+		this->add_response(epoll_fd, request_id,
+							new ArraySender(error, strlen(error)), FRAME_ERROR,
+							false);
+	}
+	else if (command == CMD_PLAY) {
+		const SongEntry &source = this->choose_tier(*song);
+		size_t start = 0;
+		if (args_len >= 9 && args[8] == SEEK_MILLISECONDS)
+			start = seek_in_tier(*song, source, read_u32(args + 4) / 1000.0, true);
+		else if (args_len >= 9)
+			start = seek_in_tier(*song, source, read_u32(args + 4), false);
+
+		ChunkedDataSender *mp3_sender = this->make_song_sender(source,
+																song_cache,
+																start);
+		if (mp3_sender != NULL) {
+			this->add_response(epoll_fd, request_id, mp3_sender, FRAME_DATA,
+								true, song->stats);
+		}
+		else {
+			const char *error = "Couldn't open song";
+			this->add_response(epoll_fd, request_id,
+								new ArraySender(error, strlen(error)),
+								FRAME_ERROR, false);
+		}
+	}
+	else if (command == CMD_RADIO) {
+		RadioChannel *channel = NULL;
+		if (args_len >= 4)
+			channel = this->find_channel(channels, read_u32(args));
+
+		if (channel != NULL) {
+			this->add_response(epoll_fd, request_id, new RadioSender(channel),
+								FRAME_DATA, true);
+		}
+		else {
+			const char *error = "No such channel";
+			this->add_response(epoll_fd, request_id,
+								new ArraySender(error, strlen(error)),
+								FRAME_ERROR, false);
+		}
+	}
+	else if (command == CMD_STOP) {
+		// Stop the given song, or every song if we weren't told which one.
+		for (Response &response : this->responses) {
+			if (response.sender != NULL && response.is_song
+					&& (args_len < 4 || response.request_id == read_u32(args)))
+				response.stopped = true;
+		}
+	}
+	else if (command == CMD_QUALITY) {
+		// Anything but the u32 argument is a mistake we shouldn't guess at.
+		// Every u32 is a valid choice though, the same ones the "quality"
+		// text command takes: QUALITY_AUTO, QUALITY_ORIGINAL, or a number of
+		// kbps in between.
+		if (args_len == 4) {
+			this->quality = read_u32(args);
+		}
+		else {
+			const char *error = "Invalid quality";
+			this->add_response(epoll_fd, request_id,
+								new ArraySender(error, strlen(error)),
+								FRAME_ERROR, false);
+		}
+	}
+	else if (command == CMD_STATS) {
+		string stats = render_stats(catalog);
+		this->add_response(epoll_fd, request_id,
+							new ArraySender(stats.data(), stats.length()),
+							FRAME_DATA, false);
+	}
+	else if (command == CMD_CLOSE) {
+		this->handle_close(epoll_fd);
 	}
 	else {
-		ss << song_file.filename().string() << "\n";
-		ss << "(No additional info)\n";
+		const char *error = "Unknown command";
+		this->add_response(epoll_fd, request_id,
+							new ArraySender(error, strlen(error)), FRAME_ERROR,
+							false);
 	}
+}
+
+void ConnectedClient::add_response(int epoll_fd, uint32_t request_id,
+									ChunkedDataSender *sender,
+									FrameType frame_type, bool is_song,
+									std::shared_ptr<SongStats> song_stats) {
+	if (this->client_fd == -1) {
+		delete sender; // closed by an earlier command
+		return;
+	}
+
+	for (Response &response : this->responses) {
+		if (response.sender == NULL) {
+			if (song_stats != NULL)
+				song_stats->plays.fetch_add(1, std::memory_order_relaxed);
+
+			response = Response{request_id, sender, frame_type, is_song, false,
+								std::move(song_stats)};
+			this->num_responses++;
+			this->set_state(SENDING);
+			return;
+		}
+	}
+
+	LOG(LogLevel::WARN, "Client (" << this->client_fd
+		<< ") has too many requests at once");
+	delete sender;
+	this->handle_close(epoll_fd);
+}
+
+
+int ConnectedClient::list_songs(int epoll_fd, const SongCatalog &catalog) {
+	// The list was already made when the catalog was built.
+	this->send_response(epoll_fd, new CachedSongSender(catalog.list()));
+
+	return 0;
+}
 
-	send_txt_response(epoll_fd, ss.str());
+
+int ConnectedClient::send_song_info(int epoll_fd, const SongEntry &song) {
+	this->send_response(epoll_fd, new CachedSongSender(song.info));
 
 	return 0;
 }
 
-fs::path ConnectedClient::select_song(int epoll_fd, path_list mp3_paths, std::string song_number) {
-	long unsigned int song_num_int = std::stoi(song_number);
+const SongEntry *ConnectedClient::select_song(int epoll_fd,
+											const SongCatalog &catalog,
+											const string &song_number) {
+	// Anything that isn't a song number is treated like one that's out of
+	// range.
+	char *end;
+	long unsigned int song_num_int = strtoul(song_number.c_str(), &end, 10);
+	if (song_number.empty() || *end != '\0')
+		song_num_int = catalog.size();
+
+	LOG(LogLevel::DEBUG, "Song Number " << song_number << " info");
 
-	std::stringstream ss;
-	cout << "Song Number " << song_number << " info\n";
+	const SongEntry *song = catalog.song(song_num_int);
+	if (song == NULL) {
+		LOG(LogLevel::DEBUG, "User tried to access song out of range.");
 
-	if (song_num_int > mp3_paths.size()-1) {
-		cout << "User tried to access song out of range.\n";
-		
 		send_txt_response(epoll_fd, "n");
-		return fs::path();
 	}
 
-	return mp3_paths[song_num_int];
+	return song;
+}
+
+RadioChannel *ConnectedClient::find_channel(const RadioChannelList *channels,
+											size_t channel_num) {
+	if (channels == NULL || channel_num >= channels->size()
+			|| this->pacer == NULL)
+		return NULL;
+
+	return (*channels)[channel_num];
 }
 
 // This method stops a song from playing immediately
 void ConnectedClient::stop_song(int epoll_fd) {
 	if (this->state == SENDING) {
-		this-> state = RECEIVING;
-		struct epoll_event client_ev;
-		client_ev.events = EPOLLIN | EPOLLRDHUP;
-		client_ev.data.fd = this->client_fd;
-		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, this->client_fd, &client_ev);
+		this->end_response();
+		this->watch_for_output(epoll_fd, false);
 	}
 	else {
-		cout << "Nothing is currently being sent\n";
+		LOG(LogLevel::DEBUG, "Nothing is currently being sent");
 	}
-	shutdown(epoll_fd, SHUT_RDWR);
 }
 
 
 // You likely should not need to modify this function.
 void ConnectedClient::handle_close(int epoll_fd) {
-	cout << "Closing connection to client " << this->client_fd << "\n\n";
+	LOG(LogLevel::DEBUG, "Closing connection to client " << this->client_fd);
 
 	if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, this->client_fd, NULL) == -1) {
 		perror("handle_close epoll_ctl");
 		exit(EXIT_FAILURE);
 	}
 
+	this->end_response();
 	close(this->client_fd);
+	this->client_fd = -1;
+}
+
+void ConnectedClient::handle_events(uint32_t events) {
+	int epoll_fd = this->context->loop->fd();
+
+	// Check if this is a "hang up" event (i.e. client closed the
+	// connection).
+	if ((events & EPOLLRDHUP) != 0) {
+		// If we get here, the socket associated with this event was
+		// closed by the remote host so we should clean up.
+		this->handle_close(epoll_fd);
+	}
+
+	// Check if this is an "input" event (i.e. ready to "read" from
+	// this socket)
+	else if ((events & EPOLLIN) != 0) {
+		/*
+		 * The client has sent us data so we can receive it now
+		 * without worrying about blocking.
+		 */
+		this->handle_input(epoll_fd, *this->context->catalog,
+							this->context->song_cache, this->context->channels);
+	}
+
+	// Check if this is an "output" event.
+	else if ((events & EPOLLOUT) != 0) {
+		/* 
+		 * We only reach this point if we started sending a response,
+		 * but had to stop because the socket buffer was full.
+		 */
+		this->continue_response(epoll_fd);
+	}
+
+	// The client may have closed (or asked us to close) the
+	// connection, in which case its slot is free again.
+	if (this->client_fd == -1)
+		this->context->clients->remove(this);
 }
 
 
 // Continue response continues the response with the client
 void ConnectedClient::continue_response(int epoll_fd) {
-	// Create a large array, just to make sure we can send a lot of data in
-	// smaller chunks
+	if (this->protocol == BINARY) {
+		this->continue_frames(epoll_fd);
+		return;
+	}
+
+	if (this->sender == NULL)
+		return; // response was stopped before we got to continue it
+
 	ssize_t num_bytes_sent;
 	ssize_t total_bytes_sent = 0;
+	size_t num_chunks = 0;
 
 	// keep sending the next chunk until it says we either didn't send
-	// anything (0 return indicates nothing left to send) or until we can't
-	// send anymore because of a full socket buffer (-1 return value)
-	while((num_bytes_sent = this->sender->send_next_chunk(this->client_fd)) > 0) {
+	// anything (0 return indicates nothing left to send), until we can't
+	// send anymore because of a full socket buffer (-1 return value), until
+	// the pacer says to wait (SEND_PACED), or until the connection breaks
+	// (SEND_FAILED)
+	while((num_bytes_sent = this->sender->send_next_chunk(this->client_fd,
+												this->chunk_size)) > 0) {
 		total_bytes_sent += num_bytes_sent;
+		num_chunks++;
+	}
+	this->count_sent(total_bytes_sent, num_chunks, this->song_stats.get());
+	LOG(LogLevel::DEBUG, "sent " << total_bytes_sent << " bytes to client");
+
+	if (num_bytes_sent == SEND_FAILED) {
+		this->handle_close(epoll_fd);
+	}
+	else if (num_bytes_sent == SEND_PACED) {
+		// The socket is still writable, so there's no point watching for
+		// EPOLLOUT: the pacer will tell us when we can send again.
+		this->paced = true;
+		this->watch_for_output(epoll_fd, false);
+		this->schedule_wakeup(this->sender->resume_time());
+	}
+	else if (num_bytes_sent < 0) {
+		// Full socket buffer, so wait for epoll to tell us there is room.
+		this->note_drain(total_bytes_sent);
+		this->paced = false;
+		this->watch_for_output(epoll_fd, true);
+	}
+	else {
+		// Sent everything with no problem so we are done with our sender.
+		this->end_response();
+		this->watch_for_output(epoll_fd, false);
+
+		// Only hang up once the client's last command has been answered
+		// (and it isn't part way through sending another). If
+		// run_text_commands is what got us here, it goes on to the next
+		// command itself.
+		if (this->input_len == 0) {
+			shutdown(client_fd, SHUT_RDWR);
+			this->shut_down = true;
+		}
+		else if (this->has_text_command() && !this->running_commands
+				&& this->context != NULL) {
+			this->run_text_commands(epoll_fd, *this->context->catalog,
+									this->context->song_cache,
+									this->context->channels);
+		}
+	}
+}
+
+void ConnectedClient::continue_frames(int epoll_fd) {
+	ssize_t total_bytes_sent = 0;
+
+	while (true) {
+		if (this->header_sent < FRAME_HEADER_SIZE) {
+			// The payload (if any) comes right after the header, so ask the
+			// kernel to wait for it rather than sending a tiny packet.
+			int flags = MSG_NOSIGNAL | ((this->frame_left > 0) ? MSG_MORE : 0);
+			ssize_t num_bytes_sent = send(this->client_fd,
+									this->frame_header + this->header_sent,
+									FRAME_HEADER_SIZE - this->header_sent, flags);
+			if (num_bytes_sent < 0 && errno == EAGAIN) {
+				break; // full socket buffer
+			}
+			else if (num_bytes_sent < 0) {
+				// The client is gone (e.g. it reset the connection).
+				LOG(LogLevel::DEBUG, "Couldn't send to client ("
+					<< this->client_fd << "): " << strerror(errno));
+				this->handle_close(epoll_fd);
+				return;
+			}
+
+			this->header_sent += num_bytes_sent;
+		}
+		else if (this->frame_left > 0) {
+			Response &response = this->responses[this->current_response];
+			ssize_t num_bytes_sent =
+				response.sender->send_next_chunk(this->client_fd,
+										std::min(this->frame_left, this->chunk_size));
+			if (num_bytes_sent == -1)
+				break; // full socket buffer
+
+			if (num_bytes_sent == SEND_FAILED) {
+				this->handle_close(epoll_fd);
+				return;
+			}
+
+			if (num_bytes_sent == SEND_PACED) {
+				// The sender has less data than it had when the frame was
+				// started (e.g. a radio listener that was skipped ahead), so
+				// wait for the rest.
+				this->watch_for_output(epoll_fd, false);
+				this->paced = true;
+				this->schedule_wakeup(response.sender->resume_time());
+				return;
+			}
+
+			if (num_bytes_sent <= 0) {
+				// The sender came up short (e.g. the file shrank), so the
+				// frame can never be finished and the client would lose track
+				// of where the next one starts.
+				LOG(LogLevel::WARN, "Response to client (" << this->client_fd
+					<< ") ended in the middle of a frame");
+				this->handle_close(epoll_fd);
+				return;
+			}
+
+			this->frame_left -= num_bytes_sent;
+			total_bytes_sent += num_bytes_sent;
+			this->count_sent(num_bytes_sent, 1, response.song_stats.get());
+		}
+		else if (!this->start_next_frame()) {
+			// Nothing can be sent right now. If there are responses left,
+			// they are all waiting on the pacer, so ask it to wake us up
+			// when the first of them can go again.
+			LOG(LogLevel::DEBUG, "sent " << total_bytes_sent << " bytes to client");
+			this->watch_for_output(epoll_fd, false);
+
+			if (this->num_responses == 0) {
+				this->set_state(RECEIVING);
+				this->paced = false;
+				return;
+			}
+
+			PacingScheduler::time_point resume =
+				PacingScheduler::time_point::max();
+			for (Response &response : this->responses) {
+				if (response.sender != NULL)
+					resume = std::min(resume, response.sender->resume_time());
+			}
+
+			this->paced = true;
+			this->schedule_wakeup(resume);
+			return;
+		}
+	}
+
+	// Full socket buffer, so wait for epoll to tell us there is room.
+	LOG(LogLevel::DEBUG, "sent " << total_bytes_sent << " bytes to client");
+	this->note_drain(total_bytes_sent);
+	this->paced = false;
+	this->watch_for_output(epoll_fd, true);
+}
+
+bool ConnectedClient::start_next_frame() {
+	for (size_t i = 0; i < MAX_RESPONSES; i++) {
+		size_t index = (this->next_response + i) % MAX_RESPONSES;
+		Response &response = this->responses[index];
+		if (response.sender == NULL)
+			continue;
+
+		if (response.stopped || response.sender->bytes_left() == 0) {
+			// Let the client know this response is over.
+			write_frame_header(this->frame_header, response.request_id,
+								FRAME_END, 0);
+			delete response.sender;
+			response.sender = NULL;
+			response.song_stats = NULL;
+			this->num_responses--;
+		}
+		else {
+			size_t ready = response.sender->bytes_ready();
+			if (ready == 0)
+				continue; // paced
+
+			this->frame_left = std::min(ready, MAX_FRAME_PAYLOAD);
+			this->current_response = index;
+			write_frame_header(this->frame_header, response.request_id,
+								response.frame_type, this->frame_left);
+		}
+
+		// The next frame goes to someone else, if anyone else is waiting.
+		this->next_response = index + 1;
+		this->header_sent = 0;
+		return true;
+	}
+
+	return false;
+}
+
+void ConnectedClient::resume_paced_response(int epoll_fd) {
+	// A wakeup we replaced with an earlier one still comes round, but by
+	// then we're waiting on a newer one (or on none at all).
+	if (std::chrono::steady_clock::now() < this->wakeup_at)
+		return;
+	this->wakeup_at = PacingScheduler::time_point::max();
+
+	if (this->state == SENDING && this->paced)
+		this->continue_response(epoll_fd);
+}
+
+void ConnectedClient::schedule_wakeup(PacingScheduler::time_point when) {
+	if (when >= this->wakeup_at)
+		return; // the one we have comes first
+
+	this->wakeup_at = when;
+	this->pacer->schedule(this->client_fd, this->generation, when);
+}
+
+void ConnectedClient::watch_for_output(int epoll_fd, bool want_output) {
+	if (this->watching_output == want_output)
+		return; // nothing to change
+
+	struct epoll_event client_ev;
+	client_ev.events = EPOLLIN | EPOLLRDHUP;
+	if (want_output)
+		client_ev.events |= EPOLLOUT;
+	// our slot never moves (see ClientSlab)
+	client_ev.data.ptr = static_cast<EventHandler*>(this);
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, this->client_fd, &client_ev);
+	this->watching_output = want_output;
+
+	if (want_output)
+		ShardStats::add(ShardStats::local().epollout_rearms, 1);
+}
+
+void ConnectedClient::configure_socket(const SocketOptions &options) {
+	if (options.send_buffer > 0
+			&& setsockopt(this->client_fd, SOL_SOCKET, SO_SNDBUF,
+							&options.send_buffer, sizeof(int)) < 0) {
+		perror("setsockopt SO_SNDBUF");
+		exit(EXIT_FAILURE);
 	}
-	cout << "sent " << total_bytes_sent << " bytes to client\n";
-	
-	
-	
-	if (num_bytes_sent >= 0) {
-		this->state = SENDING;
-		this->sender = NULL;
-			
-		struct epoll_event client_ev;
-		client_ev.events = EPOLLIN | EPOLLRDHUP;
-		client_ev.data.fd = this->client_fd;
-
-		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, this->client_fd, &client_ev);
-		delete sender;
-		shutdown(client_fd, SHUT_RDWR);
+
+	// With a low water mark, epoll only says the socket is writable once
+	// most of what we gave it has actually gone out, so each wakeup has
+	// plenty of room to fill.
+	if (options.notsent_lowat > 0
+			&& setsockopt(this->client_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+							&options.notsent_lowat, sizeof(int)) < 0) {
+		perror("setsockopt TCP_NOTSENT_LOWAT");
+		exit(EXIT_FAILURE);
 	}
+
+	// The kernel doubles the size we asked for (half is for its own
+	// bookkeeping), so about half of what it reports is room for data.
+	int send_buffer = 0;
+	socklen_t len = sizeof(send_buffer);
+	if (getsockopt(this->client_fd, SOL_SOCKET, SO_SNDBUF, &send_buffer,
+					&len) < 0) {
+		perror("getsockopt SO_SNDBUF");
+		exit(EXIT_FAILURE);
+	}
+
+	this->chunk_size = std::clamp((size_t)send_buffer / 2, CHUNK_SIZE,
+									MAX_CHUNK_SIZE);
+}
+
+void ConnectedClient::note_drain(size_t bytes_sent) {
+	auto now = std::chrono::steady_clock::now();
+
+	if (this->watching_output) {
+		// Move a quarter of the way towards what we just saw, so one odd
+		// wakeup doesn't throw us off.
+		size_t estimate = (3 * this->chunk_size + bytes_sent) / 4;
+		this->chunk_size = std::clamp(estimate, CHUNK_SIZE, MAX_CHUNK_SIZE);
+
+		// The buffer was full last time too, so everything we sent since
+		// then is what the client managed to read in that time.
+		std::chrono::duration<double> elapsed = now - this->last_full;
+		if (elapsed.count() > 0) {
+			double rate = bytes_sent / elapsed.count();
+			this->drain_rate = (this->drain_rate == 0) ? rate
+								: (3 * this->drain_rate + rate) / 4;
+		}
+	}
+
+	this->last_full = now;
+}
+
+const SongEntry &ConnectedClient::choose_tier(const SongEntry &song) const {
+	if (this->quality == QUALITY_ORIGINAL)
+		return song;
+	else if (this->quality != QUALITY_AUTO)
+		return song.pick_tier(std::min<uint64_t>(this->quality * 1000ull, INT_MAX));
+	else if (this->drain_rate == 0)
+		return song; // it has kept up so far
+
+	// The fastest clients can read more than fits in an int.
+	return song.pick_tier(std::min<double>(this->drain_rate * 8, INT_MAX));
+}
+
+void ConnectedClient::end_response() {
+	delete this->sender;
+	this->sender = NULL;
+	this->song_stats = NULL;
+
+	for (Response &response : this->responses) {
+		delete response.sender;
+		response.sender = NULL;
+		response.song_stats = NULL;
+	}
+	this->num_responses = 0;
+	this->frame_left = 0;
+	this->header_sent = FRAME_HEADER_SIZE;
+
+	this->set_state(RECEIVING);
+	this->paced = false;
+}
+
+void ConnectedClient::set_state(ClientState new_state) {
+	if (this->state == new_state)
+		return;
+
+	ShardStats &stats = ShardStats::local();
+	if (new_state == SENDING)
+		ShardStats::add(stats.sending, 1);
+	else
+		ShardStats::subtract(stats.sending, 1);
+
+	this->state = new_state;
+}
+
+void ConnectedClient::count_sent(size_t num_bytes, size_t num_chunks,
+									SongStats *song_stats) {
+	ShardStats &stats = ShardStats::local();
+	ShardStats::add(stats.bytes_sent, num_bytes);
+	ShardStats::add(stats.chunks_sent, num_chunks);
+
+	if (num_bytes == 0)
+		return;
+
+	this->last_active = std::chrono::steady_clock::now();
+
+	// Songs are shared by every shard, so they need a real atomic add.
+	if (song_stats != NULL)
+		song_stats->bytes_sent.fetch_add(num_bytes, std::memory_order_relaxed);
+}
+
+std::chrono::steady_clock::time_point
+ConnectedClient::inactive_deadline(const IdleTimeouts &timeouts) const {
+	double seconds = (this->state == SENDING) ? timeouts.stall_seconds
+											: timeouts.idle_seconds;
+	if (seconds <= 0)
+		return std::chrono::steady_clock::time_point::max();
+
+	return this->last_active
+		+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(seconds));
 }
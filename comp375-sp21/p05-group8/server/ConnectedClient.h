@@ -1,40 +1,156 @@
 #ifndef CONNECTEDCLIENT_H
 #define CONNECTEDCLIENT_H
 
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
-#include <filesystem>
 
-typedef std::vector<std::filesystem::path> path_list;
+#include "ChunkedDataSender.h"
+#include "EventLoop.h"
+#include "Protocol.h"
+
+class ClientSlab;
+class SongCache;
+class PacingScheduler;
+class SongCatalog;
+struct SongEntry;
+class RadioChannel;
+struct SongStats;
+
+typedef std::vector<RadioChannel*> RadioChannelList;
 
 /**
  * Represents the state of a connected client.
  */
 enum ClientState { RECEIVING, SENDING };
 
+/**
+ * Which protocol a client speaks (see Protocol.h). We don't know until the
+ * client sends us something.
+ */
+enum ClientProtocol { UNDECIDED, TEXT, BINARY };
+
+// Most responses a binary protocol client can have on the go at once.
+const size_t MAX_RESPONSES = 16;
+
+// Bytes of input we can hold on to while waiting for the rest of a command.
+const size_t INPUT_BUFFER_SIZE = 1024;
+
+/**
+ * Options for a client's socket (0 leaves the kernel's default).
+ */
+struct SocketOptions {
+	int send_buffer;   // SO_SNDBUF, in bytes
+	int notsent_lowat; // TCP_NOTSENT_LOWAT, in bytes
+};
+
+/**
+ * How long a client can go without doing anything before we close its
+ * connection (0 never closes it).
+ */
+struct IdleTimeouts {
+	double idle_seconds;  // RECEIVING, and hasn't sent us anything
+	double stall_seconds; // SENDING, but hasn't read anything we sent
+};
+
+/**
+ * What a shard's clients need from it to handle their own events.
+ */
+struct ClientContext {
+	EventLoop *loop;
+	ClientSlab *clients;              // where the client's slot is
+	const SongCatalog *catalog;       // the shard's current catalog
+	SongCache *song_cache;            // NULL if turned off
+	const RadioChannelList *channels;
+};
+
+/**
+ * A response being sent to a binary protocol client.
+ */
+struct Response {
+	uint32_t request_id;       // id of the command we are responding to
+	ChunkedDataSender *sender; // NULL if this slot isn't being used
+	FrameType frame_type;      // FRAME_DATA, or FRAME_ERROR for errors
+	bool is_song;              // true if this is a song (i.e. can be stopped)
+	bool stopped;              // true if we should end it after this frame
+	std::shared_ptr<SongStats> song_stats; // counts the song's bytes (or NULL)
+};
+
 /**
  * Class that models a connected client.
  * 
  * One object of this class will be created for every client that you accept a
- * connection from.
+ * connection from. Its slot (see ClientSlab) is the handler that the shard's
+ * event loop gives the client's events to.
  */
-class ConnectedClient {
+class ConnectedClient : public EventHandler {
   public:
 	// Member Variablesa (i.e. fields)
-	int client_fd;
+	int client_fd;          // -1 once the connection has been closed
+	uint32_t generation;    // bumped each time this slot gets a new client
 	ChunkedDataSender *sender;
+	std::shared_ptr<SongStats> song_stats; // song that sender is for (or NULL)
 	ClientState state;
+	PacingScheduler *pacer; // decides how fast we stream songs (may be NULL)
+	ClientContext *context; // the shard the client belongs to (may be NULL)
+	bool paced;             // true if waiting on the pacer rather than EPOLLOUT
+	// When the wakeup we asked the pacer for is due (max if there isn't one).
+	std::chrono::steady_clock::time_point wakeup_at;
+	bool watching_output;   // true if epoll is watching for EPOLLOUT
+	bool shut_down;         // true once we shut down after a text response
+	ClientProtocol protocol;
+
+	// Text protocol: whether the client ends its commands with newlines
+	// (the original client doesn't), whether the response is a song or radio
+	// (which the next command interrupts rather than waits for), and whether
+	// we are in the middle of running commands.
+	bool line_mode;
+	bool streaming;
+	bool running_commands;
+
+	// Input we haven't acted on yet (e.g. half of a command).
+	uint8_t input[INPUT_BUFFER_SIZE];
+	size_t input_len;
+
+	// Binary protocol responses, which take turns sending frames.
+	Response responses[MAX_RESPONSES];
+	size_t num_responses;
+	size_t next_response;    // where to start looking for the next frame
+	size_t current_response; // index of the response the current frame is for
+	size_t frame_left;       // bytes of the current frame's payload left
+	uint8_t frame_header[FRAME_HEADER_SIZE]; // header of the current frame
+	size_t header_sent;      // bytes of frame_header sent so far
+
+	// Most bytes we ask a sender to send at once, which follows how much the
+	// socket drains between EPOLLOUT wakeups (see note_drain).
+	size_t chunk_size;
+
+	// Last time the client sent us something or we sent it something.
+	std::chrono::steady_clock::time_point last_active;
+
+	// Most kbps to send songs at (or QUALITY_AUTO or QUALITY_ORIGINAL).
+	uint32_t quality;
+
+	// How fast (in bytes per second) the client reads when it can't keep up
+	// with what we send, or 0 if it has always kept up so far. Along with
+	// the last time the socket buffer filled up, which it is measured from.
+	double drain_rate;
+	std::chrono::steady_clock::time_point last_full;
 
 	// Constructors
 	/**
 	 * Constructor that takes the client's socket file descriptor and the
-	 * initial state of the client.
+	 * initial state of the client, plus the pacer to use for songs.
 	 */
-	ConnectedClient(int fd, ClientState initial_state);
+	ConnectedClient(int fd, ClientState initial_state,
+					PacingScheduler *pacer = NULL);
 
 	/**
 	 * No argument constructor.
 	 */
-	ConnectedClient() : client_fd(-1), sender(NULL), state(RECEIVING) {}
+	ConnectedClient() : ConnectedClient(-1, RECEIVING) {}
 
 
 	// Member Functions (i.e. Methods)
@@ -44,8 +160,11 @@ class ConnectedClient {
 	 *
 	 * @param epoll_fd File descriptor for epoll.
 	 * @param data_to_send The text data to be sent to the client.
+	 * @param song_stats Counters of the song being sent (NULL if it isn't a
+	 * 	song).
 	 */
-	void send_response(int epoll_fd, ChunkedDataSender *sender);
+	void send_response(int epoll_fd, ChunkedDataSender *sender,
+						std::shared_ptr<SongStats> song_stats = nullptr);
 
 	/**
 	 * Send text data to the client (using send_response)
@@ -53,48 +172,61 @@ class ConnectedClient {
 	 * @param epoll_fd File descriptor for epoll.
 	 * @param str The text data to be sent to the client.
 	 */
-	void send_txt_response(int epoll_fd, std::string str);
+	void send_txt_response(int epoll_fd, const std::string &str);
 
 	/**
 	 * Send mp3 data to the client (using send_response)
 	 *
 	 * @param epoll_fd File descriptor for epoll.
-	 * @param mp3_file The mp3 data to be sent to the client.
+	 * @param song The song to be sent to the client.
+	 * @param song_cache Cache of song data to send from (NULL to send
+	 * 	straight from the file).
+	 * @param start Offset in the song to start from (see
+	 * 	SongEntry::seek_to_byte).
 	 */
-	void send_mp3_response(int epoll_fd, std::filesystem::path mp3_file);
+	void send_mp3_response(int epoll_fd, const SongEntry &song,
+							SongCache *song_cache, size_t start = 0);
 
 	/**
-	 * Handles new input from the client.
+	 * Handles new input from the client. Depending on the client's protocol,
+	 * this runs every complete command we have received so far.
 	 *
 	 * @param epoll_fd File descriptor for epoll.
-	 * @param mp3_paths A vector of the file paths to each available mp3 file.
+	 * @param catalog The songs that are available.
+	 * @param song_cache Cache of song data (NULL if caching is turned off).
+	 * @param channels Radio channels clients can tune in to (NULL if there
+	 * 	aren't any).
 	 */
-	void handle_input(int epoll_fd, path_list mp3_paths);
+	void handle_input(int epoll_fd, const SongCatalog &catalog,
+						SongCache *song_cache,
+						const RadioChannelList *channels = NULL);
 
 	/**
 	 * Sends a list of songs to the client.
 	 *
 	 * @param epoll_fd File descriptor for epoll.
-	 * @param mp3_paths The list of available mp3 files.
+	 * @param catalog The songs that are available.
 	 */
-	int list_songs(int epoll_fd, path_list mp3_paths);
+	int list_songs(int epoll_fd, const SongCatalog &catalog);
 
 	/**
 	 * Sends song information to the client.
 	 *
 	 * @param epoll_fd File descriptor for epoll.
-	 * @param song_file The mp3 file to send information about.
+	 * @param song The song to send information about.
 	 */
-	int send_song_info(int epoll_fd, std::filesystem::path song_file);
+	int send_song_info(int epoll_fd, const SongEntry &song);
 	
 	/**
 	 * Select a song from available songs using its number.
 	 *
 	 * @param epoll_fd File descriptor for epoll.
-	 * @param mp3_paths The list of available mp3 files.
+	 * @param catalog The songs that are available.
 	 * @param song_number The song number.
+	 * @return The song, or NULL if there is no such song.
 	 */
-	std::filesystem::path select_song(int epoll_fd, path_list mp3_paths, std::string song_number);
+	const SongEntry *select_song(int epoll_fd, const SongCatalog &catalog,
+							const std::string &song_number);
 
 	/**
 	 * If a song is playing, stop sending to the client.
@@ -104,18 +236,217 @@ class ConnectedClient {
 	void stop_song(int epoll_fd);
 
 	/**
-	 * Handles a close request from the client.
+	 * Handles a close request from the client. Afterwards, client_fd is -1.
 	 *
 	 * @param epoll_fd File descriptor for epoll.
 	 */
 	void handle_close(int epoll_fd);
 
 	/**
-	 * Continues a response from the client.
+	 * Handles the events epoll reported for the client, using its context,
+	 * and frees its slot if the connection gets closed.
+	 *
+	 * @param events The EPOLL* event bits.
+	 */
+	void handle_events(uint32_t events) override;
+
+	/**
+	 * Continues a response from the client. For binary protocol clients, this
+	 * sends frames from all of their responses until none can go any
+	 * further.
 	 *
 	 * @param epoll_fd File descriptor for epoll.
 	 */
 	void continue_response(int epoll_fd);
+
+	/**
+	 * Continues a paced response once the pacer says it is our turn again.
+	 * Does nothing if we aren't waiting on the pacer (e.g. the song was
+	 * stopped in the meantime).
+	 *
+	 * @param epoll_fd File descriptor for epoll.
+	 */
+	void resume_paced_response(int epoll_fd);
+
+	/**
+	 * Asks the pacer to wake us up at when, unless the wakeup we already
+	 * have is due by then (the pacer needs us to keep just one).
+	 */
+	void schedule_wakeup(std::chrono::steady_clock::time_point when);
+
+	/**
+	 * Applies socket options to the client's socket, and starts our chunk
+	 * size off at what its send buffer can hold.
+	 *
+	 * @param options The options to apply.
+	 */
+	void configure_socket(const SocketOptions &options);
+
+	/**
+	 * Gets the time at which the client will have been inactive for too
+	 * long (see IdleTimeouts) if nothing changes in the meantime.
+	 *
+	 * @param timeouts The timeouts to apply.
+	 * @return The time, or time_point::max() if the timeout for our current
+	 * 	state is turned off.
+	 */
+	std::chrono::steady_clock::time_point
+	inactive_deadline(const IdleTimeouts &timeouts) const;
+
+  private:
+	/**
+	 * Updates epoll so that it does (or doesn't) watch for EPOLLOUT on our
+	 * socket. It always watches for input and hang ups.
+	 *
+	 * @param epoll_fd File descriptor for epoll.
+	 * @param want_output True to watch for EPOLLOUT.
+	 */
+	void watch_for_output(int epoll_fd, bool want_output);
+
+	/**
+	 * Adjusts chunk_size after the socket buffer fills up, based on how much
+	 * we sent since epoll last told us there was room. A socket that drains a
+	 * lot at a time gets bigger chunks, so it takes fewer sends (and fewer
+	 * wakeups) per MB.
+	 *
+	 * If the buffer was also full last time, the client is what's holding us
+	 * back, so this also updates drain_rate.
+	 *
+	 * @param bytes_sent Bytes sent since the EPOLLOUT wakeup (or since we
+	 * 	started sending, if we weren't waiting for EPOLLOUT).
+	 */
+	void note_drain(size_t bytes_sent);
+
+	/**
+	 * Picks the copy of a song to send, based on the quality the client
+	 * asked for (or, by default, how fast it reads).
+	 */
+	const SongEntry &choose_tier(const SongEntry &song) const;
+
+	/**
+	 * Gets rid of the response we were sending (if any). For binary protocol
+	 * clients, this gets rid of all of their responses.
+	 */
+	void end_response();
+
+	/**
+	 * Changes our state, keeping count of how many clients are sending.
+	 */
+	void set_state(ClientState new_state);
+
+	/**
+	 * Counts bytes of a response that were sent.
+	 *
+	 * @param num_chunks Number of sends it took.
+	 * @param song_stats Counters of the song they were from (or NULL).
+	 */
+	void count_sent(size_t num_bytes, size_t num_chunks,
+					SongStats *song_stats);
+
+	/**
+	 * Makes a sender for a song, which is paced if we have a pacer.
+	 *
+	 * @param song The song to send.
+	 * @param song_cache Cache of song data to send from (NULL to send
+	 * 	straight from the file).
+	 * @param start Offset in the song to start from.
+	 * @return The sender, or NULL if the song's file couldn't be opened.
+	 */
+	ChunkedDataSender *make_song_sender(const SongEntry &song,
+										SongCache *song_cache, size_t start);
+
+	/**
+	 * Runs the (newline separated) text commands in the input buffer, unless
+	 * they have to wait for the answer that is going out now.
+	 */
+	void handle_text_input(int epoll_fd, const SongCatalog &catalog,
+							SongCache *song_cache,
+							const RadioChannelList *channels);
+
+	/**
+	 * Checks if the input buffer has a complete text command in it: one
+	 * ending in a newline, or (for a client that never sends newlines)
+	 * anything at all.
+	 */
+	bool has_text_command() const;
+
+	/**
+	 * Runs complete text commands from the input buffer, one after another,
+	 * until one of them has an answer that can't all go out right away.
+	 * The rest wait for that answer to finish (see continue_response).
+	 */
+	void run_text_commands(int epoll_fd, const SongCatalog &catalog,
+							SongCache *song_cache,
+							const RadioChannelList *channels);
+
+	/**
+	 * Runs one text command.
+	 *
+	 * @param command The command (e.g. "play 2").
+	 */
+	void run_text_command(int epoll_fd, const char *command,
+							const SongCatalog &catalog, SongCache *song_cache,
+							const RadioChannelList *channels);
+
+	/**
+	 * Runs every complete binary command frame in the input buffer, keeping
+	 * any partial frame for later.
+	 */
+	void handle_binary_input(int epoll_fd, const SongCatalog &catalog,
+								SongCache *song_cache,
+								const RadioChannelList *channels);
+
+	/**
+	 * Runs one binary command.
+	 *
+	 * @param request_id The command's request id.
+	 * @param command Which command it is.
+	 * @param args The command's arguments.
+	 * @param args_len Length of the arguments (in bytes).
+	 */
+	void run_binary_command(int epoll_fd, uint32_t request_id, uint8_t command,
+							const uint8_t *args, size_t args_len,
+							const SongCatalog &catalog, SongCache *song_cache,
+							const RadioChannelList *channels);
+
+	/**
+	 * Finds the radio channel with the given number.
+	 *
+	 * @return The channel, or NULL if there is no such channel (or we can't
+	 * 	listen to the radio because we have no pacer to wake us up).
+	 */
+	RadioChannel *find_channel(const RadioChannelList *channels,
+								size_t channel_num);
+
+	/**
+	 * Adds a binary protocol response. The client is disconnected if it
+	 * already has too many responses on the go.
+	 *
+	 * @param request_id The request we are responding to.
+	 * @param sender The sender for the response (we take ownership of it).
+	 * @param frame_type FRAME_DATA, or FRAME_ERROR for an error message.
+	 * @param is_song True if the response is a song.
+	 * @param song_stats Counters of the song being sent (NULL if the
+	 * 	response isn't from the catalog).
+	 */
+	void add_response(int epoll_fd, uint32_t request_id,
+						ChunkedDataSender *sender, FrameType frame_type,
+						bool is_song,
+						std::shared_ptr<SongStats> song_stats = nullptr);
+
+	/**
+	 * Sends frames until the socket is full or none of our responses can
+	 * send anything (e.g. they are paced).
+	 */
+	void continue_frames(int epoll_fd);
+
+	/**
+	 * Fills in the header for the next frame, taking turns between the
+	 * responses.
+	 *
+	 * @return false if none of the responses has anything to send right now.
+	 */
+	bool start_next_frame();
 };
 
 #endif
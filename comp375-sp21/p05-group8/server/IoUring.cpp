@@ -0,0 +1,172 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "IoUring.h"
+
+/**
+ * Maps part of the ring into our memory.
+ */
+static void *map_ring(int ring_fd, size_t size, off_t offset) {
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+	if (ptr == MAP_FAILED) {
+		perror("io_uring mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+IoUring::IoUring(unsigned entries) : sqe_tail(0) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	this->ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (this->ring_fd < 0) {
+		perror("io_uring_setup");
+		exit(EXIT_FAILURE);
+	}
+
+	this->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	this->cq_ring_size = params.cq_off.cqes
+							+ params.cq_entries * sizeof(struct io_uring_cqe);
+
+	// Newer kernels put both queues in one mapping.
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (this->cq_ring_size > this->sq_ring_size)
+			this->sq_ring_size = this->cq_ring_size;
+		this->cq_ring_size = this->sq_ring_size;
+	}
+
+	this->sq_ring = map_ring(this->ring_fd, this->sq_ring_size, IORING_OFF_SQ_RING);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		this->cq_ring = this->sq_ring;
+	else
+		this->cq_ring = map_ring(this->ring_fd, this->cq_ring_size,
+									IORING_OFF_CQ_RING);
+
+	this->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	this->sqes = (struct io_uring_sqe*)map_ring(this->ring_fd, this->sqes_size,
+												IORING_OFF_SQES);
+
+	char *sq = (char*)this->sq_ring;
+	this->sq_head = (unsigned*)(sq + params.sq_off.head);
+	this->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	this->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+	this->sq_entries = params.sq_entries;
+	this->sq_array = (unsigned*)(sq + params.sq_off.array);
+	this->sqe_tail = *this->sq_tail;
+
+	char *cq = (char*)this->cq_ring;
+	this->cq_head = (unsigned*)(cq + params.cq_off.head);
+	this->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	this->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+	this->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+	munmap(this->sqes, this->sqes_size);
+	if (this->cq_ring != this->sq_ring)
+		munmap(this->cq_ring, this->cq_ring_size);
+	munmap(this->sq_ring, this->sq_ring_size);
+	close(this->ring_fd);
+}
+
+struct io_uring_sqe *IoUring::get_sqe() {
+	unsigned head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+	if (this->sqe_tail - head >= this->sq_entries) {
+		this->submit(0);
+		head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+	}
+
+	// submit gives up if the kernel won't take more until completions are
+	// read (EBUSY) or it is short of memory (EAGAIN). Handing out the next
+	// entry then would write over one the kernel hasn't read yet, and we
+	// can't read completions from here (only the loop knows what to do with
+	// them), so there's nothing better to do than stop.
+	if (this->sqe_tail - head >= this->sq_entries) {
+		std::cerr << "ERROR: io_uring submission queue is still full after submitting.\n";
+		exit(EXIT_FAILURE);
+	}
+
+	unsigned index = this->sqe_tail & this->sq_mask;
+	this->sq_array[index] = index;
+	this->sqe_tail++;
+
+	struct io_uring_sqe *sqe = &this->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+void IoUring::submit(unsigned wait_for) {
+	// Let the kernel see the new entries, then tell it about them (and wait
+	// for completions) in the same system call.
+	__atomic_store_n(this->sq_tail, this->sqe_tail, __ATOMIC_RELEASE);
+	unsigned to_submit = this->sqe_tail
+							- __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+	unsigned flags = (wait_for > 0) ? IORING_ENTER_GETEVENTS : 0;
+
+	while (syscall(__NR_io_uring_enter, this->ring_fd, to_submit, wait_for,
+					flags, NULL, 0) < 0) {
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			perror("io_uring_enter");
+			exit(EXIT_FAILURE);
+		}
+		if (errno != EINTR)
+			return; // completions need reading before we can submit more
+
+		to_submit = this->sqe_tail
+						- __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+	}
+}
+
+struct io_uring_cqe *IoUring::peek_cqe() {
+	unsigned head = *this->cq_head;
+	if (head == __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &this->cqes[head & this->cq_mask];
+}
+
+void IoUring::cqe_seen() {
+	__atomic_store_n(this->cq_head, *this->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void IoUring::register_buffers(const struct iovec *buffers,
+								unsigned num_buffers) {
+	if (syscall(__NR_io_uring_register, this->ring_fd, IORING_REGISTER_BUFFERS,
+				buffers, num_buffers) < 0) {
+		perror("io_uring_register buffers");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void IoUring::register_file_slots(unsigned num_slots) {
+	std::vector<int> fds(num_slots, -1);
+	if (syscall(__NR_io_uring_register, this->ring_fd, IORING_REGISTER_FILES,
+				fds.data(), num_slots) < 0) {
+		perror("io_uring_register files");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void IoUring::set_file_slot(unsigned slot, int fd) {
+	struct io_uring_files_update update;
+	memset(&update, 0, sizeof(update));
+	update.offset = slot;
+	update.fds = (uint64_t)(uintptr_t)&fd;
+
+	if (syscall(__NR_io_uring_register, this->ring_fd,
+				IORING_REGISTER_FILES_UPDATE, &update, 1) < 0) {
+		perror("io_uring_register files update");
+		exit(EXIT_FAILURE);
+	}
+}
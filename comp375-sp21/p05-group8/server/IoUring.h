@@ -0,0 +1,102 @@
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/**
+ * Class that wraps one io_uring instance, using the raw system calls (so we
+ * don't need liburing).
+ *
+ * Requests are added with get_sqe, which hands out the next free submission
+ * queue entry to fill in, and go to the kernel with the next submit. Results
+ * are read with peek_cqe and then handed back with cqe_seen. An IoUring
+ * should only be used by one thread.
+ */
+class IoUring {
+  private:
+	int ring_fd;
+
+	// submission queue (shared with the kernel)
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned sqe_tail; // entries handed out by get_sqe (some not yet submitted)
+
+	// completion queue (shared with the kernel)
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+  public:
+	/**
+	 * Constructor for IoUring class.
+	 *
+	 * @param entries Size of the submission queue (the completion queue is
+	 * 	twice as big).
+	 */
+	IoUring(unsigned entries);
+
+	~IoUring();
+
+	IoUring(const IoUring&) = delete;
+	IoUring &operator=(const IoUring&) = delete;
+
+	/**
+	 * Gets a cleared submission queue entry to fill in. If the queue is
+	 * full, what's already in it is submitted first to make room (and the
+	 * program exits if the kernel won't take it).
+	 */
+	struct io_uring_sqe *get_sqe();
+
+	/**
+	 * Submits every entry we have filled in, then waits until there are at
+	 * least wait_for completions to read.
+	 *
+	 * @param wait_for Number of completions to wait for (0 to not wait).
+	 */
+	void submit(unsigned wait_for);
+
+	/**
+	 * Gets the next completion, or NULL if there isn't one yet.
+	 */
+	struct io_uring_cqe *peek_cqe();
+
+	/**
+	 * Hands the completion we got from peek_cqe back to the kernel.
+	 */
+	void cqe_seen();
+
+	/**
+	 * Registers buffers, so that READ_FIXED requests can use them without
+	 * the kernel mapping them in each time.
+	 */
+	void register_buffers(const struct iovec *buffers, unsigned num_buffers);
+
+	/**
+	 * Registers a table of (initially empty) file slots, which requests with
+	 * IOSQE_FIXED_FILE refer to by index.
+	 */
+	void register_file_slots(unsigned num_slots);
+
+	/**
+	 * Puts a file in one of the registered slots (or empties the slot, if
+	 * fd is -1). The slot keeps its own reference to the file, so fd can be
+	 * closed straight away.
+	 */
+	void set_file_slot(unsigned slot, int fd);
+};
+
+#endif // IOURING_H
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "Log.h"
+
+std::atomic<int> current_log_level((int)LogLevel::INFO);
+
+static const char *LEVEL_NAMES[] = { "error", "warn", "info", "debug" };
+
+void set_log_level(LogLevel level) {
+	current_log_level.store((int)level, std::memory_order_relaxed);
+}
+
+bool parse_log_level(const std::string &name, LogLevel &level) {
+	for (int i = 0; i <= (int)LogLevel::DEBUG; i++) {
+		if (name == LEVEL_NAMES[i]) {
+			level = (LogLevel)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+LogLimiter::LogLimiter() :
+	tokens(LOG_BURST), last_refill(std::chrono::steady_clock::now()),
+	suppressed(0) {}
+
+bool LogLimiter::allow(size_t &num_suppressed) {
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed = now - this->last_refill;
+	this->last_refill = now;
+	this->tokens = std::min(LOG_BURST,
+							this->tokens + elapsed.count() * LOG_MESSAGES_PER_SEC);
+
+	if (this->tokens < 1) {
+		this->suppressed++;
+		return false;
+	}
+
+	this->tokens--;
+	num_suppressed = this->suppressed;
+	this->suppressed = 0;
+	return true;
+}
+
+void write_log(LogLevel level, const std::string &message,
+				size_t num_suppressed) {
+	std::string line = "[";
+	line += LEVEL_NAMES[(int)level];
+	line += "] ";
+	line += message;
+	if (num_suppressed > 0)
+		line += " (" + std::to_string(num_suppressed) + " similar messages suppressed)";
+	line += "\n";
+
+	// stdio locks the stream for each call, so the line stays in one piece.
+	// Messages are rate limited, so flushing each one costs little, and
+	// means nothing is lost if we get killed.
+	fwrite(line.data(), 1, line.length(), stdout);
+	fflush(stdout);
+}
@@ -0,0 +1,101 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <sstream>
+#include <string>
+
+/**
+ * How important a log message is. Only messages at or above the current
+ * level (set_log_level) are written.
+ */
+enum class LogLevel { ERROR = 0, WARN = 1, INFO = 2, DEBUG = 3 };
+
+// Most messages per second one place in the code can write (per thread),
+// and how many it can write in a burst before that kicks in.
+const double LOG_MESSAGES_PER_SEC = 10;
+const double LOG_BURST = 20;
+
+extern std::atomic<int> current_log_level;
+
+/**
+ * Sets the least important level of message that gets written.
+ */
+void set_log_level(LogLevel level);
+
+/**
+ * Parses a level name ("error", "warn", "info" or "debug").
+ *
+ * @param name The name to parse.
+ * @param level Set to the level, if the name is valid.
+ * @return true if the name is valid.
+ */
+bool parse_log_level(const std::string &name, LogLevel &level);
+
+/**
+ * Checks whether messages of the given level are written.
+ */
+inline bool log_enabled(LogLevel level) {
+	return (int)level <= current_log_level.load(std::memory_order_relaxed);
+}
+
+/**
+ * Class that limits how often one place in the code can write log messages
+ * (a token bucket), and counts the messages it held back.
+ */
+class LogLimiter {
+  private:
+	double tokens;
+	std::chrono::steady_clock::time_point last_refill;
+	size_t suppressed;
+
+  public:
+	LogLimiter();
+
+	/**
+	 * Checks whether another message can be written now.
+	 *
+	 * @param num_suppressed Set to the number of messages held back since
+	 * 	the last one we allowed (only if we allow this one).
+	 * @return true if the message can be written.
+	 */
+	bool allow(size_t &num_suppressed);
+};
+
+/**
+ * Writes a log message (as a single line, so messages from different threads
+ * don't get mixed up).
+ *
+ * @param level The message's level.
+ * @param message The message.
+ * @param num_suppressed Number of messages from the same place that were
+ * 	held back before this one.
+ */
+void write_log(LogLevel level, const std::string &message,
+				size_t num_suppressed);
+
+/*
+ * Logs a message built with <<, e.g.
+ *
+ *   LOG(LogLevel::DEBUG, "sent " << num_bytes << " bytes");
+ *
+ * Nothing in the message is evaluated unless the level is enabled, so debug
+ * messages cost a single comparison when they are turned off. Each LOG has
+ * its own rate limit.
+ */
+#define LOG(level, message) \
+	do { \
+		if (log_enabled(level)) { \
+			static thread_local LogLimiter log_limiter; \
+			size_t log_suppressed; \
+			if (log_limiter.allow(log_suppressed)) { \
+				std::ostringstream log_stream; \
+				log_stream << message; \
+				write_log(level, log_stream.str(), log_suppressed); \
+			} \
+		} \
+	} while (0)
+
+#endif // LOG_H
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Mp3Frame.h"
+
+namespace fs = std::filesystem;
+
+// How much of the start of a file to look at when estimating its bitrate.
+const size_t BITRATE_SCAN_BYTES = 64 * 1024;
+
+// Bitrates (in kbps) indexed by [table][bitrate index]. The tables are:
+// MPEG-1 layer I, II, III then MPEG-2/2.5 layer I, then layer II & III.
+static const int BITRATES[5][16] = {
+	{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, -1 },
+	{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, -1 },
+	{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, -1 },
+	{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, -1 },
+	{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, -1 },
+};
+
+// Sample rates indexed by [version][sample rate index], where version is
+// 0 for MPEG-1, 1 for MPEG-2 and 2 for MPEG-2.5.
+static const int SAMPLE_RATES[3][3] = {
+	{ 44100, 48000, 32000 },
+	{ 22050, 24000, 16000 },
+	{ 11025, 12000, 8000 },
+};
+
+bool parse_mp3_frame_header(const uint8_t *data, size_t len, Mp3FrameHeader &hdr) {
+	if (len < 4)
+		return false;
+
+	// All frames start with 11 set bits (the frame sync).
+	if (data[0] != 0xFF || (data[1] & 0xE0) != 0xE0)
+		return false;
+
+	int version_bits = (data[1] >> 3) & 0x3; // 0: 2.5, 1: reserved, 2: 2, 3: 1
+	int layer_bits = (data[1] >> 1) & 0x3;   // 1: III, 2: II, 3: I
+	int bitrate_index = (data[2] >> 4) & 0xF;
+	int sample_rate_index = (data[2] >> 2) & 0x3;
+	int padding = (data[2] >> 1) & 0x1;
+
+	if (version_bits == 1 || layer_bits == 0 || sample_rate_index == 3
+			|| bitrate_index == 0 || bitrate_index == 15)
+		return false;
+
+	int version = (version_bits == 3) ? 0 : (version_bits == 2) ? 1 : 2;
+	int layer = 4 - layer_bits; // 1, 2 or 3
+
+	int table;
+	if (version == 0)
+		table = layer - 1;
+	else
+		table = (layer == 1) ? 3 : 4;
+
+	hdr.bitrate = BITRATES[table][bitrate_index] * 1000;
+	hdr.sample_rate = SAMPLE_RATES[version][sample_rate_index];
+
+	if (layer == 1)
+		hdr.samples_per_frame = 384;
+	else if (layer == 3 && version != 0)
+		hdr.samples_per_frame = 576;
+	else
+		hdr.samples_per_frame = 1152;
+
+	if (layer == 1) {
+		// Layer I frames are measured in 4 byte slots.
+		hdr.frame_length = (12 * hdr.bitrate / hdr.sample_rate + padding) * 4;
+	}
+	else {
+		hdr.frame_length = (hdr.samples_per_frame / 8) * hdr.bitrate
+							/ hdr.sample_rate + padding;
+	}
+
+	return true;
+}
+
+size_t id3v2_tag_size(const uint8_t *data, size_t len) {
+	if (len < 10 || data[0] != 'I' || data[1] != 'D' || data[2] != '3')
+		return 0;
+
+	// The size is stored as 4 bytes with 7 bits each (i.e. "syncsafe"), and
+	// doesn't include the 10 byte header (or the 10 byte footer, if any).
+	size_t size = ((size_t)(data[6] & 0x7F) << 21) | ((data[7] & 0x7F) << 14)
+					| ((data[8] & 0x7F) << 7) | (data[9] & 0x7F);
+	bool has_footer = (data[5] & 0x10) != 0;
+
+	return 10 + size + (has_footer ? 10 : 0);
+}
+
+int estimate_mp3_bitrate(const fs::path &mp3_file) {
+	// A catalog scan calls this once per file from several threads at once,
+	// so each thread reuses its own 64 KiB buffer rather than allocating one
+	// per file (or sharing one between threads).
+	static thread_local uint8_t data[BITRATE_SCAN_BYTES];
+
+	int file_fd = open(mp3_file.c_str(), O_RDONLY);
+	if (file_fd < 0)
+		return 0;
+
+	ssize_t bytes_read = pread(file_fd, data, BITRATE_SCAN_BYTES, 0);
+	close(file_fd);
+	if (bytes_read <= 0)
+		return 0;
+
+	size_t len = bytes_read;
+	size_t pos = id3v2_tag_size(data, len);
+
+	// Add up the bits and the playing time of every frame we can see, so that
+	// variable bitrate files get their average bitrate.
+	double total_bits = 0;
+	double total_seconds = 0;
+
+	Mp3FrameHeader hdr;
+	while (pos < len) {
+		if (!parse_mp3_frame_header(data + pos, len - pos, hdr)) {
+			// Not a frame (e.g. junk or a tag we don't know), so look for
+			// the next frame sync.
+			pos++;
+			continue;
+		}
+
+		total_bits += hdr.frame_length * 8.0;
+		total_seconds += (double)hdr.samples_per_frame / hdr.sample_rate;
+		pos += hdr.frame_length;
+	}
+
+	if (total_seconds == 0)
+		return 0;
+
+	return (int)(total_bits / total_seconds);
+}
+
+Mp3FrameIndex::Mp3FrameIndex(const fs::path &mp3_file) :
+	file_size(0), frame_seconds(0) {
+	std::ifstream file(mp3_file, std::ifstream::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+								std::istreambuf_iterator<char>());
+	this->file_size = data.size();
+
+	size_t pos = id3v2_tag_size(data.data(), data.size());
+
+	Mp3FrameHeader hdr;
+	while (pos < data.size()) {
+		if (!parse_mp3_frame_header(data.data() + pos, data.size() - pos, hdr)) {
+			// Not a frame, so look for the next frame sync.
+			pos++;
+			continue;
+		}
+
+		if (this->frame_starts.empty())
+			this->frame_seconds = (double)hdr.samples_per_frame / hdr.sample_rate;
+
+		this->frame_starts.push_back(pos);
+		pos += hdr.frame_length;
+	}
+}
+
+size_t Mp3FrameIndex::frame_at_byte(size_t offset) const {
+	// Find the first frame that starts after offset: the one before it is
+	// the frame that offset is in.
+	auto after = std::upper_bound(this->frame_starts.begin(),
+									this->frame_starts.end(), offset);
+	if (after == this->frame_starts.begin())
+		return (this->frame_starts.empty()) ? this->file_size : this->frame_starts[0];
+
+	if (after == this->frame_starts.end() && offset >= this->file_size)
+		return this->file_size;
+
+	return *(after - 1);
+}
+
+size_t Mp3FrameIndex::frame_at_time(double seconds) const {
+	if (this->frame_seconds <= 0 || seconds < 0)
+		return this->frame_at_byte(0);
+
+	// Every frame in a song plays for the same amount of time, so the frame
+	// number comes straight from the time.
+	size_t frame_num = seconds / this->frame_seconds;
+	if (frame_num >= this->frame_starts.size())
+		return this->file_size;
+
+	return this->frame_starts[frame_num];
+}
+
+LazyFrameIndex::LazyFrameIndex(std::unique_ptr<const Mp3FrameIndex> prebuilt) :
+	ready(false) {
+	std::call_once(this->built, [&]() {
+		this->index = std::move(prebuilt);
+		this->ready.store(true, std::memory_order_release);
+	});
+}
+
+const Mp3FrameIndex &LazyFrameIndex::get(const fs::path &mp3_file) {
+	std::call_once(this->built, [&]() {
+		this->index.reset(new Mp3FrameIndex(mp3_file));
+		this->ready.store(true, std::memory_order_release);
+	});
+
+	return *this->index;
+}
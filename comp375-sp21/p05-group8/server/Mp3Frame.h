@@ -0,0 +1,170 @@
+#ifndef MP3FRAME_H
+#define MP3FRAME_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * The parts of an MP3 (MPEG audio) frame header that we care about.
+ */
+struct Mp3FrameHeader {
+	int bitrate;           // bits per second
+	int sample_rate;       // samples per second
+	int samples_per_frame; // samples of audio in the frame
+	size_t frame_length;   // bytes in the frame, including the header
+};
+
+/**
+ * Parses the 4 byte MPEG audio frame header at the start of data.
+ *
+ * @param data Pointer to the (possible) start of a frame.
+ * @param len Number of bytes available at data.
+ * @param hdr Where to store the parsed header.
+ * @return true if data starts with a valid frame header.
+ */
+bool parse_mp3_frame_header(const uint8_t *data, size_t len, Mp3FrameHeader &hdr);
+
+/**
+ * Gets the size of the ID3v2 tag at the start of data (if there is one).
+ *
+ * @param data Pointer to the start of the file.
+ * @param len Number of bytes available at data.
+ * @return Number of bytes taken up by the tag (0 if there is no tag).
+ */
+size_t id3v2_tag_size(const uint8_t *data, size_t len);
+
+/**
+ * Estimates the average bitrate of an MP3 file by reading the frame headers
+ * near the start of the file.
+ *
+ * @param mp3_file Path to the MP3 file.
+ * @return The bitrate in bits per second, or 0 if we couldn't find any
+ * 	frames.
+ */
+int estimate_mp3_bitrate(const std::filesystem::path &mp3_file);
+
+/**
+ * Class that knows where every frame of an MP3 file starts, so that we can
+ * start playing from the middle of a song without cutting a frame in half.
+ */
+class Mp3FrameIndex {
+  private:
+	std::vector<uint32_t> frame_starts; // file offset of each frame, in order
+	size_t file_size;     // bytes in the whole file
+	double frame_seconds; // playing time of one frame
+
+  public:
+	/**
+	 * Constructor that reads the whole file to find its frames.
+	 *
+	 * @param mp3_file Path to the MP3 file.
+	 */
+	Mp3FrameIndex(const std::filesystem::path &mp3_file);
+
+	/**
+	 * Constructor for an index that was built earlier (e.g. loaded from a
+	 * catalog snapshot).
+	 *
+	 * @param frame_starts File offset of each frame, in order.
+	 * @param file_size Bytes in the whole file.
+	 * @param frame_seconds Playing time of one frame.
+	 */
+	Mp3FrameIndex(std::vector<uint32_t> frame_starts, size_t file_size,
+					double frame_seconds) :
+		frame_starts(std::move(frame_starts)), file_size(file_size),
+		frame_seconds(frame_seconds) {}
+
+	/**
+	 * Finds the start of the frame that contains the given byte, using a
+	 * binary search.
+	 *
+	 * @param offset Offset in the file.
+	 * @return Offset of the frame (or the end of the file, if the offset is
+	 * 	past the last frame).
+	 */
+	size_t frame_at_byte(size_t offset) const;
+
+	/**
+	 * Finds the start of the frame that is playing at the given time.
+	 *
+	 * @param seconds Time since the start of the song.
+	 * @return Offset of the frame (or the end of the file, if the song is
+	 * 	shorter than that).
+	 */
+	size_t frame_at_time(double seconds) const;
+
+	/**
+	 * Gets the number of frames in the file.
+	 */
+	size_t num_frames() const {
+		return frame_starts.size();
+	}
+
+	/**
+	 * Gets the file offset of each frame, in order.
+	 */
+	const std::vector<uint32_t> &starts() const {
+		return frame_starts;
+	}
+
+	/**
+	 * Gets the number of bytes in the whole file.
+	 */
+	size_t total_size() const {
+		return file_size;
+	}
+
+	/**
+	 * Gets the playing time of one frame, in seconds.
+	 */
+	double seconds_per_frame() const {
+		return frame_seconds;
+	}
+};
+
+/**
+ * Class that builds a song's Mp3FrameIndex the first time someone asks for
+ * it, then hands out the same index from then on. Any number of threads can
+ * use it at once.
+ */
+class LazyFrameIndex {
+  private:
+	std::once_flag built;
+	std::unique_ptr<const Mp3FrameIndex> index;
+	std::atomic<bool> ready; // true once index is set
+
+  public:
+	LazyFrameIndex() : ready(false) {}
+
+	/**
+	 * Constructor for an index that has already been built.
+	 *
+	 * @param prebuilt The index to hand out.
+	 */
+	LazyFrameIndex(std::unique_ptr<const Mp3FrameIndex> prebuilt);
+
+	/**
+	 * Gets the index for the given file, building it if this is the first
+	 * call.
+	 *
+	 * @param mp3_file Path to the MP3 file (the same one every time).
+	 */
+	const Mp3FrameIndex &get(const std::filesystem::path &mp3_file);
+
+	/**
+	 * Gets the index if it has been built, without building it.
+	 *
+	 * @return The index, or NULL if no one has asked for it yet.
+	 */
+	const Mp3FrameIndex *peek() const {
+		return ready.load(std::memory_order_acquire) ? index.get() : NULL;
+	}
+};
+
+#endif // MP3FRAME_H
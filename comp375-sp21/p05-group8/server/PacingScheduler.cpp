@@ -0,0 +1,34 @@
+#include "PacingScheduler.h"
+
+using std::vector;
+using std::pair;
+
+
+PacingScheduler::PacingScheduler(double pace_factor, double burst_seconds) :
+	pace_factor(pace_factor), burst_seconds(burst_seconds) {}
+
+void PacingScheduler::schedule(int fd, uint32_t generation, time_point when) {
+	this->wakeups.push(Wakeup(when, fd, generation));
+}
+
+int PacingScheduler::ms_until_next() const {
+	if (this->wakeups.empty())
+		return -1;
+
+	auto wait = std::get<0>(this->wakeups.top()) - std::chrono::steady_clock::now();
+	if (wait <= wait.zero())
+		return 0;
+
+	// Round up so we don't wake up just before the client is due.
+	return std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+}
+
+void PacingScheduler::pop_due(time_point now, vector<pair<int, uint32_t>> &due) {
+	due.clear();
+
+	while (!this->wakeups.empty() && std::get<0>(this->wakeups.top()) <= now) {
+		const Wakeup &wakeup = this->wakeups.top();
+		due.emplace_back(std::get<1>(wakeup), std::get<2>(wakeup));
+		this->wakeups.pop();
+	}
+}
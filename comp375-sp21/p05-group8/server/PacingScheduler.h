@@ -0,0 +1,72 @@
+#ifndef PACINGSCHEDULER_H
+#define PACINGSCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+#include <queue>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/**
+ * Class that decides how fast songs are streamed and keeps track of when
+ * paced clients are allowed to send again.
+ *
+ * The event loop uses ms_until_next as its epoll_wait timeout, then calls
+ * pop_due to find the clients whose wait is over.
+ */
+class PacingScheduler {
+  public:
+	typedef std::chrono::steady_clock::time_point time_point;
+
+	/**
+	 * Constructor for PacingScheduler class.
+	 *
+	 * @param pace_factor How much faster than real time to stream songs
+	 * 	(e.g. 1.1), or 0 to not pace songs at all.
+	 * @param burst_seconds Seconds of audio to send right away so the
+	 * 	client can start buffering.
+	 */
+	PacingScheduler(double pace_factor, double burst_seconds);
+
+	double pace_factor;   // multiple of the song's bitrate we stream at
+	double burst_seconds; // seconds of audio in the initial burst
+
+	/**
+	 * Remembers that the client on fd (with the given ClientSlab generation)
+	 * should try to send again at when.
+	 *
+	 * Wakeups aren't checked for duplicates, so a client must only have one
+	 * outstanding at a time (ConnectedClient keeps track of its own). Each
+	 * extra one would come back to schedule yet another, forever.
+	 */
+	void schedule(int fd, uint32_t generation, time_point when);
+
+	/**
+	 * Gets the number of milliseconds until the next client is due (rounded
+	 * up), or -1 if there are no clients waiting.
+	 */
+	int ms_until_next() const;
+
+	/**
+	 * Removes every client (as an fd and generation) whose wait is over and
+	 * puts them in due. The caller can reuse due from one call to the next,
+	 * so this doesn't need to allocate once the loop has warmed up.
+	 */
+	void pop_due(time_point now, std::vector<std::pair<int, uint32_t>> &due);
+
+	/**
+	 * Gets the number of wakeups waiting to come round.
+	 */
+	size_t size() const {
+		return wakeups.size();
+	}
+
+  private:
+	typedef std::tuple<time_point, int, uint32_t> Wakeup;
+
+	// earliest wakeup at the top
+	std::priority_queue<Wakeup, std::vector<Wakeup>, std::greater<Wakeup>> wakeups;
+};
+
+#endif // PACINGSCHEDULER_H
@@ -0,0 +1,138 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * The jukebox server speaks two protocols, chosen by the first byte a client
+ * sends.
+ *
+ * The text protocol is what the original client uses: a command such as
+ * "play 2" (optionally ending in a newline), answered by the raw response
+ * bytes. "play 2 90s" or "play 2 100000" starts the song 90 seconds or 100000
+ * bytes in, and "radio 1" tunes in to radio channel 1. "list 100 50" lists
+ * just songs 100 to 149, and "search beatles help" lists the songs whose
+ * title, artist or album contain both words (or words starting with them).
+ * Only one response is sent at a time and the connection is shut down
+ * once it is done.
+ *
+ * The binary protocol starts with the two bytes PROTOCOL_MAGIC and
+ * PROTOCOL_VERSION. After that, everything is sent as frames, with all
+ * numbers in network byte order:
+ *
+ *   client -> server:  u32 length | u32 request id | u8 command | arguments
+ *   server -> client:  u32 length | u32 request id | u8 frame type | payload
+ *
+ * where length counts the bytes after the length field. A client can send as
+ * many commands as it likes without waiting for answers. Each command's
+ * response is sent as DATA (or ERROR) frames tagged with the command's
+ * request id, followed by an END frame, and the frames of different
+ * responses are interleaved. For example, a client can ask for the song list
+ * while a song is streaming, and both arrive on the same connection.
+ *
+ * Command arguments:
+ *   LIST:         none, or u32 offset and u32 count to list just part of
+ *                 the catalog
+ *   CLOSE:        none
+ *   INFO:         u32 song number
+ *   PLAY:         u32 song number, optionally followed by u32 offset and
+ *                 u8 SeekUnit to start part way through the song
+ *   RADIO:        u32 channel number (like a song that never ends)
+ *   STOP:         u32 request id of the PLAY or RADIO to stop (or none to
+ *                 stop every song)
+ *   STATS:        none (the response is the same text as the "stats" text
+ *                 command)
+ *   QUALITY:      u32 most kbps to send songs at from now on, QUALITY_AUTO
+ *                 to decide based on how fast the client reads, or
+ *                 QUALITY_ORIGINAL to always send the original (no response,
+ *                 unless the argument is missing)
+ *   SEARCH:       the search terms (the rest of the frame), answered with
+ *                 the matching songs in the same format as LIST
+ */
+
+const uint8_t PROTOCOL_MAGIC = 0xb5; // never the start of a text command
+const uint8_t PROTOCOL_VERSION = 1;
+
+/**
+ * Commands a client can send.
+ */
+enum Command : uint8_t {
+	CMD_LIST = 1,
+	CMD_INFO = 2,
+	CMD_PLAY = 3,
+	CMD_STOP = 4,
+	CMD_CLOSE = 5,
+	CMD_RADIO = 6,
+	CMD_STATS = 7,
+	CMD_QUALITY = 8,
+	CMD_SEARCH = 9,
+};
+
+// Special values for the argument of a QUALITY command.
+const uint32_t QUALITY_AUTO = 0;
+const uint32_t QUALITY_ORIGINAL = 0xffffffff;
+
+/**
+ * Types of frames the server sends.
+ */
+enum FrameType : uint8_t {
+	FRAME_DATA = 1,  // part of a response
+	FRAME_ERROR = 2, // part of an error message (e.g. no such song)
+	FRAME_END = 3,   // the response is finished (or was stopped)
+};
+
+/**
+ * Units for the offset of a PLAY command. Either way, the song starts at the
+ * beginning of the frame that contains the offset.
+ */
+enum SeekUnit : uint8_t {
+	SEEK_BYTES = 0,
+	SEEK_MILLISECONDS = 1,
+};
+
+// u32 length + u32 request id + u8 command/frame type
+const size_t FRAME_HEADER_SIZE = 9;
+
+// Commands are small (a search query is the biggest), so anything bigger
+// than this is a broken client.
+const size_t MAX_COMMAND_FRAME = 256;
+
+// Most payload bytes in one frame we send. Smaller frames let responses take
+// turns more often.
+const size_t MAX_FRAME_PAYLOAD = 16 * 1024;
+
+/**
+ * Reads a u32 in network byte order.
+ */
+inline uint32_t read_u32(const uint8_t *data) {
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+		| ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+/**
+ * Writes a u32 in network byte order.
+ */
+inline void write_u32(uint8_t *data, uint32_t value) {
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+/**
+ * Fills in a frame header.
+ *
+ * @param header Where to write the header (FRAME_HEADER_SIZE bytes).
+ * @param request_id Request the frame belongs to.
+ * @param type The command or frame type.
+ * @param payload_length Number of bytes that follow the header.
+ */
+inline void write_frame_header(uint8_t *header, uint32_t request_id,
+								uint8_t type, uint32_t payload_length) {
+	write_u32(header, payload_length + FRAME_HEADER_SIZE - 4);
+	write_u32(header + 4, request_id);
+	header[8] = type;
+}
+
+#endif // PROTOCOL_H
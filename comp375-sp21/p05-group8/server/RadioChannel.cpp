@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "RadioChannel.h"
+#include "Mp3Frame.h"
+#include "SongCatalog.h"
+
+namespace fs = std::filesystem;
+
+using std::chrono::steady_clock;
+
+typedef std::chrono::duration<double> seconds;
+
+
+RadioChannel::RadioChannel(size_t first_song, double join_seconds) :
+	first_song(first_song), join_seconds(join_seconds), bytes_published(0),
+	frames_published(0), frame_seconds(0), next_publish(0), bytes_written(0),
+	frames_written(0) {
+	for (std::atomic<uint64_t> &start : this->frame_starts)
+		start.store(0, std::memory_order_relaxed);
+}
+
+void RadioChannel::run(CurrentCatalog *catalog) {
+	std::vector<uint8_t> data; // the song being played
+	size_t song_num = this->first_song;
+
+	// We wake up every RADIO_PUBLISH_SECONDS and publish every frame that
+	// starts playing in the next two of those periods, so listeners always
+	// have at least one period of audio in hand.
+	auto wake_time = steady_clock::now();
+	auto play_time = wake_time; // when the next frame starts playing
+	auto period = std::chrono::duration_cast<steady_clock::duration>(
+									seconds(RADIO_PUBLISH_SECONDS));
+
+	while (true) {
+		std::shared_ptr<const SongCatalog> songs = catalog->get();
+		const SongEntry *song = NULL;
+		if (songs->size() > 0)
+			song = songs->song(song_num++ % songs->size());
+
+		// Read the whole song. If it has gone missing since the catalog was
+		// built, we just move on to the next one.
+		std::error_code error;
+		data.clear();
+		if (song != NULL) {
+			size_t size = fs::file_size(song->path, error);
+			std::ifstream file(song->path, std::ifstream::binary);
+			if (!error && file) {
+				data.resize(size);
+				file.read((char*)data.data(), size);
+				data.resize(file.gcount());
+			}
+		}
+
+		size_t num_frames = 0;
+		size_t pos = id3v2_tag_size(data.data(), data.size());
+		Mp3FrameHeader hdr;
+		while (pos < data.size()) {
+			if (!parse_mp3_frame_header(data.data() + pos, data.size() - pos, hdr)
+					|| pos + hdr.frame_length > data.size()) {
+				pos++; // not a (whole) frame, so look for the next one
+				continue;
+			}
+
+			double frame_secs = (double)hdr.samples_per_frame / hdr.sample_rate;
+			if (play_time > wake_time + 2 * period) {
+				this->publish(frame_secs, wake_time + period);
+				wake_time += period;
+				std::this_thread::sleep_until(wake_time);
+			}
+
+			this->write_frame(data.data() + pos, hdr.frame_length);
+			play_time += std::chrono::duration_cast<steady_clock::duration>(
+														seconds(frame_secs));
+			pos += hdr.frame_length;
+			num_frames++;
+		}
+
+		if (num_frames == 0) {
+			// Nothing to play (e.g. an empty catalog), so don't spin.
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+
+		// Don't try to make up for time we spent not playing anything.
+		auto now = steady_clock::now();
+		if (play_time < now) {
+			play_time = now;
+			wake_time = now;
+		}
+	}
+}
+
+void RadioChannel::write_frame(const uint8_t *frame, size_t length) {
+	// Copy the frame into the ring, wrapping around the end if we have to.
+	size_t offset = this->bytes_written % RADIO_RING_BYTES;
+	size_t first_part = std::min(length, RADIO_RING_BYTES - offset);
+	memcpy(this->ring + offset, frame, first_part);
+	memcpy(this->ring, frame + first_part, length - first_part);
+
+	this->frame_starts[this->frames_written % RADIO_RING_FRAMES].store(
+						this->bytes_written, std::memory_order_relaxed);
+	this->bytes_written += length;
+	this->frames_written++;
+}
+
+void RadioChannel::publish(double seconds_per_frame,
+							steady_clock::time_point next) {
+	this->frame_seconds.store(seconds_per_frame, std::memory_order_relaxed);
+	this->next_publish.store(next.time_since_epoch().count(),
+								std::memory_order_relaxed);
+
+	// Bytes first, so that anyone who sees a frame can also see its data.
+	this->bytes_published.store(this->bytes_written, std::memory_order_release);
+	this->frames_published.store(this->frames_written, std::memory_order_release);
+}
+
+uint64_t RadioChannel::join_position() const {
+	uint64_t num_frames = this->frames_published.load(std::memory_order_acquire);
+	double secs = this->frame_seconds.load(std::memory_order_relaxed);
+	if (num_frames == 0 || secs <= 0)
+		return this->live_edge();
+
+	// Go back join_seconds worth of frames, but not so far that the frame
+	// (or its data) could be overwritten under us.
+	uint64_t frames_back = std::min({(uint64_t)(this->join_seconds / secs),
+										num_frames,
+										(uint64_t)(RADIO_RING_FRAMES
+													- RADIO_GUARD_FRAMES)});
+
+	for (uint64_t frame = num_frames - frames_back; frame < num_frames; frame++) {
+		uint64_t start = this->frame_starts[frame % RADIO_RING_FRAMES].load(
+											std::memory_order_relaxed);
+		if (!this->is_stale(start))
+			return start;
+	}
+
+	return this->live_edge();
+}
+
+steady_clock::time_point RadioChannel::next_publish_time() const {
+	return steady_clock::time_point(steady_clock::duration(
+					this->next_publish.load(std::memory_order_relaxed)));
+}
+
+
+
+RadioSender::RadioSender(RadioChannel *channel) :
+	channel(channel), position(channel->join_position()) {}
+
+uint64_t RadioSender::send_position() const {
+	if (this->channel->is_stale(this->position))
+		return this->channel->join_position();
+
+	return this->position;
+}
+
+ssize_t RadioSender::send_next_chunk(int sock_fd, size_t max_bytes) {
+	this->position = this->send_position();
+
+	uint64_t live_edge = this->channel->live_edge();
+	if (this->position >= live_edge)
+		return SEND_PACED;
+
+	// The data may wrap around the end of the ring, so send it in (up to)
+	// two pieces with a single call.
+	size_t length = std::min(live_edge - this->position, (uint64_t)max_bytes);
+	struct iovec pieces[2];
+	size_t contiguous;
+	pieces[0].iov_base = (void*)this->channel->data_at(this->position, contiguous);
+	pieces[0].iov_len = std::min(length, contiguous);
+	pieces[1].iov_base = (void*)this->channel->data_at(this->position
+														+ pieces[0].iov_len,
+														contiguous);
+	pieces[1].iov_len = length - pieces[0].iov_len;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = pieces;
+	msg.msg_iovlen = (pieces[1].iov_len > 0) ? 2 : 1;
+
+	// A listener hanging up is an error for their connection, not a signal
+	// that kills the server.
+	ssize_t num_bytes_sent = sendmsg(sock_fd, &msg, MSG_NOSIGNAL);
+	if (num_bytes_sent > 0) {
+		this->position += num_bytes_sent;
+		return num_bytes_sent;
+	}
+	else if (num_bytes_sent < 0 && errno == EAGAIN) {
+		// We couldn't send anything because the buffer was full
+		return -1;
+	}
+	else {
+		// The connection is gone (e.g. EPIPE or ECONNRESET), so the client
+		// should be closed.
+		return SEND_FAILED;
+	}
+}
+
+size_t RadioSender::bytes_ready() const {
+	// The live edge only moves forward, so get it after our position.
+	uint64_t position = this->send_position();
+	return this->channel->live_edge() - position;
+}
+
+steady_clock::time_point RadioSender::resume_time() const {
+	// If the channel is late publishing, check back in a little while rather
+	// than spinning.
+	auto soon = steady_clock::now() + std::chrono::milliseconds(10);
+	return std::max(this->channel->next_publish_time(), soon);
+}
@@ -0,0 +1,186 @@
+#ifndef RADIOCHANNEL_H
+#define RADIOCHANNEL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ChunkedDataSender.h"
+
+class CurrentCatalog;
+
+// Bytes of MP3 data a channel keeps (about a minute of audio at 128 kbps).
+const size_t RADIO_RING_BYTES = 1024 * 1024;
+
+// Frame starts a channel remembers, which limits how far behind the live
+// edge a listener can join.
+const size_t RADIO_RING_FRAMES = 4096;
+
+// A listener this close to being overwritten is skipped ahead, so the
+// channel can keep writing while the listener is in the middle of a send.
+const size_t RADIO_GUARD_BYTES = 128 * 1024;
+const size_t RADIO_GUARD_FRAMES = 1024;
+
+// How far ahead of real time a channel publishes frames. Listeners wake up
+// once per publish, so this is also how often they send.
+const double RADIO_PUBLISH_SECONDS = 0.1;
+
+/**
+ * Class for a radio channel: a shared stream of MP3 frames that any number of
+ * listeners can tune in to.
+ *
+ * A single reader thread (run) plays through the catalog at real time,
+ * writing each song's frames into a ring buffer. Listeners (RadioSenders)
+ * each keep their own position in the ring and send straight out of it, so a
+ * listener costs nothing but its socket sends. A listener that falls so far
+ * behind that its data is about to be overwritten skips ahead to the live
+ * edge.
+ *
+ * Only the reader thread writes to the ring. Everything listeners read is
+ * published through atomics, so listeners in any event loop can share a
+ * channel without locking.
+ */
+class RadioChannel {
+  private:
+	size_t first_song;     // the song the channel starts with
+	double join_seconds;   // audio new listeners get right away
+
+	char ring[RADIO_RING_BYTES];
+	std::atomic<uint64_t> frame_starts[RADIO_RING_FRAMES]; // stream offsets
+
+	std::atomic<uint64_t> bytes_published;  // stream offset of the live edge
+	std::atomic<uint64_t> frames_published; // frames before the live edge
+	std::atomic<double> frame_seconds;      // length of the current frames
+	std::atomic<int64_t> next_publish;      // steady_clock time, in ns
+
+	// Only used by the reader thread.
+	uint64_t bytes_written;
+	uint64_t frames_written;
+
+  public:
+	/**
+	 * Constructor for RadioChannel class.
+	 *
+	 * @param first_song Number of the song to start playing.
+	 * @param join_seconds Seconds of audio (already published) that a new
+	 * 	listener gets right away, so its player can fill its buffer.
+	 */
+	RadioChannel(size_t first_song, double join_seconds);
+
+	/**
+	 * Plays the songs in the catalog, one after another, forever. This is
+	 * meant to be the body of the channel's thread.
+	 *
+	 * @param catalog The songs to play (a rescan takes effect at the start
+	 * 	of the next song).
+	 */
+	void run(CurrentCatalog *catalog);
+
+	/**
+	 * Adds a frame to the ring. It isn't visible to listeners until the next
+	 * publish.
+	 *
+	 * @param frame The frame data.
+	 * @param length Bytes in the frame.
+	 */
+	void write_frame(const uint8_t *frame, size_t length);
+
+	/**
+	 * Makes every frame written so far visible to listeners.
+	 *
+	 * @param seconds_per_frame Playing time of the frames.
+	 * @param next Time of the next publish.
+	 */
+	void publish(double seconds_per_frame,
+					std::chrono::steady_clock::time_point next);
+
+	/**
+	 * Gets the stream offset of the live edge, i.e. one past the last byte
+	 * that listeners can send.
+	 */
+	uint64_t live_edge() const {
+		return bytes_published.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Gets the stream offset a listener should start from: the start of the
+	 * frame join_seconds behind the live edge.
+	 */
+	uint64_t join_position() const;
+
+	/**
+	 * Checks whether the data at a stream offset may be overwritten before a
+	 * listener can finish sending it.
+	 */
+	bool is_stale(uint64_t position) const {
+		return position + RADIO_RING_BYTES - RADIO_GUARD_BYTES < live_edge();
+	}
+
+	/**
+	 * Gets the ring data at a stream offset, along with how many bytes are
+	 * contiguous there (the rest wraps around to the start of the ring).
+	 *
+	 * @param position Stream offset (which must not be stale).
+	 * @param length Set to the number of contiguous bytes before the end of
+	 * 	the ring.
+	 */
+	const char *data_at(uint64_t position, size_t &length) const {
+		size_t offset = position % RADIO_RING_BYTES;
+		length = RADIO_RING_BYTES - offset;
+		return ring + offset;
+	}
+
+	/**
+	 * Gets the time at which more data should be published.
+	 */
+	std::chrono::steady_clock::time_point next_publish_time() const;
+};
+
+/**
+ * Class that sends a radio channel to one listener, from the listener's own
+ * position in the channel's ring. The stream never ends: it goes until the
+ * listener stops it.
+ */
+class RadioSender : public virtual ChunkedDataSender {
+  private:
+	RadioChannel *channel;
+	uint64_t position; // stream offset of the next byte to send
+
+	/**
+	 * Gets where we would send from next: our position, or the channel's
+	 * join position if we have fallen too far behind.
+	 */
+	uint64_t send_position() const;
+
+  public:
+	/**
+	 * Constructor for RadioSender class.
+	 *
+	 * @param channel The channel to listen to.
+	 */
+	RadioSender(RadioChannel *channel);
+
+	/**
+	 * Sends the next chunk of the channel, skipping ahead first if we have
+	 * fallen too far behind.
+	 *
+	 * @param sock_fd Socket which to send the data over.
+	 * @param max_bytes Most bytes to send.
+	 * @return SEND_PACED if we have caught up with the live edge, SEND_FAILED
+	 * 	if the connection is broken, otherwise the number of bytes sent (or -1
+	 * 	if the socket buffer is full).
+	 */
+	virtual ssize_t send_next_chunk(int sock_fd, size_t max_bytes = SIZE_MAX);
+
+	virtual size_t bytes_left() const {
+		return SIZE_MAX; // the radio never stops
+	}
+
+	virtual size_t bytes_ready() const;
+
+	virtual std::chrono::steady_clock::time_point resume_time() const;
+};
+
+#endif // RADIOCHANNEL_H
@@ -0,0 +1,68 @@
+#include <new>
+#include <utility>
+
+#include "SenderPool.h"
+
+using std::vector;
+
+
+SenderPool &SenderPool::local() {
+	static thread_local SenderPool pool;
+	return pool;
+}
+
+void *SenderPool::allocate(size_t size) {
+	size_t size_class = (size + BLOCK_ALIGN - 1) / BLOCK_ALIGN;
+	if (size_class >= NUM_SIZE_CLASSES)
+		return ::operator new(size);
+
+	vector<void*> &free_list = this->free_blocks[size_class];
+	if (free_list.empty())
+		return ::operator new(size_class * BLOCK_ALIGN);
+
+	void *block = free_list.back();
+	free_list.pop_back();
+	return block;
+}
+
+void SenderPool::deallocate(void *block, size_t size) {
+	size_t size_class = (size + BLOCK_ALIGN - 1) / BLOCK_ALIGN;
+	if (size_class >= NUM_SIZE_CLASSES) {
+		::operator delete(block);
+		return;
+	}
+
+	// Don't hang on to everything from a burst of clients forever.
+	vector<void*> &free_list = this->free_blocks[size_class];
+	if (free_list.size() >= MAX_FREE_BLOCKS) {
+		::operator delete(block);
+		return;
+	}
+
+	free_list.push_back(block);
+}
+
+vector<char> SenderPool::take_buffer() {
+	if (this->free_buffers.empty())
+		return vector<char>();
+
+	vector<char> buffer = std::move(this->free_buffers.back());
+	this->free_buffers.pop_back();
+	return buffer;
+}
+
+void SenderPool::give_back_buffer(vector<char> &&buffer) {
+	if (buffer.capacity() == 0 || buffer.capacity() > MAX_BUFFER_BYTES
+			|| this->free_buffers.size() >= MAX_FREE_BUFFERS)
+		return; // buffer frees itself when it goes out of scope
+
+	buffer.clear();
+	this->free_buffers.push_back(std::move(buffer));
+}
+
+SenderPool::~SenderPool() {
+	for (auto &free_list : this->free_blocks) {
+		for (void *block : free_list)
+			::operator delete(block);
+	}
+}
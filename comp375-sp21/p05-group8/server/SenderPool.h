@@ -0,0 +1,66 @@
+#ifndef SENDERPOOL_H
+#define SENDERPOOL_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Class that recycles the memory used by senders and by the text they send,
+ * so that handling a command doesn't have to go to the heap once the server
+ * has warmed up.
+ *
+ * Each thread has its own pool (see local()). Since every event loop runs on
+ * its own thread and a sender never leaves the loop that created it, that
+ * makes this a per-loop pool that needs no locking.
+ */
+class SenderPool {
+  public:
+	/**
+	 * Gets the calling thread's pool.
+	 */
+	static SenderPool &local();
+
+	/**
+	 * Gets a block of memory that can hold size bytes, reusing a freed block
+	 * if there is one.
+	 */
+	void *allocate(size_t size);
+
+	/**
+	 * Gives a block from allocate back to the pool.
+	 *
+	 * @param block The block to give back.
+	 * @param size The size that was asked for when allocating the block.
+	 */
+	void deallocate(void *block, size_t size);
+
+	/**
+	 * Gets an empty buffer for response text. It may already have room for
+	 * a typical response, left over from an earlier one.
+	 */
+	std::vector<char> take_buffer();
+
+	/**
+	 * Gives a buffer from take_buffer back to the pool for reuse.
+	 */
+	void give_back_buffer(std::vector<char> &&buffer);
+
+	/**
+	 * Destructor for SenderPool class. Frees everything in the pool.
+	 */
+	~SenderPool();
+
+  private:
+	static const size_t BLOCK_ALIGN = 16; // blocks come in multiples of this
+	static const size_t NUM_SIZE_CLASSES = 16; // i.e. blocks up to 256 bytes
+	static const size_t MAX_FREE_BLOCKS = 4096; // per size class
+	static const size_t MAX_FREE_BUFFERS = 256;
+	static const size_t MAX_BUFFER_BYTES = 64 * 1024; // bigger ones are freed
+
+	std::vector<void*> free_blocks[NUM_SIZE_CLASSES];
+	std::vector<std::vector<char>> free_buffers;
+
+	SenderPool() {}
+};
+
+#endif // SENDERPOOL_H
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "ServerStats.h"
+#include "SongCatalog.h"
+
+using std::string;
+
+// Every thread's counters, so render_stats can find them. Counters are never
+// freed, so they are still there (and still counted) after their thread
+// exits.
+static std::mutex all_shards_lock;
+static std::vector<ShardStats*> all_shards;
+
+ShardStats &ShardStats::local() {
+	static thread_local ShardStats *stats = NULL;
+	if (stats == NULL) {
+		stats = new ShardStats();
+
+		std::lock_guard<std::mutex> guard(all_shards_lock);
+		all_shards.push_back(stats);
+	}
+
+	return *stats;
+}
+
+void ShardStats::record_loop(uint64_t ns) {
+	add(this->loop_iterations, 1);
+	add(this->loop_ns, ns);
+	if (ns > this->loop_max_ns.load(std::memory_order_relaxed))
+		this->loop_max_ns.store(ns, std::memory_order_relaxed);
+}
+
+string render_stats(const SongCatalog &catalog) {
+	uint64_t clients = 0, sending = 0, bytes_sent = 0, chunks_sent = 0;
+	uint64_t rearms = 0, timed_out = 0, iterations = 0, loop_ns = 0, loop_max_ns = 0;
+
+	{
+		std::lock_guard<std::mutex> guard(all_shards_lock);
+		for (ShardStats *shard : all_shards) {
+			clients += shard->clients.load(std::memory_order_relaxed);
+			sending += shard->sending.load(std::memory_order_relaxed);
+			bytes_sent += shard->bytes_sent.load(std::memory_order_relaxed);
+			chunks_sent += shard->chunks_sent.load(std::memory_order_relaxed);
+			rearms += shard->epollout_rearms.load(std::memory_order_relaxed);
+			timed_out += shard->timed_out.load(std::memory_order_relaxed);
+			iterations += shard->loop_iterations.load(std::memory_order_relaxed);
+			loop_ns += shard->loop_ns.load(std::memory_order_relaxed);
+			loop_max_ns = std::max(loop_max_ns,
+								shard->loop_max_ns.load(std::memory_order_relaxed));
+		}
+	}
+
+	// The shards keep counting while we read, so the gauges can be a
+	// little out of step with each other.
+	sending = std::min(sending, clients);
+
+	std::stringstream ss;
+	ss << "clients: " << clients << "\n";
+	ss << "sending: " << sending << "\n";
+	ss << "receiving: " << clients - sending << "\n";
+	ss << "bytes_sent: " << bytes_sent << "\n";
+	ss << "chunks_sent: " << chunks_sent << "\n";
+	ss << "avg_chunk_bytes: " << (chunks_sent ? bytes_sent / chunks_sent : 0) << "\n";
+	ss << "epollout_rearms: " << rearms << "\n";
+	ss << "timed_out: " << timed_out << "\n";
+	ss << "loop_iterations: " << iterations << "\n";
+	ss << "loop_avg_us: " << (iterations ? loop_ns / iterations / 1000.0 : 0) << "\n";
+	ss << "loop_max_us: " << loop_max_ns / 1000.0 << "\n";
+
+	for (size_t i = 0; i < catalog.size(); i++) {
+		const SongEntry *song = catalog.song(i);
+		ss << "song " << i << " " << song->path.filename().string()
+			<< ": plays " << song->stats->plays.load(std::memory_order_relaxed)
+			<< ", bytes_sent "
+			<< song->stats->bytes_sent.load(std::memory_order_relaxed) << "\n";
+	}
+
+	return ss.str();
+}
@@ -0,0 +1,76 @@
+#ifndef SERVERSTATS_H
+#define SERVERSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+class SongCatalog;
+
+/**
+ * Counters for one song, shared by every event loop.
+ */
+struct SongStats {
+	std::atomic<uint64_t> plays{0};      // times the song was started
+	std::atomic<uint64_t> bytes_sent{0}; // bytes of the song sent
+};
+
+/**
+ * Counters for one event loop thread (shard).
+ *
+ * Only the thread itself changes its counters, so they are updated with a
+ * plain load and store rather than a locked read-modify-write, which makes
+ * them about as cheap as ordinary variables. They are atomics only so that
+ * other threads can read them for the stats command.
+ */
+class ShardStats {
+  public:
+	std::atomic<uint64_t> clients{0};         // connected clients
+	std::atomic<uint64_t> sending{0};         // clients in the SENDING state
+	std::atomic<uint64_t> bytes_sent{0};      // response bytes sent
+	std::atomic<uint64_t> chunks_sent{0};     // successful sender sends
+	std::atomic<uint64_t> epollout_rearms{0}; // times we started watching EPOLLOUT
+	std::atomic<uint64_t> timed_out{0};       // clients closed for inactivity
+	std::atomic<uint64_t> loop_iterations{0}; // times around the event loop
+	std::atomic<uint64_t> loop_ns{0};         // time spent handling events
+	std::atomic<uint64_t> loop_max_ns{0};     // longest single iteration
+
+	/**
+	 * Gets the counters for the calling thread, creating them the first
+	 * time.
+	 */
+	static ShardStats &local();
+
+	/**
+	 * Adds to one of the calling thread's own counters.
+	 */
+	static void add(std::atomic<uint64_t> &counter, uint64_t amount) {
+		counter.store(counter.load(std::memory_order_relaxed) + amount,
+						std::memory_order_relaxed);
+	}
+
+	/**
+	 * Subtracts from one of the calling thread's own counters.
+	 */
+	static void subtract(std::atomic<uint64_t> &counter, uint64_t amount) {
+		counter.store(counter.load(std::memory_order_relaxed) - amount,
+						std::memory_order_relaxed);
+	}
+
+	/**
+	 * Records how long one time around the event loop took.
+	 *
+	 * @param ns The time, in nanoseconds.
+	 */
+	void record_loop(uint64_t ns);
+};
+
+/**
+ * Adds up the counters of every shard (and every song in the catalog) and
+ * formats them as text, one "name: value" per line.
+ *
+ * @param catalog The songs to report on.
+ */
+std::string render_stats(const SongCatalog &catalog);
+
+#endif // SERVERSTATS_H
@@ -0,0 +1,69 @@
+#include <fstream>
+#include <iostream>
+
+#include "SongCache.h"
+
+namespace fs = std::filesystem;
+
+using std::vector;
+
+
+SongCache::SongCache(size_t max_bytes) : max_bytes(max_bytes), total_bytes(0) {}
+
+SharedBuffer SongCache::get(const fs::path &song_file) {
+	{
+		std::unique_lock<std::mutex> lk(this->mutex);
+
+		auto it = this->entries.find(song_file);
+		if (it != this->entries.end()) {
+			// Cache hit: move the song to the front of the LRU list.
+			this->lru.splice(this->lru.begin(), this->lru, it->second.lru_pos);
+			return it->second.data;
+		}
+	}
+
+	// Cache miss: read the song without holding the lock so that other
+	// clients can keep using the cache while we wait on the disk.
+	std::error_code ec;
+	size_t size = fs::file_size(song_file, ec);
+	if (ec || size > this->max_bytes)
+		return NULL;
+
+	std::ifstream file(song_file, std::ifstream::binary);
+	auto data = std::make_shared<vector<char>>(size);
+	if (!file.read(data->data(), size))
+		return NULL;
+
+	std::unique_lock<std::mutex> lk(this->mutex);
+
+	// Someone else may have loaded the same song while we were reading it,
+	// in which case we use theirs so there is only ever one copy.
+	auto it = this->entries.find(song_file);
+	if (it != this->entries.end()) {
+		this->lru.splice(this->lru.begin(), this->lru, it->second.lru_pos);
+		return it->second.data;
+	}
+
+	this->evict_until_fits(size);
+
+	this->lru.push_front(song_file);
+	this->entries[song_file] = Entry{data, this->lru.begin()};
+	this->total_bytes += size;
+
+	return data;
+}
+
+/**
+ * Drops least recently used songs until there is room for new_bytes more.
+ * Must be called with the lock held.
+ *
+ * @param new_bytes Size of the song we are about to add.
+ */
+void SongCache::evict_until_fits(size_t new_bytes) {
+	while (!this->lru.empty() && this->total_bytes + new_bytes > this->max_bytes) {
+		auto it = this->entries.find(this->lru.back());
+		this->total_bytes -= it->second.data->size();
+		this->entries.erase(it);
+		this->lru.pop_back();
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef SONGCACHE_H
+#define SONGCACHE_H
+
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "ChunkedDataSender.h"
+
+/**
+ * Class that keeps the contents of recently played songs in memory so that
+ * clients playing the same song can share one copy of it.
+ *
+ * Songs are read from disk the first time someone asks for them. When the
+ * total size of the cached songs goes over the limit, the least recently
+ * used songs are dropped from the cache. Songs are handed out as
+ * SharedBuffers, so a song that is dropped stays in memory until the last
+ * client that is playing it is done.
+ */
+class SongCache {
+  private:
+	/**
+	 * A cached song and its place in the LRU list.
+	 */
+	struct Entry {
+		SharedBuffer data;
+		std::list<std::filesystem::path>::iterator lru_pos;
+	};
+
+	/**
+	 * Hash for song paths, so we can look songs up by the path we are given
+	 * without making a copy of it first.
+	 */
+	struct PathHash {
+		size_t operator()(const std::filesystem::path &p) const {
+			return std::filesystem::hash_value(p);
+		}
+	};
+
+	size_t max_bytes;   // most bytes we will keep cached
+	size_t total_bytes; // bytes currently cached
+
+	std::list<std::filesystem::path> lru; // song paths, most recently used first
+	std::unordered_map<std::filesystem::path, Entry, PathHash> entries; // song path -> entry
+	std::mutex mutex; // protects all of the above
+
+	void evict_until_fits(size_t new_bytes);
+
+  public:
+	/**
+	 * Constructor for SongCache class.
+	 *
+	 * @param max_bytes The most bytes of song data to keep cached.
+	 */
+	SongCache(size_t max_bytes);
+
+	/**
+	 * Gets the contents of a song, reading it from disk if it isn't cached.
+	 *
+	 * @param song_file Path to the song.
+	 * @return The song data, or NULL if the song is too big to cache (or
+	 * 	couldn't be read).
+	 */
+	SharedBuffer get(const std::filesystem::path &song_file);
+};
+
+#endif // SONGCACHE_H
@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include <sys/stat.h>
+
+#include "SongCatalog.h"
+#include "Mp3Frame.h"
+#include "Log.h"
+
+namespace fs = std::filesystem;
+
+using std::string;
+using std::vector;
+
+// Fewest songs worth starting another thread for when scanning.
+const size_t MIN_SONGS_PER_THREAD = 64;
+
+// Fields of an info file that are searched (in lower case).
+const char *const SEARCH_FIELDS[] = { "title", "song", "artist", "album" };
+
+/**
+ * Turns a string into a SharedBuffer.
+ */
+static SharedBuffer make_buffer(const string &str) {
+	return std::make_shared<const vector<char>>(str.begin(), str.end());
+}
+
+/**
+ * Builds the response to an "info" command for a song: the contents of its
+ * info file (e.g. song.mp3.info), or just its name if it doesn't have one.
+ *
+ * @param song_file The song's MP3 file.
+ */
+static SharedBuffer render_info(const fs::path &song_file) {
+	std::stringstream ss;
+
+	fs::path info_file_path = song_file;
+	info_file_path.replace_extension(".mp3.info");
+	if (fs::is_regular_file(info_file_path)) {
+		std::ifstream t(info_file_path);
+		ss << t.rdbuf() << "\n";
+	}
+	else {
+		ss << song_file.filename().string() << "\n";
+		ss << "(No additional info)\n";
+	}
+
+	return make_buffer(ss.str());
+}
+
+fs::path tier_path(const fs::path &song_file, int kbps) {
+	fs::path path = song_file;
+	path.replace_extension("." + std::to_string(kbps) + "k.mp3");
+	return path;
+}
+
+bool is_tier_file(const fs::path &mp3_file) {
+	// i.e. the stem ends in something like ".64k"
+	string tier = mp3_file.stem().extension().string();
+	return tier.length() > 2 && tier.back() == 'k'
+		&& std::all_of(tier.begin() + 1, tier.end() - 1, ::isdigit);
+}
+
+FileStamp stamp_file(const fs::path &file) {
+	FileStamp stamp;
+	struct stat info;
+	if (stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+		stamp.size = info.st_size;
+		stamp.mtime = (int64_t)info.st_mtim.tv_sec * 1000000000
+						+ info.st_mtim.tv_nsec;
+	}
+
+	return stamp;
+}
+
+/**
+ * Finds the lower quality copies of a song that are up to date (i.e. weren't
+ * made from an older version of the song).
+ *
+ * @param song The song, which its tiers share info and stats with.
+ * @param previous The song's entry in the previous catalog, if the song
+ * 	hasn't changed since (otherwise NULL).
+ */
+static vector<SongEntry> find_tiers(const SongEntry &song,
+									const SongEntry *previous) {
+	vector<SongEntry> tiers;
+
+	for (int kbps : TIER_KBPS) {
+		fs::path path = tier_path(song.path, kbps);
+		FileStamp stamp = stamp_file(path);
+		if (stamp.size == 0 || stamp.mtime < song.stamp.mtime)
+			continue;
+
+		// A copy we already know about can be used as it is.
+		const SongEntry *known = NULL;
+		for (size_t i = 0; previous != NULL && i < previous->tiers.size(); i++) {
+			if (previous->tiers[i].path == path && previous->tiers[i].stamp == stamp)
+				known = &previous->tiers[i];
+		}
+
+		if (known != NULL) {
+			tiers.push_back(*known);
+			tiers.back().info = song.info;
+			continue;
+		}
+
+		int bitrate = estimate_mp3_bitrate(path);
+		if (bitrate == 0 || (song.bitrate != 0 && bitrate >= song.bitrate))
+			continue; // no use to anyone
+
+		tiers.push_back(SongEntry{path, song.info, bitrate,
+									std::make_shared<LazyFrameIndex>(),
+									song.stats, {}, stamp, {}});
+	}
+
+	return tiers;
+}
+
+/**
+ * Finds a song's entry in a catalog, by its path.
+ *
+ * @param songs The catalog's songs, in order of their paths (or NULL).
+ * @param path The song's MP3 file.
+ * @return The entry, or NULL if the song isn't there.
+ */
+static const SongEntry *find_song(const vector<SongEntry> *songs,
+									const fs::path &path) {
+	if (songs == NULL)
+		return NULL;
+
+	auto it = std::lower_bound(songs->begin(), songs->end(), path,
+								[](const SongEntry &song, const fs::path &path) {
+									return song.path < path;
+								});
+	return (it != songs->end() && it->path == path) ? &*it : NULL;
+}
+
+/**
+ * Gets the search terms for a song: the words of its file name, plus the
+ * title, artist and album from its info file. Info files that don't have
+ * any of those fields (e.g. just a description) are searched in full.
+ *
+ * @param song The song.
+ */
+static vector<string> metadata_terms(const SongEntry &song) {
+	vector<string> terms = split_terms(song.path.stem().string());
+
+	std::istringstream info(string(song.info->begin(), song.info->end()));
+	string line;
+	bool found_field = false;
+	while (std::getline(info, line)) {
+		size_t colon = line.find(':');
+		if (colon == string::npos)
+			continue;
+
+		string field = line.substr(0, colon);
+		std::transform(field.begin(), field.end(), field.begin(), ::tolower);
+		field.erase(0, field.find_first_not_of(" \t"));
+		field.erase(field.find_last_not_of(" \t") + 1);
+		if (std::find(std::begin(SEARCH_FIELDS), std::end(SEARCH_FIELDS),
+						field) == std::end(SEARCH_FIELDS))
+			continue;
+
+		vector<string> value = split_terms(line.substr(colon + 1));
+		terms.insert(terms.end(), value.begin(), value.end());
+		found_field = true;
+	}
+
+	if (!found_field) {
+		vector<string> all = split_terms(info.str());
+		terms.insert(terms.end(), all.begin(), all.end());
+	}
+
+	return terms;
+}
+
+/**
+ * Fills in the entries of some of the songs, and collects their search
+ * terms. Each thread of a scan runs this on its own range of songs.
+ *
+ * @param paths Every song's MP3 file.
+ * @param songs Every song's entry (only [first, last) are filled in).
+ * @param first The first song to fill in.
+ * @param last One past the last song to fill in.
+ * @param previous_songs The songs of the previous catalog (or NULL).
+ * @param terms Where to add the (term, song number) pairs.
+ */
+static void scan_songs(const vector<fs::path> &paths, vector<SongEntry> &songs,
+						size_t first, size_t last,
+						const vector<SongEntry> *previous_songs,
+						vector<std::pair<string, uint32_t>> &terms) {
+	for (size_t i = first; i < last; i++) {
+		SongEntry &song = songs[i];
+		FileStamp stamp = stamp_file(paths[i]);
+		fs::path info_path = paths[i];
+		info_path.replace_extension(".mp3.info");
+		FileStamp info_stamp = stamp_file(info_path);
+
+		// Only read the parts of the song that have changed since last time
+		// (if there was a last time).
+		const SongEntry *previous = find_song(previous_songs, paths[i]);
+		if (previous != NULL && previous->stamp == stamp) {
+			song = *previous;
+		}
+		else {
+			song = SongEntry{paths[i], NULL, estimate_mp3_bitrate(paths[i]),
+								std::make_shared<LazyFrameIndex>(),
+								std::make_shared<SongStats>(), {}, stamp, {}};
+			previous = NULL;
+		}
+
+		if (previous == NULL || !(previous->info_stamp == info_stamp)) {
+			song.info = render_info(paths[i]);
+			song.info_stamp = info_stamp;
+		}
+
+		song.tiers = find_tiers(song, previous);
+
+		for (string &term : metadata_terms(song))
+			terms.emplace_back(std::move(term), i);
+	}
+}
+
+std::shared_ptr<const SongCatalog> SongCatalog::scan(const fs::path &dir,
+														const SongCatalog *previous) {
+	vector<fs::path> mp3_paths;
+
+	// Loop through all files in the directory, keeping the MP3 files (but
+	// not lower quality copies of them, which go with their song).
+	for (const fs::directory_entry &entry : fs::directory_iterator(dir)) {
+		if (entry.path().extension() == ".mp3" && !is_tier_file(entry.path()))
+			mp3_paths.push_back(entry.path());
+	}
+
+	// The directory can list files in any order, so sort them to keep song
+	// numbers the same from one scan to the next.
+	std::sort(mp3_paths.begin(), mp3_paths.end());
+
+	std::shared_ptr<SongCatalog> catalog(new SongCatalog());
+	catalog->dir = dir;
+	catalog->songs.resize(mp3_paths.size());
+
+	const vector<SongEntry> *previous_songs = NULL;
+	if (previous != NULL && previous->dir == dir)
+		previous_songs = &previous->songs;
+
+	// Give each thread an equal share of the songs, and its own list of
+	// search terms so they don't have to share anything.
+	size_t num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	num_threads = std::min(num_threads,
+							mp3_paths.size() / MIN_SONGS_PER_THREAD + 1);
+	vector<vector<std::pair<string, uint32_t>>> thread_terms(num_threads);
+	vector<std::thread> threads;
+	for (size_t t = 0; t < num_threads; t++) {
+		size_t first = mp3_paths.size() * t / num_threads;
+		size_t last = mp3_paths.size() * (t + 1) / num_threads;
+		threads.emplace_back(scan_songs, std::cref(mp3_paths),
+								std::ref(catalog->songs), first, last,
+								previous_songs, std::ref(thread_terms[t]));
+	}
+
+	vector<std::pair<string, uint32_t>> terms;
+	for (size_t t = 0; t < num_threads; t++) {
+		threads[t].join();
+		terms.insert(terms.end(), std::make_move_iterator(thread_terms[t].begin()),
+						std::make_move_iterator(thread_terms[t].end()));
+		thread_terms[t].clear();
+	}
+
+	catalog->index = SongIndex(terms);
+	catalog->render_list();
+
+	LOG(LogLevel::INFO, "Found " << mp3_paths.size() << " songs ("
+		<< catalog->index.num_terms() << " search terms).");
+
+	return catalog;
+}
+
+void SongCatalog::render_list() {
+	std::stringstream list_ss;
+	list_ss << "No.\tFilename\n";
+	for (size_t song_num = 0; song_num < this->songs.size(); song_num++) {
+		string filename = this->songs[song_num].path.filename().string();
+		LOG(LogLevel::DEBUG, "(" << song_num << ") " << filename);
+		list_ss << "(" << song_num << ")\t" << filename << "\n";
+	}
+
+	this->list_text = make_buffer(list_ss.str());
+}
+
+string SongCatalog::list_page(size_t offset, size_t count) const {
+	std::stringstream ss;
+	ss << "No.\tFilename\n";
+	for (size_t i = offset; i < this->songs.size() && i - offset < count; i++)
+		ss << "(" << i << ")\t" << this->songs[i].path.filename().string() << "\n";
+
+	return ss.str();
+}
+
+string SongCatalog::search_results(const string &query) const {
+	vector<uint32_t> matches = this->search(query);
+
+	std::stringstream ss;
+	ss << "No.\tFilename\n";
+	for (size_t i = 0; i < matches.size() && i < MAX_SEARCH_RESULTS; i++) {
+		ss << "(" << matches[i] << ")\t"
+			<< this->songs[matches[i]].path.filename().string() << "\n";
+	}
+
+	if (matches.size() > MAX_SEARCH_RESULTS)
+		ss << "(" << matches.size() - MAX_SEARCH_RESULTS << " more)\n";
+
+	return ss.str();
+}
@@ -0,0 +1,291 @@
+#ifndef SONGCATALOG_H
+#define SONGCATALOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ChunkedDataSender.h"
+#include "Mp3Frame.h"
+#include "ServerStats.h"
+#include "SongIndex.h"
+
+// Bitrates (in kbps) of the lower quality copies of songs we can send to
+// clients that can't keep up with the original, lowest first.
+const int TIER_KBPS[] = { 64, 128 };
+
+// Most songs a "search" lists. Anything past that is just counted.
+const size_t MAX_SEARCH_RESULTS = 100;
+
+/**
+ * Gets the path of a song's lower quality copy, which sits next to the song
+ * (e.g. song.64k.mp3 for song.mp3).
+ *
+ * @param song_file The song's MP3 file.
+ * @param kbps The copy's bitrate, in kbps.
+ */
+std::filesystem::path tier_path(const std::filesystem::path &song_file,
+								int kbps);
+
+/**
+ * Checks whether an MP3 file is the lower quality copy of a song (i.e. its
+ * name is like song.64k.mp3), rather than a song in its own right.
+ */
+bool is_tier_file(const std::filesystem::path &mp3_file);
+
+/**
+ * What a file looked like when we read it, so that a later scan can tell
+ * whether it has changed since.
+ */
+struct FileStamp {
+	uint64_t size = 0; // bytes (0 if the file doesn't exist)
+	int64_t mtime = 0; // last change, in nanoseconds since the epoch
+
+	bool operator==(const FileStamp &other) const {
+		return size == other.size && mtime == other.mtime;
+	}
+};
+
+/**
+ * Gets the stamp of a file as it is now (all zeros if it doesn't exist).
+ */
+FileStamp stamp_file(const std::filesystem::path &file);
+
+/**
+ * Everything we know about one song in the catalog.
+ */
+struct SongEntry {
+	std::filesystem::path path; // the MP3 file
+	SharedBuffer info;          // response to an "info" command for the song
+	int bitrate;                // in bits per second (0 if unknown)
+
+	// Where the song's frames start, for playing from the middle of it. This
+	// is only built the first time someone seeks in the song.
+	std::shared_ptr<LazyFrameIndex> frame_index;
+
+	// How often the song has been played, and how much of it was sent.
+	std::shared_ptr<SongStats> stats;
+
+	// Lower quality copies of the song that have been made so far (see
+	// jukebox-transcode), lowest bitrate first. They share the song's info
+	// and stats, and have no tiers of their own.
+	std::vector<SongEntry> tiers;
+
+	// The song's file and its info file when they were read, so a rescan
+	// only reads them again if they have changed.
+	FileStamp stamp;
+	FileStamp info_stamp;
+
+	/**
+	 * Picks the best copy of the song (this one or one of its tiers) that
+	 * doesn't go over the given bitrate. If none of them fit, we pick the
+	 * lowest bitrate one we have.
+	 *
+	 * @param max_bitrate Most bits per second to send.
+	 */
+	const SongEntry &pick_tier(int max_bitrate) const {
+		if (bitrate <= max_bitrate || tiers.empty())
+			return *this;
+
+		const SongEntry *best = &tiers[0];
+		for (const SongEntry &tier : tiers) {
+			if (tier.bitrate <= max_bitrate)
+				best = &tier;
+		}
+		return *best;
+	}
+
+	/**
+	 * Finds where to start playing the song so that the given byte is played,
+	 * without starting in the middle of a frame.
+	 *
+	 * @param offset Byte offset in the file (0 for the very start).
+	 * @return The offset to start sending from.
+	 */
+	size_t seek_to_byte(size_t offset) const {
+		if (offset == 0)
+			return 0; // keep any tags at the start of the file
+		return frame_index->get(path).frame_at_byte(offset);
+	}
+
+	/**
+	 * Finds where to start playing the song to skip the given amount of
+	 * playing time.
+	 *
+	 * @param seconds Time since the start of the song.
+	 * @return The offset to start sending from.
+	 */
+	size_t seek_to_time(double seconds) const {
+		if (seconds <= 0)
+			return 0;
+		return frame_index->get(path).frame_at_time(seconds);
+	}
+};
+
+/**
+ * Class that holds the songs in the music directory, along with the
+ * responses to "list" and "info" commands about them and an index of their
+ * metadata for "search" commands.
+ *
+ * A catalog is built once (by scan) and never changes afterwards, so any
+ * number of event loops can use it at the same time without locking. The
+ * responses are SharedBuffers, so a client can keep sending one even if the
+ * catalog is replaced in the meantime.
+ */
+class SongCatalog {
+  private:
+	std::filesystem::path dir;    // the music directory
+	std::vector<SongEntry> songs; // in the order they are listed
+	SharedBuffer list_text;       // response to a "list" command
+	SongIndex index;              // metadata of the songs
+
+	SongCatalog() {}
+
+	/**
+	 * Fills in list_text from the songs.
+	 */
+	void render_list();
+
+  public:
+	/**
+	 * Builds a catalog of the MP3 files in the given directory. Songs are
+	 * numbered in order of their file names. Reading each song's info and
+	 * working out its bitrate is split between several threads, since with
+	 * a big library that is most of the work.
+	 *
+	 * If there is a previous catalog of the same directory, songs (and lower
+	 * quality copies) that haven't changed since are taken from it rather
+	 * than read again, so the only work for them is a stat of each file.
+	 *
+	 * @param dir The directory to look in.
+	 * @param previous An earlier catalog of the directory (or NULL).
+	 * @return The new catalog.
+	 */
+	static std::shared_ptr<const SongCatalog> scan(const std::filesystem::path &dir,
+													const SongCatalog *previous = NULL);
+
+	/**
+	 * Loads a catalog from a snapshot made by save_snapshot. The file is
+	 * memory mapped and copied out in one pass, without touching the songs
+	 * themselves, so the catalog may be out of date: rescan it (passing it
+	 * as the previous catalog) to catch up.
+	 *
+	 * @param snapshot_file The snapshot.
+	 * @param dir The music directory the snapshot should be of.
+	 * @return The catalog, or NULL if there is no usable snapshot of dir.
+	 */
+	static std::shared_ptr<const SongCatalog> load_snapshot(
+								const std::filesystem::path &snapshot_file,
+								const std::filesystem::path &dir);
+
+	/**
+	 * Saves the catalog (including any frame indices built so far) to a
+	 * snapshot for load_snapshot. The file is replaced in one go, so a
+	 * reader never sees half of it.
+	 *
+	 * @param snapshot_file Where to save the snapshot.
+	 * @return true if it was saved.
+	 */
+	bool save_snapshot(const std::filesystem::path &snapshot_file) const;
+
+	/**
+	 * Gets the number of songs in the catalog.
+	 */
+	size_t size() const {
+		return songs.size();
+	}
+
+	/**
+	 * Gets the song with the given number.
+	 *
+	 * @return The song, or NULL if there is no song with that number.
+	 */
+	const SongEntry *song(size_t song_num) const {
+		return (song_num < songs.size()) ? &songs[song_num] : NULL;
+	}
+
+	/**
+	 * Gets the response to a "list" command.
+	 */
+	const SharedBuffer &list() const {
+		return list_text;
+	}
+
+	/**
+	 * Builds the response to a "list" command for part of the catalog, in the
+	 * same format as the full list.
+	 *
+	 * @param offset Number of the first song to list.
+	 * @param count Most songs to list.
+	 */
+	std::string list_page(size_t offset, size_t count) const;
+
+	/**
+	 * Finds the songs whose metadata matches every term in a query.
+	 *
+	 * @param query The search terms.
+	 * @return The matching song numbers, lowest first.
+	 */
+	std::vector<uint32_t> search(const std::string &query) const {
+		return index.search(query);
+	}
+
+	/**
+	 * Builds the response to a "search" command: the matching songs (up to
+	 * MAX_SEARCH_RESULTS of them), in the same format as the list.
+	 *
+	 * @param query The search terms.
+	 */
+	std::string search_results(const std::string &query) const;
+};
+
+/**
+ * Class that holds the catalog currently being served, which can be replaced
+ * (e.g. after a rescan) while the event loops are running.
+ *
+ * Event loops should check version() each time around and only call get()
+ * when it has changed, so that the common case is a single atomic load.
+ */
+class CurrentCatalog {
+  private:
+	std::shared_ptr<const SongCatalog> catalog; // only used atomically
+	std::atomic<uint64_t> current_version;
+
+  public:
+	/**
+	 * Constructor for CurrentCatalog class.
+	 *
+	 * @param initial The catalog to start with.
+	 */
+	CurrentCatalog(std::shared_ptr<const SongCatalog> initial) :
+		catalog(initial), current_version(0) {}
+
+	/**
+	 * Gets the current catalog.
+	 */
+	std::shared_ptr<const SongCatalog> get() const {
+		return std::atomic_load(&catalog);
+	}
+
+	/**
+	 * Gets a number that changes every time the catalog is replaced.
+	 */
+	uint64_t version() const {
+		return current_version.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Replaces the current catalog. Anyone still using the old one can keep
+	 * doing so until they next call get().
+	 */
+	void replace(std::shared_ptr<const SongCatalog> new_catalog) {
+		std::atomic_store(&catalog, new_catalog);
+		current_version.fetch_add(1, std::memory_order_release);
+	}
+};
+
+#endif // SONGCATALOG_H
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+
+#include "SongIndex.h"
+
+using std::string;
+using std::vector;
+
+vector<string> split_terms(const string &text) {
+	vector<string> terms;
+	string term;
+
+	for (char c : text) {
+		if (std::isalnum((unsigned char)c)) {
+			term += std::tolower((unsigned char)c);
+		}
+		else if (!term.empty()) {
+			terms.push_back(term);
+			term.clear();
+		}
+	}
+	if (!term.empty())
+		terms.push_back(term);
+
+	return terms;
+}
+
+SongIndex::SongIndex(vector<std::pair<string, uint32_t>> &entries) {
+	// Sorting groups each term's songs together, in order.
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+	for (std::pair<string, uint32_t> &entry : entries) {
+		if (this->terms.empty() || this->terms.back() != entry.first) {
+			this->terms.push_back(std::move(entry.first));
+			this->postings.emplace_back();
+		}
+		this->postings.back().push_back(entry.second);
+	}
+
+	entries.clear();
+	entries.shrink_to_fit();
+}
+
+vector<uint32_t> SongIndex::prefix_matches(const string &prefix) const {
+	auto first = std::lower_bound(this->terms.begin(), this->terms.end(), prefix);
+	auto last = first;
+	while (last != this->terms.end()
+			&& last->compare(0, prefix.length(), prefix) == 0)
+		last++;
+
+	// The usual case: the term is a whole word that nothing else starts with.
+	if (last - first == 1)
+		return this->postings[first - this->terms.begin()];
+
+	// A short prefix can match thousands of terms, so gather their songs and
+	// sort them once rather than merging them one term at a time.
+	vector<uint32_t> songs;
+	for (auto it = first; it != last; it++) {
+		const vector<uint32_t> &more = this->postings[it - this->terms.begin()];
+		songs.insert(songs.end(), more.begin(), more.end());
+	}
+
+	std::sort(songs.begin(), songs.end());
+	songs.erase(std::unique(songs.begin(), songs.end()), songs.end());
+	return songs;
+}
+
+vector<uint32_t> SongIndex::search(const string &query) const {
+	vector<string> query_terms = split_terms(query);
+	if (query_terms.empty())
+		return {};
+
+	// Longer terms tend to match fewer songs, so start with those to keep
+	// the intersections small.
+	std::sort(query_terms.begin(), query_terms.end(),
+				[](const string &a, const string &b) {
+					return a.length() > b.length();
+				});
+
+	vector<uint32_t> songs = this->prefix_matches(query_terms[0]);
+	for (size_t i = 1; i < query_terms.size() && !songs.empty(); i++) {
+		vector<uint32_t> more = this->prefix_matches(query_terms[i]);
+		vector<uint32_t> both;
+		std::set_intersection(songs.begin(), songs.end(), more.begin(),
+								more.end(), std::back_inserter(both));
+		songs.swap(both);
+	}
+
+	return songs;
+}
@@ -0,0 +1,87 @@
+#ifndef SONGINDEX_H
+#define SONGINDEX_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Splits text into search terms: runs of letters and digits, in lower case.
+ */
+std::vector<std::string> split_terms(const std::string &text);
+
+/**
+ * Class that holds an inverted index of song metadata: for every term, the
+ * numbers of the songs whose title, artist, album (or file name) contain it.
+ *
+ * Terms are kept sorted, so a search term also matches every term it is the
+ * start of (e.g. "beat" finds "beatles"). Like the catalog it belongs to, an
+ * index never changes once it is built, so any number of threads can search
+ * it at once.
+ */
+class SongIndex {
+  private:
+	std::vector<std::string> terms;             // sorted, no duplicates
+	std::vector<std::vector<uint32_t>> postings; // songs for each term, sorted
+
+	/**
+	 * Gets every song with a term that starts with prefix, in order.
+	 */
+	std::vector<uint32_t> prefix_matches(const std::string &prefix) const;
+
+  public:
+	SongIndex() {}
+
+	/**
+	 * Builds an index from (term, song number) pairs, which can be in any
+	 * order and contain duplicates.
+	 *
+	 * @param entries The pairs (emptied by building the index).
+	 */
+	SongIndex(std::vector<std::pair<std::string, uint32_t>> &entries);
+
+	/**
+	 * Constructor for an index that was built earlier (e.g. loaded from a
+	 * catalog snapshot).
+	 *
+	 * @param terms Every term, sorted.
+	 * @param postings The songs for each term, sorted.
+	 */
+	SongIndex(std::vector<std::string> terms,
+				std::vector<std::vector<uint32_t>> postings) :
+		terms(std::move(terms)), postings(std::move(postings)) {}
+
+	/**
+	 * Finds the songs that match every term in a query.
+	 *
+	 * @param query The search terms, as typed by the user.
+	 * @return The numbers of the matching songs, lowest first (none if the
+	 * 	query has no terms).
+	 */
+	std::vector<uint32_t> search(const std::string &query) const;
+
+	/**
+	 * Gets the number of distinct terms in the index.
+	 */
+	size_t num_terms() const {
+		return terms.size();
+	}
+
+	/**
+	 * Gets a term in the index, by its position in sorted order.
+	 */
+	const std::string &term(size_t i) const {
+		return terms[i];
+	}
+
+	/**
+	 * Gets the songs that contain a term, by the term's position in sorted
+	 * order.
+	 */
+	const std::vector<uint32_t> &songs_with(size_t i) const {
+		return postings[i];
+	}
+};
+
+#endif // SONGINDEX_H
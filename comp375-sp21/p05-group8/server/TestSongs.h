@@ -0,0 +1,36 @@
+#ifndef TESTSONGS_H
+#define TESTSONGS_H
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// Fake songs written by the tests (test-alloc and test-protocol).
+const int NUM_FRAMES = 400; // about 10 seconds of audio
+const size_t FRAME_LENGTH = 417;
+
+/**
+ * Writes a fake song (constant bitrate MP3 frames of silence) with an info
+ * file to the given directory.
+ *
+ * @param dir Directory to write the song to.
+ * @param name Name of the song (without ".mp3"), also used as its title.
+ * @return Path to the song.
+ */
+inline std::filesystem::path make_song(const std::filesystem::path &dir,
+										const std::string &name) {
+	std::filesystem::path song_file = dir / (name + ".mp3");
+
+	// MPEG-1 layer III, 128 kbps, 44.1 kHz, no padding: 417 bytes per frame.
+	char frame[FRAME_LENGTH] = { (char)0xff, (char)0xfb, (char)0x90, 0x00 };
+	std::ofstream song(song_file, std::ofstream::binary);
+	for (int i = 0; i < NUM_FRAMES; i++)
+		song.write(frame, sizeof(frame));
+
+	std::ofstream info(dir / (name + ".mp3.info"));
+	info << "Title: " << name << "\n";
+
+	return song_file;
+}
+
+#endif // TESTSONGS_H
@@ -0,0 +1,70 @@
+#include <algorithm>
+
+#include "TimerWheel.h"
+
+using std::vector;
+using std::pair;
+
+
+TimerWheel::TimerWheel(std::chrono::milliseconds tick_length, size_t num_slots) :
+	tick_length(tick_length), start(std::chrono::steady_clock::now()),
+	current_tick(0), slots(num_slots), num_timers(0) {}
+
+void TimerWheel::schedule(int fd, uint32_t generation, time_point when) {
+	// Round up, so the timer can't go off before when. Anything already due
+	// goes in the next tick we handle.
+	uint64_t tick = this->current_tick;
+	if (when > this->start) {
+		auto since = when - this->start;
+		uint64_t ticks = (since + this->tick_length - decltype(since)(1))
+							/ this->tick_length;
+		tick = std::max(tick, ticks);
+	}
+
+	this->slots[tick % this->slots.size()].push_back(Timer{tick, fd, generation});
+	this->num_timers++;
+}
+
+int TimerWheel::ms_until_next() const {
+	if (this->num_timers == 0)
+		return -1;
+
+	time_point next = this->start + this->current_tick * this->tick_length;
+	auto wait = next - std::chrono::steady_clock::now();
+	if (wait <= wait.zero())
+		return 0;
+
+	return std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+}
+
+void TimerWheel::pop_due(time_point now, vector<pair<int, uint32_t>> &due) {
+	due.clear();
+	if (now < this->start)
+		return;
+
+	// Every tick that has started by now is due.
+	uint64_t now_tick = (now - this->start) / this->tick_length;
+	if (now_tick < this->current_tick)
+		return;
+
+	// If we fell more than a whole turn behind, one turn still visits every
+	// slot.
+	uint64_t last_tick = std::min(now_tick,
+									this->current_tick + this->slots.size() - 1);
+	for (uint64_t tick = this->current_tick; tick <= last_tick; tick++) {
+		vector<Timer> &slot = this->slots[tick % this->slots.size()];
+
+		// Take out the due timers, keeping the ones for later turns.
+		size_t kept = 0;
+		for (Timer &timer : slot) {
+			if (timer.tick <= now_tick)
+				due.emplace_back(timer.fd, timer.generation);
+			else
+				slot[kept++] = timer;
+		}
+		slot.resize(kept);
+	}
+
+	this->num_timers -= due.size();
+	this->current_tick = now_tick + 1;
+}
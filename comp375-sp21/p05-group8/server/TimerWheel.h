@@ -0,0 +1,78 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Class that keeps track of client timeouts (e.g. idle clients) in a hashed
+ * timing wheel.
+ *
+ * Time is cut into ticks, and a timer goes in the slot for its tick (modulo
+ * the number of slots), so adding a timer and finding the ones that are due
+ * take constant time no matter how many clients there are. Timers further
+ * off than one turn of the wheel just stay in their slot until the wheel
+ * comes around to their tick. Timers never go off early, but can go off up
+ * to a tick late.
+ *
+ * Like PacingScheduler, timers are (fd, ClientSlab generation) pairs, and the
+ * event loop uses ms_until_next as its epoll_wait timeout, then calls pop_due
+ * to find the clients whose time is up.
+ */
+class TimerWheel {
+  public:
+	typedef std::chrono::steady_clock::time_point time_point;
+
+	/**
+	 * Constructor for TimerWheel class.
+	 *
+	 * @param tick_length How much time each slot covers.
+	 * @param num_slots Number of slots in the wheel.
+	 */
+	TimerWheel(std::chrono::milliseconds tick_length, size_t num_slots);
+
+	/**
+	 * Remembers that the client on fd (with the given ClientSlab generation)
+	 * should be checked on at when.
+	 */
+	void schedule(int fd, uint32_t generation, time_point when);
+
+	/**
+	 * Gets the number of milliseconds until the next tick is due (rounded
+	 * up), or -1 if there are no timers. While there are timers, we wake up
+	 * once a tick rather than looking through the slots for the next one.
+	 */
+	int ms_until_next() const;
+
+	/**
+	 * Removes every timer (as an fd and generation) that is due and puts
+	 * them in due. The caller can reuse due from one call to the next, so
+	 * this doesn't need to allocate once the loop has warmed up.
+	 */
+	void pop_due(time_point now, std::vector<std::pair<int, uint32_t>> &due);
+
+	/**
+	 * Gets the number of timers in the wheel.
+	 */
+	size_t size() const {
+		return num_timers;
+	}
+
+  private:
+	struct Timer {
+		uint64_t tick;
+		int fd;
+		uint32_t generation;
+	};
+
+	std::chrono::milliseconds tick_length;
+	time_point start;      // when tick 0 started
+	uint64_t current_tick; // first tick we haven't handled yet
+	std::vector<std::vector<Timer>> slots;
+	size_t num_timers;
+};
+
+#endif // TIMERWHEEL_H
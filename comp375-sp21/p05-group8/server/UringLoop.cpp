@@ -0,0 +1,749 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "IoUring.h"
+#include "UringLoop.h"
+#include "ChunkedDataSender.h"
+#include "ConnectedClient.h"
+#include "SongCache.h"
+#include "SongCatalog.h"
+#include "ServerStats.h"
+#include "Log.h"
+
+namespace fs = std::filesystem;
+
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+// Paced songs wait until at least this much can be sent, so a slow stream
+// doesn't turn into a stream of tiny sends.
+const size_t URING_MIN_PACED_SEND = 16 * 1024;
+
+/**
+ * The kinds of requests we make, which go in the bottom byte of each
+ * request's user_data.
+ */
+enum UringOp : uint8_t {
+	OP_ACCEPT,
+	OP_RECV,
+	OP_READ,
+	OP_SEND,
+	OP_TIMER,
+	OP_CANCEL,
+};
+
+/**
+ * Packs a client (fd and generation) and the kind of request into the
+ * user_data that comes back with the request's completion.
+ */
+static uint64_t make_user_data(int fd, uint32_t generation, UringOp op) {
+	return ((uint64_t)(uint32_t)fd << 32)
+		| ((uint64_t)(generation & 0xffffff) << 8) | op;
+}
+
+/**
+ * Something we are sending to a client.
+ */
+struct UringResponse {
+	bool active = false;  // false if there is no response
+	bool stopped = false; // true to end it without shutting down
+	SharedBuffer data;    // text or a cached song (NULL to read from path)
+	fs::path path;        // the song, if data is NULL
+	size_t position = 0;  // next byte to send
+	size_t end = 0;       // where to stop
+
+	// Pacing: how many bytes we can send after start_time.
+	double bytes_per_sec = 0; // 0 if not paced
+	double burst_bytes = 0;
+	size_t paced_from = 0;
+	time_point start_time;
+
+	std::shared_ptr<SongStats> song_stats;
+};
+
+/**
+ * A client of the io_uring event loop.
+ */
+struct UringClient {
+	int fd = -1;             // -1 once the slot is free
+	uint32_t generation = 0; // bumped each time the slot gets a new client
+	int pending = 0;         // requests still in flight
+	bool closing = false;    // true once we have started closing it
+	bool got_input = false;  // true once it has sent us anything
+	bool line_mode = false;  // true once it has ended a command with a newline
+	bool running_commands = false; // true while run_pending is going
+	bool sending = false;    // true while a chunk (or pacing wait) is in flight
+	bool waiting = false;    // true while a pacing wait is in flight
+	int file_slot = -1;      // registered file slot of the song, -1 if none
+	int buffer = -1;         // registered buffer of the chunk in flight
+	UringResponse current;   // what we are sending
+	UringResponse next;      // what to send once the chunk in flight is done
+	char input[INPUT_BUFFER_SIZE];
+	size_t input_len = 0;    // bytes of input we haven't run as commands yet
+	struct __kernel_timespec timeout; // for pacing waits
+};
+
+/**
+ * Class that holds the state of one io_uring event loop (see
+ * uring_event_loop).
+ */
+class UringServer {
+  private:
+	IoUring ring;
+	int server_socket;
+	CurrentCatalog *current_catalog;
+	std::shared_ptr<const SongCatalog> catalog;
+	SongCache *song_cache;
+	double pace_factor;
+	double burst_seconds;
+
+	vector<std::unique_ptr<UringClient>> clients; // indexed by fd
+
+	// registered buffers (one per chunk in flight) and file slots (one per
+	// song being read)
+	vector<char> buffer_memory;
+	vector<int> free_buffers;
+	std::deque<std::pair<int, uint32_t>> buffer_waiters;
+	vector<int> free_file_slots;
+
+  public:
+	UringServer(int server_socket, CurrentCatalog *current_catalog,
+				SongCache *song_cache, double pace_factor,
+				double burst_seconds);
+
+	void run();
+
+  private:
+	char *buffer_data(int buffer) {
+		return &buffer_memory[(size_t)buffer * URING_CHUNK_SIZE];
+	}
+
+	UringClient *find(int fd, uint32_t generation);
+	void handle_completion(uint64_t user_data, int res);
+	void accept_next();
+	void recv_next(UringClient *client);
+	void add_client(int fd);
+	void run_commands(UringClient *client, size_t len);
+	bool has_command(const UringClient *client) const;
+	bool must_wait(const UringClient *client) const;
+	void run_pending(UringClient *client);
+	void run_command(UringClient *client, const char *command);
+	void respond(UringClient *client, UringResponse response);
+	void respond_text(UringClient *client, const string &text);
+	void continue_client(UringClient *client);
+	bool open_song(UringClient *client);
+	void close_song(UringClient *client);
+	bool take_buffer(UringClient *client);
+	void release_buffer(UringClient *client);
+	void end_current(UringClient *client);
+	void begin_close(UringClient *client);
+	void finish_close(UringClient *client);
+};
+
+UringServer::UringServer(int server_socket, CurrentCatalog *current_catalog,
+							SongCache *song_cache, double pace_factor,
+							double burst_seconds) :
+	ring(URING_QUEUE_SIZE), server_socket(server_socket),
+	current_catalog(current_catalog), catalog(current_catalog->get()),
+	song_cache(song_cache), pace_factor(pace_factor),
+	burst_seconds(burst_seconds),
+	buffer_memory((size_t)URING_BUFFERS * URING_CHUNK_SIZE) {
+	vector<struct iovec> buffers(URING_BUFFERS);
+	for (unsigned i = 0; i < URING_BUFFERS; i++) {
+		buffers[i].iov_base = this->buffer_data(i);
+		buffers[i].iov_len = URING_CHUNK_SIZE;
+		this->free_buffers.push_back(i);
+	}
+
+	this->ring.register_buffers(buffers.data(), URING_BUFFERS);
+	this->ring.register_file_slots(URING_FILE_SLOTS);
+	for (unsigned i = 0; i < URING_FILE_SLOTS; i++)
+		this->free_file_slots.push_back(i);
+
+	// The ring waits for new connections for us, so accept should block
+	// (i.e. wait) rather than fail when there aren't any yet.
+	int flags = fcntl(server_socket, F_GETFL);
+	if (flags < 0 || fcntl(server_socket, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+		perror("fcntl");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void UringServer::run() {
+	uint64_t catalog_version = this->current_catalog->version();
+	this->accept_next();
+
+	while (true) {
+		// Send off everything we queued last time around, and wait for at
+		// least one thing to finish, all in one system call.
+		this->ring.submit(1);
+		auto loop_start = std::chrono::steady_clock::now();
+
+		if (this->current_catalog->version() != catalog_version) {
+			catalog_version = this->current_catalog->version();
+			this->catalog = this->current_catalog->get();
+		}
+
+		struct io_uring_cqe *cqe;
+		while ((cqe = this->ring.peek_cqe()) != NULL) {
+			uint64_t user_data = cqe->user_data;
+			int res = cqe->res;
+			this->ring.cqe_seen();
+
+			this->handle_completion(user_data, res);
+		}
+
+		std::chrono::nanoseconds loop_time =
+			std::chrono::steady_clock::now() - loop_start;
+		ShardStats::local().record_loop(loop_time.count());
+	}
+}
+
+UringClient *UringServer::find(int fd, uint32_t generation) {
+	if (fd < 0 || (size_t)fd >= this->clients.size() || this->clients[fd] == NULL)
+		return NULL;
+
+	UringClient *client = this->clients[fd].get();
+	if (client->fd != fd || (client->generation & 0xffffff) != generation)
+		return NULL;
+
+	return client;
+}
+
+void UringServer::handle_completion(uint64_t user_data, int res) {
+	UringOp op = (UringOp)(user_data & 0xff);
+	if (op == OP_ACCEPT) {
+		if (res >= 0)
+			this->add_client(res);
+		else
+			LOG(LogLevel::WARN, "accept: " << strerror(-res));
+
+		this->accept_next();
+		return;
+	}
+
+	UringClient *client = this->find(user_data >> 32,
+										(user_data >> 8) & 0xffffff);
+	if (client == NULL) {
+		LOG(LogLevel::ERROR, "Completion for a client we don't have");
+		return;
+	}
+
+	client->pending--;
+
+	if (op == OP_RECV) {
+		if (client->closing)
+			; // just waiting for everything to finish
+		else if (res <= 0)
+			this->begin_close(client); // hung up
+		else
+			this->run_commands(client, res);
+	}
+	else if (op == OP_READ) {
+		// A short read (e.g. the file shrank) cancels the linked send, which
+		// is where we give up on the client.
+		if (res < 0)
+			LOG(LogLevel::WARN, "Reading song for client (" << client->fd
+				<< "): " << strerror(-res));
+	}
+	else if (op == OP_SEND) {
+		client->sending = false;
+		this->release_buffer(client);
+		if (res < 0) {
+			LOG(LogLevel::DEBUG, "Sending to client (" << client->fd << "): "
+				<< strerror(-res));
+			this->begin_close(client);
+		}
+		else {
+			UringResponse &response = client->current;
+			response.position += res;
+
+			ShardStats &stats = ShardStats::local();
+			ShardStats::add(stats.bytes_sent, res);
+			ShardStats::add(stats.chunks_sent, 1);
+			if (response.song_stats != NULL)
+				response.song_stats->bytes_sent.fetch_add(res,
+												std::memory_order_relaxed);
+		}
+	}
+	else if (op == OP_TIMER) {
+		client->sending = false;
+		client->waiting = false;
+	}
+
+	if (client->closing)
+		this->finish_close(client);
+	else
+		this->continue_client(client);
+}
+
+void UringServer::accept_next() {
+	struct io_uring_sqe *sqe = this->ring.get_sqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = this->server_socket;
+	sqe->user_data = make_user_data(-1, 0, OP_ACCEPT);
+}
+
+void UringServer::recv_next(UringClient *client) {
+	// Commands waiting their turn stay at the front of the buffer, so new
+	// input goes after them.
+	size_t space = INPUT_BUFFER_SIZE - client->input_len;
+	if (space == 0) {
+		LOG(LogLevel::WARN, "Client (" << client->fd
+			<< ") sent more input than we can hold");
+		this->begin_close(client);
+		return;
+	}
+
+	struct io_uring_sqe *sqe = this->ring.get_sqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = client->fd;
+	sqe->addr = (uint64_t)(uintptr_t)(client->input + client->input_len);
+	sqe->len = space;
+	sqe->user_data = make_user_data(client->fd, client->generation, OP_RECV);
+	client->pending++;
+}
+
+void UringServer::add_client(int fd) {
+	LOG(LogLevel::DEBUG, "Accepted a new connection!");
+
+	if ((size_t)fd >= this->clients.size())
+		this->clients.resize(fd + 1);
+
+	std::unique_ptr<UringClient> &slot = this->clients[fd];
+	uint32_t generation = 0;
+	if (slot == NULL)
+		slot.reset(new UringClient());
+	else
+		generation = slot->generation + 1;
+
+	*slot = UringClient();
+	slot->fd = fd;
+	slot->generation = generation;
+	ShardStats::add(ShardStats::local().clients, 1);
+
+	this->recv_next(slot.get());
+}
+
+void UringServer::run_commands(UringClient *client, size_t len) {
+	char *data = client->input + client->input_len;
+
+	if (!client->got_input && (uint8_t)data[0] == PROTOCOL_MAGIC) {
+		LOG(LogLevel::WARN, "Client (" << client->fd << ") wants the binary"
+			<< " protocol, which the io_uring loop doesn't speak");
+		this->begin_close(client);
+		return;
+	}
+	client->got_input = true;
+
+	if (memchr(data, '\n', len) != NULL)
+		client->line_mode = true;
+	client->input_len += len;
+
+	this->run_pending(client);
+
+	if (!client->closing)
+		this->recv_next(client);
+}
+
+bool UringServer::has_command(const UringClient *client) const {
+	if (client->input_len == 0)
+		return false;
+
+	// Like the epoll loop: the original client doesn't send newlines, so
+	// until we see one, what we have is taken to be a whole command.
+	return !client->line_mode
+		|| memchr(client->input, '\n', client->input_len) != NULL;
+}
+
+bool UringServer::must_wait(const UringClient *client) const {
+	// The next command waits for a text response to go out in full, but
+	// interrupts a song (which is how "stop" gets through).
+	const UringResponse &latest = client->next.active ? client->next
+														: client->current;
+	return latest.active && !latest.stopped && latest.song_stats == NULL;
+}
+
+void UringServer::run_pending(UringClient *client) {
+	// Finishing a response runs the next command, which may finish
+	// straight away too, so don't start again from inside ourselves.
+	if (client->running_commands)
+		return;
+	client->running_commands = true;
+
+	while (!client->closing && this->has_command(client)
+			&& !this->must_wait(client)) {
+		// Take the command out of the buffer before running it.
+		char *newline = (char*)memchr(client->input, '\n', client->input_len);
+		size_t len = (newline != NULL) ? newline - client->input
+										: client->input_len;
+		char command[INPUT_BUFFER_SIZE + 1];
+		for (size_t i = 0; i < len; i++)
+			command[i] = std::tolower(client->input[i]);
+		command[len] = '\0';
+
+		size_t used = (newline != NULL) ? len + 1 : len;
+		client->input_len -= used;
+		memmove(client->input, client->input + used, client->input_len);
+
+		if (command[0] == '\0')
+			continue;
+
+		LOG(LogLevel::DEBUG, "Received data: " << command << " from client ("
+			<< client->fd << ")");
+		this->run_command(client, command);
+	}
+
+	client->running_commands = false;
+}
+
+void UringServer::run_command(UringClient *client, const char *command) {
+	std::stringstream ss(command);
+	string input;
+	ss >> input;
+
+	if (input == "list") {
+		size_t offset, count;
+		if (ss >> offset >> count) {
+			this->respond_text(client, this->catalog->list_page(offset, count));
+		}
+		else {
+			UringResponse response;
+			response.data = this->catalog->list();
+			this->respond(client, response);
+		}
+	}
+	else if (input == "search") {
+		string query;
+		std::getline(ss, query);
+		this->respond_text(client, this->catalog->search_results(query));
+	}
+	else if (input == "info" || input == "play") {
+		string song_number;
+		ss >> song_number;
+		char *end;
+		size_t song_num = strtoul(song_number.c_str(), &end, 10);
+		const SongEntry *song = NULL;
+		if (!song_number.empty() && *end == '\0')
+			song = this->catalog->song(song_num);
+
+		// An optional offset, in bytes or (ending in "s") seconds.
+		string offset;
+		size_t start = 0;
+		if (song != NULL && input == "play" && ss >> offset) {
+			double amount = strtod(offset.c_str(), &end);
+			bool in_seconds = (*end == 's');
+			if (in_seconds)
+				end++;
+
+			if (*end != '\0' || !(amount >= 0))
+				song = NULL;
+			else
+				start = in_seconds ? song->seek_to_time(amount)
+									: song->seek_to_byte(amount);
+		}
+
+		if (song == NULL) {
+			LOG(LogLevel::DEBUG, "User tried to access song out of range.");
+			this->respond_text(client, "n");
+			return;
+		}
+
+		UringResponse response;
+		if (input == "info") {
+			response.data = song->info;
+			this->respond(client, response);
+			return;
+		}
+
+		// Songs in the cache are sent straight from memory, the rest are
+		// read from their file a chunk at a time.
+		if (this->song_cache != NULL)
+			response.data = this->song_cache->get(song->path);
+
+		std::error_code error;
+		size_t size = (response.data != NULL) ? response.data->size()
+						: fs::file_size(song->path, error);
+		if (error) {
+			this->respond_text(client, "n");
+			return;
+		}
+
+		response.path = song->path;
+		response.position = std::min(start, size);
+		response.end = size;
+		response.song_stats = song->stats;
+		if (this->pace_factor > 0 && song->bitrate > 0) {
+			double bytes_per_sec = song->bitrate / 8.0;
+			response.bytes_per_sec = bytes_per_sec * this->pace_factor;
+			response.burst_bytes = bytes_per_sec * this->burst_seconds;
+			response.paced_from = response.position;
+			response.start_time = std::chrono::steady_clock::now();
+		}
+
+		song->stats->plays.fetch_add(1, std::memory_order_relaxed);
+		this->respond(client, response);
+	}
+	else if (input == "stop") {
+		client->next = UringResponse();
+		client->current.stopped = true;
+		this->continue_client(client);
+	}
+	else if (input == "stats") {
+		this->respond_text(client, render_stats(*this->catalog));
+	}
+	else if (input == "close") {
+		this->begin_close(client);
+	}
+	else {
+		LOG(LogLevel::DEBUG, "Invalid command (" << input << ")");
+	}
+}
+
+void UringServer::respond(UringClient *client, UringResponse response) {
+	// A new response replaces the old one as soon as the chunk in flight
+	// (if any) is done with.
+	response.active = true;
+	if (response.data != NULL && response.path.empty())
+		response.end = response.data->size();
+
+	client->next = std::move(response);
+	this->continue_client(client);
+}
+
+void UringServer::respond_text(UringClient *client, const string &text) {
+	UringResponse response;
+	response.data = std::make_shared<const vector<char>>(text.begin(),
+															text.end());
+	this->respond(client, response);
+}
+
+void UringServer::continue_client(UringClient *client) {
+	if (client->closing || client->sending)
+		return;
+
+	if (client->next.active) {
+		this->end_current(client);
+		client->current = std::move(client->next);
+		client->next = UringResponse();
+		ShardStats::add(ShardStats::local().sending, 1);
+	}
+
+	UringResponse &response = client->current;
+	if (!response.active)
+		return;
+
+	if (response.stopped) {
+		this->end_current(client);
+		this->run_pending(client);
+		return;
+	}
+
+	if (response.position >= response.end) {
+		// Done, so (just like the epoll loop) go on to the next command, or
+		// hang up if the client has no more (and isn't part way through
+		// sending one).
+		this->end_current(client);
+		if (client->input_len == 0)
+			shutdown(client->fd, SHUT_RDWR);
+		else
+			this->run_pending(client);
+		return;
+	}
+
+	size_t len = std::min((size_t)URING_CHUNK_SIZE,
+							response.end - response.position);
+	if (response.bytes_per_sec > 0) {
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - response.start_time;
+		double allowed = response.burst_bytes
+							+ response.bytes_per_sec * elapsed.count()
+							- (response.position - response.paced_from);
+		size_t wanted = std::min(len, URING_MIN_PACED_SEND);
+		if (allowed < wanted) {
+			// Wait until we can send a decent amount.
+			double wait = (wanted - allowed) / response.bytes_per_sec;
+			client->timeout.tv_sec = (long long)wait;
+			client->timeout.tv_nsec = (long long)((wait - (long long)wait) * 1e9);
+
+			struct io_uring_sqe *sqe = this->ring.get_sqe();
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->addr = (uint64_t)(uintptr_t)&client->timeout;
+			sqe->len = 1;
+			sqe->user_data = make_user_data(client->fd, client->generation,
+											OP_TIMER);
+			client->pending++;
+			client->sending = true;
+			client->waiting = true;
+			return;
+		}
+
+		len = std::min(len, (size_t)allowed);
+	}
+
+	const char *data;
+	if (response.data != NULL) {
+		data = response.data->data() + response.position;
+	}
+	else {
+		if (client->file_slot < 0 && !this->open_song(client))
+			return; // the song went away
+		if (!this->take_buffer(client))
+			return; // waiting for a buffer
+
+		// Read the chunk into a buffer, and once that's done (the link), send
+		// it. The buffer goes back when the send is done.
+		data = this->buffer_data(client->buffer);
+		struct io_uring_sqe *sqe = this->ring.get_sqe();
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+		sqe->fd = client->file_slot;
+		sqe->addr = (uint64_t)(uintptr_t)data;
+		sqe->len = len;
+		sqe->off = response.position;
+		sqe->buf_index = client->buffer;
+		sqe->user_data = make_user_data(client->fd, client->generation, OP_READ);
+		client->pending++;
+	}
+
+	struct io_uring_sqe *sqe = this->ring.get_sqe();
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = client->fd;
+	sqe->addr = (uint64_t)(uintptr_t)data;
+	sqe->len = len;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	sqe->user_data = make_user_data(client->fd, client->generation, OP_SEND);
+	client->pending++;
+	client->sending = true;
+}
+
+bool UringServer::open_song(UringClient *client) {
+	int file_fd = -1;
+	if (this->free_file_slots.empty())
+		LOG(LogLevel::WARN, "Too many songs being read at once");
+	else if ((file_fd = open(client->current.path.c_str(), O_RDONLY)) < 0)
+		LOG(LogLevel::WARN, "Opening " << client->current.path << ": "
+			<< strerror(errno));
+
+	if (file_fd < 0) {
+		this->end_current(client);
+		shutdown(client->fd, SHUT_RDWR);
+		return false;
+	}
+
+	client->file_slot = this->free_file_slots.back();
+	this->free_file_slots.pop_back();
+
+	// The slot holds on to the file, so we don't need our own fd for it.
+	this->ring.set_file_slot(client->file_slot, file_fd);
+	close(file_fd);
+	return true;
+}
+
+void UringServer::close_song(UringClient *client) {
+	if (client->file_slot < 0)
+		return;
+
+	this->ring.set_file_slot(client->file_slot, -1);
+	this->free_file_slots.push_back(client->file_slot);
+	client->file_slot = -1;
+}
+
+bool UringServer::take_buffer(UringClient *client) {
+	if (this->free_buffers.empty()) {
+		this->buffer_waiters.emplace_back(client->fd, client->generation);
+		return false;
+	}
+
+	client->buffer = this->free_buffers.back();
+	this->free_buffers.pop_back();
+	return true;
+}
+
+void UringServer::release_buffer(UringClient *client) {
+	if (client->buffer < 0)
+		return;
+
+	this->free_buffers.push_back(client->buffer);
+	client->buffer = -1;
+
+	// Give the buffer to the next client that still wants one.
+	while (!this->buffer_waiters.empty() && !this->free_buffers.empty()) {
+		auto waiter = this->buffer_waiters.front();
+		this->buffer_waiters.pop_front();
+
+		UringClient *next = this->find(waiter.first, waiter.second & 0xffffff);
+		if (next != NULL)
+			this->continue_client(next);
+	}
+}
+
+void UringServer::end_current(UringClient *client) {
+	if (!client->current.active)
+		return;
+
+	this->close_song(client);
+	client->current = UringResponse();
+	ShardStats::subtract(ShardStats::local().sending, 1);
+}
+
+void UringServer::begin_close(UringClient *client) {
+	if (client->closing)
+		return;
+
+	LOG(LogLevel::DEBUG, "Closing connection to client " << client->fd);
+
+	// Anything still in flight on the socket finishes (with an error) once
+	// it's shut down. We can only close it after that.
+	client->closing = true;
+	shutdown(client->fd, SHUT_RDWR);
+
+	// A pacing wait doesn't care about the socket, so cut it short.
+	if (client->waiting) {
+		struct io_uring_sqe *sqe = this->ring.get_sqe();
+		sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+		sqe->addr = make_user_data(client->fd, client->generation, OP_TIMER);
+		sqe->user_data = make_user_data(client->fd, client->generation,
+										OP_CANCEL);
+		client->pending++;
+	}
+
+	this->finish_close(client);
+}
+
+void UringServer::finish_close(UringClient *client) {
+	if (client->fd == -1 || client->pending > 0)
+		return; // already closed, or still waiting
+
+	this->end_current(client);
+	client->next = UringResponse();
+	close(client->fd);
+	client->fd = -1;
+	ShardStats::subtract(ShardStats::local().clients, 1);
+}
+
+void uring_event_loop(int server_socket, CurrentCatalog *current_catalog,
+						SongCache *song_cache, double pace_factor,
+						double burst_seconds) {
+	UringServer server(server_socket, current_catalog, song_cache, pace_factor,
+						burst_seconds);
+	server.run();
+}
@@ -0,0 +1,47 @@
+#ifndef URINGLOOP_H
+#define URINGLOOP_H
+
+class CurrentCatalog;
+class SongCache;
+
+// Most bytes of a song we read and send in one go.
+const unsigned URING_CHUNK_SIZE = 64 * 1024;
+
+// Registered buffers per event loop, i.e. how many chunks read from files
+// can be on their way to clients at once. Anyone else waits for a turn.
+const unsigned URING_BUFFERS = 128;
+
+// Registered file slots per event loop, i.e. how many clients can be
+// streaming songs from files at once.
+const unsigned URING_FILE_SLOTS = 4096;
+
+// Size of each event loop's submission queue.
+const unsigned URING_QUEUE_SIZE = 1024;
+
+/**
+ * Runs an event loop built on io_uring rather than epoll, forever.
+ *
+ * Each streaming client keeps one chunk on the go at a time: a READ_FIXED of
+ * the song (from a registered file into a registered buffer) linked to a
+ * SEND of that buffer, so the kernel does both without waking us up in
+ * between. Everything we queue while handling one batch of completions goes
+ * to the kernel in a single io_uring_enter, which also waits for the next
+ * batch. Songs in the song cache are sent straight from memory, and pacing
+ * waits are TIMEOUT requests on the same ring.
+ *
+ * Only the text protocol is supported (list, search, info, play, stop, close
+ * and stats); clients that start the binary protocol are disconnected.
+ *
+ * @param server_socket Socket that is listening for connections.
+ * @param current_catalog The (shared) catalog of available songs.
+ * @param song_cache Shared cache of song data (NULL if turned off).
+ * @param pace_factor How much faster than real time to stream songs (0 to
+ * 	not pace them).
+ * @param burst_seconds Seconds of audio to send right away when a song
+ * 	starts.
+ */
+void uring_event_loop(int server_socket, CurrentCatalog *current_catalog,
+						SongCache *song_cache, double pace_factor,
+						double burst_seconds);
+
+#endif // URINGLOOP_H
@@ -0,0 +1,246 @@
+/*
+ * File: bench-sender.cpp
+ *
+ * Benchmark for the FileSender send modes.
+ *
+ * Streams the given MP3 file to many concurrent listeners over loopback TCP,
+ * once with each FileSender mode, and reports how much CPU time the sending
+ * side used per megabit streamed. The listeners run in a forked child
+ * process so that their CPU time isn't counted against the sender.
+ *
+ * Usage: ./bench-sender <mp3 file> [num listeners]
+ */
+
+// C++ standard libraries
+#include <iostream>
+#include <vector>
+#include <filesystem>
+
+// C standard libraries
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+// POSIX and OS-specific libraries
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "ChunkedDataSender.h"
+
+namespace fs = std::filesystem;
+
+using std::cout;
+using std::cerr;
+using std::vector;
+
+const int MAX_EVENTS = 64;
+const int DEFAULT_LISTENERS = 1000;
+
+/**
+ * Sets the given socket to non-blocking mode.
+ *
+ * @param sock The socket to change.
+ */
+void set_non_blocking(int sock) {
+	int flags = fcntl(sock, F_GETFL);
+	if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		perror("fcntl");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Returns the CPU time (user + system) used by this process so far, in
+ * seconds.
+ */
+double cpu_seconds() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+		+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * Connects num_listeners sockets to the given port then reads (and throws
+ * away) everything sent to them until they have all been closed.
+ * This is run in the child process.
+ *
+ * @param port The port the sender is listening on.
+ * @param num_listeners How many connections to make.
+ */
+void run_listeners(uint16_t port, int num_listeners) {
+	int epoll_fd = epoll_create1(0);
+
+	struct sockaddr_in addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (int i = 0; i < num_listeners; i++) {
+		int sock = socket(AF_INET, SOCK_STREAM, 0);
+		if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+			perror("connect");
+			exit(EXIT_FAILURE);
+		}
+		set_non_blocking(sock);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = sock;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+	}
+
+	int num_open = num_listeners;
+	char buffer[65536];
+
+	while (num_open > 0) {
+		struct epoll_event events[MAX_EVENTS];
+		int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+
+		for (int n = 0; n < num_events; n++) {
+			int sock = events[n].data.fd;
+			ssize_t bytes = recv(sock, buffer, sizeof(buffer), 0);
+
+			if (bytes == 0 || (bytes < 0 && errno != EAGAIN)) {
+				close(sock);
+				num_open--;
+			}
+		}
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+/**
+ * Streams the file to num_listeners listeners using the given mode.
+ *
+ * @param mp3_file The file to stream.
+ * @param num_listeners How many listeners to stream to.
+ * @param mode The FileSender mode to use.
+ */
+void run_round(fs::path mp3_file, int num_listeners, FileSendMode mode) {
+	int server_sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	struct sockaddr_in addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = 0; // let the OS pick a free port
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	socklen_t addr_len = sizeof(addr);
+	if (bind(server_sock, (struct sockaddr*)&addr, sizeof(addr)) < 0
+			|| listen(server_sock, num_listeners) < 0
+			|| getsockname(server_sock, (struct sockaddr*)&addr, &addr_len) < 0) {
+		perror("server socket");
+		exit(EXIT_FAILURE);
+	}
+
+	// Flush now so the child doesn't inherit (and repeat) our buffered output.
+	fflush(stdout);
+	pid_t child = fork();
+	if (child == 0)
+		run_listeners(ntohs(addr.sin_port), num_listeners);
+
+	int epoll_fd = epoll_create1(0);
+	vector<FileSender*> senders(num_listeners * 2 + 64, NULL);
+
+	for (int i = 0; i < num_listeners; i++) {
+		int sock = accept(server_sock, NULL, NULL);
+		if (sock < 0) {
+			perror("accept");
+			exit(EXIT_FAILURE);
+		}
+		set_non_blocking(sock);
+
+		if ((size_t)sock >= senders.size())
+			senders.resize(sock + 1, NULL);
+		senders[sock] = FileSender::open_file(mp3_file, mode);
+		if (senders[sock] == NULL)
+			exit(EXIT_FAILURE);
+
+		struct epoll_event ev;
+		ev.events = EPOLLOUT;
+		ev.data.fd = sock;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+	}
+
+	double start_cpu = cpu_seconds();
+	struct timeval start_time, end_time;
+	gettimeofday(&start_time, NULL);
+
+	size_t total_bytes = 0;
+	int num_open = num_listeners;
+
+	// Same loop as ConnectedClient::continue_response: keep sending until
+	// the socket buffer is full or the file is done.
+	while (num_open > 0) {
+		struct epoll_event events[MAX_EVENTS];
+		int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+
+		for (int n = 0; n < num_events; n++) {
+			int sock = events[n].data.fd;
+			ssize_t num_bytes_sent;
+
+			while ((num_bytes_sent = senders[sock]->send_next_chunk(sock)) > 0)
+				total_bytes += num_bytes_sent;
+
+			if (num_bytes_sent == 0 || num_bytes_sent == SEND_FAILED) {
+				delete senders[sock];
+				senders[sock] = NULL;
+				close(sock);
+				num_open--;
+			}
+		}
+	}
+
+	double cpu_used = cpu_seconds() - start_cpu;
+	gettimeofday(&end_time, NULL);
+	double wall = (end_time.tv_sec - start_time.tv_sec)
+		+ (end_time.tv_usec - start_time.tv_usec) / 1e6;
+
+	waitpid(child, NULL, 0);
+	close(epoll_fd);
+	close(server_sock);
+
+	double mbits = total_bytes * 8 / 1e6;
+	printf("%-9s %8d %10.1f %9.3f %9.3f %14.4f\n",
+			(mode == SENDFILE) ? "sendfile" : "buffered", num_listeners,
+			mbits, wall, cpu_used, cpu_used * 1000 / mbits);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " <mp3 file> [num listeners]\n";
+		exit(EXIT_FAILURE);
+	}
+
+	fs::path mp3_file(argv[1]);
+	if (!fs::is_regular_file(mp3_file)) {
+		cerr << "ERROR: " << argv[1] << " is not a file\n";
+		exit(EXIT_FAILURE);
+	}
+
+	int num_listeners = (argc > 2) ? atoi(argv[2]) : DEFAULT_LISTENERS;
+
+	// Both ends of every connection need a descriptor, so make sure we are
+	// allowed to open enough of them.
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	printf("%-9s %8s %10s %9s %9s %14s\n", "mode", "clients", "Mbit",
+			"wall (s)", "cpu (s)", "cpu ms/Mbit");
+	run_round(mp3_file, num_listeners, BUFFERED);
+	run_round(mp3_file, num_listeners, SENDFILE);
+
+	return 0;
+}
@@ -0,0 +1,571 @@
+/*
+ * File: jukebox-load.cpp
+ *
+ * Load generator for the jukebox server.
+ *
+ * Keeps a fixed number of simulated listeners connected to the server, each
+ * running one command at a time (using the text protocol) and starting a new
+ * one as soon as the last is done. The commands are a mix of list, info,
+ * play, and play followed by stop part way through the song.
+ *
+ * Songs are "played" by a simple model of a player: it starts playing once
+ * it has a second of audio buffered, then uses up the stream at the song's
+ * bitrate. Reading stops while the player's buffer is full, just like a real
+ * client would, and a stall is counted every time the buffer runs dry.
+ *
+ * At the end, we report time to first byte, stalls, throughput and (given
+ * the server's pid) how much CPU the server used.
+ *
+ * Usage: ./jukebox-load [-n listeners] [-d seconds] [-m mix] [-k kbps]
+ *                       [-b buffer_seconds] [-r connects_per_sec]
+ *                       [-p server_pid] <host> <port>
+ */
+
+// C++ standard libraries
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// C standard libraries
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// POSIX and OS-specific libraries
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+using std::cerr;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+const int MAX_EVENTS = 256;
+
+// How often (in ms) we update every player, even if nothing happens.
+const int TICK_MS = 20;
+
+// Audio a player wants buffered before it starts (or restarts) playing.
+const double PREBUFFER_SECONDS = 1.0;
+
+/**
+ * Kinds of sessions a listener can run.
+ */
+enum SessionKind { LIST, INFO, PLAY, PLAY_STOP, NUM_KINDS };
+
+const char *KIND_NAMES[NUM_KINDS] = { "list", "info", "play", "play+stop" };
+
+/**
+ * Settings for a load test.
+ */
+struct LoadConfig {
+	int num_listeners;      // listeners connected at once
+	double duration;        // seconds to run for
+	int mix[NUM_KINDS];     // relative weight of each kind of session
+	double bytes_per_sec;   // how fast players use up a song
+	double buffer_seconds;  // most audio a player buffers
+	double connect_rate;    // most new connections per second
+	pid_t server_pid;       // 0 if we don't know the server's pid
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+};
+
+/**
+ * One listener's current session: a connection running one command.
+ */
+struct Session {
+	int fd;                 // -1 if the listener is between sessions
+	SessionKind kind;
+	string command;
+	bool connected;
+	bool reading;           // false while the player's buffer is full
+	bool got_first_byte;
+	time_point start_time;  // when we started connecting
+	time_point stop_time;   // when to send "stop" (PLAY_STOP only)
+	bool stop_sent;
+
+	// The player (PLAY and PLAY_STOP only).
+	uint64_t received;      // bytes received
+	double played;          // bytes used up by the player
+	bool playing;           // false while (pre)buffering
+	time_point last_update;
+};
+
+/**
+ * Totals for the whole run.
+ */
+struct LoadStats {
+	size_t started[NUM_KINDS] = {};
+	size_t completed[NUM_KINDS] = {};
+	size_t errors = 0;
+	size_t stalls = 0;
+	uint64_t total_bytes = 0;
+	vector<double> ttfb_ms[NUM_KINDS];
+};
+
+/**
+ * Returns the CPU time (user + system) used by this process so far, in
+ * seconds.
+ */
+double cpu_seconds() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+		+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * Returns the CPU time (user + system) used by another process so far, in
+ * seconds, or -1 if we can't find out.
+ *
+ * @param pid The process to ask about.
+ */
+double process_cpu_seconds(pid_t pid) {
+	std::ifstream stat_file("/proc/" + std::to_string(pid) + "/stat");
+	string line;
+	if (!std::getline(stat_file, line))
+		return -1;
+
+	// The command name (field 2) can have spaces in it, so start counting
+	// fields after its closing parenthesis. utime and stime are fields 14
+	// and 15.
+	std::stringstream fields(line.substr(line.rfind(')') + 2));
+	string field;
+	double utime = 0, stime = 0;
+	for (int i = 3; i <= 15 && fields >> field; i++) {
+		if (i == 14)
+			utime = std::stod(field);
+		else if (i == 15)
+			stime = std::stod(field);
+	}
+
+	return (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * Gets the value at the given percentile of some (sorted) numbers.
+ */
+double percentile(const vector<double> &sorted, double pct) {
+	if (sorted.empty())
+		return 0;
+
+	size_t index = (size_t)(pct / 100 * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+/**
+ * Looks up the server's address.
+ */
+void resolve_server(const char *host, const char *port, LoadConfig &config) {
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	int error = getaddrinfo(host, port, &hints, &result);
+	if (error != 0) {
+		cerr << "getaddrinfo: " << gai_strerror(error) << "\n";
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(&config.addr, result->ai_addr, result->ai_addrlen);
+	config.addr_len = result->ai_addrlen;
+	freeaddrinfo(result);
+}
+
+/**
+ * Asks the server for its song list (without any load), so we know which
+ * song numbers we can ask for.
+ *
+ * @return The number of songs.
+ */
+int count_songs(const LoadConfig &config) {
+	int sock = socket(config.addr.ss_family, SOCK_STREAM, 0);
+	if (connect(sock, (struct sockaddr*)&config.addr, config.addr_len) < 0) {
+		perror("connect");
+		exit(EXIT_FAILURE);
+	}
+
+	send(sock, "list", 4, 0);
+
+	string list;
+	char buffer[4096];
+	ssize_t bytes;
+	while ((bytes = recv(sock, buffer, sizeof(buffer), 0)) > 0)
+		list.append(buffer, bytes);
+	close(sock);
+
+	// Every song is on a line of its own, starting with its number.
+	int num_songs = 0;
+	std::stringstream lines(list);
+	string line;
+	while (std::getline(lines, line)) {
+		if (!line.empty() && line[0] == '(')
+			num_songs++;
+	}
+
+	return num_songs;
+}
+
+/**
+ * Starts a new session for a listener: picks what it will do and starts
+ * connecting to the server.
+ */
+void start_session(Session &session, const LoadConfig &config, int num_songs,
+					std::mt19937 &rng, int epoll_fd, LoadStats &stats) {
+	std::discrete_distribution<int> pick_kind(config.mix, config.mix + NUM_KINDS);
+	std::uniform_int_distribution<int> pick_song(0, std::max(num_songs - 1, 0));
+
+	session.kind = (SessionKind)pick_kind(rng);
+	if (session.kind == LIST)
+		session.command = "list";
+	else if (session.kind == INFO)
+		session.command = "info " + std::to_string(pick_song(rng));
+	else
+		session.command = "play " + std::to_string(pick_song(rng));
+
+	session.start_time = std::chrono::steady_clock::now();
+	session.connected = false;
+	session.reading = false; // we are only watching for EPOLLOUT
+	session.got_first_byte = false;
+	session.stop_sent = false;
+	session.received = 0;
+	session.played = 0;
+	session.playing = false;
+	session.last_update = session.start_time;
+
+	// Stop somewhere in the first minute of the song.
+	std::uniform_real_distribution<double> pick_stop(1.0, 60.0);
+	session.stop_time = session.start_time
+		+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>(pick_stop(rng)));
+
+	session.fd = socket(config.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (session.fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	if (connect(session.fd, (struct sockaddr*)&config.addr, config.addr_len) < 0
+			&& errno != EINPROGRESS) {
+		perror("connect");
+		exit(EXIT_FAILURE);
+	}
+
+	// We'll hear that the connection is done when the socket is writable.
+	struct epoll_event ev;
+	ev.events = EPOLLOUT;
+	ev.data.ptr = &session;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, session.fd, &ev);
+
+	stats.started[session.kind]++;
+}
+
+/**
+ * Ends a listener's session, freeing it up for the next one.
+ *
+ * @param completed Whether the session got everything it was after.
+ */
+void end_session(Session &session, LoadStats &stats, bool completed) {
+	if (completed)
+		stats.completed[session.kind]++;
+	else
+		stats.errors++;
+
+	close(session.fd); // which also takes it out of the epoll
+	session.fd = -1;
+}
+
+/**
+ * Turns reading on or off for a session (i.e. whether we watch for EPOLLIN).
+ */
+void set_reading(Session &session, int epoll_fd, bool reading) {
+	if (session.reading == reading)
+		return;
+
+	struct epoll_event ev;
+	ev.events = reading ? (uint32_t)EPOLLIN : 0;
+	ev.data.ptr = &session;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session.fd, &ev);
+	session.reading = reading;
+}
+
+/**
+ * Moves a session's player along to the given time: uses up audio while it
+ * is playing, counts a stall if it runs out, and pauses (or resumes) reading
+ * depending on how full its buffer is.
+ */
+void update_player(Session &session, const LoadConfig &config, time_point now,
+					int epoll_fd, LoadStats &stats) {
+	if (session.kind != PLAY && session.kind != PLAY_STOP)
+		return;
+
+	std::chrono::duration<double> elapsed = now - session.last_update;
+	session.last_update = now;
+
+	if (session.playing) {
+		session.played += elapsed.count() * config.bytes_per_sec;
+		if (session.played >= session.received) {
+			session.played = session.received;
+			session.playing = false;
+			stats.stalls++;
+		}
+	}
+	else if (session.received - session.played
+				>= PREBUFFER_SECONDS * config.bytes_per_sec) {
+		session.playing = true;
+	}
+
+	double buffered = session.received - session.played;
+	set_reading(session, epoll_fd,
+				buffered < config.buffer_seconds * config.bytes_per_sec);
+}
+
+/**
+ * Handles an epoll event for a session.
+ */
+void handle_event(Session &session, uint32_t events, const LoadConfig &config,
+					int epoll_fd, LoadStats &stats) {
+	static char buffer[65536];
+
+	if (!session.connected) {
+		int error = 0;
+		socklen_t len = sizeof(error);
+		getsockopt(session.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+		if (error != 0 || (events & (EPOLLERR | EPOLLHUP)) != 0) {
+			end_session(session, stats, false);
+			return;
+		}
+
+		// Commands are tiny, so this never has to wait for buffer space.
+		session.connected = true;
+		send(session.fd, session.command.data(), session.command.length(), 0);
+		set_reading(session, epoll_fd, true);
+		return;
+	}
+
+	ssize_t bytes = recv(session.fd, buffer, sizeof(buffer), 0);
+	if (bytes < 0 && errno == EAGAIN)
+		return;
+
+	if (bytes <= 0) {
+		// The server closes the connection once it is done (or it died).
+		end_session(session, stats, bytes == 0);
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if (!session.got_first_byte) {
+		session.got_first_byte = true;
+		std::chrono::duration<double, std::milli> ttfb = now - session.start_time;
+		stats.ttfb_ms[session.kind].push_back(ttfb.count());
+	}
+
+	session.received += bytes;
+	stats.total_bytes += bytes;
+	update_player(session, config, now, epoll_fd, stats);
+}
+
+/**
+ * Runs the load test and prints what happened.
+ */
+void run_load(const LoadConfig &config) {
+	int num_songs = count_songs(config);
+	printf("server has %d songs\n", num_songs);
+
+	int epoll_fd = epoll_create1(0);
+	std::mt19937 rng(375);
+	LoadStats stats;
+
+	// Sessions are pointed to by epoll, so they must never move.
+	vector<Session> sessions(config.num_listeners);
+	for (Session &session : sessions)
+		session.fd = -1;
+
+	double start_cpu = cpu_seconds();
+	double start_server_cpu = (config.server_pid != 0)
+		? process_cpu_seconds(config.server_pid) : -1;
+	auto start_time = std::chrono::steady_clock::now();
+	auto end_time = start_time
+		+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>(config.duration));
+
+	double connect_budget = 0; // connections we may start right now
+	auto last_tick = start_time;
+
+	while (true) {
+		auto now = std::chrono::steady_clock::now();
+		if (now >= end_time)
+			break;
+
+		// Start sessions for idle listeners, no faster than connect_rate.
+		std::chrono::duration<double> since_tick = now - last_tick;
+		connect_budget = std::min(connect_budget
+									+ since_tick.count() * config.connect_rate,
+									config.connect_rate);
+		last_tick = now;
+
+		for (Session &session : sessions) {
+			if (connect_budget < 1)
+				break;
+			if (session.fd == -1) {
+				start_session(session, config, num_songs, rng, epoll_fd, stats);
+				connect_budget--;
+			}
+		}
+
+		struct epoll_event events[MAX_EVENTS];
+		int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, TICK_MS);
+		if (num_events < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+
+		for (int n = 0; n < num_events; n++) {
+			Session &session = *(Session*)events[n].data.ptr;
+			if (session.fd != -1)
+				handle_event(session, events[n].events, config, epoll_fd, stats);
+		}
+
+		// Play everyone's audio, and stop the songs that are due to stop.
+		now = std::chrono::steady_clock::now();
+		for (Session &session : sessions) {
+			if (session.fd == -1 || !session.connected)
+				continue;
+
+			update_player(session, config, now, epoll_fd, stats);
+
+			if (session.kind == PLAY_STOP && !session.stop_sent
+					&& now >= session.stop_time) {
+				send(session.fd, "stop", 4, 0);
+				session.stop_sent = true;
+				end_session(session, stats, true);
+			}
+		}
+	}
+
+	std::chrono::duration<double> wall = std::chrono::steady_clock::now()
+											- start_time;
+	double cpu_used = cpu_seconds() - start_cpu;
+	double server_cpu = (start_server_cpu >= 0)
+		? process_cpu_seconds(config.server_pid) - start_server_cpu : -1;
+
+	for (Session &session : sessions) {
+		if (session.fd != -1)
+			close(session.fd);
+	}
+	close(epoll_fd);
+
+	printf("\n%-10s %9s %9s %10s %10s %10s %10s\n", "session", "started",
+			"done", "ttfb p50", "ttfb p90", "ttfb p99", "ttfb max");
+	for (int kind = 0; kind < NUM_KINDS; kind++) {
+		vector<double> &ttfb = stats.ttfb_ms[kind];
+		std::sort(ttfb.begin(), ttfb.end());
+		printf("%-10s %9zu %9zu %8.1fms %8.1fms %8.1fms %8.1fms\n",
+				KIND_NAMES[kind], stats.started[kind], stats.completed[kind],
+				percentile(ttfb, 50), percentile(ttfb, 90),
+				percentile(ttfb, 99), percentile(ttfb, 100));
+	}
+
+	size_t num_plays = stats.started[PLAY] + stats.started[PLAY_STOP];
+	printf("\nerrors:     %zu\n", stats.errors);
+	printf("stalls:     %zu (%.3f per play)\n", stats.stalls,
+			num_plays > 0 ? (double)stats.stalls / num_plays : 0.0);
+	printf("throughput: %.2f Mbit/s (%.1f MB in %.1f s)\n",
+			stats.total_bytes * 8 / 1e6 / wall.count(), stats.total_bytes / 1e6,
+			wall.count());
+	printf("client cpu: %.1f%%\n", cpu_used * 100 / wall.count());
+	if (server_cpu >= 0)
+		printf("server cpu: %.1f%%\n", server_cpu * 100 / wall.count());
+}
+
+/**
+ * Reads a session mix such as "1:1:6:2" (list:info:play:play+stop).
+ */
+void parse_mix(const char *arg, LoadConfig &config) {
+	std::stringstream ss(arg);
+	string weight;
+	int total = 0;
+	for (int kind = 0; kind < NUM_KINDS; kind++) {
+		if (!std::getline(ss, weight, ':')) {
+			cerr << "ERROR: mix needs " << NUM_KINDS << " weights\n";
+			exit(EXIT_FAILURE);
+		}
+		config.mix[kind] = std::stoi(weight);
+		total += config.mix[kind];
+	}
+
+	if (total <= 0) {
+		cerr << "ERROR: mix needs a weight above 0\n";
+		exit(EXIT_FAILURE);
+	}
+}
+
+int main(int argc, char **argv) {
+	LoadConfig config;
+	config.num_listeners = 1000;
+	config.duration = 30;
+	parse_mix("1:1:6:2", config);
+	config.bytes_per_sec = 128 * 1000 / 8;
+	config.buffer_seconds = 15;
+	config.connect_rate = 1000;
+	config.server_pid = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:d:m:k:b:r:p:")) != -1) {
+		if (opt == 'n')
+			config.num_listeners = std::stoi(optarg);
+		else if (opt == 'd')
+			config.duration = std::stod(optarg);
+		else if (opt == 'm')
+			parse_mix(optarg, config);
+		else if (opt == 'k')
+			config.bytes_per_sec = std::stod(optarg) * 1000 / 8;
+		else if (opt == 'b')
+			config.buffer_seconds = std::stod(optarg);
+		else if (opt == 'r')
+			config.connect_rate = std::stod(optarg);
+		else if (opt == 'p')
+			config.server_pid = std::stoi(optarg);
+		else {
+			cerr << "Usage: " << argv[0] << " [-n listeners] [-d seconds]"
+				<< " [-m list:info:play:stop] [-k kbps] [-b buffer_seconds]"
+				<< " [-r connects_per_sec] [-p server_pid] <host> <port>\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 2) {
+		cerr << "Usage: " << argv[0] << " [-n listeners] [-d seconds]"
+			<< " [-m list:info:play:stop] [-k kbps] [-b buffer_seconds]"
+			<< " [-r connects_per_sec] [-p server_pid] <host> <port>\n";
+		exit(EXIT_FAILURE);
+	}
+
+	resolve_server(argv[optind], argv[optind + 1], config);
+
+	// Every listener needs a descriptor, so make sure we are allowed to open
+	// enough of them.
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	run_load(config);
+
+	return 0;
+}
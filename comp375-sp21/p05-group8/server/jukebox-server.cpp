@@ -11,17 +11,17 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <map>
 #include <vector>
+#include <thread>
 #include <filesystem>
 
 // C standard libraries
 #include <cerrno>
+#include <csignal>
 
 // POSIX and OS-specific libraries
 #include <unistd.h>
 #include <dirent.h>
-#include <fcntl.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -32,215 +32,336 @@
 
 #include "ChunkedDataSender.h"
 #include "ConnectedClient.h"
+#include "ClientSlab.h"
+#include "EventLoop.h"
+#include "NetSocket.h"
+#include "SongCache.h"
+#include "PacingScheduler.h"
+#include "SongCatalog.h"
+#include "RadioChannel.h"
+#include "ServerStats.h"
+#include "TimerWheel.h"
+#include "Log.h"
+#ifdef JUKEBOX_URING
+#include "UringLoop.h"
+#endif
 
 namespace fs = std::filesystem;
 
-using std::cout;
 using std::cerr;
 using std::string;
 using std::vector;
-using std::map;
 
-const int BACKLOG = 10;
 const int MAX_EVENTS = 64;
 
-typedef vector<fs::path> path_list;
+// Songs are streamed this many times faster than real time (after the
+// initial burst) unless changed with -r.
+const double DEFAULT_PACE_FACTOR = 1.1;
+
+// Seconds of audio sent right away when a song starts, so the client can
+// fill its buffer.
+const double BURST_SECONDS = 10;
+
+// Clients are closed after this many seconds without sending us anything
+// (while we aren't sending to them), or without reading anything we send
+// them, unless changed with -i and -s.
+const double DEFAULT_IDLE_SECONDS = 300;
+const double DEFAULT_STALL_SECONDS = 60;
+
+// Inactive clients are noticed within a tick. A wheel of this many ticks
+// covers the default idle timeout in one turn.
+const std::chrono::milliseconds TIMER_TICK(1000);
+const size_t TIMER_SLOTS = 512;
 
 // forward declarations
-int accept_connection(int server_socket);
-int setup_server_socket(uint16_t port_num);
-void set_non_blocking(int sock);
-path_list find_mp3_files(const char *dir);
-void event_loop(int epoll_fd, int server_socket, path_list mp3_paths);
+void run_admin(uint16_t port, CurrentCatalog *catalog);
+void event_loop(EventLoop &loop, int server_socket,
+				CurrentCatalog *current_catalog, SongCache *song_cache,
+				const RadioChannelList *channels,
+				const SocketOptions &socket_options, PacingScheduler *pacer,
+				const IdleTimeouts &timeouts, TimerWheel *idle_timers);
+void run_shard(uint16_t port, CurrentCatalog *catalog, SongCache *song_cache,
+				const RadioChannelList *channels,
+				SocketOptions socket_options, double pace_factor,
+				IdleTimeouts timeouts, bool use_uring);
 
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " <port> <filedir>\n";
+	// -c <megabytes> turns on the shared song cache.
+	// -r <factor> sets how much faster than real time we stream songs (0
+	// streams them as fast as the client can take them).
+	// -t <threads> sets how many event loop threads to run (default: one
+	// per core).
+	// -R <channels> sets how many radio channels to run (default: none).
+	// -b <kilobytes> sets each client's socket send buffer size, and
+	// -w <kilobytes> its TCP_NOTSENT_LOWAT (default: the kernel's).
+	// -a <port> opens an admin port on localhost that replies to every
+	// connection with the server's stats (default: none).
+	// -l <level> sets how much gets logged: error, warn, info (default) or
+	// debug.
+	// -i <seconds> and -s <seconds> set the idle and stall timeouts (0 turns
+	// them off).
+	// -U runs io_uring event loops instead of epoll ones (if built with
+	// URING=1).
+	// -C <file> keeps a snapshot of the catalog in the given file, so that
+	// the next start doesn't have to read every song before serving.
+	size_t cache_mb = 0;
+	uint16_t admin_port = 0;
+	size_t num_channels = 0;
+	SocketOptions socket_options = { 0, 0 };
+	IdleTimeouts timeouts = { DEFAULT_IDLE_SECONDS, DEFAULT_STALL_SECONDS };
+	bool use_uring = false;
+	const char *snapshot_arg = NULL;
+	double pace_factor = DEFAULT_PACE_FACTOR;
+	unsigned int num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	int opt;
+	while ((opt = getopt(argc, argv, "c:r:t:R:b:w:a:l:i:s:UC:")) != -1) {
+		LogLevel log_level;
+
+		if (opt == 'c') {
+			cache_mb = std::stoul(optarg);
+		}
+		else if (opt == 'r') {
+			pace_factor = std::stod(optarg);
+		}
+		else if (opt == 't') {
+			num_threads = std::max(std::stoul(optarg), 1ul);
+		}
+		else if (opt == 'R') {
+			num_channels = std::stoul(optarg);
+		}
+		else if (opt == 'b') {
+			socket_options.send_buffer = std::stoi(optarg) * 1024;
+		}
+		else if (opt == 'w') {
+			socket_options.notsent_lowat = std::stoi(optarg) * 1024;
+		}
+		else if (opt == 'a') {
+			admin_port = (uint16_t) std::stoul(optarg);
+		}
+		else if (opt == 'l' && parse_log_level(optarg, log_level)) {
+			set_log_level(log_level);
+		}
+		else if (opt == 'i') {
+			timeouts.idle_seconds = std::stod(optarg);
+		}
+		else if (opt == 's') {
+			timeouts.stall_seconds = std::stod(optarg);
+		}
+		else if (opt == 'C') {
+			snapshot_arg = optarg;
+		}
+#ifdef JUKEBOX_URING
+		else if (opt == 'U') {
+			use_uring = true;
+		}
+#endif
+		else {
+			cerr << "Usage: " << argv[0] << " [-c cache_mb] [-r pace_factor]"
+				<< " [-t threads] [-R channels] [-b sndbuf_kb] [-w lowat_kb]"
+				<< " [-a admin_port] [-l log_level] [-i idle_s] [-s stall_s]"
+				<< " [-U] [-C snapshot] <port> <filedir>\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+
+    if (argc - optind != 2) {
+        cerr << "Usage: " << argv[0] << " [-c cache_mb] [-r pace_factor]"
+			<< " [-t threads] [-R channels] [-b sndbuf_kb] [-w lowat_kb]"
+			<< " [-a admin_port] [-l log_level] [-i idle_s] [-s stall_s]"
+			<< " [-U] [-C snapshot] <port> <filedir>\n";
         exit(EXIT_FAILURE);
     }
 
-	if (!fs::is_directory(argv[2])) {
-		cerr << "ERROR: " << argv[2] << " is not a directory\n";
+	const char *port_arg = argv[optind];
+	const char *dir_arg = argv[optind + 1];
+
+	if (!fs::is_directory(dir_arg)) {
+		cerr << "ERROR: " << dir_arg << " is not a directory\n";
 		exit(EXIT_FAILURE);
 	}
 
     // Get the port number from the arguments.
-    uint16_t port = (uint16_t) std::stoul(argv[1]);
+    uint16_t port = (uint16_t) std::stoul(port_arg);
+
+    // Read the other argument (mp3 directory) to build the song catalog,
+	// or start with the snapshot of it (if we have one) and catch up once
+	// we're serving.
+	std::shared_ptr<const SongCatalog> initial_catalog;
+	if (snapshot_arg != NULL)
+		initial_catalog = SongCatalog::load_snapshot(snapshot_arg, dir_arg);
+
+	bool from_snapshot = (initial_catalog != NULL);
+	if (!from_snapshot)
+		initial_catalog = SongCatalog::scan(dir_arg);
+
+	CurrentCatalog catalog(initial_catalog);
+	initial_catalog.reset();
+
+	SongCache *song_cache = NULL;
+	if (cache_mb > 0)
+		song_cache = new SongCache(cache_mb * 1024 * 1024);
+
+	// SIGHUP asks us to rescan the mp3 directory, and SIGINT and SIGTERM
+	// to stop (saving the snapshot first). Block them here, before starting
+	// any other threads, so that they all inherit the blocked signals and
+	// they are only ever picked up by sigwait below.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	// A client that goes away should only cost us its own connection. Most
+	// sends say so with MSG_NOSIGNAL, but sendfile has no such flag.
+	signal(SIGPIPE, SIG_IGN);
+
+	// Each radio channel has a thread of its own that plays through the
+	// catalog, with channel n starting at song n. Listeners in every shard
+	// send from the same channel.
+	RadioChannelList channels;
+	vector<std::thread> radio_threads;
+	for (size_t i = 0; i < num_channels; i++) {
+		channels.push_back(new RadioChannel(i, BURST_SECONDS));
+		radio_threads.emplace_back(&RadioChannel::run, channels.back(),
+									&catalog);
+	}
 
-	int serv_sock = setup_server_socket(port);
+	// Start one event loop (shard) per thread. Each shard has its own
+	// listening socket, epoll instance and clients, so the only things they
+	// share are the (read-only) song catalog and the (thread-safe) song cache.
+	vector<std::thread> shards;
+	for (unsigned int i = 0; i < num_threads; i++) {
+		shards.emplace_back(run_shard, port, &catalog, song_cache, &channels,
+							socket_options, pace_factor, timeouts, use_uring);
+	}
 
-    /* 
-	 * Read the other argument (mp3 directory).
-	 * See the notes for this function above.
-	 */
-    path_list mp3_paths = find_mp3_files(argv[2]);
+	std::thread admin_thread;
+	if (admin_port != 0)
+		admin_thread = std::thread(run_admin, admin_port, &catalog);
+
+	// The shards run forever, so the main thread's only job from now on is
+	// to build a new catalog whenever the songs might have changed: right
+	// away if we started from a snapshot, then whenever we get a SIGHUP. The
+	// shards switch to it the next time around their event loops. Rescans
+	// only read the songs that have changed.
+	bool rescan = from_snapshot;
+	while (true) {
+		if (rescan) {
+			LOG(LogLevel::INFO, "Rescanning " << dir_arg);
+			catalog.replace(SongCatalog::scan(dir_arg, catalog.get().get()));
+		}
 
-	// Create the epoll, which returns a file descriptor for us to use later.
-	int epoll_fd = epoll_create1(0);
-	if (epoll_fd < 0) {
-		perror("epoll_create1");
-		exit(EXIT_FAILURE);
-	}
+		if (snapshot_arg != NULL)
+			catalog.get()->save_snapshot(snapshot_arg);
 
-	// We want to watch for input events (i.e. connection requests) on our
-	// server socket.
-	struct epoll_event server_ev;
-	server_ev.data.fd = serv_sock;
-	server_ev.events = EPOLLIN;
+		int sig;
+		if (sigwait(&signals, &sig) != 0) {
+			perror("sigwait");
+			exit(EXIT_FAILURE);
+		}
 
-	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, serv_sock, &server_ev) == -1) {
-		perror("epoll_ctl");
-		exit(EXIT_FAILURE);
-	}
+		if (sig != SIGHUP) {
+			// Save the frame indices built since the last save.
+			LOG(LogLevel::INFO, "Got signal " << sig << ", stopping");
+			if (snapshot_arg != NULL)
+				catalog.get()->save_snapshot(snapshot_arg);
+			exit(EXIT_SUCCESS);
+		}
 
-	event_loop(epoll_fd, serv_sock, mp3_paths);
+		LOG(LogLevel::INFO, "Got SIGHUP");
+		rescan = true;
+	}
 }
 
 /**
- * Creates a socket, sets it to non-blocking, binds it to the given port, then
- * sets it to start listen for incoming connections.
+ * Runs one shard of the server: sets up its own listening socket and epoll
+ * instance, then runs an event loop on them forever.
+ *
+ * The listening sockets of all shards share the same port (SO_REUSEPORT), so
+ * the kernel spreads new connections across the shards for us. A client
+ * stays with the shard that accepted it, so none of its state needs locking.
  *
- * @param port_num The port number we will listen on.
- * @return The file descriptor of the newly created/setup server socket.
+ * @param port The port number to listen on.
+ * @param catalog The (shared) catalog of available songs.
+ * @param song_cache Shared cache of song data (NULL if turned off).
+ * @param channels The (shared) radio channels.
+ * @param socket_options Options for each client's socket.
+ * @param pace_factor How much faster than real time to stream songs.
+ * @param timeouts When to close inactive clients.
+ * @param use_uring True to run an io_uring event loop instead (which
+ * 	ignores the radio channels, socket options and timeouts).
  */
-int setup_server_socket(uint16_t port_num) {
-    /* Create the socket that we'll listen on. */
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-
-    /* Set SO_REUSEADDR so that we don't waste time in TIME_WAIT. */
-    int val = setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, 
-							&val, sizeof(val));
-    if (val < 0) {
-        perror("Setting socket option failed");
-        exit(EXIT_FAILURE);
-    }
+void run_shard(uint16_t port, CurrentCatalog *catalog, SongCache *song_cache,
+				const RadioChannelList *channels,
+				SocketOptions socket_options, double pace_factor,
+				IdleTimeouts timeouts, bool use_uring) {
+	int serv_sock = setup_server_socket(port, LISTEN_REUSEPORT);
+
+#ifdef JUKEBOX_URING
+	if (use_uring) {
+		uring_event_loop(serv_sock, catalog, song_cache, pace_factor,
+							BURST_SECONDS);
+		return;
+	}
+#else
+	(void)use_uring; // only set when built with URING=1
+#endif
 
-    /* 
-	 * Set our server socket to non-blocking mode.  This way, if we
-     * accidentally accept() when we shouldn't have, we won't block
-     * indefinitely.
-	 */
-    set_non_blocking(sock_fd);
-
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port_num);
-    addr.sin_addr.s_addr = INADDR_ANY;
-
-    /* Bind our socket and start listening for connections. */
-    if (bind(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("Error binding to port");
-        exit(EXIT_FAILURE);
-    }
+	PacingScheduler pacer(pace_factor, BURST_SECONDS);
 
-    if (listen(sock_fd, BACKLOG) < 0) {
-        perror("Error listening for connections");
-        exit(EXIT_FAILURE);
-    }
+	// Clients only need checking on if they can time out.
+	TimerWheel idle_timers(TIMER_TICK, TIMER_SLOTS);
+	bool use_timers = timeouts.idle_seconds > 0 || timeouts.stall_seconds > 0;
 
-	return sock_fd;
+	EventLoop loop(MAX_EVENTS);
+	event_loop(loop, serv_sock, catalog, song_cache, channels,
+				socket_options, &pacer, timeouts,
+				use_timers ? &idle_timers : NULL);
 }
 
 /**
- * Accepts a connection and returns the socket descriptor of the new client
- * that has connected to us.
+ * Runs the admin port: every connection gets a copy of the server's stats
+ * and is then closed (e.g. "nc localhost <port>").
+ *
+ * It only listens on localhost, and has a thread of its own, so that it can
+ * use plain blocking sockets without holding up any of the shards.
  *
- * @param server_socket Socket descriptor of the server (that is listening)
- * @return Socket descriptor for newly connected client.
+ * @param port The port number to listen on.
+ * @param catalog The (shared) catalog of available songs.
  */
-int accept_connection(int server_socket) {
-	struct sockaddr_storage their_addr;
-	socklen_t addr_size = sizeof(their_addr);
-	int new_fd = accept(server_socket, (struct sockaddr *)&their_addr,
-						&addr_size);
-	if (new_fd < 0) {
-		perror("accept");
-		exit(EXIT_FAILURE);
+void run_admin(uint16_t port, CurrentCatalog *catalog) {
+	int sock_fd = setup_server_socket(port, LISTEN_BLOCKING | LISTEN_LOOPBACK);
+
+	while (true) {
+		int client_fd = accept_connection(sock_fd, SOCK_CLOEXEC);
+		if (client_fd < 0)
+			continue;
+
+		// The stats are small, so a blocking send gets them out in one go.
+		// If the client has already gone away, there's nothing to do.
+		std::string stats = render_stats(*catalog->get());
+		send(client_fd, stats.data(), stats.length(), MSG_NOSIGNAL);
+		close(client_fd);
 	}
-
-	return new_fd;
 }
 
-/* 
- * Use fcntl (file control) to set the given socket to non-blocking mode.
- * With non-blocking mode set, any time you try to call send or recv that
- * would normally block, it will instead immediately return -1 and set errno
- * to EAGAIN (or EWOULDBLOCK).
- *
- * @param sock The file descriptor for the socket you want to make
- * 				non-blocking.
+/**
+ * Handler for a shard's listening socket. It only notes that there's a new
+ * connection: event_loop accepts it after handling the rest of the batch,
+ * so that a file descriptor closed in this batch can't be reused by a new
+ * client while there may still be events for the old one.
  */
-void set_non_blocking(int sock) {
-    // Get the current flags
-    int socket_flags = fcntl(sock, F_GETFL);
-    if (socket_flags < 0) {
-        perror("fcntl");
-        exit(EXIT_FAILURE);
-    }
-
-	// Add in the nonblock option
-    socket_flags = socket_flags | O_NONBLOCK;
-
-    // Set the new flags, including O_NONBLOCK.
-    int result = fcntl(sock, F_SETFL, socket_flags);
-    if (result < 0) {
-        perror("fcntl");
-        exit(EXIT_FAILURE);
-    }
-}
+class ListenerEvents : public EventHandler {
+  public:
+	bool new_connection;
 
+	ListenerEvents() : new_connection(false) {}
 
-/*
- * Given a path to a directory, this function searches the directory for any
- * files that end in ".mp3".
- * When it files an MP3 file, it also looks for an associated ".info" file, and
- * prints the contents of this file if it exists.
- *
- * @info You'll need to edit this to meet your needs (i.e. don't expect this
- * to do everything you want without any effort). I would recommend making it
- * return a vector (C++'s version of Java's ArrayList) containing the paths to
- * each of the mp3 files you find.
- *
- * @param dir String that represents the path to the directory that you want
- * 				to check.
- *
- * @return Number of MP3 files found inside of the specified directory.
- */
-path_list find_mp3_files(const char *dir) {
-	int num_mp3_files = 0;
-
-	path_list mp3_paths;
-
-	// Loop through all files in the directory
-	for(fs::directory_iterator entry(dir); entry != fs::directory_iterator(); ++entry) {
-		string filename = entry->path().filename().string();
-
-		// See if the current file is an MP3 file
-		if (entry->path().extension() == ".mp3") {
-			cout << "(" << num_mp3_files << ") " << filename << "\n";
-			num_mp3_files++;
-
-			// Add the MP3 file to the list of paths
-			mp3_paths.push_back(entry->path());
-			cout << mp3_paths.back() << "\n";
-
-			// Look for an associated info file
-			fs::path info_file_path = entry->path();
-			info_file_path = info_file_path.replace_extension(".mp3.info");
-			if (fs::is_regular_file(info_file_path)) {
-				// read contents of file into a buffer
-				std::ifstream t(info_file_path.string());
-				std::stringstream buffer;
-				buffer << t.rdbuf();
-				cout << "Info:\n" << buffer.str() << "\n";
-			}
-		}
+	void handle_events(uint32_t) override {
+		this->new_connection = true;
 	}
-
-    cout << "Found " << num_mp3_files << " songs.\n";
-
-    return mp3_paths;
-}
+};
 
 /**
  * Accepts a new client then sets the server up to be ready to receive data
@@ -250,110 +371,180 @@ path_list find_mp3_files(const char *dir) {
  * this new client (watching for inputs or closes from the client).
  *
  * @param server_socket Socket listening for new connections.
- * @param clients Mapping between client sockets and client info
+ * @param clients Slab of clients, indexed by socket
+ * @param context The shard's context, for the new client.
+ * @param socket_options Options for the new client's socket.
+ * @param pacer Pacer for the new client's songs.
+ * @return The new client, or NULL if there wasn't one after all.
+ */
+ConnectedClient *setup_new_client(int server_socket, ClientSlab &clients,
+									ClientContext *context,
+									const SocketOptions &socket_options,
+									PacingScheduler *pacer) {
+	// The new socket is non-blocking from the start, so we never get hung
+	// up trying to send or receive from this client.
+	int client_fd = accept_connection(server_socket, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client_fd < 0)
+		return NULL;
+
+	LOG(LogLevel::DEBUG, "Accepted a new connection!");
+
+	// We have a new client so we'll put a new ConnectClient object in the
+	// slot for its file descriptor.
+	ConnectedClient *client = clients.add(client_fd, pacer, context);
+	client->configure_socket(socket_options);
+
+	// Watch for "input" and "hangup" events for new clients. The loop hands
+	// them straight to the client's slot.
+	context->loop->add(client_fd, EPOLLIN | EPOLLRDHUP, client);
+
+	return client;
+}
+
+/**
+ * Closes a client if it has been inactive for too long, otherwise sets a
+ * timer to check on it again when it could next time out.
+ *
+ * Clients don't touch their timers when they do something (they just note
+ * the time), so a timer usually finds that its client has been busy since
+ * and simply gets set again for later.
+ *
+ * @param client The client to check on.
+ * @param clients Slab of clients, indexed by socket
  * @param epoll_fd File descriptor for epoll
+ * @param timeouts When to close inactive clients.
+ * @param idle_timers Timers for checking on clients.
+ * @param now The current time.
  */
-void setup_new_client(int server_socket, 
-						map<int, ConnectedClient> &clients, 
-						int epoll_fd) {
-	int client_fd = accept_connection(server_socket);
-	cout << "Accepted a new connection!\n";
-
-	// The client_fd shouldn't exist in our clients map.
-	if (clients.find(client_fd) != clients.end()) {
-		cerr << "ERROR: File descriptor already mapped to an existing client.\n";
-		exit(EXIT_FAILURE);
+void check_inactive(ConnectedClient *client, ClientSlab &clients, int epoll_fd,
+					const IdleTimeouts &timeouts, TimerWheel *idle_timers,
+					TimerWheel::time_point now) {
+	TimerWheel::time_point deadline = client->inactive_deadline(timeouts);
+	if (deadline <= now) {
+		LOG(LogLevel::INFO, "Closing inactive client (" << client->client_fd
+			<< ")");
+		ShardStats::add(ShardStats::local().timed_out, 1);
+		client->handle_close(epoll_fd);
+		clients.remove(client);
+		return;
 	}
 
-	// Set this to non-blocking mode so we never get hung up
-	// trying to send or receive from this client.
-	set_non_blocking(client_fd);
-
-	// Watch for "input" and "hangup" events for new clients.
-	struct epoll_event new_client_ev;
-	new_client_ev.events = EPOLLIN | EPOLLRDHUP;
-	new_client_ev.data.fd = client_fd;
-
-	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, 
-					&new_client_ev) == -1) {
-		perror("epoll_ctl: client_fd");
-		exit(EXIT_FAILURE);
+	// The timeout for the client's current state may be turned off, but the
+	// other one could apply once its state changes, so look again after that
+	// long.
+	if (deadline == TimerWheel::time_point::max()) {
+		double seconds = std::max(timeouts.idle_seconds, timeouts.stall_seconds);
+		deadline = now + std::chrono::duration_cast<TimerWheel::time_point::duration>(
+							std::chrono::duration<double>(seconds));
 	}
 
-	// We have a new client so we'll create a new ConnectClient object to
-	// represent this new client.
-	ConnectedClient cc(client_fd, RECEIVING);
-
-	// Add this new connected client to our map from file descriptor to client.
-	clients[client_fd] = cc;
+	idle_timers->schedule(client->client_fd, client->generation, deadline);
 }
 
 /**
  * Waits for epoll events then handles them accordingly.
  *
- * @param epoll_fd File descriptor for our epoll.
+ * @param loop The shard's event loop.
  * @param server_socket Socket that is listening for connections.
- * @param mp3_paths A vector of the file paths to each mp3 file.
+ * @param current_catalog The (shared) catalog of available songs.
+ * @param song_cache Shared cache of song data (NULL if turned off).
+ * @param channels The (shared) radio channels.
+ * @param socket_options Options for each new client's socket.
+ * @param pacer Decides when paced clients can send again.
+ * @param timeouts When to close inactive clients.
+ * @param idle_timers Timers for checking on inactive clients (NULL if they
+ * 	never time out).
  */
-void event_loop(int epoll_fd, int server_socket, path_list mp3_paths) {
-	// associate client's file descriptor with its ConnectedClient object
-	map<int, ConnectedClient> clients;
+void event_loop(EventLoop &loop, int server_socket,
+				CurrentCatalog *current_catalog, SongCache *song_cache,
+				const RadioChannelList *channels,
+				const SocketOptions &socket_options, PacingScheduler *pacer,
+				const IdleTimeouts &timeouts, TimerWheel *idle_timers) {
+	int epoll_fd = loop.fd();
+
+	// slot for each client, indexed by the client's file descriptor
+	ClientSlab clients;
+
+	// clients whose pacing wait is over (kept here so it is only allocated
+	// once)
+	std::vector<std::pair<int, uint32_t>> due_clients;
+
+	// our reference to the catalog, which we swap for the current one when
+	// it gets replaced
+	std::shared_ptr<const SongCatalog> catalog = current_catalog->get();
+	uint64_t catalog_version = current_catalog->version();
+
+	// Clients handle their own events, with what they need from us.
+	ClientContext context = { &loop, &clients, catalog.get(), song_cache,
+								channels };
+
+	// We want to watch for input events (i.e. connection requests) on our
+	// server socket.
+	ListenerEvents listener;
+	loop.add(server_socket, EPOLLIN, &listener);
 
     while (true) {
-		// wait for some events to occur, writing them to our events array
-		struct epoll_event events[MAX_EVENTS];
+		// Nothing holds on to catalog entries from one pass to the next, so
+		// this is a safe time to switch to a new catalog.
+		if (current_catalog->version() != catalog_version) {
+			catalog_version = current_catalog->version();
+			catalog = current_catalog->get();
+			context.catalog = catalog.get();
+		}
 
-		int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
-		if (num_events < 0) {
-			perror("epoll_wait");
-			exit(EXIT_FAILURE);
+		// Don't sleep past the time the next paced client can send again,
+		// or the next time we need to check for inactive clients.
+		int timeout = pacer->ms_until_next();
+		if (idle_timers != NULL) {
+			int idle_timeout = idle_timers->ms_until_next();
+			if (timeout < 0 || (idle_timeout >= 0 && idle_timeout < timeout))
+				timeout = idle_timeout;
 		}
 
-		// Loop through all the I/O events that just happened.
-		for (int n = 0; n < num_events; n++) {
-			// Check if this is a "hang up" event (i.e. client closed the
-			// connection).
-			if ((events[n].events & EPOLLRDHUP) != 0) {
-				// If we get here, the socket associated with this event was
-				// closed by the remote host so we should clean up.
-				clients[events[n].data.fd].handle_close(epoll_fd);
-				clients.erase(events[n].data.fd);
+		// Wait for some events to occur and hand each to its client (or
+		// the listener).
+		listener.new_connection = false;
+		loop.run_once(timeout);
+
+		auto now = std::chrono::steady_clock::now();
+
+		if (listener.new_connection) {
+			ConnectedClient *client = setup_new_client(server_socket, clients,
+														&context, socket_options,
+														pacer);
+			if (client != NULL && idle_timers != NULL)
+				check_inactive(client, clients, epoll_fd, timeouts, idle_timers,
+								now);
+		}
+
+		// Let paced clients whose wait is over send some more.
+		pacer->pop_due(now, due_clients);
+		for (auto &due : due_clients) {
+			ConnectedClient *client = clients.find(due.first, due.second);
+			if (client == NULL)
+				continue;
+
+			// Sending can find the connection broken, which closes the client.
+			client->resume_paced_response(epoll_fd);
+			if (client->client_fd == -1)
+				clients.remove(client);
+		}
+
+		// Close clients that have been inactive for too long.
+		if (idle_timers != NULL) {
+			idle_timers->pop_due(now, due_clients);
+			for (auto &due : due_clients) {
+				ConnectedClient *client = clients.find(due.first, due.second);
+				if (client != NULL)
+					check_inactive(client, clients, epoll_fd, timeouts,
+									idle_timers, now);
 			}
+		}
 
-			// Check if this is an "input" event (i.e. ready to "read" from
-			// this socket)
-			else if ((events[n].events & EPOLLIN) != 0) {
-				if (events[n].data.fd == server_socket) {
-					/*
-					 * If the server socket is ready for "reading," that implies
-					 * we have a new client that wants to connect so lets
-					 * set up that new client now.
-					 */
-					setup_new_client(server_socket, clients, epoll_fd);
-				}
-				else {
-					cout << "going to handle input from client\n";
-					/*
-					 * This wasn't the server socket so this means we have a
-					 * client that has sent us data so we can receive it now
-					 * without worrying about blocking.
-					 */
-					clients[events[n].data.fd].handle_input(epoll_fd, mp3_paths);
-				}
-            }
-
-			// Check if this is an "output" event.
-			// Note: You may want/need to make this an else if, depending on
-			// how you are handling clients.
-			if ((events[n].events & EPOLLOUT) != 0) {
-				/* 
-				 * If you set things up correctly, you should only reach this
-				 * point if you started sending a response, but had to stop.
-				 * You'll therefore need to continue sending whatever response
-				 * you had in progress.
-				 */
-				clients[events[n].data.fd].continue_response(epoll_fd);
-            }
-        }
+		// Everything since the wait ended counts towards the loop's latency
+		// (i.e. how long events wait behind each other).
+		std::chrono::nanoseconds loop_time =
+			std::chrono::steady_clock::now() - loop.last_wake();
+		ShardStats::local().record_loop(loop_time.count());
     }
 }
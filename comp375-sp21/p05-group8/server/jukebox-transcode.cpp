@@ -0,0 +1,220 @@
+/*
+ * File: jukebox-transcode.cpp
+ *
+ * Makes the lower quality copies of songs (see TIER_KBPS in SongCatalog.h)
+ * that the jukebox server sends to clients that can't keep up with the
+ * original.
+ *
+ * Each copy is made by an external MP3 encoder (lame by default, or ffmpeg)
+ * and saved next to its song (e.g. song.64k.mp3 for song.mp3). Copies that
+ * are already there and newer than their song are left alone, so this can
+ * be run again whenever songs are added. Send the server a SIGHUP afterwards
+ * so that it picks up the new copies.
+ *
+ * Usage: ./jukebox-transcode [-e encoder] [-j jobs] [-f] <filedir>
+ */
+
+// C++ standard libraries
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// C standard libraries
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+// POSIX and OS-specific libraries
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "Mp3Frame.h"
+#include "SongCatalog.h"
+
+namespace fs = std::filesystem;
+
+using std::cout;
+using std::cerr;
+using std::string;
+using std::vector;
+
+/**
+ * One copy of a song to make.
+ */
+struct Job {
+	fs::path song;   // the original
+	fs::path output; // where the copy goes
+	int kbps;        // the copy's bitrate
+};
+
+/**
+ * Starts the encoder on one job, writing to a temporary file so the server
+ * can't pick up a half finished copy.
+ *
+ * @param encoder The encoder to run (lame, or anything with "ffmpeg" in its
+ * 	name).
+ * @param job The copy to make.
+ * @return The encoder's process id.
+ */
+pid_t start_encoder(const string &encoder, const Job &job) {
+	string input = job.song.string();
+	string output = job.output.string() + ".part";
+	string bitrate = std::to_string(job.kbps);
+
+	vector<string> args;
+	if (fs::path(encoder).filename().string().find("ffmpeg") != string::npos) {
+		args = { encoder, "-loglevel", "error", "-y", "-i", input,
+					"-map", "0:a", "-codec:a", "libmp3lame", "-b:a", bitrate + "k",
+					"-f", "mp3", output };
+	}
+	else {
+		args = { encoder, "--quiet", "--mp3input", "-b", bitrate, input,
+					output };
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	else if (pid == 0) {
+		vector<char*> argv;
+		for (string &arg : args)
+			argv.push_back(&arg[0]);
+		argv.push_back(NULL);
+
+		execvp(argv[0], argv.data());
+		perror(encoder.c_str());
+		_exit(127);
+	}
+
+	return pid;
+}
+
+/**
+ * Finds the copies that need making: every tier below the song's own
+ * bitrate that isn't there yet (or is older than the song).
+ *
+ * @param dir The music directory.
+ * @param force True to make copies even if they are already up to date.
+ */
+vector<Job> find_jobs(const fs::path &dir, bool force) {
+	vector<Job> jobs;
+
+	for (const fs::directory_entry &entry : fs::directory_iterator(dir)) {
+		const fs::path &song = entry.path();
+		if (song.extension() != ".mp3" || is_tier_file(song))
+			continue;
+
+		int bitrate = estimate_mp3_bitrate(song);
+		for (int kbps : TIER_KBPS) {
+			if (bitrate != 0 && kbps * 1000 >= bitrate)
+				continue; // would be no smaller than the original
+
+			fs::path output = tier_path(song, kbps);
+			if (!force && fs::is_regular_file(output)
+					&& fs::last_write_time(output) >= fs::last_write_time(song))
+				continue;
+
+			jobs.push_back(Job{song, output, kbps});
+		}
+	}
+
+	return jobs;
+}
+
+int main(int argc, char **argv) {
+	// -e <encoder> picks the encoder to run (default: lame).
+	// -j <jobs> sets how many encoders to run at once (default: one per
+	// core).
+	// -f makes every copy again, even ones that are up to date.
+	string encoder = "lame";
+	unsigned int num_jobs = std::max(std::thread::hardware_concurrency(), 1u);
+	bool force = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "e:j:f")) != -1) {
+		if (opt == 'e') {
+			encoder = optarg;
+		}
+		else if (opt == 'j') {
+			num_jobs = std::max(std::stoul(optarg), 1ul);
+		}
+		else if (opt == 'f') {
+			force = true;
+		}
+		else {
+			cerr << "Usage: " << argv[0] << " [-e encoder] [-j jobs] [-f]"
+				<< " <filedir>\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind != 1) {
+		cerr << "Usage: " << argv[0] << " [-e encoder] [-j jobs] [-f]"
+			<< " <filedir>\n";
+		exit(EXIT_FAILURE);
+	}
+
+	fs::path dir = argv[optind];
+	if (!fs::is_directory(dir)) {
+		cerr << "ERROR: " << dir << " is not a directory\n";
+		exit(EXIT_FAILURE);
+	}
+
+	vector<Job> jobs = find_jobs(dir, force);
+
+	// Keep up to num_jobs encoders going until every job is done.
+	vector<std::pair<pid_t, Job>> running;
+	size_t next_job = 0;
+	int num_made = 0;
+	int num_failed = 0;
+	while (next_job < jobs.size() || !running.empty()) {
+		if (next_job < jobs.size() && running.size() < num_jobs) {
+			const Job &job = jobs[next_job++];
+			running.emplace_back(start_encoder(encoder, job), job);
+			continue;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+		if (pid < 0 && errno == EINTR) {
+			continue;
+		}
+		else if (pid < 0) {
+			perror("wait");
+			exit(EXIT_FAILURE);
+		}
+
+		for (size_t i = 0; i < running.size(); i++) {
+			if (running[i].first != pid)
+				continue;
+
+			const Job &job = running[i].second;
+			fs::path part = job.output.string() + ".part";
+			std::error_code error;
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0
+					&& estimate_mp3_bitrate(part) != 0) {
+				fs::rename(part, job.output);
+				cout << "Made " << job.output.filename().string() << "\n";
+				num_made++;
+			}
+			else {
+				fs::remove(part, error);
+				cerr << "Couldn't make " << job.output.filename().string()
+					<< "\n";
+				num_failed++;
+			}
+
+			running.erase(running.begin() + i);
+			break;
+		}
+	}
+
+	cout << "Made " << num_made << " copies (" << num_failed << " failed).\n";
+
+	return (num_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
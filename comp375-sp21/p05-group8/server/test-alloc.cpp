@@ -0,0 +1,177 @@
+/*
+ * File: test-alloc.cpp
+ *
+ * Test that handling client commands doesn't allocate any memory once the
+ * server has warmed up.
+ *
+ * Replaces the global operator new with one that counts calls, then runs a
+ * mix of list, info, play and stop commands (with and without the song
+ * cache) through a ConnectedClient over a socket pair. After a few warm-up
+ * rounds, which fill the SenderPool, every round should make no
+ * allocations at all.
+ *
+ * Usage: ./test-alloc
+ */
+
+// C++ standard libraries
+#include <filesystem>
+#include <new>
+#include <string>
+
+// C standard libraries
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// POSIX and OS-specific libraries
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "ConnectedClient.h"
+#include "Log.h"
+#include "PacingScheduler.h"
+#include "SongCache.h"
+#include "SongCatalog.h"
+#include "TestSongs.h"
+
+namespace fs = std::filesystem;
+
+const int WARM_UP_ROUNDS = 3;
+const int TEST_ROUNDS = 100;
+
+// Number of allocations made while counting is turned on.
+static size_t num_allocations = 0;
+static bool counting = false;
+
+void *operator new(size_t size) {
+	if (counting)
+		num_allocations++;
+
+	void *block = malloc(size == 0 ? 1 : size);
+	if (block == NULL)
+		throw std::bad_alloc();
+	return block;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *block) noexcept {
+	free(block);
+}
+
+void operator delete[](void *block) noexcept {
+	free(block);
+}
+
+void operator delete(void *block, size_t) noexcept {
+	free(block);
+}
+
+void operator delete[](void *block, size_t) noexcept {
+	free(block);
+}
+
+/**
+ * Reads (and throws away) everything waiting on the socket.
+ */
+void drain(int sock) {
+	char buffer[65536];
+	while (recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+		;
+}
+
+/**
+ * Runs some commands through a fresh connection.
+ *
+ * @param commands The commands to send, one after another.
+ * @param num_commands How many commands there are.
+ */
+void run_commands(const char **commands, int num_commands,
+					const SongCatalog &catalog, SongCache *song_cache,
+					PacingScheduler *pacer) {
+	int socks[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, socks) < 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	int epoll_fd = epoll_create1(0);
+	ConnectedClient client(socks[0], RECEIVING, pacer);
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = &client;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socks[0], &ev);
+
+	for (int i = 0; i < num_commands; i++) {
+		send(socks[1], commands[i], strlen(commands[i]), 0);
+		client.handle_input(epoll_fd, catalog, song_cache);
+		drain(socks[1]);
+	}
+
+	if (client.client_fd != -1)
+		client.handle_close(epoll_fd);
+	close(socks[1]);
+	close(epoll_fd);
+}
+
+/**
+ * Runs one round of every kind of command.
+ */
+void run_round(const SongCatalog &catalog, SongCache *song_cache,
+				PacingScheduler *pacer) {
+	const char *list[] = { "list" };
+	const char *info[] = { "info 0" };
+	const char *bad_info[] = { "info 7" };
+	const char *play[] = { "play 0", "stop" };
+
+	run_commands(list, 1, catalog, NULL, pacer);
+	run_commands(info, 1, catalog, NULL, pacer);
+	run_commands(bad_info, 1, catalog, NULL, pacer);
+	run_commands(play, 2, catalog, NULL, pacer);
+	run_commands(play, 2, catalog, song_cache, pacer);
+
+	// Forget about the stopped songs' pacing wakeups, like the event loop
+	// would.
+	static std::vector<std::pair<int, uint32_t>> due;
+	pacer->pop_due(PacingScheduler::time_point::max(), due);
+}
+
+int main() {
+	fs::path dir = fs::temp_directory_path() / ("test-alloc-" + std::to_string(getpid()));
+	fs::create_directory(dir);
+
+	// Only log errors (the catalog logs a line for every song).
+	set_log_level(LogLevel::ERROR);
+
+	make_song(dir, "test-song");
+	auto catalog = SongCatalog::scan(dir);
+
+	SongCache song_cache(1024 * 1024);
+
+	// A short burst makes sure play is still going (and paced) when we stop.
+	PacingScheduler pacer(1.0, 1.0);
+
+	for (int i = 0; i < WARM_UP_ROUNDS; i++)
+		run_round(*catalog, &song_cache, &pacer);
+
+	counting = true;
+	for (int i = 0; i < TEST_ROUNDS; i++)
+		run_round(*catalog, &song_cache, &pacer);
+	counting = false;
+
+	fs::remove_all(dir);
+
+	printf("%zu allocations in %d rounds of commands\n", num_allocations,
+			TEST_ROUNDS);
+	if (num_allocations != 0) {
+		printf("FAIL\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
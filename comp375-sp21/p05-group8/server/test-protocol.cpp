@@ -0,0 +1,669 @@
+/*
+ * File: test-protocol.cpp
+ *
+ * Test for the binary and text protocols (see Protocol.h), run through a
+ * ConnectedClient over a socket pair. Checks that:
+ *  - commands split across reads, or several in one read, are all answered
+ *    (in both protocols), with the right request ids
+ *  - info works while a paced song streams, and the song can be stopped
+ *  - playing from an offset, and radio listeners, start on frame boundaries
+ *  - search and partial list find the right songs
+ *  - a catalog snapshot loads back the same and is caught up by a rescan
+ *  - a song whose file has gone missing gets an error
+ *  - radio listeners and (cached) song clients that go away are closed
+ *
+ * Usage: ./test-protocol
+ */
+
+// C++ standard libraries
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// C standard libraries
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// POSIX and OS-specific libraries
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "ConnectedClient.h"
+#include "Log.h"
+#include "PacingScheduler.h"
+#include "Protocol.h"
+#include "RadioChannel.h"
+#include "SongCache.h"
+#include "SongCatalog.h"
+#include "TestSongs.h"
+
+namespace fs = std::filesystem;
+
+using std::string;
+using std::vector;
+
+const size_t TIER_FRAME_LENGTH = 208;
+const double FRAME_SECONDS = 1152 / 44100.0;
+
+/**
+ * A frame we got from the server.
+ */
+struct Frame {
+	uint32_t request_id;
+	uint8_t type;
+	string payload;
+};
+
+static int num_failures = 0;
+
+/**
+ * Checks that something is true and prints the result.
+ */
+void check(bool ok, const char *what) {
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok)
+		num_failures++;
+}
+
+/**
+ * Writes a 64 kbps copy of a fake song (as jukebox-transcode would).
+ */
+void make_tier(const fs::path &dir, const string &name) {
+	// MPEG-1 layer III, 64 kbps, 44.1 kHz, no padding: 208 bytes per frame.
+	char frame[TIER_FRAME_LENGTH] = { (char)0xff, (char)0xfb, (char)0x50, 0x00 };
+	std::ofstream song(tier_path(dir / (name + ".mp3"), 64),
+						std::ofstream::binary);
+	for (int i = 0; i < NUM_FRAMES; i++)
+		song.write(frame, sizeof(frame));
+}
+
+/**
+ * Makes a command frame.
+ */
+string command_frame(uint32_t request_id, uint8_t command,
+						bool has_arg = false, uint32_t arg = 0) {
+	uint8_t frame[13];
+	size_t length = has_arg ? 13 : 9;
+	write_u32(frame, length - 4);
+	write_u32(frame + 4, request_id);
+	frame[8] = command;
+	if (has_arg)
+		write_u32(frame + 9, arg);
+
+	return string((char*)frame, length);
+}
+
+/**
+ * Makes a command frame whose argument is text (e.g. a search query).
+ */
+string text_frame(uint32_t request_id, uint8_t command, const string &text) {
+	uint8_t header[9];
+	write_u32(header, sizeof(header) - 4 + text.length());
+	write_u32(header + 4, request_id);
+	header[8] = command;
+
+	return string((char*)header, sizeof(header)) + text;
+}
+
+/**
+ * Makes a LIST command frame for part of the catalog.
+ */
+string list_frame(uint32_t request_id, uint32_t offset, uint32_t count) {
+	uint8_t frame[17];
+	write_u32(frame, sizeof(frame) - 4);
+	write_u32(frame + 4, request_id);
+	frame[8] = CMD_LIST;
+	write_u32(frame + 9, offset);
+	write_u32(frame + 13, count);
+
+	return string((char*)frame, sizeof(frame));
+}
+
+/**
+ * Makes a PLAY command frame that starts part way through the song.
+ */
+string play_frame(uint32_t request_id, uint32_t song_num, uint32_t offset,
+					SeekUnit unit) {
+	uint8_t frame[18];
+	write_u32(frame, sizeof(frame) - 4);
+	write_u32(frame + 4, request_id);
+	frame[8] = CMD_PLAY;
+	write_u32(frame + 9, song_num);
+	write_u32(frame + 13, offset);
+	frame[17] = unit;
+
+	return string((char*)frame, sizeof(frame));
+}
+
+/**
+ * Makes a connected pair of (non-blocking) TCP sockets over the loopback
+ * interface, for tests that need TCP behaviour such as resets. socks[0] is
+ * the accepted end.
+ */
+void tcp_pair(int socks[2]) {
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addr_len = sizeof(addr);
+	if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0
+			|| listen(listener, 1) < 0
+			|| getsockname(listener, (struct sockaddr*)&addr, &addr_len) < 0) {
+		perror("tcp_pair");
+		exit(EXIT_FAILURE);
+	}
+
+	socks[1] = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(socks[1], (struct sockaddr*)&addr, sizeof(addr)) < 0
+			|| (socks[0] = accept(listener, NULL, NULL)) < 0) {
+		perror("tcp_pair");
+		exit(EXIT_FAILURE);
+	}
+	close(listener);
+
+	for (int i = 0; i < 2; i++)
+		fcntl(socks[i], F_SETFL, fcntl(socks[i], F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * Class that plays the part of the client end of the connection.
+ */
+class TestClient {
+  public:
+	int epoll_fd;
+	int socks[2]; // [0] is the server's end, [1] is ours
+	ConnectedClient client;
+	ClientContext context; // so finished responses can go on to the next command
+	const SongCatalog &catalog;
+	const RadioChannelList *channels;
+	string received; // bytes we haven't parsed into frames yet
+	vector<Frame> frames;
+
+	TestClient(const SongCatalog &catalog, PacingScheduler *pacer,
+				const RadioChannelList *channels = NULL, bool over_tcp = false) :
+		catalog(catalog), channels(channels) {
+		if (over_tcp)
+			tcp_pair(socks);
+		else
+			socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, socks);
+		epoll_fd = epoll_create1(0);
+		client = ConnectedClient(socks[0], RECEIVING, pacer);
+		context = ClientContext{NULL, NULL, &catalog, NULL, channels};
+		client.context = &context;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = &client;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socks[0], &ev);
+	}
+
+	~TestClient() {
+		if (client.client_fd != -1)
+			client.handle_close(epoll_fd);
+		if (socks[1] != -1)
+			close(socks[1]);
+		close(epoll_fd);
+	}
+
+	/**
+	 * Sends bytes to the server and has it handle them.
+	 */
+	void send_bytes(const string &data) {
+		send(socks[1], data.data(), data.length(), 0);
+		client.handle_input(epoll_fd, catalog, NULL, channels);
+		pump();
+	}
+
+	/**
+	 * Lets the server send whatever it can, then reads it all.
+	 */
+	void pump() {
+		char buffer[65536];
+		ssize_t n;
+
+		client.continue_response(epoll_fd);
+		while ((n = recv(socks[1], buffer, sizeof(buffer), 0)) > 0) {
+			received.append(buffer, n);
+			client.continue_response(epoll_fd);
+		}
+
+		// Parse the complete frames (text responses aren't framed).
+		while (client.protocol == BINARY && received.length() >= 4) {
+			uint32_t length = read_u32((uint8_t*)received.data());
+			if (received.length() < 4 + length)
+				break;
+
+			const uint8_t *frame = (uint8_t*)received.data() + 4;
+			frames.push_back(Frame{read_u32(frame), frame[4],
+									received.substr(FRAME_HEADER_SIZE,
+													length + 4 - FRAME_HEADER_SIZE)});
+			received.erase(0, 4 + length);
+		}
+	}
+
+	/**
+	 * Gets all the payload a request got in frames of the given type.
+	 */
+	string payload(uint32_t request_id, uint8_t type = FRAME_DATA) {
+		string all;
+		for (Frame &frame : frames) {
+			if (frame.request_id == request_id && frame.type == type)
+				all += frame.payload;
+		}
+		return all;
+	}
+
+	/**
+	 * Gets the position of a request's END frame (-1 if there isn't one).
+	 */
+	int end_position(uint32_t request_id) {
+		for (size_t i = 0; i < frames.size(); i++) {
+			if (frames[i].request_id == request_id && frames[i].type == FRAME_END)
+				return i;
+		}
+		return -1;
+	}
+};
+
+/**
+ * Runs all the checks on one connection.
+ */
+void run_checks(const SongCatalog &catalog) {
+	string list_text(catalog.list()->begin(), catalog.list()->end());
+	string info_a(catalog.song(0)->info->begin(), catalog.song(0)->info->end());
+	string info_b(catalog.song(1)->info->begin(), catalog.song(1)->info->end());
+
+	// A short burst makes sure the song is still going (and paced) when we
+	// ask for more.
+	PacingScheduler pacer(1.0, 1.0);
+	TestClient test(catalog, &pacer);
+
+	// Three commands, with the second one split across two reads.
+	string hello = { (char)PROTOCOL_MAGIC, (char)PROTOCOL_VERSION };
+	string commands = hello + command_frame(1, CMD_LIST)
+		+ command_frame(2, CMD_INFO, true, 0)
+		+ command_frame(3, CMD_PLAY, true, 0);
+	test.send_bytes(commands.substr(0, 17));
+	test.send_bytes(commands.substr(17));
+
+	check(test.payload(1) == list_text, "list response");
+	check(test.end_position(1) >= 0, "list response ends");
+	check(test.payload(2) == info_a, "info response");
+	check(test.end_position(2) >= 0, "info response ends");
+
+	size_t song_bytes = test.payload(3).length();
+	check(song_bytes > 0 && test.end_position(3) == -1,
+			"song is streaming (and paced)");
+
+	// Ask for info on another song (and a song that doesn't exist) while
+	// the first one is still going.
+	test.send_bytes(command_frame(4, CMD_INFO, true, 1)
+					+ command_frame(5, CMD_INFO, true, 99));
+
+	check(test.payload(4) == info_b, "info while streaming");
+	check(test.end_position(4) >= 0, "info while streaming ends");
+	check(!test.payload(5, FRAME_ERROR).empty() && test.end_position(5) >= 0,
+			"error for bad song number");
+	check(test.end_position(3) == -1, "song is still streaming");
+
+	// Each of those went back to waiting on the pacer, but it should still
+	// only have the one wakeup for us.
+	for (uint32_t id = 100; id < 120; id++)
+		test.send_bytes(command_frame(id, CMD_INFO, true, 1));
+	check(pacer.size() == 1, "one pacing wakeup at a time");
+
+	// The stats should know about the song we're playing.
+	test.send_bytes(command_frame(7, CMD_STATS));
+	string stats = test.payload(7);
+	check(stats.find("\nbytes_sent: ") != string::npos
+			&& stats.find("a-song.mp3: plays 1, bytes_sent") != string::npos
+			&& test.end_position(7) >= 0, "stats response");
+
+	// Now stop the song.
+	test.send_bytes(command_frame(6, CMD_STOP, true, 3));
+	check(test.end_position(3) >= 0, "stopped song ends");
+	check(test.received.empty(), "no partial frames left over");
+}
+
+/**
+ * Checks that text commands are answered one after another, however they
+ * are split into reads, and that the server hangs up after the last one.
+ */
+void run_text_checks(const SongCatalog &catalog) {
+	string list_text(catalog.list()->begin(), catalog.list()->end());
+	string info_a(catalog.song(0)->info->begin(), catalog.song(0)->info->end());
+	string info_b(catalog.song(1)->info->begin(), catalog.song(1)->info->end());
+
+	{
+		// The original client: one command, without a newline.
+		TestClient test(catalog, NULL);
+		test.send_bytes("LIST");
+		check(test.received == list_text && test.client.shut_down,
+				"text command without a newline");
+	}
+
+	{
+		TestClient test(catalog, NULL);
+		test.send_bytes("info 0\ninfo 1\n");
+		check(test.received == info_a + info_b && test.client.shut_down,
+				"pipelined text commands");
+	}
+
+	{
+		TestClient test(catalog, NULL);
+		test.send_bytes("info 0\ninf");
+		check(test.received == info_a && !test.client.shut_down,
+				"partial text command waits for the rest");
+		test.send_bytes("o 1\n");
+		check(test.received == info_a + info_b && test.client.shut_down,
+				"text command split across reads");
+	}
+}
+
+/**
+ * Checks that songs played from an offset start at the right frame.
+ */
+void run_seek_checks(const SongCatalog &catalog) {
+	// No pacer, so the whole song arrives at once.
+	TestClient test(catalog, NULL);
+	size_t song_size = fs::file_size(catalog.song(0)->path);
+
+	string hello = { (char)PROTOCOL_MAGIC, (char)PROTOCOL_VERSION };
+	test.send_bytes(hello + play_frame(1, 0, 1000, SEEK_BYTES)
+					+ play_frame(2, 0, 1000, SEEK_MILLISECONDS)
+					+ play_frame(3, 0, 1000000, SEEK_BYTES));
+
+	// Byte 1000 is in the third frame.
+	string song = test.payload(1);
+	check(song.length() == song_size - 2 * 417 && (uint8_t)song[0] == 0xff,
+			"play from byte offset starts at a frame");
+
+	// A frame is 1152 samples at 44.1 kHz, so one second is in frame 38.
+	song = test.payload(2);
+	check(song.length() == song_size - 38 * 417 && (uint8_t)song[0] == 0xff,
+			"play from time offset starts at a frame");
+
+	check(test.payload(3).empty() && test.end_position(3) >= 0,
+			"play past the end sends nothing");
+}
+
+/**
+ * Checks that a client that resets the connection part way through a song
+ * is closed, rather than taking the server down with it.
+ *
+ * @param song_cache Cache to send the song from (NULL to send it straight
+ * 	from the file).
+ */
+void run_reset_checks(const SongCatalog &catalog, SongCache *song_cache) {
+	TestClient test(catalog, NULL, NULL, true);
+
+	// Small buffers, so the song can't all be sent before the reset.
+	int size = 4096;
+	setsockopt(test.socks[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	setsockopt(test.socks[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	send(test.socks[1], "play 0", 6, 0);
+	test.client.handle_input(test.epoll_fd, catalog, song_cache, NULL);
+	check(test.client.client_fd != -1 && test.client.state == SENDING,
+			"song is waiting for room to send");
+
+	// Closing with a zero linger time sends a reset.
+	struct linger reset = { 1, 0 };
+	setsockopt(test.socks[1], SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+	close(test.socks[1]);
+	test.socks[1] = -1;
+	usleep(10000);
+
+	test.client.continue_response(test.epoll_fd);
+	check(test.client.client_fd == -1, (song_cache != NULL)
+			? "client that reset a cached song is closed"
+			: "client that reset a song is closed");
+}
+
+/**
+ * Checks that a song whose file was deleted after the catalog was scanned
+ * gets an error (in both protocols).
+ */
+void run_missing_file_checks(const fs::path &dir) {
+	fs::create_directory(dir);
+	make_song(dir, "gone");
+	auto catalog = SongCatalog::scan(dir);
+	fs::remove(dir / "gone.mp3");
+
+	{
+		TestClient test(*catalog, NULL);
+		string hello = { (char)PROTOCOL_MAGIC, (char)PROTOCOL_VERSION };
+		test.send_bytes(hello + command_frame(1, CMD_PLAY, true, 0));
+		check(!test.payload(1, FRAME_ERROR).empty() && test.end_position(1) >= 0,
+				"error for song with a missing file");
+	}
+
+	{
+		TestClient test(*catalog, NULL);
+		test.send_bytes("play 0");
+		check(test.received == "n", "text error for song with a missing file");
+	}
+}
+
+/**
+ * Checks that clients get the lower quality copy of a song when they ask for
+ * it.
+ */
+void run_tier_checks(const SongCatalog &catalog) {
+	check(catalog.size() == 2 && catalog.song(0)->tiers.size() == 1
+			&& catalog.song(1)->tiers.empty(), "copies aren't listed as songs");
+
+	TestClient test(catalog, NULL);
+	string hello = { (char)PROTOCOL_MAGIC, (char)PROTOCOL_VERSION };
+	test.send_bytes(hello + command_frame(1, CMD_QUALITY, true, 64)
+					+ command_frame(2, CMD_PLAY, true, 0)
+					+ play_frame(3, 0, 1000, SEEK_MILLISECONDS)
+					+ command_frame(4, CMD_QUALITY, true, QUALITY_ORIGINAL)
+					+ command_frame(5, CMD_PLAY, true, 0));
+
+	string song = test.payload(2);
+	check(song.length() == NUM_FRAMES * TIER_FRAME_LENGTH
+			&& (uint8_t)song[2] == 0x50, "quality 64 plays the 64 kbps copy");
+
+	song = test.payload(3);
+	check(song.length() == (NUM_FRAMES - 38) * TIER_FRAME_LENGTH,
+			"seeking in a copy goes by time");
+
+	song = test.payload(5);
+	check(song.length() == NUM_FRAMES * FRAME_LENGTH
+			&& (uint8_t)song[2] == 0x90, "original quality plays the original");
+
+	test.send_bytes(command_frame(6, CMD_QUALITY));
+	check(!test.payload(6, FRAME_ERROR).empty() && test.client.quality == QUALITY_ORIGINAL,
+			"error for quality without a bitrate");
+}
+
+/**
+ * Checks that searches find songs by their metadata, and that the list can
+ * be fetched a page at a time.
+ */
+void run_search_checks(const SongCatalog &catalog) {
+	const string header = "No.\tFilename\n";
+	const string line_a = "(0)\ta-song.mp3\n";
+	const string line_b = "(1)\tb-song.mp3\n";
+
+	check(catalog.search("SONG") == vector<uint32_t>({0, 1}),
+			"search matches either case");
+	check(catalog.search("so b") == vector<uint32_t>({1}),
+			"search matches every term, by prefix");
+	check(catalog.search("song nothing").empty() && catalog.search(" - ").empty(),
+			"search with no matches");
+
+	TestClient test(catalog, NULL);
+	string hello = { (char)PROTOCOL_MAGIC, (char)PROTOCOL_VERSION };
+	test.send_bytes(hello + text_frame(1, CMD_SEARCH, "b-song")
+					+ text_frame(2, CMD_SEARCH, "zzz")
+					+ list_frame(3, 1, 10)
+					+ list_frame(4, 0, 1)
+					+ list_frame(5, 7, 1));
+
+	check(test.payload(1) == header + line_b && test.end_position(1) >= 0,
+			"search response");
+	check(test.payload(2) == header, "search response with no matches");
+	check(test.payload(3) == header + line_b, "list from an offset");
+	check(test.payload(4) == header + line_a, "list a set number of songs");
+	check(test.payload(5) == header && test.end_position(5) >= 0,
+			"list past the end");
+}
+
+/**
+ * Checks that a catalog saved to a snapshot loads back the same (frame
+ * indices included), and that rescanning it only picks up what changed.
+ */
+void run_snapshot_checks(const fs::path &dir, const SongCatalog &catalog) {
+	fs::path snapshot_file = dir / "catalog.snapshot";
+	catalog.song(0)->seek_to_time(1.0); // builds song 0's frame index
+
+	check(catalog.save_snapshot(snapshot_file), "snapshot saved");
+	auto loaded = SongCatalog::load_snapshot(snapshot_file, dir);
+	check(loaded != NULL && loaded->size() == catalog.size()
+			&& *loaded->list() == *catalog.list()
+			&& *loaded->song(1)->info == *catalog.song(1)->info
+			&& loaded->song(0)->tiers.size() == 1
+			&& loaded->song(0)->bitrate == catalog.song(0)->bitrate
+			&& loaded->search("b song") == catalog.search("b song"),
+			"snapshot loads the same catalog");
+	if (loaded == NULL)
+		return;
+
+	check(loaded->song(0)->frame_index->peek() != NULL
+			&& loaded->song(0)->seek_to_time(1.0) == catalog.song(0)->seek_to_time(1.0)
+			&& loaded->song(1)->frame_index->peek() == NULL,
+			"snapshot keeps frame indices");
+	check(SongCatalog::load_snapshot(snapshot_file, dir / "elsewhere") == NULL,
+			"snapshot of another directory is ignored");
+
+	std::ofstream(dir / "b-song.mp3.info") << "Title: changed\n";
+	auto rescanned = SongCatalog::scan(dir, loaded.get());
+	string info_b(rescanned->song(1)->info->begin(), rescanned->song(1)->info->end());
+	check(rescanned->search("changed") == vector<uint32_t>({1})
+			&& info_b == "Title: changed\n\n", "rescan reads changed info");
+	check(rescanned->song(0)->frame_index == loaded->song(0)->frame_index
+			&& rescanned->song(0)->stats == loaded->song(0)->stats,
+			"rescan keeps unchanged songs");
+
+	std::ofstream(snapshot_file, std::ofstream::app) << "junk";
+	check(SongCatalog::load_snapshot(snapshot_file, dir) == NULL,
+			"damaged snapshot is ignored");
+}
+
+/**
+ * Writes some frames to a radio channel, as its reader thread would.
+ */
+void play_radio(RadioChannel *channel, int num_frames) {
+	uint8_t frame[FRAME_LENGTH] = { 0xff, 0xfb, 0x90, 0x00 };
+	for (int i = 0; i < num_frames; i++)
+		channel->write_frame(frame, sizeof(frame));
+
+	channel->publish(FRAME_SECONDS, std::chrono::steady_clock::now());
+}
+
+/**
+ * Checks that radio listeners get the channel's frames, and skip ahead when
+ * they fall too far behind.
+ */
+void run_radio_checks(const SongCatalog &catalog) {
+	// Listeners join 1 second (38 frames) behind the live edge.
+	RadioChannel *channel = new RadioChannel(0, 1.0);
+	RadioChannelList channels = { channel };
+	play_radio(channel, 100);
+
+	PacingScheduler pacer(1.0, 1.0);
+	TestClient test(catalog, &pacer, &channels);
+
+	string hello = { (char)PROTOCOL_MAGIC, (char)PROTOCOL_VERSION };
+	test.send_bytes(hello + command_frame(1, CMD_RADIO, true, 0)
+					+ command_frame(2, CMD_RADIO, true, 1));
+
+	string radio = test.payload(1);
+	check(radio.length() == 38 * FRAME_LENGTH && (uint8_t)radio[0] == 0xff,
+			"radio listener joins behind the live edge");
+	check(test.end_position(1) == -1, "radio keeps going");
+	check(!test.payload(2, FRAME_ERROR).empty() && test.end_position(2) >= 0,
+			"error for bad channel number");
+
+	// New frames are sent as they are published.
+	play_radio(channel, 10);
+	test.pump();
+	check(test.payload(1).length() == 48 * FRAME_LENGTH,
+			"radio listener gets new frames");
+
+	// Publish more than the ring holds without letting the listener send,
+	// so it has to skip ahead.
+	play_radio(channel, RADIO_RING_BYTES / FRAME_LENGTH + 100);
+	test.pump();
+	radio = test.payload(1).substr(48 * FRAME_LENGTH);
+	check(radio.length() == 38 * FRAME_LENGTH && (uint8_t)radio[0] == 0xff,
+			"lagging radio listener skips to the live edge");
+
+	test.send_bytes(command_frame(3, CMD_STOP, true, 1));
+	check(test.end_position(1) >= 0, "stopped radio ends");
+
+	// A listener that stops reading (as if it had gone away) gets closed
+	// rather than taking the server down with it.
+	TestClient gone(catalog, &pacer, &channels);
+	gone.send_bytes(hello + command_frame(1, CMD_RADIO, true, 0));
+	shutdown(gone.socks[1], SHUT_RD);
+	play_radio(channel, 10);
+	gone.client.continue_response(gone.epoll_fd);
+	check(gone.client.client_fd == -1, "radio listener that went away is closed");
+
+	TestClient gone_text(catalog, &pacer, &channels);
+	gone_text.send_bytes("radio 0");
+	shutdown(gone_text.socks[1], SHUT_RD);
+	play_radio(channel, 10);
+	gone_text.client.continue_response(gone_text.epoll_fd);
+	check(gone_text.client.client_fd == -1,
+			"text radio listener that went away is closed");
+
+	delete channel;
+}
+
+int main() {
+	fs::path dir = fs::temp_directory_path() / ("test-protocol-" + std::to_string(getpid()));
+	fs::create_directory(dir);
+	make_song(dir, "a-song");
+	make_song(dir, "b-song");
+	make_tier(dir, "a-song");
+
+	// Like jukebox-server, since sendfile can't be told not to raise it.
+	signal(SIGPIPE, SIG_IGN);
+
+	// Only log errors (the catalog logs a line for every song).
+	set_log_level(LogLevel::ERROR);
+	auto catalog = SongCatalog::scan(dir);
+	run_checks(*catalog);
+	run_text_checks(*catalog);
+	run_seek_checks(*catalog);
+	run_tier_checks(*catalog);
+	run_search_checks(*catalog);
+	run_snapshot_checks(dir, *catalog);
+	run_radio_checks(*catalog);
+	run_missing_file_checks(dir / "missing");
+	run_reset_checks(*catalog, NULL);
+	SongCache song_cache(1024 * 1024);
+	run_reset_checks(*catalog, &song_cache);
+
+	fs::remove_all(dir);
+
+	if (num_failures != 0) {
+		printf("FAIL (%d checks failed)\n", num_failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("PASS\n");
+	return EXIT_SUCCESS;
+}
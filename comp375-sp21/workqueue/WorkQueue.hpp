@@ -0,0 +1,27 @@
+#ifndef WORKQUEUE_HPP
+#define WORKQUEUE_HPP
+
+/**
+ * An interface for a thread-safe queue of work items (e.g. client sockets)
+ * that one or more producers put items into and one or more consumers take
+ * items out of.
+ *
+ * Both BoundedBuffer and WorkStealingPool implement this interface so that a
+ * program can pick between them at run time.
+ */
+class WorkQueue {
+  public:
+	virtual ~WorkQueue() {}
+
+	/**
+	 * Removes an item from the queue, waiting until one is available.
+	 */
+	virtual int getItem() = 0;
+
+	/**
+	 * Adds a new item to the queue, waiting until there is room for it.
+	 */
+	virtual void putItem(int new_item) = 0;
+};
+
+#endif // WORKQUEUE_HPP
@@ -0,0 +1,298 @@
+/**
+ * Implementation of the ChaseLevDeque and WorkStealingPool classes.
+ * See the associated header file (WorkStealingPool.hpp) for the declaration of
+ * these classes.
+ */
+#include <algorithm>
+#include <thread>
+
+#include "WorkStealingPool.hpp"
+
+// Most items we will move from the injection queue to a worker's own deque
+// in one go.
+static const size_t MAX_BATCH = 32;
+
+// Each pool gets a unique id so that a thread can remember which pool it is
+// a worker for (and its index in that pool).
+static std::atomic<unsigned long> next_pool_id(1);
+
+struct WorkerSlot {
+	unsigned long pool_id;
+	int index;
+};
+
+static thread_local WorkerSlot my_slot = {0, -1};
+
+/**
+ * Returns a (cheap, non-cryptographic) random number that is local to the
+ * calling thread.
+ */
+static unsigned int randomNumber() {
+	static thread_local unsigned int state =
+		std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+
+	// xorshift32
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+
+/**
+ * Constructor that rounds the capacity up to the next power of two so that
+ * we can use a mask rather than a mod when wrapping around.
+ *
+ * @param min_capacity The minimum number of items the deque can hold.
+ */
+ChaseLevDeque::ChaseLevDeque(size_t min_capacity) : top(0), bottom(0) {
+	size_t capacity = 1;
+	while (capacity < min_capacity)
+		capacity <<= 1;
+
+	this->mask = capacity - 1;
+	this->slots.reset(new std::atomic<int>[capacity]);
+}
+
+bool ChaseLevDeque::push(int item) {
+	long b = this->bottom.load(std::memory_order_relaxed);
+	long t = this->top.load(std::memory_order_acquire);
+
+	if (b - t > (long)this->mask)
+		return false; // full
+
+	this->slots[b & this->mask].store(item, std::memory_order_relaxed);
+
+	// Make sure the item is visible before thieves can see the new bottom.
+	std::atomic_thread_fence(std::memory_order_release);
+	this->bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+bool ChaseLevDeque::pop(int &item) {
+	long b = this->bottom.load(std::memory_order_relaxed) - 1;
+	this->bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long t = this->top.load(std::memory_order_relaxed);
+
+	if (t > b) {
+		// Deque was empty, so put bottom back where it was.
+		this->bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	item = this->slots[b & this->mask].load(std::memory_order_relaxed);
+
+	if (t == b) {
+		// This was the last item so we have to race any thieves for it.
+		bool won = this->top.compare_exchange_strong(t, t + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed);
+		this->bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+
+	return true;
+}
+
+bool ChaseLevDeque::steal(int &item) {
+	long t = this->top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long b = this->bottom.load(std::memory_order_acquire);
+
+	if (t >= b)
+		return false; // empty
+
+	item = this->slots[t & this->mask].load(std::memory_order_relaxed);
+
+	// Another thief (or the owner) may have beaten us to this item.
+	return this->top.compare_exchange_strong(t, t + 1,
+			std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+bool ChaseLevDeque::looksEmpty() const {
+	long t = this->top.load(std::memory_order_acquire);
+	long b = this->bottom.load(std::memory_order_acquire);
+	return t >= b;
+}
+
+
+/**
+ * Constructor that creates an empty injection queue plus one (empty) deque
+ * per worker. Each deque can hold as many items as the injection queue.
+ *
+ * @param max_size The desired capacity for the injection queue.
+ * @param num_workers The number of consumer threads.
+ */
+WorkStealingPool::WorkStealingPool(int max_size, int num_workers) :
+	capacity(max_size), next_worker(0), num_sleeping(0) {
+	for (int i = 0; i < num_workers; ++i) {
+		this->deques.emplace_back(new ChaseLevDeque(std::max(max_size, 1)));
+	}
+
+	this->pool_id = next_pool_id++;
+}
+
+/**
+ * Gets the index of the calling thread's deque, making the caller a worker if
+ * it isn't one yet and there are still deques left over.
+ *
+ * @param join True if the caller should become a worker if it isn't already.
+ * @return The caller's deque index, or -1 if the caller is not a worker.
+ */
+int WorkStealingPool::workerIndex(bool join) {
+	if (my_slot.pool_id == this->pool_id)
+		return my_slot.index;
+
+	if (!join)
+		return -1;
+
+	int index = this->next_worker++;
+	if (index >= (int)this->deques.size())
+		index = -1;
+
+	my_slot.pool_id = this->pool_id;
+	my_slot.index = index;
+	return index;
+}
+
+/**
+ * Takes one item from the injection queue. If the caller is a worker, it also
+ * moves its fair share of the remaining items onto its own deque so that
+ * later calls (and other thieves) don't need the lock.
+ *
+ * @param index The caller's deque index (-1 if not a worker).
+ * @param item Where to store the item we took.
+ * @return false if the injection queue was empty.
+ */
+bool WorkStealingPool::takeFromInjection(int index, int &item) {
+	std::unique_lock<std::mutex> lk(this->mutex);
+
+	if (this->injection.empty())
+		return false;
+
+	item = this->injection.front();
+	this->injection.pop();
+
+	size_t num_moved = 0;
+	if (index >= 0) {
+		size_t batch = std::min(this->injection.size() / this->deques.size(),
+								MAX_BATCH);
+		while (num_moved < batch
+				&& this->deques[index]->push(this->injection.front())) {
+			this->injection.pop();
+			num_moved++;
+		}
+	}
+
+	// We made space for producers, and maybe work for parked thieves.
+	if (num_moved > 0)
+		this->spaceAvailable.notify_all();
+	else
+		this->spaceAvailable.notify_one();
+
+	if (num_moved > 0 && this->num_sleeping > 0)
+		this->dataAvailable.notify_one();
+
+	return true;
+}
+
+/**
+ * Tries to steal an item from each of the other workers, starting with a
+ * randomly chosen victim.
+ *
+ * @param index The caller's deque index (-1 if not a worker).
+ * @param item Where to store the item we stole.
+ * @return false if we didn't manage to steal anything.
+ */
+bool WorkStealingPool::stealFromOthers(int index, int &item) {
+	size_t num_deques = this->deques.size();
+	if (num_deques == 0)
+		return false;
+
+	size_t start = randomNumber() % num_deques;
+	for (size_t i = 0; i < num_deques; ++i) {
+		size_t victim = (start + i) % num_deques;
+		if ((int)victim != index && this->deques[victim]->steal(item))
+			return true;
+	}
+
+	return false;
+}
+
+bool WorkStealingPool::anyDequeHasWork() const {
+	for (auto &deque : this->deques) {
+		if (!deque->looksEmpty())
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Wakes up one parked worker.
+ *
+ * We grab the lock first so the worker can't be in between checking for work
+ * and going to sleep when we notify it.
+ */
+void WorkStealingPool::wakeSleeper() {
+	std::unique_lock<std::mutex> lk(this->mutex);
+	this->dataAvailable.notify_one();
+}
+
+/**
+ * Gets an item from our own deque, the injection queue, or another worker (in
+ * that order), parking until one of those has work if they are all empty.
+ */
+int WorkStealingPool::getItem() {
+	int index = this->workerIndex(true);
+	int item;
+
+	while (true) {
+		if (index >= 0 && this->deques[index]->pop(item))
+			return item;
+
+		if (this->takeFromInjection(index, item))
+			return item;
+
+		if (this->stealFromOthers(index, item))
+			return item;
+
+		// Nothing to do, so park until someone puts more work in the pool.
+		std::unique_lock<std::mutex> lk(this->mutex);
+		this->num_sleeping++;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		while (this->injection.empty() && !this->anyDequeHasWork())
+			this->dataAvailable.wait(lk);
+
+		this->num_sleeping--;
+	}
+}
+
+/**
+ * Adds a new item to the pool. Workers put it on their own deque; everyone
+ * else puts it in the injection queue, waiting if that is full.
+ *
+ * @param new_item The item to put in the pool.
+ */
+void WorkStealingPool::putItem(int new_item) {
+	int index = this->workerIndex(false);
+
+	if (index >= 0 && this->deques[index]->push(new_item)) {
+		// Pairs with the fence in getItem so that either we see the sleeper
+		// or the sleeper sees our item.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (this->num_sleeping > 0)
+			this->wakeSleeper();
+		return;
+	}
+
+	std::unique_lock<std::mutex> lk(this->mutex);
+
+	while (this->injection.size() >= this->capacity)
+		this->spaceAvailable.wait(lk);
+
+	this->injection.push(new_item);
+
+	if (this->num_sleeping > 0)
+		this->dataAvailable.notify_one();
+}
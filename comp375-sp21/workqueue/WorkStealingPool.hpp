@@ -0,0 +1,108 @@
+#ifndef WORKSTEALINGPOOL_HPP
+#define WORKSTEALINGPOOL_HPP
+
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "WorkQueue.hpp"
+
+/**
+ * A fixed-size Chase-Lev work-stealing deque of ints.
+ *
+ * Only the thread that owns the deque may push and pop (at the bottom). Any
+ * other thread may steal (from the top). See "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (Le et al., PPoPP 2013) for the
+ * memory ordering used here.
+ */
+class ChaseLevDeque {
+  public:
+	  /**
+	   * Constructor that creates an empty deque that can hold at least
+	   * min_capacity items.
+	   */
+	  ChaseLevDeque(size_t min_capacity);
+
+	  /**
+	   * Pushes an item onto the bottom of the deque (owner only).
+	   *
+	   * @return false if the deque was full.
+	   */
+	  bool push(int item);
+
+	  /**
+	   * Pops an item off the bottom of the deque (owner only).
+	   *
+	   * @return false if the deque was empty.
+	   */
+	  bool pop(int &item);
+
+	  /**
+	   * Steals an item off the top of the deque (any thread).
+	   *
+	   * @return false if the deque was empty or we lost a race for the item.
+	   */
+	  bool steal(int &item);
+
+	  /**
+	   * Checks whether the deque currently looks empty. Only a hint, since
+	   * another thread may change it right after we look.
+	   */
+	  bool looksEmpty() const;
+
+  private:
+	  std::atomic<long> top;
+	  std::atomic<long> bottom;
+	  size_t mask; // capacity - 1 (capacity is a power of two)
+	  std::unique_ptr<std::atomic<int>[]> slots;
+};
+
+/**
+ * A work queue that gives every consumer (i.e. worker) thread its own deque.
+ *
+ * Items put by threads outside the pool go into a bounded, shared injection
+ * queue. A worker that finds its own deque empty grabs a batch from the
+ * injection queue, then tries to steal from randomly chosen workers, and
+ * finally parks until more work shows up. Items put by a worker go straight
+ * onto its own deque, without touching the shared lock.
+ *
+ * Threads become workers the first time they call getItem, up to num_workers
+ * threads. Any extra threads still work correctly, they just don't get a
+ * deque of their own.
+ */
+class WorkStealingPool : public virtual WorkQueue {
+  public:
+	  /**
+	   * Constructor for the WorkStealingPool class.
+	   *
+	   * @param max_size Capacity of the shared injection queue.
+	   * @param num_workers Number of consumer threads that will use the pool.
+	   */
+	  WorkStealingPool(int max_size, int num_workers);
+
+	  virtual int getItem();
+	  virtual void putItem(int new_item);
+
+  private:
+	  long unsigned int capacity;
+	  std::queue<int> injection; // items put by non-worker threads
+	  std::mutex mutex; // protects injection and parking
+	  std::condition_variable dataAvailable;
+	  std::condition_variable spaceAvailable;
+
+	  std::vector<std::unique_ptr<ChaseLevDeque>> deques;
+	  std::atomic<int> next_worker; // index handed out to the next new worker
+	  std::atomic<int> num_sleeping; // workers currently parked
+	  unsigned long pool_id;
+
+	  int workerIndex(bool join);
+	  bool takeFromInjection(int index, int &item);
+	  bool stealFromOthers(int index, int &item);
+	  bool anyDequeHasWork() const;
+	  void wakeSleeper();
+};
+
+#endif // WORKSTEALINGPOOL_HPP
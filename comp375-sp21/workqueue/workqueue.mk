@@ -0,0 +1,7 @@
+# Work queue interface and work-stealing pool shared by lab04 and p02. A
+# Makefile sets WORKQUEUE to the path of this directory, includes this file,
+# and then adds $(WORKQUEUE_SRC) to its sources and $(WORKQUEUE_HEADERS) to
+# its dependencies.
+WORKQUEUE_SRC = $(WORKQUEUE)/WorkStealingPool.cpp
+WORKQUEUE_HEADERS = $(WORKQUEUE)/WorkQueue.hpp $(WORKQUEUE)/WorkStealingPool.hpp
+CXXFLAGS += -I$(WORKQUEUE)